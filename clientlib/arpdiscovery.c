@@ -91,6 +91,17 @@ FSTATIC void _arpdiscovery_notify_function(gpointer data);
 FSTATIC void _arpdiscovery_sendarpcache(ArpDiscovery* self);
 FSTATIC gboolean _arpdiscovery_gsourcefunc(gpointer);
 FSTATIC gboolean _arpdiscovery_first_discovery(gpointer);
+FSTATIC guint _arpdiscovery_hash(guint bits, guint32 ipaddr);
+FSTATIC guint _arpdiscovery_slot(const ArpEntry* table, guint bits, guint32 ipaddr);
+FSTATIC void _arpdiscovery_grow(ArpDiscovery* self);
+FSTATIC void _arpdiscovery_remove(ArpDiscovery* self, guint slot);
+FSTATIC gboolean _arpdiscovery_update(ArpDiscovery* self, const guint8* ipaddr
+,			const guint8* macaddr, guint8 maclen, gint64 now);
+FSTATIC char* _arpdiscovery_ipstring(const ArpEntry* entry);
+FSTATIC gboolean _arpdiscovery_materialize(ArpDiscovery* self, gint64 now);
+FSTATIC void _arpdiscovery_logstats(ArpDiscovery* self);
+FSTATIC void _arpdiscovery_flushcache(Discovery* self);
+FSTATIC gint _arpdiscovery_cfgint(ConfigContext* cfg, const char* name, gint defvalue);
 
 DEBUGDECLARATIONS
 
@@ -107,9 +118,15 @@ _arpdiscovery_finalize(AssimObj* dself)
 	ArpDiscovery * self = CASTTOCLASS(ArpDiscovery, dself);
 	g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of ARP pkts received:"
 	,	self->baseclass.discovercount);
+	g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of ARP IP addresses added:", self->addcount);
+	g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of ARP MAC addresses changed:", self->changecount);
+	g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of ARP IP addresses expired:", self->expirecount);
+	g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of ARP table overflows:", self->overflowcount);
+	g_info("%-35s %8u", "Count of ARP table entries:", self->arpcount);
+	g_info("%-35s %8"G_GSIZE_FORMAT, "Size of ARP table (bytes):"
+	,	sizeof(ArpEntry) << self->arptablebits);
 	if (self->source) {
-		g_source_unref(self->source);
-		g_source_destroy(self->source);
+		pcap_mux_detach(self->source);
 		self->source = NULL;
 	}
         if (self->timeout_source != 0) {
@@ -121,17 +138,24 @@ _arpdiscovery_finalize(AssimObj* dself)
 	}
 
 	UNREF(self->ArpMap);
-	self->ArpMapData = NULL;	// Child object of ArpMap
-	
+	g_free(self->arptable);
+	self->arptable = NULL;
+
 	// Call base object finalization routine (which we saved away)
 	self->finalize(&self->baseclass.baseclass);
 }
 
-/// Discover member function for timed discovery -- not applicable -- return FALSE
+/// Discover member function -- sends our ARP cache to the CMA right now (if we have one).
+/// Our own timer does the periodic reporting, so we return FALSE to keep the
+/// discovery scheduler from calling us again.
 FSTATIC gboolean
-_arpdiscovery_discover(Discovery* self)  ///<[in/out] 
+_arpdiscovery_discover(Discovery* dself)  ///<[in/out] 
 {
-	(void)self;
+	ArpDiscovery*	self = CASTTOCLASS(ArpDiscovery, dself);
+
+	if (self->arpcount > 0) {
+		_arpdiscovery_sendarpcache(self);
+	}
 	return FALSE;
 }
 
@@ -176,11 +200,246 @@ _arpdiscovery_notify_function(gpointer data)
         self->timeout_source = 0;
 }
 
+/// Return the slot where 'ipaddr' would go if there were no collisions - a Fibonacci hash
+FSTATIC guint
+_arpdiscovery_hash(guint bits,		///<[in] log2(size of table)
+		   guint32 ipaddr)	///<[in] Address to hash (network byte order)
+{
+	return (guint)((g_ntohl(ipaddr) * 2654435761U) >> (32 - bits));
+}
+
+/// Return the slot in 'table' which holds 'ipaddr' - or the empty slot where it belongs.
+/// We use linear probing from _arpdiscovery_hash().
+FSTATIC guint
+_arpdiscovery_slot(const ArpEntry* table,	///<[in] Table to look in
+		   guint bits,			///<[in] log2(size of table)
+		   guint32 ipaddr)		///<[in] Address to look for (network byte order)
+{
+	guint	mask = (1U << bits) - 1;
+	guint	slot = _arpdiscovery_hash(bits, ipaddr);
+
+	while (table[slot].ipaddr != 0 && table[slot].ipaddr != ipaddr) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+/// Double the size of our ARP table - the only place (besides creation) that we allocate it
+FSTATIC void
+_arpdiscovery_grow(ArpDiscovery* self)
+{
+	ArpEntry*	oldtable = self->arptable;
+	guint		oldsize = 1U << self->arptablebits;
+	guint		j;
+
+	self->arptablebits += 1;
+	self->arptable = g_new0(ArpEntry, 1U << self->arptablebits);
+	for (j=0; j < oldsize; ++j) {
+		if (oldtable[j].ipaddr != 0) {
+			guint	slot = _arpdiscovery_slot(self->arptable, self->arptablebits
+			,		oldtable[j].ipaddr);
+			self->arptable[slot] = oldtable[j];
+		}
+	}
+	g_free(oldtable);
+}
+
+/// Remove the entry in 'slot' from our table.
+/// We shift any following entries in its probe sequence back, so we never need tombstones.
+FSTATIC void
+_arpdiscovery_remove(ArpDiscovery* self	///<[in/out] Us
+,		     guint slot)	///<[in] Slot to empty
+{
+	ArpEntry*	table = self->arptable;
+	guint		mask = (1U << self->arptablebits) - 1;
+	guint		hole = slot;
+	guint		j = slot;
+
+	table[hole].ipaddr = 0;
+	for (;;) {
+		guint	home;
+		j = (j + 1) & mask;
+		if (table[j].ipaddr == 0) {
+			break;
+		}
+		home = _arpdiscovery_hash(self->arptablebits, table[j].ipaddr);
+		// Leave it alone if its home slot is (cyclically) in (hole, j]
+		if (hole < j ? (home <= hole || home > j) : (home <= hole && home > j)) {
+			table[hole] = table[j];
+			table[j].ipaddr = 0;
+			hole = j;
+		}
+	}
+	self->arpcount -= 1;
+}
+
+/// Record that 'ipaddr' is at 'macaddr' as of 'now' - updating our table in place.
+/// @return TRUE if this IP address was new or its MAC address changed
+FSTATIC gboolean
+_arpdiscovery_update(ArpDiscovery* self		///<[in/out] Us
+,		     const guint8* ipaddr	///<[in] 4 byte IPv4 address
+,		     const guint8* macaddr	///<[in] MAC address
+,		     guint8 maclen		///<[in] Length of macaddr (6 or 8)
+,		     gint64 now)		///<[in] When we saw it
+{
+	guint32		ip;
+	ArpEntry*	entry;
+
+	memcpy(&ip, ipaddr, sizeof(ip));
+	entry = &self->arptable[_arpdiscovery_slot(self->arptable, self->arptablebits, ip)];
+	if (entry->ipaddr == 0) {
+		if (self->arpcount >= self->maxentries) {
+			++self->overflowcount;
+			return FALSE;
+		}
+		if (4*(self->arpcount+1) > 3*(1U << self->arptablebits)) {
+			_arpdiscovery_grow(self);
+			entry = &self->arptable[_arpdiscovery_slot(self->arptable
+			,			self->arptablebits, ip)];
+		}
+		entry->ipaddr = ip;
+		entry->flags = 0;
+		self->arpcount += 1;
+		++self->addcount;
+	}else if (entry->maclen != maclen || memcmp(entry->macaddr, macaddr, maclen) != 0) {
+		++self->changecount;
+	}else{
+		entry->lastseen = now;
+		return FALSE;
+	}
+	entry->maclen = maclen;
+	memcpy(entry->macaddr, macaddr, maclen);
+	entry->flags |= ARP_ENTRY_UNREPORTED;
+	entry->lastseen = now;
+	return TRUE;
+}
+
+/// Return the IPv6-format string we use to name an ARP table entry in our JSON
+FSTATIC char*
+_arpdiscovery_ipstring(const ArpEntry* entry)
+{
+	NetAddr*	ipv4 = netaddr_ipv4_new(&entry->ipaddr, 0);
+	NetAddr*	ipv6 = ipv4->toIPv6(ipv4);
+	char*		ret = ipv6->baseclass.toString(&ipv6->baseclass);
+
+	UNREF(ipv6);
+	UNREF(ipv4);
+	return ret;
+}
+
+/// Build our next ARP report from our table - expiring idle entries as we go.
+/// A full report (discovertype "ARP") has every entry in "data".
+/// A delta report (discovertype "ARPDELTA") has only what was added or changed since our last
+/// report in "data", and "expired" lists what we forgot about.  The CMA merges these into
+/// the last full report it got from us.
+/// @return FALSE if this would be a delta report with nothing in it
+FSTATIC gboolean
+_arpdiscovery_materialize(ArpDiscovery* self	///<[in/out] Us
+,			  gint64 now)		///<[in] Current time (monotonic clock)
+{
+	ConfigContext*	data = configcontext_new(0);
+	gboolean	full = self->_needfull || (now - self->_lastfull) >= self->resyncusecs;
+	guint		nchanged = 0;
+	guint		nexpired = 0;
+	guint		j;
+
+	if (full) {
+		self->ArpMap->delkey(self->ArpMap, "expired");
+	}else{
+		self->ArpMap->setarray(self->ArpMap, "expired", NULL);
+	}
+	for (j=0; j < (1U << self->arptablebits); ) {
+		ArpEntry*	entry = &self->arptable[j];
+		NetAddr*	mac;
+		char*		ipstring;
+
+		if (entry->ipaddr == 0) {
+			++j;
+			continue;
+		}
+		if ((now - entry->lastseen) > self->expireusecs) {
+			if (entry->flags & ARP_ENTRY_REPORTED) {
+				if (!full) {
+					ipstring = _arpdiscovery_ipstring(entry);
+					self->ArpMap->appendstring(self->ArpMap, "expired", ipstring);
+					g_free(ipstring);
+				}
+				++nexpired;
+			}
+			++self->expirecount;
+			_arpdiscovery_remove(self, j);
+			// Something else may have moved into slot j
+			continue;
+		}
+		if (full || (entry->flags & ARP_ENTRY_UNREPORTED)) {
+			ipstring = _arpdiscovery_ipstring(entry);
+			mac = netaddr_macaddr_new(entry->macaddr, entry->maclen);
+			data->setaddr(data, ipstring, mac);
+			g_free(ipstring);
+			UNREF(mac);
+			if (entry->flags & ARP_ENTRY_UNREPORTED) {
+				++nchanged;
+			}
+		}
+		entry->flags = ARP_ENTRY_REPORTED;
+		++j;
+	}
+	if (!full && 0 == nchanged && 0 == nexpired) {
+		UNREF(data);
+		return FALSE;
+	}
+	self->ArpMap->setstring(self->ArpMap, "discovertype", (full ? "ARP" : "ARPDELTA"));
+	self->ArpMap->setconfig(self->ArpMap, "data", data);
+	UNREF(data);
+
+	// These change every time - so they don't belong in what we send the CMA
+	DEBUGMSG1("%s.%d: %s ARP report: %u entries (max %u, %"G_GSIZE_FORMAT" bytes)"
+	", %u changed, %u expired, %"G_GUINT64_FORMAT" overflows in %"G_GINT64_FORMAT" seconds"
+	,	__FUNCTION__, __LINE__, (full ? "Full" : "Delta"), self->arpcount
+	,	self->maxentries, sizeof(ArpEntry) << self->arptablebits, nchanged, nexpired
+	,	self->overflowcount, (now - self->_lastreport)/G_USEC_PER_SEC);
+	self->_lastreport = now;
+	if (full) {
+		self->_lastfull = now;
+		self->_needfull = FALSE;
+		_arpdiscovery_logstats(self);
+	}
+	return TRUE;
+}
+
+/// Log how big our table is and how fast it's changing - we do this with every full report.
+/// It's a log message, not part of our report: these numbers are different every time.
+FSTATIC void
+_arpdiscovery_logstats(ArpDiscovery* self)	///<[in] Us
+{
+	struct pcap_stat	pcapstats;
+	guint			pcapdrops = 0;
+
+	if (self->source && pcap_mux_source(self->source)
+	&&	g_source_pcap_getstats(pcap_mux_source(self->source), &pcapstats)) {
+		pcapdrops = pcapstats.ps_drop;
+	}
+	g_info("%s: ARP table: %u entries (max %u, %"G_GSIZE_FORMAT" bytes)"
+	"; %"G_GUINT64_FORMAT" added, %"G_GUINT64_FORMAT" changed, %"G_GUINT64_FORMAT" expired"
+	", %"G_GUINT64_FORMAT" overflows, %u pcap drops"
+	,	self->baseclass.instancename(&self->baseclass), self->arpcount, self->maxentries
+	,	sizeof(ArpEntry) << self->arptablebits, self->addcount, self->changecount
+	,	self->expirecount, self->overflowcount, pcapdrops);
+}
+
+/// Make our next report a full one - the CMA has lost track of what we told it
+FSTATIC void
+_arpdiscovery_flushcache(Discovery* dself)
+{
+	ArpDiscovery*	self = CASTTOCLASS(ArpDiscovery, dself);
+	self->_needfull = TRUE;
+}
+
 /// Internal pcap gsource dispatch routine - called when we get an ARP packet.
-/// It examines the ARP packet and sees if it is the same IP address and MAC address as previously discovered.
-/// A hash table is built of IP/MAC addresses.  If the IP address is new, it adds it to the hash table.
-/// If not new, then it checks to see if the corresponding MAC address has changed.  
-/// If so, then it adds it to the hash table.
+/// It examines the ARP packet and records its sender IP and MAC addresses in our table.
+/// A repeat of an IP/MAC pair we already know about just updates its last-seen time
+/// in place - no allocation and no string formatting.  We only build NetAddrs and
+/// JSON when we send a report.
 /// All we really care about are those two fields (Sender IP & MAC addresses)--the rest we leave to the CMA.
 FSTATIC gboolean
 _arpdiscovery_dispatch(GSource_pcap_t* gsource, ///<[in] Gsource object causing dispatch
@@ -207,16 +466,7 @@ _arpdiscovery_dispatch(GSource_pcap_t* gsource, ///<[in] Gsource object causing
 	const guint8*		pktstart = ((const guint8*)pkt) + ARP_PKT_OFFSET;
 	const guint8*		arp_sha;	// sender hardware address
 	const guint8*		arp_spa;	// sender protocol address
-	NetAddr*		sha_netaddr;	// sender hardware address
-	NetAddr*		spa_netaddr;	// sender protocol address
-	NetAddr*		arp_spaIPv6;	// sender protocol address in IPv6 format
-	const guint8*		arp_tha;	// target hardware address
-	const guint8*		arp_tpa;	// target protocol address
 	const guint8*		lastbyte;	// last byte of packet according to ARP
-	NetAddr*		tha_netaddr;	// target hardware address
-	NetAddr*		tpa_netaddr;	// target protocol address
-	NetAddr*		theMAC;
-	char *			v6string;
 	static const guint8	zeroes[4] = {0, 0, 0, 0};
 
 	(void)gsource; (void)capstruct; (void)pkthdr; (void)capturedev;
@@ -247,49 +497,29 @@ _arpdiscovery_dispatch(GSource_pcap_t* gsource, ///<[in] Gsource object causing
 		// Some glitchy device gave us a funky IP address...
 		return TRUE;
 	}
-	sha_netaddr = netaddr_macaddr_new(arp_sha, arppkt.arp_hln);
-	spa_netaddr = netaddr_ipv4_new(arp_spa, 0);
-	arp_spaIPv6 = spa_netaddr->toIPv6(spa_netaddr);		// convert sender protocol address to IPv6 format
-	arp_tha = arp_spa + arppkt.arp_pln;
-	arp_tpa = arp_tha + arppkt.arp_hln;
-	tha_netaddr = netaddr_macaddr_new(arp_tha, arppkt.arp_hln);
-	tpa_netaddr = netaddr_ipv4_new(arp_tpa, 0);
-
-	/*
-	fprintf(stderr, "ARP Sender Hardware Address: %s  %p\n", arp_sha->baseclass.toString(&arp_sha->baseclass), arp_sha);
-	fprintf(stderr, "ARP Sender Protocol Address: %s  %p\n", arp_spa->baseclass.toString(&arp_spa->baseclass), arp_spa);
-	fprintf(stderr, "ARP Sender Protocol Address as IPV6: %s  %p\n", arp_spaIPv6->baseclass.toString(&arp_spaIPv6->baseclass), arp_spaIPv6);
-	fprintf(stderr, "ARP Target Hardware Address: %s  %p\n", arp_tha->baseclass.toString(&arp_tha->baseclass), arp_tha);
-	fprintf(stderr, "ARP Target Protocol Address: %s  %p\n", arp_tpa->baseclass.toString(&arp_tpa->baseclass), arp_tpa);
-	*/
 
 	++ self->baseclass.discovercount;
 
-	v6string = arp_spaIPv6->baseclass.toString(&arp_spaIPv6->baseclass);
-	theMAC = self->ArpMapData->getaddr(self->ArpMapData, v6string);
-	if (NULL == theMAC) {
-		// The IP address is not already there, so add it to the ConfigContext hash table.
-		DEBUGMSG3("IP Address NOT in ConfigContext table: %s", v6string);
-		self->ArpMapData->setaddr(self->ArpMapData, v6string, sha_netaddr);
-	} else {
-		// If the IP address is already there, see if the MAC address is the same.  
-		// If so, then we do not need to add it again.
-		DEBUGMSG3("IP Address FOUND in ConfigContext table: %s", v6string);
-		if ( ! theMAC->equal(theMAC, sha_netaddr) ) {
-			DEBUGMSG3(" ... but MAC address is different: %s", v6string);
-			self->ArpMapData->setaddr(self->ArpMapData, v6string, sha_netaddr);
-		}
+	if (_arpdiscovery_update(self, arp_spa, arp_sha, arppkt.arp_hln, g_get_monotonic_time())) {
+		DEBUGMSG3("%s.%d: New or changed IP/MAC pair for %d.%d.%d.%d", __FUNCTION__, __LINE__
+		,	arp_spa[0], arp_spa[1], arp_spa[2], arp_spa[3]);
 	}
-	g_free(v6string);
-	UNREF(sha_netaddr);
-	UNREF(spa_netaddr);
-	UNREF(tha_netaddr);
-	UNREF(tpa_netaddr);
-	UNREF(arp_spaIPv6);
-
 	return TRUE;
 }
 
+/// Return a positive integer configuration value - or 'defvalue' if it's missing or bad
+FSTATIC gint
+_arpdiscovery_cfgint(ConfigContext* cfg, const char* name, gint defvalue)
+{
+	gint64	value;
+
+	if (cfg->gettype(cfg, name) != CFG_INT64) {
+		return defvalue;
+	}
+	value = cfg->getint(cfg, name);
+	return (value > 0 && value <= G_MAXINT ? (gint)value : defvalue);
+}
+
 /// ArpDiscovery constructor - good for listening to ARP packets via pcap
 ArpDiscovery*
 arpdiscovery_new(ConfigContext*	arpconfig	///<[in] ARP configuration info
@@ -330,7 +560,22 @@ arpdiscovery_new(ConfigContext*	arpconfig	///<[in] ARP configuration info
 	ret->finalize = dret->baseclass._finalize;
 	dret->baseclass._finalize = _arpdiscovery_finalize;
 	dret->discover = _arpdiscovery_discover;
-	ret->source = g_source_pcap_new(dev, ENABLE_ARP, _arpdiscovery_dispatch, NULL, priority, FALSE, mcontext, 0, ret);
+	dret->flushcache = _arpdiscovery_flushcache;
+	ret->arptablebits = ARP_TABLE_INITBITS;
+	ret->arptable = g_new0(ArpEntry, 1U << ret->arptablebits);
+	ret->arpcount = 0;
+	ret->maxentries = _arpdiscovery_cfgint(arpconfig, CONFIGNAME_ARPMAXENTRIES
+	,	DEFAULT_ARP_MAXENTRIES);
+	ret->expireusecs = G_USEC_PER_SEC
+	*	_arpdiscovery_cfgint(arpconfig, CONFIGNAME_ARPEXPIRE, DEFAULT_ARP_EXPIRE);
+	ret->resyncusecs = G_USEC_PER_SEC
+	*	_arpdiscovery_cfgint(arpconfig, CONFIGNAME_ARPRESYNC, DEFAULT_ARP_RESYNC);
+	ret->_needfull = TRUE;
+	ret->_lastreport = g_get_monotonic_time();
+	ret->source = pcap_mux_attach(dev, ENABLE_ARP
+	,	_arpdiscovery_cfgint(arpconfig, CONFIGNAME_PCAPBUFSIZE, 0)
+	,	_arpdiscovery_cfgint(arpconfig, CONFIGNAME_PCAPSNAPLEN, 0)
+	,	_arpdiscovery_dispatch, ret, priority, mcontext);
 
 	ret->ArpMap = configcontext_new_JSON_string("{\"discovertype\": \"ARP\", \"description\": \"ARP map\", \"source\": \"arpcache\", \"data\":{}}");
 	// Need to set host, and discoveryname
@@ -340,8 +585,6 @@ arpdiscovery_new(ConfigContext*	arpconfig	///<[in] ARP configuration info
 	ret->ArpMap->setstring(ret->ArpMap, CONFIGNAME_INSTANCE, instance);
 	ret->ArpMap->setstring(ret->ArpMap, CONFIGNAME_DEVNAME, dev);
 
-	ret->ArpMapData = ret->ArpMap->getconfig(ret->ArpMap, "data");
-
 	// Set the timer for initially when to send to the CMA
 	// We do start this randomly to keep multiple reporters from flooding the CMA
 	// It's not a bad idea in general, but until we select who is reporting ARPs
@@ -369,6 +612,17 @@ _arpdiscovery_sendarpcache(ArpDiscovery* self)
 {
 	gchar* jsonout = NULL;
 	gsize jsonlen = 0;
+	ConfigContext* cfg = self->baseclass._config;
+
+	// If we can't send it, keep our changes for when we can
+	if (cfg->getaddr(cfg, CONFIGNAME_CMADISCOVER) == NULL) {
+		DEBUGMSG3("%s.%d: CMA address unknown - not reporting yet", __FUNCTION__, __LINE__);
+		return;
+	}
+	if (!_arpdiscovery_materialize(self, g_get_monotonic_time())) {
+		DEBUGMSG3("%s.%d: No ARP changes to report", __FUNCTION__, __LINE__);
+		return;
+	}
 	jsonout = self->ArpMap->baseclass.toString(&self->ArpMap->baseclass);
         jsonlen = strlen(jsonout);
         if (jsonlen == 0) {
@@ -43,16 +43,16 @@ FSTATIC void
 _assimobj_ref(gpointer vself)
 {
 	AssimObj* self = CASTTOCLASS(AssimObj, vself);
-	g_return_if_fail(self != NULL && self->_refcount > 0);
-	self->_refcount += 1;
+	g_return_if_fail(self != NULL && g_atomic_int_get(&self->_refcount) > 0);
+	// Atomic so objects can be shared with (for example) our MarshalPool threads
+	g_atomic_int_inc(&self->_refcount);
 }
 FSTATIC void
 _assimobj_unref(gpointer vself)
 {
 	AssimObj* self = CASTTOCLASS(AssimObj, vself);
-	g_return_if_fail(self != NULL && self->_refcount > 0);
-	self->_refcount -= 1;
-	if (self->_refcount == 0) {
+	g_return_if_fail(self != NULL && g_atomic_int_get(&self->_refcount) > 0);
+	if (g_atomic_int_dec_and_test(&self->_refcount)) {
 		self->_finalize(self); self=NULL;
 	}
 }
@@ -161,6 +161,33 @@ compressframe_new_string(guint16 frame_type, const char* compression_name)
 	}
 	g_return_val_if_reached(NULL);
 }
+/**
+ * Return the size this packet would compress to with this CompressFrame's method
+ * - or zero if it won't compress into @p maxout bytes.
+ * Only the bytes after the first @p offset bytes are compressed - just like when we construct a packet.
+ */
+WINEXPORT gsize
+compressframe_compressed_size(CompressFrame* self	///<[in] Compression method to try
+,			      gconstpointer pkt		///<[in] Packet to (try and) compress
+,			      gsize pktlen		///<[in] Length of packet
+,			      gsize offset		///<[in] Bytes at start of packet to leave alone
+,			      gsize maxout)		///<[in] Largest acceptable compressed size
+{
+	gpointer	newpacket;
+	int		compressedsize = 0;
+	g_return_val_if_fail(NULL != self && NULL != pkt, 0);
+	if (pktlen > MAXUNCOMPRESSEDSIZE) {
+		// Our peers would refuse to decompress it anyway
+		return 0;
+	}
+	newpacket = allcompressions[self->compression_index].compress(pkt, pktlen, offset, maxout
+	,	&compressedsize, 0);
+	if (NULL == newpacket) {
+		return 0;
+	}
+	FREE(newpacket);
+	return compressedsize;
+}
 /// Return TRUE if this is a valid CompressFrame - either an object or on-the-wire version
 FSTATIC gboolean
 _compressframe_isvalid(const Frame *fself, gconstpointer tlvstart, gconstpointer pktend)
@@ -381,12 +408,16 @@ z_compressbuf(gconstpointer inbuf	///<[in] Input buffer
 	/* Compress it */
 	ret = deflate(&stream, Z_FINISH);
 	if (ret != Z_STREAM_END) {
+		(void)deflateEnd(&stream);
 		g_free(outbuf);
 		if (level < 9) {
 			return z_compressbuf(inbuf, insize, offset, maxout, actualsize, 9);
 		}
-		g_warning("%s.%d: Got return code %d from deflate."
-		,	__FUNCTION__, __LINE__, ret);
+		// Running out of output space just means it doesn't fit - our caller decides if that's bad
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			g_warning("%s.%d: Got return code %d from deflate."
+			,	__FUNCTION__, __LINE__, ret);
+		}
 		return NULL;
 	}
 #if 0
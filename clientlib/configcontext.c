@@ -78,6 +78,14 @@ FSTATIC ConfigContext*	_configcontext_JSON_parse_object(GScanner* scan);
 FSTATIC ConfigContext*	_configcontext_JSON_parse_members(GScanner* scan, ConfigContext* cfg);
 FSTATIC ConfigContext*	_configcontext_JSON_parse_pair(GScanner* scan, ConfigContext* cfg);
 FSTATIC ConfigValue*	_configcontext_JSON_parse_value(GScanner* scan);
+FSTATIC char*	_configcontext_pointer(const char * path, const char * elem);
+FSTATIC void	_configcontext_patch_op(GString* patch, const char * op, char * path, ConfigValue* val);
+FSTATIC void	_configcontext_diff_value(GString* patch, char * path, ConfigValue* oldval
+,		ConfigValue* newval);
+FSTATIC void	_configcontext_diff_array(GString* patch, const char * path, GSList* oldlist
+,		GSList* newlist);
+FSTATIC void	_configcontext_diff_object(GString* patch, const char * path
+,		const ConfigContext* oldcfg, const ConfigContext* newcfg);
 FSTATIC gboolean	_configcontext_JSON_parse_array(GScanner* scan, GSList** retval);
 FSTATIC ConfigValue* _configcontext_value_new(enum ConfigValType);
 FSTATIC void _configcontext_value_vfinalize(gpointer vself);
@@ -767,6 +775,184 @@ configcontext_elem_toString(ConfigValue* val)
 	return g_strdup("null");
 }
 
+/// Return a JSON pointer (RFC 6901) to the element 'elem' of the object or array at 'path'
+FSTATIC char*
+_configcontext_pointer(const char * path,	///<[in] pointer to the containing object
+		       const char * elem)	///<[in] member name (or array index)
+{
+	GString*	ret = g_string_new(path);
+	const char *	p;
+
+	g_string_append_c(ret, '/');
+	for (p = elem; *p; ++p) {
+		switch (*p) {
+			case '~':	g_string_append(ret, "~0");
+					break;
+			case '/':	g_string_append(ret, "~1");
+					break;
+			default:	g_string_append_c(ret, *p);
+					break;
+		}
+	}
+	return g_string_free(ret, FALSE);
+}
+
+/// Append one JSON patch (RFC 6902) operation to 'patch'
+FSTATIC void
+_configcontext_patch_op(GString* patch,		///<[in/out] patch we're building
+			const char * op,	///<[in] "add", "remove" or "replace"
+			char * path,		///<[in] JSON pointer to what we're changing
+			ConfigValue* val)	///<[in] new value - NULL for "remove"
+{
+	gchar*	qpath = JSONquotestring(path);
+
+	g_string_append_printf(patch, "%s{\"op\":\"%s\",\"path\":%s"
+	,	(patch->len > 1 ? "," : ""), op, qpath);
+	g_free(qpath);
+	if (val) {
+		gchar*	valstr = configcontext_elem_toString(val);
+		g_string_append_printf(patch, ",\"value\":%s", valstr);
+		g_free(valstr);
+	}
+	g_string_append_c(patch, '}');
+}
+
+/// Append the operations which change 'oldval' into 'newval' to 'patch'
+FSTATIC void
+_configcontext_diff_value(GString* patch,	///<[in/out] patch we're building
+			  char * path,		///<[in] JSON pointer to these values
+			  ConfigValue* oldval,	///<[in] old value
+			  ConfigValue* newval)	///<[in] new value
+{
+	gboolean	same = FALSE;
+
+	if (oldval->valtype == newval->valtype) {
+		switch (oldval->valtype) {
+			case CFG_CFGCTX:
+				_configcontext_diff_object(patch, path, oldval->u.cfgctxvalue
+				,	newval->u.cfgctxvalue);
+				return;
+			case CFG_ARRAY:
+				_configcontext_diff_array(patch, path, oldval->u.arrayvalue
+				,	newval->u.arrayvalue);
+				return;
+			case CFG_BOOL:
+			case CFG_INT64:
+				same = (oldval->u.intvalue == newval->u.intvalue);
+				break;
+			case CFG_FLOAT:
+				same = (oldval->u.floatvalue == newval->u.floatvalue);
+				break;
+			case CFG_STRING:
+				same = (strcmp(oldval->u.strvalue, newval->u.strvalue) == 0);
+				break;
+			case CFG_EEXIST:
+			case CFG_NULL:
+				same = TRUE;
+				break;
+			case CFG_NETADDR:
+			case CFG_FRAME: {
+				gchar*	oldstr = configcontext_elem_toString(oldval);
+				gchar*	newstr = configcontext_elem_toString(newval);
+				same = (strcmp(oldstr, newstr) == 0);
+				g_free(oldstr);
+				g_free(newstr);
+				break;
+			}
+		}
+	}
+	if (!same) {
+		_configcontext_patch_op(patch, "replace", path, newval);
+	}
+}
+
+/// Append the operations which change one array into another to 'patch'.
+/// Elements are compared by position - so inserting near the front of an array changes everything
+/// after it.  Our discovery data is mostly objects, so this is good enough.
+FSTATIC void
+_configcontext_diff_array(GString* patch,	///<[in/out] patch we're building
+			  const char * path,	///<[in] JSON pointer to these arrays
+			  GSList* oldlist,	///<[in] old array
+			  GSList* newlist)	///<[in] new array
+{
+	guint	index = 0;
+	guint	oldlen;
+	char	indexstr[16];
+
+	for (; oldlist && newlist; oldlist = oldlist->next, newlist = newlist->next, ++index) {
+		char *	elempath;
+		g_snprintf(indexstr, sizeof(indexstr), "%u", index);
+		elempath = _configcontext_pointer(path, indexstr);
+		_configcontext_diff_value(patch, elempath, CASTTOCLASS(ConfigValue, oldlist->data)
+		,	CASTTOCLASS(ConfigValue, newlist->data));
+		g_free(elempath);
+	}
+	for (; newlist; newlist = newlist->next) {
+		char *	elempath = _configcontext_pointer(path, "-");
+		_configcontext_patch_op(patch, "add", elempath, CASTTOCLASS(ConfigValue, newlist->data));
+		g_free(elempath);
+	}
+	// Remove extra elements from the end - so the indexes of the others don't change
+	for (oldlen = index + g_slist_length(oldlist); oldlen > index; --oldlen) {
+		char *	elempath;
+		g_snprintf(indexstr, sizeof(indexstr), "%u", oldlen-1);
+		elempath = _configcontext_pointer(path, indexstr);
+		_configcontext_patch_op(patch, "remove", elempath, NULL);
+		g_free(elempath);
+	}
+}
+
+/// Append the operations which change one object into another to 'patch'
+FSTATIC void
+_configcontext_diff_object(GString* patch,		///<[in/out] patch we're building
+			   const char * path,		///<[in] JSON pointer to these objects
+			   const ConfigContext* oldcfg,	///<[in] old object
+			   const ConfigContext* newcfg)	///<[in] new object
+{
+	GSList*	keylist;
+	GSList*	thiskey;
+
+	keylist = oldcfg->keys(oldcfg);
+	for (thiskey = keylist; thiskey; thiskey = thiskey->next) {
+		const char *	key = thiskey->data;
+		ConfigValue*	newval = newcfg->getvalue(newcfg, key);
+		char *		elempath = _configcontext_pointer(path, key);
+
+		if (NULL == newval) {
+			_configcontext_patch_op(patch, "remove", elempath, NULL);
+		}else{
+			_configcontext_diff_value(patch, elempath, oldcfg->getvalue(oldcfg, key), newval);
+		}
+		g_free(elempath);
+	}
+	g_slist_free(keylist);
+	keylist = newcfg->keys(newcfg);
+	for (thiskey = keylist; thiskey; thiskey = thiskey->next) {
+		const char *	key = thiskey->data;
+
+		if (NULL == oldcfg->getvalue(oldcfg, key)) {
+			char *	elempath = _configcontext_pointer(path, key);
+			_configcontext_patch_op(patch, "add", elempath, newcfg->getvalue(newcfg, key));
+			g_free(elempath);
+		}
+	}
+	g_slist_free(keylist);
+}
+
+/// Compute a JSON patch (RFC 6902) which turns 'oldcfg' into 'newcfg'.
+/// We only generate "add", "remove" and "replace" operations.
+/// @return malloced JSON text of the patch - "[]" if they're the same
+WINEXPORT char *
+configcontext_diff(const ConfigContext* oldcfg,	///<[in] what we're changing from
+		   const ConfigContext* newcfg)	///<[in] what we're changing to
+{
+	GString*	patch = g_string_new("[");
+
+	_configcontext_diff_object(patch, "", oldcfg, newcfg);
+	g_string_append_c(patch, ']');
+	return g_string_free(patch, FALSE);
+}
+
 ///
 ///	Create a GScanner object that is set up to scan JSON text.
 ///	See <a href="http://www.json.org/">JSON web site</a> for details
@@ -845,6 +1031,22 @@ configcontext_new_JSON_string(const char * jsontext)
 	return ret;
 }
 
+/// Construct a ConfigContext object from the given JSON string - keeping all strings as strings.
+/// Strings which look like addresses aren't turned into NetAddrs - so when we turn it back
+/// into JSON, every string comes out exactly the way it went in.
+WINEXPORT ConfigContext*
+configcontext_new_JSON_string_raw(const char * jsontext)
+{
+	GScanner*	scanner = _configcontext_JSON_GScanner_new();
+	ConfigContext*	ret;
+
+	scanner->user_data = GINT_TO_POINTER(TRUE);	// Raw strings - no NetAddrs
+	g_scanner_input_text(scanner, jsontext, strlen(jsontext));
+	ret = _configcontext_JSON_parse_objandEOF(scanner);
+	g_scanner_destroy(scanner);
+	return ret;
+}
+
 /// Parse complete JSON object followed by EOF
 FSTATIC ConfigContext*
 _configcontext_JSON_parse_objandEOF(GScanner* scan)
@@ -959,10 +1161,11 @@ _configcontext_JSON_parse_value(GScanner* scan)
 			/// @todo recognize NetAddr objects encoded as strings and reconstitute them
 			ConfigValue* val;
 			NetAddr* encoded;
+			gboolean	rawstrings = GPOINTER_TO_INT(scan->user_data);
 			GULP;
-			// See if we can convert it to a NetAddr...
-			/// FIXME: Need to make the conversion to a NetAddr optional...
-			if ((encoded = netaddr_string_new(scan->value.v_string)) != NULL) {
+			// See if we can convert it to a NetAddr (unless we were asked not to)
+			if (!rawstrings
+			&&	(encoded = netaddr_string_new(scan->value.v_string)) != NULL) {
 				val = _configcontext_value_new(CFG_NETADDR);
 				val->u.addrvalue = encoded;
                                 encoded = NULL;
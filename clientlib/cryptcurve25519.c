@@ -23,6 +23,7 @@
  *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
  */
 #include <unistd.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <pwd.h>
@@ -101,6 +102,44 @@ dump_memory(const char * label, const guint8* start, const guint8* end)
 	(4 + strnlen(receiverkey_id, MAXCRYPTNAMELENGTH+1) + strnlen(senderkey_id, MAXCRYPTNAMELENGTH+1) \
 	+	crypto_box_NONCEBYTES + crypto_box_MACBYTES)
 
+/*
+  Our key index file (KEYINDEXNAME in CRYPTKEYDIR) lets us start up without opening every key file.
+  It's a KeyIndexHeader followed by 'count' KeyIndexEntry structures sorted by key id,
+  so we can map it into memory and search it in place.  Public keys listed in it are only
+  loaded when someone first asks for them.  It is only read by the machine that wrote it,
+  so it's in native byte order.  Any key id not in it gets read from its key file and added.
+ */
+#define	KEYINDEXNAME		"keys.idx"
+#define	KEYINDEXMAGIC		"AssimKI1"
+#define	KEYINDEX_CKSUM		G_CHECKSUM_SHA256
+#define	KEYINDEX_HASSECRET	0x01		///< We have the secret key too - always load it
+
+typedef struct _KeyIndexHeader {
+	char	magic[8];		///< KEYINDEXMAGIC (without the trailing NUL)
+	guint32	entrysize;		///< sizeof(KeyIndexEntry) when this index was written
+	guint32	count;			///< Number of KeyIndexEntry structures after us
+	guint8	digest[32];		///< KEYINDEX_CKSUM digest of those entries
+}KeyIndexHeader;
+
+typedef struct _KeyIndexEntry {
+	char	key_id[MAXCRYPTKEYNAMELENGTH+1];	///< NUL-terminated key id
+	guint8	flags;					///< KEYINDEX_* flags
+	guint8	public_key[crypto_box_PUBLICKEYBYTES];	///< The public key itself
+}KeyIndexEntry;
+
+static GMappedFile*	keyindex_map = NULL;	///< Our mapped index file (if that's what we're using)
+static GArray*		keyindex_array = NULL;	///< ...or the entries we just wrote out
+static KeyIndexEntry*	keyindex = NULL;	///< Our (sorted) index entries - read only!
+static guint		keyindex_count = 0;	///< Number of entries in keyindex
+static GHashTable*	keyindex_purged = NULL;	///< Key ids purged since we built keyindex
+
+FSTATIC int _keyindex_key_cmp(const void* vkey_id, const void* ventry);
+FSTATIC gint _keyindex_entry_cmp(gconstpointer va, gconstpointer vb);
+FSTATIC gboolean _keyindex_map_file(GMappedFile** mapp, KeyIndexEntry** entriesp, guint* countp);
+FSTATIC void _keyindex_write(const GArray* entries);
+FSTATIC CryptFramePublicKey* _keyindex_load_public_key(const char * key_id);
+FSTATIC GList* _keyindex_key_ids(void);
+
 /// Map a key name on the wire to a file name in the filesystem
 /// We make this a function on the idea that we might eventually want to have hashed subdirectories
 /// or something similar...
@@ -382,17 +421,192 @@ cryptcurve25519_purge_keypair(const char* key_id)	///< Key id of keypair to purg
 		}
 	}
 	g_free(filename); filename = NULL;
+	cryptframe_lock_keys();
+	if (NULL != keyindex) {
+		// Don't let our index bring it back from the dead...
+		if (NULL == keyindex_purged) {
+			keyindex_purged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		}
+		g_hash_table_add(keyindex_purged, g_strdup(key_id));
+	}
 	cryptframe_purge_key_id(key_id);
+	cryptframe_unlock_keys();
 	g_warning("%s.%d:  Key ID %s has been purged.", __FUNCTION__, __LINE__, key_id);
 	return retval;
 }
 
-/// We read in and cache all the key pairs (or public keys) that we find in CRYPTKEYDIR
+/// Compare a key id to a KeyIndexEntry (for bsearch(3))
+FSTATIC int
+_keyindex_key_cmp(const void* vkey_id, const void* ventry)
+{
+	const KeyIndexEntry*	entry = ventry;
+	return strcmp((const char *)vkey_id, entry->key_id);
+}
+
+/// Compare two KeyIndexEntry structures by key id (for sorting)
+FSTATIC gint
+_keyindex_entry_cmp(gconstpointer va, gconstpointer vb)
+{
+	const KeyIndexEntry*	a = va;
+	const KeyIndexEntry*	b = vb;
+	return strcmp(a->key_id, b->key_id);
+}
+
+/// Map our key index file into memory, and make sure it's intact.
+/// @return TRUE if we have a valid key index
+FSTATIC gboolean
+_keyindex_map_file(GMappedFile** mapp,			///<[out] The mapped file
+		   KeyIndexEntry** entriesp,		///<[out] Its index entries
+		   guint* countp)			///<[out] How many entries it has
+{
+	char *		filename = g_build_filename(CRYPTKEYDIR, KEYINDEXNAME, NULL);
+	GMappedFile*	map = g_mapped_file_new(filename, FALSE, NULL);
+	guint8*		contents;
+	gsize		size;
+	KeyIndexHeader	hdr;
+	guint8		digest[sizeof(hdr.digest)];
+	gsize		digestlen = sizeof(digest);
+	GChecksum*	cksum;
+	KeyIndexEntry*	entries = NULL;
+	guint		j;
+	gboolean	ret = FALSE;
+
+	if (NULL == map) {
+		// No index yet
+		g_free(filename);
+		return FALSE;
+	}
+	contents = (guint8*)g_mapped_file_get_contents(map);
+	size = g_mapped_file_get_length(map);
+	if (NULL == contents || size < sizeof(hdr)) {
+		goto getout;
+	}
+	memcpy(&hdr, contents, sizeof(hdr));
+	if (memcmp(hdr.magic, KEYINDEXMAGIC, sizeof(hdr.magic)) != 0
+	||	hdr.entrysize != sizeof(KeyIndexEntry)
+	||	size != sizeof(hdr) + ((gsize)hdr.count * sizeof(KeyIndexEntry))) {
+		goto getout;
+	}
+	cksum = g_checksum_new(KEYINDEX_CKSUM);
+	g_checksum_update(cksum, contents + sizeof(hdr), size - sizeof(hdr));
+	g_checksum_get_digest(cksum, digest, &digestlen);
+	g_checksum_free(cksum);
+	if (digestlen != sizeof(digest) || memcmp(digest, hdr.digest, sizeof(digest)) != 0) {
+		goto getout;
+	}
+	entries = (KeyIndexEntry*)(contents + sizeof(hdr));
+	for (j=0; j < hdr.count; ++j) {
+		if (entries[j].key_id[MAXCRYPTKEYNAMELENGTH] != EOS
+		||	!_is_legal_curve25519_key_id(entries[j].key_id)) {
+			goto getout;
+		}
+	}
+	ret = TRUE;
+getout:
+	if (ret) {
+		*mapp = map;
+		*entriesp = entries;
+		*countp = hdr.count;
+	}else{
+		g_warning("%s.%d: Ignoring damaged key index %s", __FUNCTION__, __LINE__, filename);
+		g_mapped_file_unref(map);
+	}
+	g_free(filename);
+	return ret;
+}
+
+/// Write out our key index file
+FSTATIC void
+_keyindex_write(const GArray* entries)	///<[in] Sorted KeyIndexEntry array
+{
+	KeyIndexHeader	hdr;
+	gsize		entrybytes = (gsize)entries->len * sizeof(KeyIndexEntry);
+	gsize		digestlen = sizeof(hdr.digest);
+	GChecksum*	cksum;
+	guint8*		buf;
+	char *		filename;
+	GError*		err = NULL;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, KEYINDEXMAGIC, sizeof(hdr.magic));
+	hdr.entrysize = sizeof(KeyIndexEntry);
+	hdr.count = entries->len;
+	cksum = g_checksum_new(KEYINDEX_CKSUM);
+	g_checksum_update(cksum, (const guint8*)entries->data, entrybytes);
+	g_checksum_get_digest(cksum, hdr.digest, &digestlen);
+	g_checksum_free(cksum);
+
+	buf = g_malloc(sizeof(hdr) + entrybytes);
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), entries->data, entrybytes);
+	filename = g_build_filename(CRYPTKEYDIR, KEYINDEXNAME, NULL);
+	// g_file_set_contents() writes a temporary file and renames it - so it's never half-written
+	if (!g_file_set_contents(filename, (const gchar*)buf, sizeof(hdr) + entrybytes, &err)) {
+		g_warning("%s.%d: Cannot write key index %s [%s]", __FUNCTION__, __LINE__
+		,	filename, err->message);
+		g_clear_error(&err);
+	}
+	g_free(filename);
+	g_free(buf);
+}
+
+/// Load a public key from our key index the first time someone wants it.
+/// Called by cryptframe_public_key_by_id() with the key maps locked.
+FSTATIC CryptFramePublicKey*
+_keyindex_load_public_key(const char * key_id)	///<[in] Key id being sought
+{
+	const KeyIndexEntry*	entry;
+	gpointer		public_key;
+
+	if (NULL == keyindex
+	||	(NULL != keyindex_purged && g_hash_table_contains(keyindex_purged, key_id))) {
+		return NULL;
+	}
+	entry = bsearch(key_id, keyindex, keyindex_count, sizeof(KeyIndexEntry), _keyindex_key_cmp);
+	if (NULL == entry) {
+		return NULL;
+	}
+	public_key = g_malloc(crypto_box_PUBLICKEYBYTES);
+	memcpy(public_key, entry->public_key, crypto_box_PUBLICKEYBYTES);
+	return cryptframe_publickey_new(key_id, public_key);
+}
+
+/// Return a list of all the (unpurged) key ids in our key index.  Don't free the key ids.
+FSTATIC GList*
+_keyindex_key_ids(void)
+{
+	GList*	ret = NULL;
+	guint	j;
+	for (j=0; j < keyindex_count; ++j) {
+		char *	key_id = keyindex[j].key_id;
+		if (NULL == keyindex_purged || !g_hash_table_contains(keyindex_purged, key_id)) {
+			ret = g_list_prepend(ret, key_id);
+		}
+	}
+	return ret;
+}
+
+/// We cache all the key pairs (or public keys) that we find in CRYPTKEYDIR.
+/// We only read the directory itself, relying on our key index for any keys we've seen before.
+/// Public keys from our index are loaded when first needed.  Key pairs are always loaded.
+/// Key files never change once written (a changed key gets a new key id),
+/// so we only have to notice key ids which have come and gone.
 WINEXPORT void
 cryptcurve25519_cache_all_keypairs(void)
 {
 	GDir*		key_directory;
 	const char*	filename;
+	gint64		starttime = g_get_monotonic_time();
+	GPtrArray*	public_ids;
+	GHashTable*	secret_ids;
+	GMappedFile*	oldmap = NULL;
+	KeyIndexEntry*	oldentries;
+	guint		oldcount;
+	GArray*		newindex;
+	guint		unchanged = 0;
+	guint		j;
+	gsize		keymem;
+	guint		keycount;
 
 	_cryptcurve25519_make_cryptdir(CRYPTKEYDIR);
 	key_directory = g_dir_open(CRYPTKEYDIR, 0, NULL);
@@ -402,18 +616,115 @@ cryptcurve25519_cache_all_keypairs(void)
 		,	CRYPTKEYDIR, g_strerror(errno));
 		return;
 	}
-
+	// Just the names - no opening files (yet)
+	public_ids = g_ptr_array_new_with_free_func(g_free);
+	secret_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 	while (NULL != (filename = g_dir_read_name(key_directory))) {
-		if (_cryptcurve25519_keytype_from_filename(filename) == PUBLICKEY) {
-			char *	key_id = _cryptcurve25519_key_id_from_filename(filename);
-			if (NULL == key_id) {
-				continue;
-			}
-			_cache_curve25519_keypair(key_id);
-			g_free(key_id); key_id = NULL;
+		enum keytype	ktype = _cryptcurve25519_keytype_from_filename(filename);
+		char *		key_id;
+		if (NOTAKEY == ktype) {
+			continue;
+		}
+		key_id = _cryptcurve25519_key_id_from_filename(filename);
+		if (NULL == key_id) {
+			continue;
+		}
+		if (PUBLICKEY == ktype) {
+			g_ptr_array_add(public_ids, key_id);
+		}else{
+			g_hash_table_add(secret_ids, key_id);
 		}
 	}
 	g_dir_close(key_directory);
+
+	// Nobody gets to look up keys while our index is in flux
+	cryptframe_lock_keys();
+	oldentries = keyindex;
+	oldcount = keyindex_count;
+	if (NULL == oldentries && !_keyindex_map_file(&oldmap, &oldentries, &oldcount)) {
+		oldentries = NULL;
+		oldcount = 0;
+	}
+	// Don't let our (old) index answer for keys we're about to read from disk
+	keyindex = NULL;
+	keyindex_count = 0;
+
+	newindex = g_array_sized_new(FALSE, TRUE, sizeof(KeyIndexEntry), public_ids->len);
+	for (j=0; j < public_ids->len; ++j) {
+		const char *		key_id = g_ptr_array_index(public_ids, j);
+		guint8			flags = 0;
+		const KeyIndexEntry*	old = NULL;
+		CryptFramePublicKey*	pub;
+		KeyIndexEntry		entry;
+
+		if (g_hash_table_contains(secret_ids, key_id)) {
+			flags |= KEYINDEX_HASSECRET;
+		}
+		if (NULL != oldentries) {
+			old = bsearch(key_id, oldentries, oldcount, sizeof(KeyIndexEntry)
+			,	_keyindex_key_cmp);
+		}
+		if (NULL != old && old->flags == flags && 0 == (flags & KEYINDEX_HASSECRET)) {
+			// Seen it before - leave it be until someone asks for it
+			g_array_append_val(newindex, *old);
+			++unchanged;
+			continue;
+		}
+		if (!_cache_curve25519_keypair(key_id)
+		||	NULL == (pub = cryptframe_public_key_by_id(key_id))) {
+			continue;
+		}
+		memset(&entry, 0, sizeof(entry));
+		g_strlcpy(entry.key_id, key_id, sizeof(entry.key_id));
+		entry.flags = flags;
+		memcpy(entry.public_key, pub->public_key, crypto_box_PUBLICKEYBYTES);
+		if (NULL != old && old->flags == flags
+		&&	memcmp(old->public_key, entry.public_key, sizeof(entry.public_key)) == 0) {
+			++unchanged;
+		}
+		g_array_append_val(newindex, entry);
+	}
+	g_array_sort(newindex, _keyindex_entry_cmp);
+
+	if (NULL != oldmap && unchanged == oldcount && unchanged == newindex->len) {
+		// Our index file is still good - use it in place
+		g_array_free(newindex, TRUE); newindex = NULL;
+	}else if (NULL == oldentries || unchanged != oldcount || unchanged != newindex->len) {
+		_keyindex_write(newindex);
+	}
+	if (NULL != newindex) {
+		// Replace whatever index we had before with this new one
+		if (NULL != keyindex_map) {
+			g_mapped_file_unref(keyindex_map); keyindex_map = NULL;
+		}
+		if (NULL != keyindex_array) {
+			g_array_free(keyindex_array, TRUE); keyindex_array = NULL;
+		}
+		if (NULL != oldmap) {
+			g_mapped_file_unref(oldmap); oldmap = NULL;
+		}
+		keyindex_array = newindex;
+		keyindex = (KeyIndexEntry*)newindex->data;
+		keyindex_count = newindex->len;
+	}else{
+		keyindex_map = oldmap;
+		keyindex = oldentries;
+		keyindex_count = oldcount;
+	}
+	// Anything purged has no key file - so it's not in our index any more
+	if (NULL != keyindex_purged) {
+		g_hash_table_remove_all(keyindex_purged);
+	}
+	cryptframe_set_key_loader(_keyindex_load_public_key, _keyindex_key_ids);
+	cryptframe_unlock_keys();
+
+	keymem = cryptframe_key_memory(&keycount);
+	g_info("%s.%d: %u keys indexed (%u new or changed) in %.1f ms."
+	" %u public keys loaded using %"G_GSIZE_FORMAT" bytes."
+	,	__FUNCTION__, __LINE__, keyindex_count, keyindex_count - unchanged
+	,	(g_get_monotonic_time() - starttime)/1000.0, keycount, keymem);
+	g_ptr_array_free(public_ids, TRUE);
+	g_hash_table_destroy(secret_ids);
 }
 
 /// @ref CryptCurve25519 'isvalid' member function (checks for valid cryptcurve25519 objects)
@@ -540,6 +851,16 @@ cryptcurve25519_new(guint16 frame_type,	///<[in] TLV type of CryptCurve25519
 		DUMP3(__FUNCTION__, &ret->baseclass.baseclass.baseclass, " is return value");
 		REF(ret->private_key);
 		REF(ret->public_key);
+		if (forsending) {
+			// Sending frames get reused (see cryptframe_new_by_destaddr()), so it's
+			// worth doing the expensive part of crypto_box_easy() just once
+			ret->_shared_key = g_malloc(crypto_box_BEFORENMBYTES);
+			if (crypto_box_beforenm(ret->_shared_key, ret->public_key->public_key
+			,	ret->private_key->private_key) != 0) {
+				g_free(ret->_shared_key);
+				ret->_shared_key = NULL;
+			}
+		}
 	}else{
 		if (!ret->private_key) {
 			g_warning("%s.%d: Sender private key is NULL for key id %s", __FUNCTION__, __LINE__
@@ -562,6 +883,11 @@ _cryptcurve25519_finalize(AssimObj* aself)	///< Object to finalize/free
 {
 	CryptCurve25519*	self = CASTTOCLASS(CryptCurve25519, aself);
 	
+	if (self->_shared_key) {
+		sodium_memzero(self->_shared_key, crypto_box_BEFORENMBYTES);
+		g_free(self->_shared_key);
+		self->_shared_key = NULL;
+	}
 	if (self->public_key) {
 		UNREF(self->public_key);
 	}
@@ -711,8 +1037,13 @@ _cryptcurve25519_updatedata(Frame* f,			///< Frame to marshall
 	DEBUGCKSUM4("sender  private key cksum:", self->private_key->private_key, crypto_box_SECRETKEYBYTES);
 	DEBUGCKSUM4("nonce cksum:", nonce, crypto_box_NONCEBYTES);
 	// Encrypt in-place [we previously allocated enough space for authentication info]
-	crypto_box_easy(tlvval+cyphertextoffset, tlvval+plaintextoffset, plaintextsize
-	,	nonce, self->public_key->public_key, self->private_key->private_key);
+	if (self->_shared_key) {
+		crypto_box_easy_afternm(tlvval+cyphertextoffset, tlvval+plaintextoffset, plaintextsize
+		,	nonce, self->_shared_key);
+	}else{
+		crypto_box_easy(tlvval+cyphertextoffset, tlvval+plaintextoffset, plaintextsize
+		,	nonce, self->public_key->public_key, self->private_key->private_key);
+	}
 	DEBUGMSG4("cypher offset versus tlvstart: %ld", (long)(tlvval+cyphertextoffset-(guint8*)tlvstart));
 	DEBUGCKSUM4("cypher text checksum:", tlvval+cyphertextoffset, plaintextsize+crypto_box_MACBYTES);
 	set_generic_tlv_type(tlvstart, self->baseclass.baseclass.type, pktend);
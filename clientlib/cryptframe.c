@@ -123,6 +123,8 @@ FSTATIC void _cryptframe_publickey_finalize(AssimObj* key);
 FSTATIC void _cryptframe_privatekey_finalize(AssimObj* key);
 FSTATIC void _cryptframe_debug_checksum(const char * function, int lineno, const char * message, const guint8* buf);
 FSTATIC void _cryptframe_initialize_maps(void);
+FSTATIC void _cryptframe_cache_entry_free(gpointer ventry);
+FSTATIC void _cryptframe_cache_trim(guint maxentries);
 // All our hash tables have strings for keys
 static GHashTable*	public_key_map = NULL;		///< map of all public keys by key id
 static GHashTable*	private_key_map = NULL;		///< map of all private keys by key id
@@ -133,15 +135,34 @@ static GHashTable*	key_id_map_by_identity = NULL;	///< A hash table of hash tabl
 							///< It tells you all the key ids
 							///< associated with a given identity
 GHashTable*	addr_to_public_key_map = NULL;		///< Maps @ref NetAddr to public key
+static GHashTable*	addr_to_cryptframe_map = NULL;	///< Cache: @ref NetAddr to CryptFrameCacheEntry
+/// What we keep in addr_to_cryptframe_map
+typedef struct _CryptFrameCacheEntry {
+	CryptFrame*	frame;		///< (Sending) CryptFrame for this destination
+	guint64		lastused;	///< cryptframe_cache_clock when it was last used
+}CryptFrameCacheEntry;
+static guint		cryptframe_cache_max = CRYPTFRAME_CACHE_MAX;
+static guint64		cryptframe_cache_clock = 0;	///< Counts cache lookups - for LRU eviction
+static guint64		cryptframe_key_gen = 0;		///< Bumped whenever sending keys change
 static CryptFramePrivateKey*	default_signing_key = NULL;
 #define	INITMAPS	{if (!maps_inityet) {_cryptframe_initialize_maps();}}
 static gboolean		maps_inityet = FALSE;
+/// Our maps can be consulted (and keys cached) by @ref MarshalPool threads decrypting packets
+static GRecMutex	maps_lock;
+#define	LOCKMAPS	g_rec_mutex_lock(&maps_lock)
+#define	UNLOCKMAPS	g_rec_mutex_unlock(&maps_lock)
+/// Loads public keys we don't have yet on first use (called with our maps locked)
+static CryptFramePublicKey*	(*public_key_loader)(const char * key_id) = NULL;
+/// Lists the key ids public_key_loader could load for us
+static GList*			(*public_key_lister)(void) = NULL;
 
 /// Initialize all our maps
 FSTATIC void
 _cryptframe_initialize_maps(void)
 {
+	LOCKMAPS;
 	if (maps_inityet) {
+		UNLOCKMAPS;
 		return;
 	}
 	key_id_map_by_identity = g_hash_table_new_full(g_str_hash, g_str_equal
@@ -151,22 +172,92 @@ _cryptframe_initialize_maps(void)
 	private_key_map = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, assim_g_notify_unref);
 	addr_to_public_key_map = g_hash_table_new_full(netaddr_g_hash_hash
 	,	netaddr_g_hash_equal, assim_g_notify_unref, assim_g_notify_unref);
+	addr_to_cryptframe_map = g_hash_table_new_full(netaddr_g_hash_hash
+	,	netaddr_g_hash_equal, assim_g_notify_unref, _cryptframe_cache_entry_free);
 	maps_inityet = TRUE;
+	UNLOCKMAPS;
+}
+
+/// Free an addr_to_cryptframe_map entry
+FSTATIC void
+_cryptframe_cache_entry_free(gpointer ventry)
+{
+	CryptFrameCacheEntry*	entry = (CryptFrameCacheEntry*)ventry;
+	UNREF2(entry->frame);
+	g_free(entry);
+}
+
+/// Throw out the least recently used CryptFrames we've cached until there are fewer than
+/// 'maxentries' left (called with our maps locked).
+/// A full cache means lots of idle peers, so a linear search now and then is cheap enough.
+FSTATIC void
+_cryptframe_cache_trim(guint maxentries)
+{
+	while (g_hash_table_size(addr_to_cryptframe_map) >= maxentries
+	&&	g_hash_table_size(addr_to_cryptframe_map) > 0) {
+		GHashTableIter		iter;
+		gpointer		key;
+		gpointer		value;
+		gpointer		oldestkey = NULL;
+		guint64			oldest = G_MAXUINT64;
+
+		g_hash_table_iter_init(&iter, addr_to_cryptframe_map);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			CryptFrameCacheEntry*	entry = (CryptFrameCacheEntry*)value;
+			if (entry->lastused < oldest) {
+				oldest = entry->lastused;
+				oldestkey = key;
+			}
+		}
+		g_hash_table_remove(addr_to_cryptframe_map, oldestkey);
+	}
+}
+
+/// Set the most destinations we'll cache CryptFrames for (at least one).
+/// Frames we throw out just get rebuilt the next time we send to that destination.
+WINEXPORT void
+cryptframe_set_cache_limit(guint maxentries)	///<[in] most cached CryptFrames
+{
+	INITMAPS;
+	LOCKMAPS;
+	cryptframe_cache_max = MAX(maxentries, 1);
+	_cryptframe_cache_trim(cryptframe_cache_max+1);
+	UNLOCKMAPS;
+}
+
+/// Lock our key maps against changes from other threads.
+/// Anyone using keys or key ids returned from us outside the main thread needs to
+/// hold this lock for as long as they use them.  It's a recursive lock.
+WINEXPORT void
+cryptframe_lock_keys(void)
+{
+	LOCKMAPS;
+}
+
+/// Undo a previous cryptframe_lock_keys() call
+WINEXPORT void
+cryptframe_unlock_keys(void)
+{
+	UNLOCKMAPS;
 }
 
 /// Shut down our key caches and so on... (destroy our maps)
 WINEXPORT void
 cryptframe_shutdown(void)
 {
+	LOCKMAPS;
 	g_hash_table_destroy(key_id_map_by_identity);	key_id_map_by_identity=NULL;
 	g_hash_table_destroy(identity_map_by_key_id);	identity_map_by_key_id=NULL;
 	g_hash_table_destroy(public_key_map);		public_key_map=NULL;
 	g_hash_table_destroy(private_key_map);		private_key_map=NULL;
 	g_hash_table_destroy(addr_to_public_key_map);	addr_to_public_key_map=NULL;
+	g_hash_table_destroy(addr_to_cryptframe_map);	addr_to_cryptframe_map=NULL;
 	if (default_signing_key) {
 		UNREF(default_signing_key);
 	}
+	++cryptframe_key_gen;
 	maps_inityet = FALSE;
+	UNLOCKMAPS;
 }
 
 /// Finalize (destructor) function for our CryptFramePublicKey objects
@@ -224,8 +315,11 @@ cryptframe_publickey_new (const char *key_id,	///< Key id of the given public ke
 	CryptFramePublicKey*	self;
 	INITMAPS;
 	g_return_val_if_fail(key_id != NULL && public_key != NULL, NULL);
-	self = cryptframe_public_key_by_id(key_id);
+	LOCKMAPS;
+	// Don't use cryptframe_public_key_by_id() - our key loader calls us...
+	self = g_hash_table_lookup(public_key_map, key_id);
 	if (self) {
+		UNLOCKMAPS;
 		return self;
 	}
 	aself = assimobj_new(sizeof(CryptFramePublicKey));
@@ -236,6 +330,7 @@ cryptframe_publickey_new (const char *key_id,	///< Key id of the given public ke
 	self->frame_type = FRAMETYPE_PUBKEYCURVE25519;
 	self->public_key = public_key;
 	g_hash_table_insert(public_key_map, self->key_id, self);
+	UNLOCKMAPS;
 	DEBUGCKSUM3(self->key_id, public_key);
 	return self;
 }
@@ -249,8 +344,10 @@ cryptframe_privatekey_new(const char *key_id,	///<[in] Key id of given private k
 	CryptFramePrivateKey*	self;
 	INITMAPS;
 	g_return_val_if_fail(key_id != NULL && private_key != NULL, NULL);
+	LOCKMAPS;
 	self = cryptframe_private_key_by_id(key_id);
 	if (self) {
+		UNLOCKMAPS;
 		g_warning("%s.%d: Private key %s Already IN private key map", __FUNCTION__, __LINE__, key_id);
 		return self;
 	}
@@ -261,6 +358,7 @@ cryptframe_privatekey_new(const char *key_id,	///<[in] Key id of given private k
 	self->key_size = crypto_box_SECRETKEYBYTES;
 	self->private_key = private_key;
 	g_hash_table_insert(private_key_map, self->key_id, self);
+	UNLOCKMAPS;
 	DEBUGCKSUM3(self->key_id, private_key);
 	return self;
 }
@@ -271,7 +369,12 @@ cryptframe_public_key_by_id(const char* key_id)	///[in] Key id of public key bei
 {
 	gpointer	ret;
 	INITMAPS;
+	LOCKMAPS;
 	ret = (key_id ? g_hash_table_lookup(public_key_map, key_id): NULL);
+	if (NULL == ret && NULL != key_id && NULL != public_key_loader) {
+		ret = public_key_loader(key_id);
+	}
+	UNLOCKMAPS;
 	return (ret ? CASTTOCLASS(CryptFramePublicKey, ret): NULL);
 }
 /// Return the non-const private key with the given id
@@ -280,7 +383,9 @@ cryptframe_private_key_by_id(const char* key_id) ///<[in] Key id of the given pr
 {
 	gpointer	ret;
 	INITMAPS;
+	LOCKMAPS;
 	ret = (key_id ? g_hash_table_lookup(private_key_map, key_id): NULL);
+	UNLOCKMAPS;
 	return (ret ? CASTTOCLASS(CryptFramePrivateKey, ret): NULL);
 }
 
@@ -297,12 +402,15 @@ cryptframe_associate_identity(const char * identity,	///<[in] identity to associ
 	const char*	found_identity;
 	char*		key_id_duplicate;
 	char*		identity_duplicate;
+	gboolean	retval = TRUE;
 	INITMAPS;
 	g_return_val_if_fail(key_id != NULL && identity != NULL, FALSE);
+	LOCKMAPS;
 	if (cryptframe_public_key_by_id(key_id) == NULL) {
 		g_critical("%s.%d: no public key associated with key id %s"
 		,	__FUNCTION__, __LINE__, key_id);
-		return FALSE;
+		retval = FALSE;
+		goto getout;
 	}
 	found_identity = cryptframe_whois_key_id(key_id);
 	if (found_identity) {
@@ -310,9 +418,9 @@ cryptframe_associate_identity(const char * identity,	///<[in] identity to associ
 			g_critical("%s.%d: Key id %s cannot be associated with identity %s."
 			" Already associated with identity %s", __FUNCTION__, __LINE__
 			,	key_id, identity, found_identity);
-			return FALSE;
+			retval = FALSE;
 		}
-		return TRUE;
+		goto getout;
 	}
 	key_id_duplicate = g_strdup(key_id);
 	identity_duplicate = g_strdup(identity);
@@ -326,7 +434,9 @@ cryptframe_associate_identity(const char * identity,	///<[in] identity to associ
 	if (!g_hash_table_lookup((GHashTable*)key_id_map, key_id)) {
 		g_hash_table_insert(key_id_map, key_id_duplicate, key_id_duplicate);
 	}
-	return TRUE;
+getout:
+	UNLOCKMAPS;
+	return retval;
 }
 
 /// Dissociate the given key from the given identity (analogous to revoking the key)
@@ -340,8 +450,10 @@ cryptframe_dissociate_identity(const char * identity,	///<[in] identity to disso
 
 	g_return_val_if_fail(identity != NULL && key_id != NULL, FALSE);
 
+	LOCKMAPS;
 	found_identity = g_hash_table_lookup(identity_map_by_key_id, key_id);
 	if (NULL == found_identity) {
+		UNLOCKMAPS;
 		return FALSE;
 	}
 	// The order of these deletions matters - because of shared data between tables.
@@ -354,6 +466,7 @@ cryptframe_dissociate_identity(const char * identity,	///<[in] identity to disso
 		}
 	}
 	g_hash_table_remove(identity_map_by_key_id, key_id);
+	UNLOCKMAPS;
 	return TRUE;
 }
 
@@ -370,45 +483,123 @@ cryptframe_whois_public_key(const CryptFramePublicKey* public_key) ///<[in] publ
 WINEXPORT const char*
 cryptframe_whois_key_id(const char * key_id)	///<[in] key id whose identity is sought
 {
+	const char *	ret;
 	INITMAPS;
-	return (key_id ? (const char *)g_hash_table_lookup(identity_map_by_key_id, key_id)
+	LOCKMAPS;
+	ret = (key_id ? (const char *)g_hash_table_lookup(identity_map_by_key_id, key_id)
 	:	NULL);
+	UNLOCKMAPS;
+	return ret;
 }
 
 /// Return a GHashTable of strings of all the key ids associated with the given identity
 WINEXPORT GHashTable*
 cryptframe_key_ids_for(const char* identity) 
 {
+	GHashTable*	ret;
 	INITMAPS;
-	return (identity? (GHashTable *)g_hash_table_lookup(key_id_map_by_identity, identity)
+	LOCKMAPS;
+	ret = (identity? (GHashTable *)g_hash_table_lookup(key_id_map_by_identity, identity)
 	:	NULL);
+	UNLOCKMAPS;
+	return ret;
 }
 
 /// Return a GList of strings of all known identities
 WINEXPORT GList*
 cryptframe_get_identities(void)
 {
+	GList*	ret;
 	INITMAPS;
-	return g_hash_table_get_keys(key_id_map_by_identity);
+	LOCKMAPS;
+	ret = g_hash_table_get_keys(key_id_map_by_identity);
+	UNLOCKMAPS;
+	return ret;
 }
 
-/// Return a GList of strings of all known key ids
+/// Return a GList of strings of all known key ids - including those we could load on demand.
+/// The strings are copies - since associating or purging keys can free the originals.
+/// Free the result with g_list_free_full(list, g_free).
 WINEXPORT GList*
 cryptframe_get_key_ids(void)
 {
+	GList*		ret = NULL;
+	GHashTableIter	iter;
+	gpointer	key_id;
 	INITMAPS;
-	return g_hash_table_get_keys(public_key_map);
+	LOCKMAPS;
+	g_hash_table_iter_init(&iter, public_key_map);
+	while (g_hash_table_iter_next(&iter, &key_id, NULL)) {
+		ret = g_list_prepend(ret, g_strdup(key_id));
+	}
+	if (NULL != public_key_lister) {
+		GList*	loadable = public_key_lister();
+		GList*	elem;
+		for (elem = loadable; NULL != elem; elem = g_list_next(elem)) {
+			if (!g_hash_table_contains(public_key_map, elem->data)) {
+				ret = g_list_prepend(ret, g_strdup(elem->data));
+			}
+		}
+		g_list_free(loadable);
+	}
+	UNLOCKMAPS;
+	return ret;
+}
+
+/// Register functions for loading public keys the first time someone asks for them.
+/// This lets us start up without reading every public key we might ever need.
+WINEXPORT void
+cryptframe_set_key_loader(CryptFramePublicKey* (*loader)(const char * key_id)	///<[in] loads a key
+,			  GList* (*lister)(void))	///<[in] lists key ids 'loader' can load
+{
+	INITMAPS;
+	LOCKMAPS;
+	public_key_loader = loader;
+	public_key_lister = lister;
+	UNLOCKMAPS;
+}
+
+/// Return (approximately) how much memory our cached keys are using
+WINEXPORT gsize
+cryptframe_key_memory(guint* public_key_count)	///<[out] how many public keys are cached (or NULL)
+{
+	GHashTableIter	iter;
+	gpointer	value;
+	gsize		ret = 0;
+	INITMAPS;
+	LOCKMAPS;
+	g_hash_table_iter_init(&iter, public_key_map);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		CryptFramePublicKey*	key = CASTTOCLASS(CryptFramePublicKey, value);
+		ret += sizeof(*key) + strlen(key->key_id) + 1 + key->key_size;
+	}
+	g_hash_table_iter_init(&iter, private_key_map);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		CryptFramePrivateKey*	key = CASTTOCLASS(CryptFramePrivateKey, value);
+		ret += sizeof(*key) + strlen(key->key_id) + 1 + key->key_size;
+	}
+	if (NULL != public_key_count) {
+		*public_key_count = g_hash_table_size(public_key_map);
+	}
+	UNLOCKMAPS;
+	return ret;
 }
 
 WINEXPORT void
 cryptframe_purge_key_id(const char * key_id)
 {
-	const char* whoarewe = cryptframe_whois_key_id(key_id);
+	const char* whoarewe;
+	LOCKMAPS;
+	whoarewe = cryptframe_whois_key_id(key_id);
 	if (NULL != whoarewe) {
 		cryptframe_dissociate_identity(whoarewe, key_id);
 	}
 	g_hash_table_remove(public_key_map, key_id);
 	g_hash_table_remove(private_key_map, key_id);
+	// We don't know which destinations used this key - so forget them all
+	g_hash_table_remove_all(addr_to_cryptframe_map);
+	++cryptframe_key_gen;
+	UNLOCKMAPS;
 }
 
 /// Set the default signing key
@@ -417,12 +608,17 @@ cryptframe_set_signing_key_id(const char * key_id)
 {
 	CryptFramePrivateKey*	secret_key = cryptframe_private_key_by_id(key_id);
 	if (secret_key) {
+		LOCKMAPS;
 		if (default_signing_key) {
 			UNREF(default_signing_key);
 			default_signing_key = NULL;
 		}
 		REF(secret_key);
 		default_signing_key = secret_key;
+		// Every cached CryptFrame was built with our old signing key
+		g_hash_table_remove_all(addr_to_cryptframe_map);
+		++cryptframe_key_gen;
+		UNLOCKMAPS;
 	}else{
 		g_warning("%s.%d: Cannot set signing key to [%s] - no such private key"
 		,	__FUNCTION__, __LINE__, key_id);
@@ -455,6 +651,9 @@ cryptframe_set_dest_public_key(NetAddr*destaddr,		///< Destination addr,port
 {
 	INITMAPS;
 	g_return_if_fail(NULL != destaddr);
+	LOCKMAPS;
+	g_hash_table_remove(addr_to_cryptframe_map, destaddr);
+	++cryptframe_key_gen;
 	if (NULL == destkey) {
 		g_hash_table_remove(addr_to_public_key_map, destaddr);
 	}else{
@@ -462,6 +661,7 @@ cryptframe_set_dest_public_key(NetAddr*destaddr,		///< Destination addr,port
 		REF(destkey);
 		g_hash_table_insert(addr_to_public_key_map, destaddr, destkey);
 	}
+	UNLOCKMAPS;
 }
 ///
 ///	Set the encryption key to use when sending to destaddr
@@ -473,7 +673,7 @@ cryptframe_set_dest_key_id(NetAddr*destaddr,	///< Destination addr,port
 	CryptFramePublicKey*	destkey;
 	INITMAPS;
 	g_return_val_if_fail(NULL != destaddr && NULL != key_id, FALSE);
-	destkey = g_hash_table_lookup(public_key_map, key_id);
+	destkey = cryptframe_public_key_by_id(key_id);
 	if (NULL == destkey) {
 		g_critical("%s.%d: No key associated with key id %s"
 		,	__FUNCTION__, __LINE__, key_id);
@@ -483,20 +683,57 @@ cryptframe_set_dest_key_id(NetAddr*destaddr,	///< Destination addr,port
 	return TRUE;
 }
 
-/// Construct a @ref CryptFrame appropriate for encrypting messages to <i>destaddr</i>
+/// Return a @ref CryptFrame appropriate for encrypting messages to <i>destaddr</i>.
+/// These frames don't change from packet to packet, so we construct one per destination
+/// and hand out references to it until that destination's keys (or our signing key) change
+/// - or until it's one of the least recently used when our cache fills up.
+/// Please UNREF the return value when you're done with it.
 WINEXPORT CryptFrame*
 cryptframe_new_by_destaddr(const NetAddr* destaddr)
 {
 	const char *		receiver_key_id;
+	CryptFrame*		ret;
+	CryptFrameCacheEntry*	entry;
 	INITMAPS;
 	if (NULL == current_encryption_method || NULL == default_signing_key) {
 		return NULL;
 	}
-	receiver_key_id = cryptframe_get_dest_key_id(destaddr);
-	if (NULL == receiver_key_id) {
-		return NULL;
+	LOCKMAPS;
+	entry = g_hash_table_lookup(addr_to_cryptframe_map, destaddr);
+	if (NULL != entry) {
+		entry->lastused = ++cryptframe_cache_clock;
+		ret = entry->frame;
+	}else{
+		ret = NULL;
+		receiver_key_id = cryptframe_get_dest_key_id(destaddr);
+		if (NULL != receiver_key_id) {
+			ret = current_encryption_method(default_signing_key->key_id
+			,	receiver_key_id, TRUE);
+		}
+		if (NULL != ret) {
+			// Our hash table gets its own reference to the new CryptFrame
+			_cryptframe_cache_trim(cryptframe_cache_max);
+			entry = g_new(CryptFrameCacheEntry, 1);
+			entry->frame = ret;
+			entry->lastused = ++cryptframe_cache_clock;
+			g_hash_table_insert(addr_to_cryptframe_map, destaddr->toIPv6(destaddr), entry);
+		}
+	}
+	if (NULL != ret) {
+		REF2(ret);
 	}
-	return current_encryption_method(default_signing_key->key_id, receiver_key_id, TRUE);
+	UNLOCKMAPS;
+	return ret;
+}
+
+/// Return a number which changes whenever the CryptFrame for any destination might have changed:
+/// keys, key assignments, or our encryption method.  Anyone keeping packets they've encrypted
+/// (like @ref HbSender) can keep sending them for as long as this stays the same.
+/// Throwing CryptFrames out of our cache to make room doesn't change it.
+WINEXPORT guint64
+cryptframe_key_generation(void)
+{
+	return cryptframe_key_gen;
 }
 
 /// Return the key_id associated with the given destination address
@@ -506,7 +743,9 @@ cryptframe_get_dest_key_id(const NetAddr* destaddr)
 	gpointer		g_receiver_key;
 	CryptFramePublicKey*	receiver_key;
 	INITMAPS;
+	LOCKMAPS;
 	g_receiver_key = g_hash_table_lookup(addr_to_public_key_map, destaddr);
+	UNLOCKMAPS;
 	if (NULL == g_receiver_key) {
 		return NULL;
 	}
@@ -520,7 +759,12 @@ cryptframe_set_encryption_method(CryptFrame*	(*method)	///< method/constructor f
 							 const char * receiver_key_id,
 							 gboolean forsending))
 {
+	INITMAPS;
+	LOCKMAPS;
 	current_encryption_method = method;
+	g_hash_table_remove_all(addr_to_cryptframe_map);
+	++cryptframe_key_gen;
+	UNLOCKMAPS;
 }
 
 
@@ -28,19 +28,48 @@
 #include <cstringframe.h>
 #include <frametypes.h>
 #include <fsprotocol.h>
+#include <discoverytrigger.h>
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
+#ifdef HAVE_UNISTD_H
+#	include <unistd.h>
+#endif
 ///@defgroup DiscoveryClass Discovery class
 /// Discovery abstract base class - supporting the discovery of various local things by our subclasses.
+/// All our Discovery objects share one scheduler.  It keeps them in a heap ordered by when
+/// they're next due, and has a single timer which goes off when the earliest one is due.
+/// It limits how many (asynchronous) discovery agents run at once, gives each repeating discovery
+/// a random phase and some jitter so that a fleet of machines doesn't report in lock step,
+/// and postpones discovery while this machine is heavily loaded or our reliable output to
+/// the CMA is backed up.
+/// Discovery objects can also be triggered by kernel events (see discoverytrigger.h) - which
+/// reruns them soon, and lets their periodic runs be much less frequent.
 /// @{
 /// @ingroup C_Classes
 
 FSTATIC char *		_discovery_instancename(const Discovery* self);
 FSTATIC void		_discovery_flushcache(Discovery* self);
 FSTATIC guint		_discovery_discoverintervalsecs(const Discovery* self);
-FSTATIC gboolean	_discovery_rediscover(gpointer vself);
+FSTATIC void		_discovery_heap_swap(guint i, guint j);
+FSTATIC void		_discovery_heap_siftup(guint index);
+FSTATIC void		_discovery_heap_siftdown(guint index);
+FSTATIC void		_discovery_heap_insert(Discovery* self);
+FSTATIC void		_discovery_heap_remove(Discovery* self);
+FSTATIC void		_discovery_set_timer(void);
+FSTATIC gboolean	_discovery_timer_dispatch(GSource*, GSourceFunc, gpointer);
+FSTATIC gint64		_discovery_cfgint(const ConfigContext* cfg, const char * name, gint64 defvalue);
+FSTATIC double		_discovery_cfgdouble(const ConfigContext* cfg, const char * name, double defvalue);
+FSTATIC guint		_discovery_maxrun(void);
+FSTATIC gboolean	_discovery_busy(Discovery* self);
+FSTATIC void		_discovery_postpone(gint64 now);
+FSTATIC gint64		_discovery_nextdue(Discovery* self, gint64 now, guint interval);
+FSTATIC gint64		_discovery_debounce(const Discovery* self);
+FSTATIC gboolean	_discovery_isregistered(Discovery* self);
+FSTATIC void		_discovery_run(Discovery* self, gint64 now);
 FSTATIC void		_discovery_ghash_destructor(gpointer gdiscovery);
 FSTATIC void		_discovery_sendjson(Discovery* self, char * jsonout, gsize jsonlen);
+FSTATIC char *		_discovery_jsonpatch(const char * oldjson, const char * newjson);
 
 DEBUGDECLARATIONS
 
@@ -66,6 +95,23 @@ _discovery_discoverintervalsecs(const Discovery* self)	///<[in] Object whose int
 	return 0;
 }
 static GHashTable * _discovery_timers = NULL;
+static GPtrArray*	_discovery_due = NULL;		///< Min-heap of Discovery objects - ordered by _nextdue
+static GSource*		_discovery_timer = NULL;	///< Goes off when the earliest discovery is due
+static guint		_discovery_running = 0;		///< How many asynchronous discoveries are running
+static gint64		_discovery_backoff = 0;		///< Current backoff delay (uS) - zero if none
+
+/// Our timer only has a ready time - glib takes care of waking us up when it arrives
+static GSourceFuncs _discovery_timerfuncs = {
+	NULL,
+	NULL,
+	_discovery_timer_dispatch,
+	NULL,
+	NULL,
+	NULL
+};
+
+#define	ONESEC	1000000
+#define	HEAPITEM(index)	((Discovery*)g_ptr_array_index(_discovery_due, (index)))
 
 /// Finalizing function for Discovery objects
 FSTATIC void
@@ -74,13 +120,18 @@ _discovery_finalize(AssimObj* gself)	///<[in/out] Object to finalize (free)
 	Discovery*	self = CASTTOCLASS(Discovery, gself);
 	char *		instancename = self->_instancename;
 	
-	if (self->_timerid > 0) {
-		g_source_remove(self->_timerid);
-		self->_timerid = 0;
+	_discovery_heap_remove(self);
+	discoverytrigger_unsubscribe(self);
+	if (self->_inprogress) {
+		discovery_complete(self);
 	}
 	if (self->_config) {
 		UNREF(self->_config);
 	}
+	if (self->_lastdigest) {
+		g_free(self->_lastdigest);
+		self->_lastdigest = NULL;
+	}
 	if (_discovery_timers && instancename) {
 		self->_instancename = NULL;	// Avoid infinite recursion...
 		g_hash_table_remove(_discovery_timers, instancename);
@@ -125,14 +176,388 @@ _discovery_ghash_destructor(gpointer gdiscovery)
 	}
 }
 
-/// GSourceFunc function to invoke discover member function at the timed interval.
-/// This function is called by the g_main_loop mechanism when the rediscover timeout elapses.
+/// Exchange two entries in our heap of due times
+FSTATIC void
+_discovery_heap_swap(guint i, guint j)
+{
+	Discovery*	di = HEAPITEM(i);
+	Discovery*	dj = HEAPITEM(j);
+	g_ptr_array_index(_discovery_due, i) = dj;
+	g_ptr_array_index(_discovery_due, j) = di;
+	dj->_heapindex = i;
+	di->_heapindex = j;
+}
+
+/// Move an entry toward the top of our heap until its parent is due no later than it is
+FSTATIC void
+_discovery_heap_siftup(guint index)	///<[in] Index of entry to move
+{
+	while (index > 0) {
+		guint	parent = (index-1)/2;
+		if (HEAPITEM(parent)->_nextdue <= HEAPITEM(index)->_nextdue) {
+			break;
+		}
+		_discovery_heap_swap(index, parent);
+		index = parent;
+	}
+}
+
+/// Move an entry toward the bottom of our heap until its children are due no earlier
+FSTATIC void
+_discovery_heap_siftdown(guint index)	///<[in] Index of entry to move
+{
+	for (;;) {
+		guint	left = 2*index+1;
+		guint	right = left+1;
+		guint	earliest = index;
+		if (left < _discovery_due->len
+		&&	HEAPITEM(left)->_nextdue < HEAPITEM(earliest)->_nextdue) {
+			earliest = left;
+		}
+		if (right < _discovery_due->len
+		&&	HEAPITEM(right)->_nextdue < HEAPITEM(earliest)->_nextdue) {
+			earliest = right;
+		}
+		if (earliest == index) {
+			break;
+		}
+		_discovery_heap_swap(index, earliest);
+		index = earliest;
+	}
+}
+
+/// Add a Discovery object to our heap of due times - it doesn't hold a reference.
+FSTATIC void
+_discovery_heap_insert(Discovery* self)	///<[in/out] Discovery object to schedule
+{
+	if (self->_heapindex >= 0) {
+		return;
+	}
+	if (NULL == _discovery_due) {
+		_discovery_due = g_ptr_array_new();
+	}
+	if (NULL == _discovery_timer) {
+		_discovery_timer = g_source_new(&_discovery_timerfuncs, sizeof(GSource));
+		g_source_attach(_discovery_timer, NULL);
+	}
+	self->_heapindex = _discovery_due->len;
+	g_ptr_array_add(_discovery_due, self);
+	_discovery_heap_siftup(self->_heapindex);
+	if (self->_heapindex == 0) {
+		_discovery_set_timer();
+	}
+}
+
+/// Remove a Discovery object from our heap of due times (if it's there)
+FSTATIC void
+_discovery_heap_remove(Discovery* self)	///<[in/out] Discovery object to unschedule
+{
+	guint	index;
+	guint	last;
+	if (self->_heapindex < 0 || NULL == _discovery_due) {
+		return;
+	}
+	index = self->_heapindex;
+	last = _discovery_due->len - 1;
+	if (index != last) {
+		_discovery_heap_swap(index, last);
+	}
+	g_ptr_array_remove_index(_discovery_due, last);
+	self->_heapindex = -1;
+	if (index < _discovery_due->len) {
+		// The entry we moved into the hole may belong above it or below it
+		Discovery*	moved = HEAPITEM(index);
+		_discovery_heap_siftup(index);
+		_discovery_heap_siftdown(moved->_heapindex);
+	}
+	if (index == 0) {
+		_discovery_set_timer();
+	}
+}
+
+/// Arrange for our timer to go off when the earliest discovery is due - unless we're
+/// already running as many as we're allowed to.  Then discovery_complete() wakes us up.
+FSTATIC void
+_discovery_set_timer(void)
+{
+	if (NULL == _discovery_timer) {
+		return;
+	}
+	if (NULL == _discovery_due || _discovery_due->len == 0
+	||	_discovery_running >= _discovery_maxrun()) {
+		g_source_set_ready_time(_discovery_timer, -1);
+		return;
+	}
+	g_source_set_ready_time(_discovery_timer, HEAPITEM(0)->_nextdue);
+}
+
+/// Return an integer configuration value - or 'defvalue' if it's missing or negative
+FSTATIC gint64
+_discovery_cfgint(const ConfigContext* cfg, const char * name, gint64 defvalue)
+{
+	gint64	value;
+	if (cfg->gettype(cfg, name) != CFG_INT64) {
+		return defvalue;
+	}
+	value = cfg->getint(cfg, name);
+	return (value >= 0 ? value : defvalue);
+}
+
+/// Return a floating point configuration value (an integer will do) - or 'defvalue'
+FSTATIC double
+_discovery_cfgdouble(const ConfigContext* cfg, const char * name, double defvalue)
+{
+	switch (cfg->gettype(cfg, name)) {
+		case CFG_FLOAT:
+			return cfg->getdouble(cfg, name);
+		case CFG_INT64:	// Zero is how you turn it off
+			return (double)cfg->getint(cfg, name);
+		default:
+			return defvalue;
+	}
+}
+
+/// Return how many asynchronous discoveries we can have running at once
+FSTATIC guint
+_discovery_maxrun(void)
+{
+	gint64	maxrun;
+	if (NULL == _discovery_due || _discovery_due->len == 0) {
+		return DISCOVERY_DEFAULT_MAXRUN;
+	}
+	// All our Discovery objects share the same (global) configuration
+	maxrun = _discovery_cfgint(HEAPITEM(0)->_config, CONFIGNAME_DISCMAXRUN, DISCOVERY_DEFAULT_MAXRUN);
+	return (maxrun > 0 && maxrun <= G_MAXUINT ? (guint)maxrun : DISCOVERY_DEFAULT_MAXRUN);
+}
+
+/// Return TRUE if this machine is too busy to start discovering things now.
+/// That's when its load average is high, or we already have lots of reliable output queued
+/// up for the CMA.
+FSTATIC gboolean
+_discovery_busy(Discovery* self)	///<[in] Discovery object which wants to run
+{
+	ConfigContext*	cfg = self->_config;
+	NetGSource*	io = self->_iosource;
+	gint64		maxoutq;
+	guint		outqlen;
+#ifdef HAVE_GETLOADAVG
+	double		maxload = _discovery_cfgdouble(cfg, CONFIGNAME_DISCMAXLOAD, DISCOVERY_DEFAULT_MAXLOAD);
+	double		loadavg;
+	long		ncpus = 1;
+
+#	if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus < 1) {
+		ncpus = 1;
+	}
+#	endif
+	if (maxload > 0.0 && getloadavg(&loadavg, 1) == 1 && loadavg > maxload * ncpus) {
+		DEBUGMSG1("%s.%d: load average %.2f is too high for %ld CPUs - postponing discovery"
+		,	__FUNCTION__, __LINE__, loadavg, ncpus);
+		return TRUE;
+	}
+#endif
+	maxoutq = _discovery_cfgint(cfg, CONFIGNAME_DISCMAXOUTQ, DISCOVERY_DEFAULT_MAXOUTQ);
+	if (maxoutq == 0 || NULL == io || NULL == io->_netio) {
+		return FALSE;
+	}
+	outqlen = io->_netio->outputqlen(io->_netio);
+	if (outqlen > maxoutq) {
+		DEBUGMSG1("%s.%d: %u FrameSets queued for output - postponing discovery"
+		,	__FUNCTION__, __LINE__, outqlen);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/// Postpone everything which is due now - by a bit longer each time in a row we do this.
+/// Discovery which others are waiting for (keepjson) isn't postponed - see _discovery_timer_dispatch().
+FSTATIC void
+_discovery_postpone(gint64 now)	///<[in] current (monotonic) time
+{
+	GPtrArray*	due = g_ptr_array_new();
+	double		jitter;
+	guint		j;
+
+	_discovery_backoff = (_discovery_backoff == 0 ? DISCOVERY_BACKOFF_MIN*ONESEC
+	:	MIN(2*_discovery_backoff, DISCOVERY_BACKOFF_MAX*ONESEC));
+	jitter = CLAMP(_discovery_cfgdouble(HEAPITEM(0)->_config, CONFIGNAME_DISCJITTER
+	,	DISCOVERY_DEFAULT_JITTER), 0.0, 0.5);
+	while (_discovery_due && _discovery_due->len > 0 && HEAPITEM(0)->_nextdue <= now) {
+		Discovery*	self = HEAPITEM(0);
+		_discovery_heap_remove(self);
+		g_ptr_array_add(due, self);
+	}
+	for (j=0; j < due->len; ++j) {
+		Discovery*	self = g_ptr_array_index(due, j);
+		if (!self->keepjson) {
+			// Spread them out a little, so they don't all come due at once again
+			self->_nextdue = now
+			+	(gint64)(_discovery_backoff * g_random_double_range(1.0, 1.0+jitter));
+		}
+		_discovery_heap_insert(self);
+	}
+	g_ptr_array_free(due, TRUE);
+}
+
+/// Return when this Discovery object should next run - given that it's running now
+FSTATIC gint64
+_discovery_nextdue(Discovery* self,	///<[in/out] Discovery object being run
+		   gint64 now,		///<[in] current (monotonic) time
+		   guint interval)	///<[in] its discovery interval (seconds)
+{
+	double	usecs = (double)interval * ONESEC;
+	double	jitter = CLAMP(_discovery_cfgdouble(self->_config, CONFIGNAME_DISCJITTER
+	,		DISCOVERY_DEFAULT_JITTER), 0.0, 0.5);
+	gint64	next;
+
+	if (!self->_phased) {
+		// Start repeating at a random point in our interval - so that machines which all
+		// started at once (or just have the same intervals) don't do it all together forever
+		self->_phased = TRUE;
+		return now + (gint64)(usecs * g_random_double_range(0.5, 1.5));
+	}
+	if (jitter > 0.0) {
+		usecs *= g_random_double_range(1.0 - jitter, 1.0 + jitter);
+	}
+	// Keep our phase - unless we've fallen so far behind that we'd have to catch up
+	next = self->_nextdue + (gint64)usecs;
+	return (next > now ? next : now + (gint64)usecs);
+}
+
+/// Return how long (uS) to wait before rerunning triggered discovery.
+/// It's at least a second - otherwise something which is still running would be due again
+/// the moment we put it back in our heap, and _discovery_timer_dispatch() would never finish.
+FSTATIC gint64
+_discovery_debounce(const Discovery* self)
+{
+	return ONESEC * MAX(_discovery_cfgint(self->_config, CONFIGNAME_DISCDEBOUNCE
+	,	DISCOVERY_DEFAULT_DEBOUNCE), 1);
+}
+
+/// Return TRUE if this is (still) the Discovery object registered under its instance name
 FSTATIC gboolean
-_discovery_rediscover(gpointer vself)	///<[in/out] Object to perform discovery on
+_discovery_isregistered(Discovery* self)
+{
+	return self->_instancename && _discovery_timers
+	&&	g_hash_table_lookup(_discovery_timers, self->_instancename) == self;
+}
+
+/// Run this (due) Discovery object, and schedule it to run again - if it repeats
+FSTATIC void
+_discovery_run(Discovery* self,	///<[in/out] Discovery object to run
+	       gint64 now)	///<[in] current (monotonic) time
+{
+	gboolean	keepgoing = TRUE;
+	guint		interval;
+
+	if (!_discovery_isregistered(self)) {
+		// Replaced or unregistered since we scheduled it
+		return;
+	}
+	if (self->_inprogress && self->_triggered) {
+		// What it's discovering now may be out of date already - run it again when it's done
+		self->_nextdue = now + _discovery_debounce(self);
+		_discovery_heap_insert(self);
+		return;
+	}
+	REF(self);	// discover() might unregister us...
+	if (self->_inprogress) {
+		DEBUGMSG1("%s.%d: discovery %s is still running - skipping this iteration."
+		,	__FUNCTION__, __LINE__, self->_instancename);
+	}else{
+		self->_triggered = FALSE;
+		keepgoing = self->discover(self);
+		if (self->_inprogress) {
+			++ _discovery_running;
+		}
+	}
+	interval = self->discoverintervalsecs(self);
+	if (self->_eventdriven) {
+		// Events tell us about changes - our periodic runs are just a safety net
+		guint64	stretch = MAX(_discovery_cfgint(self->_config, CONFIGNAME_DISCSTRETCH
+		,			DISCOVERY_DEFAULT_STRETCH), 1);
+		interval = (guint)MIN(interval * stretch, G_MAXUINT);
+	}
+	if (keepgoing && interval > 0 && _discovery_isregistered(self)) {
+		self->_nextdue = _discovery_nextdue(self, now, interval);
+		_discovery_heap_insert(self);
+	}
+	UNREF(self);
+}
+
+/// GSource dispatch function for our timer - start every discovery that's due (and that we can)
+FSTATIC gboolean
+_discovery_timer_dispatch(GSource* source,	///<[unused] Our timer
+			  GSourceFunc callback,	///<[unused] Unused
+			  gpointer userdata)	///<[unused] Unused
+{
+	gint64	now = g_get_monotonic_time();
+
+	(void)source;
+	(void)callback;
+	(void)userdata;
+	while (_discovery_due && _discovery_due->len > 0 && HEAPITEM(0)->_nextdue <= now) {
+		Discovery*	self = HEAPITEM(0);
+		if (_discovery_running >= _discovery_maxrun()) {
+			// discovery_complete() will get us going again
+			break;
+		}
+		// Whoever keeps our JSON (like nano_startupidle()) is waiting for it - maybe to
+		// even contact the CMA.  So being busy can't hold it up.
+		if (!self->keepjson) {
+			if (_discovery_busy(self)) {
+				_discovery_postpone(now);
+				break;
+			}
+			_discovery_backoff = 0;
+		}
+		_discovery_heap_remove(self);
+		_discovery_run(self, now);
+	}
+	_discovery_set_timer();
+	// Our timer stays around until discovery_unregister_all()
+	return TRUE;
+}
+
+/// Subclasses whose discover() function returns before discovery is finished (by setting
+/// _inprogress) call this function when it finishes.  That lets something else run in its place.
+void
+discovery_complete(Discovery* self)	///<[in/out] Discovery object which just finished
+{
+	g_return_if_fail(self != NULL);
+	if (!self->_inprogress) {
+		return;
+	}
+	self->_inprogress = FALSE;
+	if (_discovery_running > 0) {
+		-- _discovery_running;
+	}
+	_discovery_set_timer();
+}
+
+/// Rerun this Discovery object soon - because an event says that what it discovers has
+/// (probably) changed.  Events tend to come in bunches, so we wait a few seconds
+/// (@ref CONFIGNAME_DISCDEBOUNCE - at least one) and rerun it once for the whole bunch.
+void
+discovery_trigger(Discovery* self)	///<[in/out] Discovery object to rerun
 {
-	Discovery*	self = CASTTOCLASS(Discovery, vself);
+	gint64	due;
 
-	return self->discover(self);
+	g_return_if_fail(self != NULL);
+	if (NULL == self->discover || !_discovery_isregistered(self)) {
+		return;
+	}
+	due = g_get_monotonic_time() + _discovery_debounce(self);
+	self->_triggered = TRUE;
+	if (self->_heapindex >= 0 && self->_nextdue <= due) {
+		// It's due soon enough already
+		return;
+	}
+	DEBUGMSG2("%s.%d: discovery %s triggered", __FUNCTION__, __LINE__, self->_instancename);
+	_discovery_heap_remove(self);
+	self->_nextdue = due;
+	_discovery_heap_insert(self);
 }
 
 /// Discovery constructor.
@@ -155,7 +580,7 @@ discovery_new(const char *	instname,	///<[in] instance name
 	ret->baseclass._finalize	= _discovery_finalize;
 	ret->sendjson			= _discovery_sendjson;
 	ret->discover			= NULL;
-	ret->_timerid			= 0;
+	ret->_heapindex			= -1;
 	ret->_iosource			= iosource;
 	ret->_config			= context;
 	ret->starttime			= g_get_real_time();
@@ -165,28 +590,25 @@ discovery_new(const char *	instname,	///<[in] instance name
 
 
 /// Function for registering a discovery object with the discovery infrastructure.
-/// It runs the discover function, then schedules it for repeated discovery - if appropriate.
+/// It schedules the discover function to run as soon as our scheduler lets it, then
+/// repeatedly - if appropriate.
 /// It "knows" how often to rediscover things by calling the discoverintervalsecs() member
 /// function.  If that function returns a value greater than zero, then this discovery object
-/// will be "re-discovered" according to the number of seconds returned.
+/// will be "re-discovered" roughly every that many seconds.
 ///
 void
 discovery_register(Discovery* self)	///<[in/out] Discovery object to register
 {
-	gint	timeout;
 	if (NULL == _discovery_timers) {
 		_discovery_timers = g_hash_table_new_full(g_str_hash, g_str_equal
 		,	NULL, _discovery_ghash_destructor);
 		assert(_discovery_timers != NULL);
 	}
-	self->discover(self);
-	timeout = self->discoverintervalsecs(self);
-	if (timeout > 0) {
-		self->_timerid = g_timeout_add_seconds(timeout, _discovery_rediscover, self);
-	}
 	REF(self);
 	// _discovery_ghash_destructor will unref it if there's one already there...
 	g_hash_table_replace(_discovery_timers, self->instancename(self), self);
+	self->_nextdue = g_get_monotonic_time();
+	_discovery_heap_insert(self);
 }
 FSTATIC void
 discovery_unregister(const char* instance)
@@ -209,8 +631,53 @@ discovery_unregister_all(void)
 	}else{
 		DEBUGMSG1("Discovery timers were NULL");
 	}
+	// Anything still scheduled has a discovery agent running - but won't be run again
+	while (_discovery_due && _discovery_due->len > 0) {
+		_discovery_heap_remove(HEAPITEM(0));
+	}
+	if (_discovery_due) {
+		g_ptr_array_free(_discovery_due, TRUE);
+		_discovery_due = NULL;
+	}
+	if (_discovery_timer) {
+		g_source_destroy(_discovery_timer);
+		g_source_unref(_discovery_timer);
+		_discovery_timer = NULL;
+	}
+}
+/// Compute the JSON patch which turns 'oldjson' into 'newjson'.
+/// Strings stay strings - so the CMA gets back exactly the text we have (no NetAddr rewriting).
+/// @return malloced patch text - or NULL if either of them isn't valid JSON
+FSTATIC char *
+_discovery_jsonpatch(const char * oldjson,	///<[in] JSON we sent last time
+		     const char * newjson)	///<[in] JSON we want to send now
+{
+	ConfigContext*	oldcfg = configcontext_new_JSON_string_raw(oldjson);
+	ConfigContext*	newcfg;
+	char *		patch = NULL;
+
+	if (NULL == oldcfg) {
+		return NULL;
+	}
+	newcfg = configcontext_new_JSON_string_raw(newjson);
+	if (newcfg) {
+		patch = configcontext_diff(oldcfg, newcfg);
+		UNREF(newcfg);
+	}
+	UNREF(oldcfg);
+	return patch;
 }
-/// Send JSON that we discovered to the CMA - with some caching going on
+
+/// Send JSON that we discovered to the CMA - with some caching going on.
+/// We only remember the size and digest of what we sent last - enough to know not to send it again.
+/// We keep the text itself (in our ConfigContext, under our instance name) only if something
+/// needs it: 'keepjson' being set, or a base for JSON patches.  We only need that base if we're
+/// going to report again - because we repeat, because events trigger us, or because we already
+/// have reported more than once.
+/// Each report we send has a version number.  Once the CMA has told us it can handle them
+/// (@ref CONFIGNAME_JSONDELTA), we send a JSON patch against the previous version instead
+/// of the whole thing - when that's smaller.  If the CMA is missing our previous version,
+/// it asks for the whole thing (see discovery_sendfull()).
 FSTATIC void
 _discovery_sendjson(Discovery* self,	///< Our discovery object
 		    char * jsonout,	///< malloced JSON output - which we free (!)
@@ -218,49 +685,99 @@ _discovery_sendjson(Discovery* self,	///< Our discovery object
 {
 	FrameSet*	fs;
 	CstringFrame*	jsf;
+	CstringFrame*	namef;
 	IntFrame*	intf;
 	Frame*		fsf;
 	ConfigContext*	cfg = self->_config;
 	NetGSource*	io = self->_iosource;
 	NetAddr*	cma;
 	const char *	basename = self->instancename(self);
+	const char *	oldvalue;
+	char *		patch = NULL;
+	gchar *		digest;
+	gboolean	delta;
+	gboolean	baseline;
 
 	g_return_if_fail(cfg != NULL && io != NULL);
 
 	DEBUGMSG2("%s.%d: discovering %s: _sentyet == %d"
 	,	__FUNCTION__, __LINE__, basename, self->_sentyet);
+	digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, jsonout, jsonlen);
 	// Primitive caching - don't send what we've already sent.
-	if (self->_sentyet) {
-		const char *	oldvalue = cfg->getstring(cfg, basename);
-		if (oldvalue != NULL && strcmp(jsonout, oldvalue) == 0) {
+	if (self->_sentyet && !self->_sendfull) {
+		if (self->_lastdigest != NULL && jsonlen == self->_lastlen
+		&&	strcmp(digest, self->_lastdigest) == 0) {
 			DEBUGMSG2("%s.%d: %s sent this value - don't send again."
 			,	__FUNCTION__, __LINE__, basename);
+			g_free(digest);
 			g_free(jsonout);
 			return;
 		}
 		DEBUGMSG2("%s.%d: %s this value is different from previous value"
 		,	__FUNCTION__, __LINE__, basename);
 	}
+	cma = cfg->getaddr(cfg, CONFIGNAME_CMADISCOVER);
+	delta = (cma != NULL && cfg->gettype(cfg, CONFIGNAME_JSONDELTA) == CFG_BOOL
+	&&	cfg->getbool(cfg, CONFIGNAME_JSONDELTA));
+	oldvalue = cfg->getstring(cfg, basename);
+	if (delta && self->_sentyet && !self->_sendfull && oldvalue != NULL) {
+		patch = _discovery_jsonpatch(oldvalue, jsonout);
+		if (patch && strlen(patch) >= jsonlen) {
+			// Not worth it...
+			g_free(patch); patch = NULL;
+		}
+	}
 	DEBUGMSG2("%s.%d: Sending %"G_GSIZE_FORMAT" bytes of JSON text"
 	,	__FUNCTION__, __LINE__, jsonlen);
-	cfg->setstring(cfg, basename, jsonout);
-	cma = cfg->getaddr(cfg, CONFIGNAME_CMADISCOVER);
+	baseline = delta && (self->discoverintervalsecs(self) > 0 || self->_eventdriven
+	||	self->_sentyet);
+	// Either of these frees 'oldvalue'
+	if (baseline || self->keepjson) {
+		cfg->setstring(cfg, basename, jsonout);
+	}else if (oldvalue) {
+		cfg->delkey(cfg, basename);
+	}
+	oldvalue = NULL;
 	if (cma == NULL) {
 	        DEBUGMSG2("%s.%d: %s address is unknown - skipping send"
 		,	__FUNCTION__, __LINE__, CONFIGNAME_CMADISCOVER);
+		g_free(digest);
 		g_free(jsonout);
 		return;
 	}
+	g_free(self->_lastdigest);
+	self->_lastdigest = digest;
+	self->_lastlen = jsonlen;
 	self->_sentyet = TRUE;
+	self->_sendfull = FALSE;
+	++ self->_jsonversion;
 
 	fs = frameset_new(FRAMESETTYPE_JSDISCOVERY);
 	intf = intframe_new(FRAMETYPE_WALLCLOCK, 8);
 	intf->setint(intf, self->starttime);
 	frameset_append_frame(fs, &intf->baseclass);
 	UNREF2(intf);
-	jsf = cstringframe_new(FRAMETYPE_JSDISCOVER, 0);
-	fsf = &jsf->baseclass;	// base class object of jsf
-	fsf->setvalue(fsf, jsonout, jsonlen+1, frame_default_valuefinalize); // jsonlen is strlen(jsonout)
+	namef = cstringframe_new(FRAMETYPE_DISCNAME, 0);
+	namef->baseclass.setvalue(&namef->baseclass, g_strdup(basename), strlen(basename)+1
+	,	frame_default_valuefinalize);
+	frameset_append_frame(fs, &namef->baseclass);
+	UNREF2(namef);
+	intf = intframe_new(FRAMETYPE_DISCVERSION, 8);
+	intf->setint(intf, self->_jsonversion);
+	frameset_append_frame(fs, &intf->baseclass);
+	UNREF2(intf);
+	if (patch) {
+		DEBUGMSG2("%s.%d: Sending a %"G_GSIZE_FORMAT" byte JSON patch instead of %"
+		G_GSIZE_FORMAT" bytes", __FUNCTION__, __LINE__, strlen(patch), jsonlen);
+		jsf = cstringframe_new(FRAMETYPE_JSPATCH, 0);
+		fsf = &jsf->baseclass;	// base class object of jsf
+		fsf->setvalue(fsf, patch, strlen(patch)+1, frame_default_valuefinalize);
+		g_free(jsonout);
+	}else{
+		jsf = cstringframe_new(FRAMETYPE_JSDISCOVER, 0);
+		fsf = &jsf->baseclass;	// base class object of jsf
+		fsf->setvalue(fsf, jsonout, jsonlen+1, frame_default_valuefinalize); // jsonlen is strlen(jsonout)
+	}
 	frameset_append_frame(fs, fsf);
 	DEBUGMSG2("%s.%d: Sending a %"G_GSIZE_FORMAT" bytes JSON frameset"
 	,	__FUNCTION__, __LINE__, jsonlen);
@@ -270,4 +787,36 @@ _discovery_sendjson(Discovery* self,	///< Our discovery object
 	UNREF(fs);
 }
 
+/// The CMA doesn't have the version our patches are based on - send it everything next time.
+/// If we still have what we sent last, we send it again right away.
+/// Otherwise we rediscover it - as soon as our scheduler lets us.
+void
+discovery_sendfull(const char * instance)	///<[in] discovery instance name
+{
+	gpointer	found = NULL;
+	Discovery*	self;
+	ConfigContext*	cfg;
+	const char *	lastvalue;
+
+	if (_discovery_timers) {
+		found = g_hash_table_lookup(_discovery_timers, instance);
+	}
+	if (NULL == found) {
+		g_warning("%s.%d: CMA requested full report for unknown discovery instance %s"
+		,	__FUNCTION__, __LINE__, instance);
+		return;
+	}
+	self = CASTTOCLASS(Discovery, found);
+	self->_sendfull = TRUE;
+	cfg = self->_config;
+	lastvalue = cfg->getstring(cfg, self->instancename(self));
+	if (self->_sentyet && lastvalue) {
+		self->sendjson(self, g_strdup(lastvalue), strlen(lastvalue));
+	}else if (self->discover) {
+		_discovery_heap_remove(self);
+		self->_nextdue = g_get_monotonic_time();
+		_discovery_heap_insert(self);
+	}
+}
+
 ///@}
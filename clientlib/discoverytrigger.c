@@ -0,0 +1,536 @@
+/**
+ * @file
+ * @brief Kernel events which trigger rerunning discovery - rtnetlink and inotify.
+ * @details We have (at most) one rtnetlink socket and one inotify file descriptor, each with a
+ * GSource of its own.  Everyone's subscriptions share them.
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <projectcommon.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#	include <unistd.h>
+#endif
+#include <discoverytrigger.h>
+#ifdef __linux__
+#	include <sys/socket.h>
+#	include <sys/inotify.h>
+#	include <linux/netlink.h>
+#	include <linux/rtnetlink.h>
+#	ifndef SOL_NETLINK
+#		define SOL_NETLINK	270
+#	endif
+#endif
+
+///@{
+/// @ingroup DiscoveryClass
+
+#define	TRIGGER_LINK		0x01	///< Interface changes
+#define	TRIGGER_ADDR		0x02	///< Address changes
+#define	TRIGGER_ROUTE		0x04	///< Route changes
+#define	TRIGGER_NETLINK		(TRIGGER_LINK|TRIGGER_ADDR|TRIGGER_ROUTE)
+#define	TRIGGER_BUFSIZE		8192
+#define	TRIGGER_REWATCH_SECS	5	///< How often to retry watching directories which went away
+
+/// One Discovery object's subscription to one trigger
+typedef struct _TriggerSub {
+	Discovery*	discovery;	///< Who to trigger (we don't hold a reference)
+	guint		nlmask;		///< TRIGGER_* netlink events (netlink subscriptions only)
+	int		wd;		///< inotify watch descriptor - -1 for netlink subscriptions
+					///< (and for directories we've lost track of)
+	char *		dirname;	///< Directory we watch - NULL for netlink subscriptions
+	char *		name;		///< Name within the watched directory - NULL for anything
+} TriggerSub;
+
+/// GSource watching a file descriptor we read events from
+typedef struct _TriggerSource {
+	GSource		baseclass;	///< Base GSource
+	GPollFD		gfd;		///< File descriptor we read events from
+	void		(*readevents)(int fd);	///< Read (and act on) all available events
+} TriggerSource;
+
+#ifdef __linux__
+static GSList*		_trigger_subs = NULL;		///< All our TriggerSubs
+static TriggerSource*	_trigger_netlink = NULL;	///< Our rtnetlink socket
+static TriggerSource*	_trigger_inotify = NULL;	///< Our inotify file descriptor
+static guint		_trigger_nlgroups = 0;		///< TRIGGER_* events we've joined groups for
+static guint		_trigger_rewatch_id = 0;	///< Timer for retrying lost directories
+
+FSTATIC gboolean	_trigger_source_prepare(GSource* source, gint* timeout);
+FSTATIC gboolean	_trigger_source_check(GSource* source);
+FSTATIC gboolean	_trigger_source_dispatch(GSource* source, GSourceFunc callback, gpointer user_data);
+FSTATIC void		_trigger_source_finalize(GSource* source);
+FSTATIC TriggerSource*	_trigger_source_new(int fd, void (*readevents)(int fd));
+FSTATIC void		_trigger_fire(gboolean netlink, guint nlmask, int wd, const char * name);
+FSTATIC void		_trigger_netlink_read(int fd);
+FSTATIC void		_trigger_inotify_read(int fd);
+FSTATIC gboolean	_trigger_netlink_join(guint nlmask);
+FSTATIC int		_trigger_inotify_watch(const char * dirname);
+FSTATIC gboolean	_trigger_inotify_rewatch(void);
+FSTATIC gboolean	_trigger_inotify_rewatch_timer(gpointer unused);
+FSTATIC void		_trigger_inotify_lost(int wd, gboolean moved);
+FSTATIC void		_trigger_sub_free(TriggerSub* sub);
+
+static GSourceFuncs	_trigger_source_funcs = {
+	_trigger_source_prepare,
+	_trigger_source_check,
+	_trigger_source_dispatch,
+	_trigger_source_finalize,
+	NULL,
+	NULL
+};
+
+/// We only wait for our file descriptor
+FSTATIC gboolean
+_trigger_source_prepare(GSource* source, gint* timeout)
+{
+	(void)source;
+	*timeout = -1;
+	return FALSE;
+}
+
+/// Are there events to read?
+FSTATIC gboolean
+_trigger_source_check(GSource* source)
+{
+	TriggerSource*	self = (TriggerSource*)source;
+	return (self->gfd.revents & (G_IO_IN|G_IO_ERR)) != 0;
+}
+
+/// Read and act on our events
+FSTATIC gboolean
+_trigger_source_dispatch(GSource* source, GSourceFunc callback, gpointer user_data)
+{
+	TriggerSource*	self = (TriggerSource*)source;
+	(void)callback;
+	(void)user_data;
+	self->readevents(self->gfd.fd);
+	return TRUE;
+}
+
+/// Close our file descriptor as we go away
+FSTATIC void
+_trigger_source_finalize(GSource* source)
+{
+	TriggerSource*	self = (TriggerSource*)source;
+	if (self->gfd.fd >= 0) {
+		close(self->gfd.fd);
+		self->gfd.fd = -1;
+	}
+}
+
+/// Create (and attach) a GSource reading events from this file descriptor
+FSTATIC TriggerSource*
+_trigger_source_new(int fd, void (*readevents)(int fd))
+{
+	TriggerSource*	self = (TriggerSource*)g_source_new(&_trigger_source_funcs, sizeof(TriggerSource));
+	self->gfd.fd = fd;
+	self->gfd.events = G_IO_IN|G_IO_ERR;
+	self->readevents = readevents;
+	g_source_add_poll(&self->baseclass, &self->gfd);
+	g_source_set_priority(&self->baseclass, G_PRIORITY_LOW);
+	g_source_attach(&self->baseclass, NULL);
+	return self;
+}
+
+/// Trigger everyone subscribed to these events.
+/// A negative 'wd' means we lost inotify events - so we trigger all our inotify subscribers.
+FSTATIC void
+_trigger_fire(gboolean netlink,		///<[in] TRUE for netlink events, FALSE for inotify
+	      guint nlmask,		///<[in] TRIGGER_* netlink events which happened
+	      int wd,			///<[in] inotify watch descriptor
+	      const char * name)	///<[in] name the inotify event was for (or NULL)
+{
+	GSList*	this;
+
+	for (this = _trigger_subs; this; this = this->next) {
+		TriggerSub*	sub = (TriggerSub*)this->data;
+		if (netlink) {
+			if (sub->wd >= 0 || (sub->nlmask & nlmask) == 0) {
+				continue;
+			}
+		}else if (sub->wd < 0 || (wd >= 0 && (sub->wd != wd
+		||	(name && sub->name && strcmp(name, sub->name) != 0)))) {
+			continue;
+		}
+		discovery_trigger(sub->discovery);
+	}
+}
+
+/// Read everything our rtnetlink socket has for us - and trigger whoever it concerns
+FSTATIC void
+_trigger_netlink_read(int fd)
+{
+	union {
+		struct nlmsghdr	hdr;
+		char		buf[TRIGGER_BUFSIZE];
+	}		msgs;
+	guint		events = 0;
+
+	for (;;) {
+		struct sockaddr_nl	sender;
+		socklen_t		senderlen = sizeof(sender);
+		ssize_t	len = recvfrom(fd, msgs.buf, sizeof(msgs.buf), MSG_DONTWAIT
+		,			(struct sockaddr*)&sender, &senderlen);
+		gsize	offset = 0;
+		if (len < 0) {
+			if (ENOBUFS == errno) {
+				// We lost some - assume the worst
+				events |= TRIGGER_NETLINK;
+				continue;
+			}
+			if (EINTR == errno) {
+				continue;
+			}
+			break;
+		}
+		if (0 == len) {
+			break;
+		}
+		// Anyone local can send us netlink messages - only the kernel's count
+		if (senderlen < sizeof(sender) || AF_NETLINK != sender.nl_family || 0 != sender.nl_pid) {
+			continue;
+		}
+		while (offset + sizeof(struct nlmsghdr) <= (gsize)len) {
+			const struct nlmsghdr*	nh = (const struct nlmsghdr*)(msgs.buf + offset);
+			if (nh->nlmsg_len < sizeof(struct nlmsghdr) || offset + nh->nlmsg_len > (gsize)len) {
+				break;
+			}
+			switch (nh->nlmsg_type) {
+				case RTM_NEWLINK: case RTM_DELLINK:
+					events |= TRIGGER_LINK;
+					break;
+				case RTM_NEWADDR: case RTM_DELADDR:
+					events |= TRIGGER_ADDR;
+					break;
+				case RTM_NEWROUTE: case RTM_DELROUTE:
+					events |= TRIGGER_ROUTE;
+					break;
+				default:
+					break;
+			}
+			offset += NLMSG_ALIGN(nh->nlmsg_len);
+		}
+	}
+	if (events) {
+		_trigger_fire(TRUE, events, -1, NULL);
+	}
+}
+
+/// Read everything our inotify descriptor has for us - and trigger whoever it concerns
+FSTATIC void
+_trigger_inotify_read(int fd)
+{
+	union {
+		struct inotify_event	ev;
+		char			buf[TRIGGER_BUFSIZE];
+	}		events;
+
+	for (;;) {
+		ssize_t	len = read(fd, events.buf, sizeof(events.buf));
+		gsize	offset = 0;
+		if (len < 0 && EINTR == errno) {
+			continue;
+		}
+		if (len <= 0) {
+			break;
+		}
+		while (offset + sizeof(struct inotify_event) <= (gsize)len) {
+			const struct inotify_event*	ev
+			=	(const struct inotify_event*)(events.buf + offset);
+			if (ev->mask & IN_Q_OVERFLOW) {
+				_trigger_fire(FALSE, 0, -1, NULL);
+			}else{
+				_trigger_fire(FALSE, 0, ev->wd, ev->len > 0 ? ev->name : NULL);
+				if (ev->mask & (IN_DELETE_SELF|IN_MOVE_SELF)) {
+					_trigger_inotify_lost(ev->wd, (ev->mask & IN_MOVE_SELF) != 0);
+				}
+			}
+			offset += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+}
+
+/// Make sure our rtnetlink socket hears about these events
+FSTATIC gboolean
+_trigger_netlink_join(guint nlmask)	///<[in] TRIGGER_* events we want to hear about
+{
+	static const struct {
+		guint	mask;
+		int	group;
+	} groups[] = {
+		{TRIGGER_LINK,	RTNLGRP_LINK},
+		{TRIGGER_ADDR,	RTNLGRP_IPV4_IFADDR},
+		{TRIGGER_ADDR,	RTNLGRP_IPV6_IFADDR},
+		{TRIGGER_ROUTE,	RTNLGRP_IPV4_ROUTE},
+		{TRIGGER_ROUTE,	RTNLGRP_IPV6_ROUTE},
+	};
+	guint		j;
+
+	if (NULL == _trigger_netlink) {
+		struct sockaddr_nl	addr;
+		int			fd = socket(AF_NETLINK, SOCK_RAW|SOCK_NONBLOCK|SOCK_CLOEXEC
+		,				    NETLINK_ROUTE);
+		if (fd < 0) {
+			g_warning("%s.%d: Cannot create rtnetlink socket: %s", __FUNCTION__, __LINE__
+			,	g_strerror(errno));
+			return FALSE;
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.nl_family = AF_NETLINK;
+		if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+			g_warning("%s.%d: Cannot bind rtnetlink socket: %s", __FUNCTION__, __LINE__
+			,	g_strerror(errno));
+			close(fd);
+			return FALSE;
+		}
+		_trigger_netlink = _trigger_source_new(fd, _trigger_netlink_read);
+	}
+	for (j=0; j < DIMOF(groups); ++j) {
+		if ((nlmask & groups[j].mask & ~_trigger_nlgroups) == 0) {
+			continue;
+		}
+		if (setsockopt(_trigger_netlink->gfd.fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP
+		,	&groups[j].group, sizeof(groups[j].group)) < 0) {
+			g_warning("%s.%d: Cannot join rtnetlink group %d: %s", __FUNCTION__, __LINE__
+			,	groups[j].group, g_strerror(errno));
+			return FALSE;
+		}
+	}
+	_trigger_nlgroups |= nlmask;
+	return TRUE;
+}
+
+/// Watch this directory with inotify
+/// @return its watch descriptor - or -1 if we can't watch it
+FSTATIC int
+_trigger_inotify_watch(const char * dirname)	///<[in] directory to watch
+{
+	int	wd;
+
+	if (NULL == _trigger_inotify) {
+		int	fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+		if (fd < 0) {
+			g_warning("%s.%d: Cannot initialize inotify: %s", __FUNCTION__, __LINE__
+			,	g_strerror(errno));
+			return -1;
+		}
+		_trigger_inotify = _trigger_source_new(fd, _trigger_inotify_read);
+	}
+	wd = inotify_add_watch(_trigger_inotify->gfd.fd, dirname
+	,	IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ATTRIB
+	|	IN_DELETE_SELF|IN_MOVE_SELF);
+	// Lots of our default triggers don't exist on any given machine - so we don't complain
+	return wd;
+}
+
+/// Try and watch all the directories we've lost track of again
+/// @return TRUE if some of them still can't be watched
+FSTATIC gboolean
+_trigger_inotify_rewatch(void)
+{
+	GSList*		this;
+	gboolean	stilllost = FALSE;
+
+	for (this = _trigger_subs; this; this = this->next) {
+		TriggerSub*	sub = (TriggerSub*)this->data;
+		if (NULL == sub->dirname || sub->wd >= 0) {
+			continue;
+		}
+		sub->wd = _trigger_inotify_watch(sub->dirname);
+		if (sub->wd < 0) {
+			stilllost = TRUE;
+		}else{
+			// We can't tell what changed while we weren't watching
+			discovery_trigger(sub->discovery);
+		}
+	}
+	return stilllost;
+}
+
+/// Timer function for retrying directories we've lost track of - until we find them all
+FSTATIC gboolean
+_trigger_inotify_rewatch_timer(gpointer unused)
+{
+	(void)unused;
+	if (_trigger_inotify_rewatch()) {
+		return TRUE;
+	}
+	_trigger_rewatch_id = 0;
+	return FALSE;
+}
+
+/// A directory we watch has been deleted or moved (like when /etc/pam.d is replaced).
+/// Its watch no longer tells us about what has its name now - so we watch that instead.
+FSTATIC void
+_trigger_inotify_lost(int wd,		///<[in] watch descriptor of the directory which went away
+		      gboolean moved)	///<[in] TRUE if it moved (its watch is still there)
+{
+	GSList*	this;
+
+	for (this = _trigger_subs; this; this = this->next) {
+		TriggerSub*	sub = (TriggerSub*)this->data;
+		if (sub->wd == wd) {
+			sub->wd = -1;
+		}
+	}
+	if (moved) {
+		// The kernel removes the watches for deleted directories by itself
+		inotify_rm_watch(_trigger_inotify->gfd.fd, wd);
+	}
+	if (_trigger_inotify_rewatch() && 0 == _trigger_rewatch_id) {
+		_trigger_rewatch_id = g_timeout_add_seconds(TRIGGER_REWATCH_SECS
+		,	_trigger_inotify_rewatch_timer, NULL);
+	}
+}
+
+/// Free a TriggerSub - and its inotify watch if no one else uses it
+FSTATIC void
+_trigger_sub_free(TriggerSub* sub)
+{
+	GSList*	this;
+
+	if (sub->wd >= 0 && _trigger_inotify) {
+		gboolean	shared = FALSE;
+		for (this = _trigger_subs; this; this = this->next) {
+			if (((TriggerSub*)this->data)->wd == sub->wd) {
+				shared = TRUE;
+				break;
+			}
+		}
+		if (!shared) {
+			inotify_rm_watch(_trigger_inotify->gfd.fd, sub->wd);
+		}
+	}
+	g_free(sub->dirname);
+	g_free(sub->name);
+	g_free(sub);
+}
+#endif /* __linux__ */
+
+/// Subscribe this Discovery object to a trigger (see discoverytrigger.h for what they look like)
+/// @return TRUE if we'll be watching for it
+gboolean
+discoverytrigger_subscribe(Discovery* discovery,	///<[in/out] Discovery object to trigger
+			   const char * trigger)	///<[in] What to trigger it
+{
+#ifdef __linux__
+	TriggerSub*	sub;
+	guint		nlmask = 0;
+	int		wd = -1;
+	char *		dirname = NULL;
+	char *		name = NULL;
+
+	g_return_val_if_fail(discovery != NULL && trigger != NULL, FALSE);
+	if (strcmp(trigger, "netlink") == 0) {
+		nlmask = TRIGGER_NETLINK;
+	}else if (strcmp(trigger, "netlink:link") == 0) {
+		nlmask = TRIGGER_LINK;
+	}else if (strcmp(trigger, "netlink:addr") == 0) {
+		nlmask = TRIGGER_ADDR;
+	}else if (strcmp(trigger, "netlink:route") == 0) {
+		nlmask = TRIGGER_ROUTE;
+	}else if (!g_path_is_absolute(trigger)) {
+		g_warning("%s.%d: Unknown discovery trigger [%s]", __FUNCTION__, __LINE__, trigger);
+		return FALSE;
+	}
+	if (nlmask) {
+		if (!_trigger_netlink_join(nlmask)) {
+			return FALSE;
+		}
+	}else if (g_file_test(trigger, G_FILE_TEST_IS_DIR)) {
+		dirname = g_strdup(trigger);
+		wd = _trigger_inotify_watch(dirname);
+	}else{
+		// Watch its directory - so we see it being replaced (renamed over), not just changed
+		dirname = g_path_get_dirname(trigger);
+		wd = _trigger_inotify_watch(dirname);
+		name = g_path_get_basename(trigger);
+	}
+	if (0 == nlmask && wd < 0) {
+		g_free(dirname);
+		g_free(name);
+		return FALSE;
+	}
+	sub = g_new0(TriggerSub, 1);
+	sub->discovery = discovery;
+	sub->nlmask = nlmask;
+	sub->wd = wd;
+	sub->dirname = dirname;
+	sub->name = name;
+	_trigger_subs = g_slist_prepend(_trigger_subs, sub);
+	discovery->_eventdriven = TRUE;
+	return TRUE;
+#else
+	(void)discovery;
+	(void)trigger;
+	return FALSE;
+#endif
+}
+
+/// Cancel all of this Discovery object's subscriptions
+void
+discoverytrigger_unsubscribe(Discovery* discovery)	///<[in/out] Discovery object going away
+{
+#ifdef __linux__
+	GSList*	this = _trigger_subs;
+
+	while (this) {
+		GSList*		next = this->next;
+		TriggerSub*	sub = (TriggerSub*)this->data;
+		if (sub->discovery == discovery) {
+			_trigger_subs = g_slist_delete_link(_trigger_subs, this);
+			_trigger_sub_free(sub);
+		}
+		this = next;
+	}
+#endif
+	discovery->_eventdriven = FALSE;
+}
+
+/// Cancel everyone's subscriptions and close our file descriptors - in preparation for shutting down
+void
+discoverytrigger_shutdown(void)
+{
+#ifdef __linux__
+	while (_trigger_subs) {
+		TriggerSub*	sub = (TriggerSub*)_trigger_subs->data;
+		_trigger_subs = g_slist_delete_link(_trigger_subs, _trigger_subs);
+		sub->discovery->_eventdriven = FALSE;
+		_trigger_sub_free(sub);
+	}
+	if (_trigger_rewatch_id) {
+		g_source_remove(_trigger_rewatch_id);
+		_trigger_rewatch_id = 0;
+	}
+	if (_trigger_netlink) {
+		g_source_destroy(&_trigger_netlink->baseclass);
+		g_source_unref(&_trigger_netlink->baseclass);
+		_trigger_netlink = NULL;
+		_trigger_nlgroups = 0;
+	}
+	if (_trigger_inotify) {
+		g_source_destroy(&_trigger_inotify->baseclass);
+		g_source_unref(&_trigger_inotify->baseclass);
+		_trigger_inotify = NULL;
+	}
+#endif
+}
+///@}
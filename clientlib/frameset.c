@@ -170,6 +170,7 @@ frameset_construct_packet(FrameSet* fs,		///< FrameSet for which we're creating
 	gsize		pktsize;
 	const gsize	fssize = FRAMESET_INITSIZE;	// "frameset" overhead size
 	guint32		computed_size;
+	SignFrame*	aeadsig = NULL;
 	DEBUGMSG3("%s.%d: constructing packet: sign: %p crypt: %p", __FUNCTION__, __LINE__, sigframe, cryptframe);
 	g_return_if_fail(NULL != fs);
 	g_return_if_fail(NULL != sigframe);
@@ -245,8 +246,20 @@ frameset_construct_packet(FrameSet* fs,		///< FrameSet for which we're creating
 		DEBUGMSG3("%s.%d: prepending cryptframe: %p", __FUNCTION__, __LINE__, cryptframe);
 		frameset_prepend_frame(fs, &cryptframe->baseclass);
 	}
+	if (NULL != cryptframe && cryptframe->baseclass.type == FRAMETYPE_CRYPTCURVE25519
+	&&	signframe_aead_signatures()) {
+		// Authenticated encryption already protects everything after the encryption frame,
+		// so a digest over those same bytes would just burn CPU.
+		aeadsig = signframe_aead_new(0);
+		if (aeadsig) {
+			sigframe = aeadsig;
+		}
+	}
 	// "sigframe" cannot be NULL (see check above)
 	frameset_prepend_frame(fs, CASTTOCLASS(Frame, sigframe));
+	if (aeadsig) {
+		UNREF2(aeadsig);
+	}
 
 	// Reverse list...
 	fs->framelist = g_slist_reverse(fs->framelist);
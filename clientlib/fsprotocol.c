@@ -27,6 +27,8 @@
 #include <framesettypes.h>
 #include <frametypes.h>
 #include <seqnoframe.h>
+#include <intframe.h>
+#include <misc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -46,6 +48,7 @@ FSTATIC FsProtoElem*	_fsprotocol_find(FsProtocol* self, guint16 qid, const NetAd
 FSTATIC FsProtoElem*	_fsprotocol_findbypkt(FsProtocol* self, NetAddr*, FrameSet*);
 FSTATIC gboolean	_fsprotocol_iready(FsProtocol*);
 FSTATIC gboolean	_fsprotocol_outputpending(FsProtocol*);
+FSTATIC guint		_fsprotocol_outputqlen(FsProtocol*);
 FSTATIC FrameSet*	_fsprotocol_read(FsProtocol*, NetAddr**);
 FSTATIC void		_fsprotocol_receive(FsProtocol*, NetAddr*, FrameSet*);
 FSTATIC gboolean	_fsprotocol_send1(FsProtocol*, FrameSet*, guint16 qid, NetAddr*);
@@ -60,6 +63,14 @@ FSTATIC void		_fsprotocol_fspe_closeconn(FsProtoElem* self);
 FSTATIC void		_fsprotocol_fspe_reinit(FsProtoElem* self);
 FSTATIC gboolean	_fsprotocol_canclose_immediately(gpointer unused_key, gpointer v_fspe, gpointer unused_user);
 FSTATIC void		_fsprotocol_log_conn(FsProtocol* self, guint16 qid, NetAddr* destaddr);
+FSTATIC gboolean	_fsprotocol_enq(FsProtoElem* fspe, FrameSet* fs);
+FSTATIC gsize		_fsprotocol_fssize(FrameSet* fs);
+FSTATIC gboolean	_fsprotocol_needsfragmenting(FsProtocol* self, FrameSet* fs);
+FSTATIC GSList*		_fsprotocol_fragment(FsProtocol* self, FrameSet* fs);
+FSTATIC gboolean	_fsprotocol_enqfragments(FsProtoElem* fspe, FrameSet* fs);
+FSTATIC FrameSet*	_fsprotocol_addfragment(FsProtoElem* fspe, FrameSet* fs);
+FSTATIC FrameSet*	_fsprotocol_reassemble(FsProtoElem* fspe, FrameSet* lastfrag);
+FSTATIC void		_fsprotocol_fragdiscard(FsProtoElem* fspe);
 
 typedef enum _FsProtoInput	FsProtoInput;
 
@@ -614,6 +625,10 @@ _fsprotocol_addconn(FsProtocol*self	///< typical FsProtocol 'self' object
 		ret->shutdown_complete = FALSE;
 		ret->is_encrypted = FALSE;
 		ret->peer_identity = NULL;
+		ret->fragbuf = NULL;
+		ret->fragtotal = 0;
+		ret->fragrecvd = 0;
+		ret->fragdeadline = 0;
 		ret->hist_next = 0;
 		memset(ret->fsa_states, 0, sizeof(ret->fsa_states));
 		memset(ret->fsa_inputs, 0, sizeof(ret->fsa_inputs));
@@ -745,6 +760,7 @@ _fsprotocol_fspe_reinit(FsProtoElem* self)
 	}
 	self->inq->_nextseqno = 1;
 	self->inq->_sessionid = 0;
+	_fsprotocol_fragdiscard(self);
 
 	if (self->lastacksent) {
 		UNREF2(self->lastacksent);
@@ -801,6 +817,7 @@ fsprotocol_new(guint objsize		///< Size of object to be constructed
 	self->addconn =		_fsprotocol_addconn;
 	self->iready =		_fsprotocol_iready;
 	self->outputpending =	_fsprotocol_outputpending;
+	self->outputqlen =	_fsprotocol_outputqlen;
 	self->read =		_fsprotocol_read;
 	self->receive =		_fsprotocol_receive;
 	self->send1 =		_fsprotocol_send1;
@@ -826,6 +843,13 @@ fsprotocol_new(guint objsize		///< Size of object to be constructed
 	self->window_size = FSPROTO_WINDOWSIZE;
 	self->rexmit_interval = FSPROTO_REXMITINTERVAL;
 	self->acktimeout = FSPROTO_ACKTIMEOUTINT;
+	self->reassembling = NULL;
+	self->fragthreshold = FSPROTO_FRAGTHRESHOLD;
+	self->maxpktsize = FSPROTO_MAXPKTSIZE;
+	self->fragsize = FSPROTO_FRAGSIZE;
+	self->fragmemlimit = FSPROTO_FRAGMEMLIMIT;
+	self->fragmemused = 0;
+	self->fragtimeout = FSPROTO_FRAGTIMEOUT;
 
 	if (rexmit_timer_uS == 0) {
 		rexmit_timer_uS = self->rexmit_interval/2;
@@ -867,6 +891,10 @@ _fsprotocol_finalize(AssimObj* aself)	///< FsProtocol object to finalize
 	g_queue_free(self->ipend);		// No additional 'ref's were taken for this list either
 	self->ipend = NULL;
 
+	// Closing our endpoints discarded any FrameSets being reassembled
+	g_list_free(self->reassembling);
+	self->reassembling = NULL;
+
 
 	// Lastly free our base storage
 	FREECLASSOBJ(self);
@@ -937,6 +965,21 @@ _fsprotocol_outputpending(FsProtocol* self)	///< Our object
 	return self->unacked != NULL;
 }
 
+/// Return how many FrameSets are in all our output queues (sent but unACKed, or not yet sent)
+FSTATIC guint
+_fsprotocol_outputqlen(FsProtocol* self)	///< Our object
+{
+	GList*	pending;
+	guint	qlen = 0;
+
+	// Every FsProtoElem with anything in its output queue is on our unacked list
+	for (pending = self->unacked; NULL != pending; pending = pending->next) {
+		FsProtoElem*	fspe = (FsProtoElem*)pending->data;
+		qlen += g_queue_get_length(fspe->outq->_q);
+	}
+	return qlen;
+}
+
 /// Read the next available FrameSet from any of our sources
 FSTATIC FrameSet*
 _fsprotocol_read(FsProtocol* self	///< Our object - our very self!
@@ -1002,6 +1045,16 @@ _fsprotocol_read(FsProtocol* self	///< Our object - our very self!
 				fspe->inq->isready = TRUE;
 				g_queue_push_tail(self->ipend, fspe);
 			}
+			if (ret && FRAMESETTYPE_FRAGMENT == ret->fstype) {
+				ret = _fsprotocol_addfragment(fspe, ret);
+				if (NULL == ret) {
+					// Not a whole FrameSet yet - see if anything else is ready
+					UNREF(*fromaddr);
+					TRYXMIT(fspe);
+					AUDITIREADY(self);
+					return _fsprotocol_read(self, fromaddr);
+				}
+			}
 			if (ret && FRAMESETTYPE_CONNSHUT == ret->fstype) {
 				_fsprotocol_fsa(fspe, FSPROTO_RCVSHUTDOWN, ret);
 			}
@@ -1214,6 +1267,26 @@ _fsprotocol_send1(FsProtocol* self	///< Our object
 	DEBUGMSG3("%s.%d: calling fsprotocol_fsa(FSPROTO_REQSEND)", __FUNCTION__, __LINE__);
 	_fsprotocol_fsa(fspe, FSPROTO_REQSEND, NULL);
 
+	if (_fsprotocol_needsfragmenting(self, fs)) {
+		ret = _fsprotocol_enqfragments(fspe, fs);
+	}else{
+		ret = _fsprotocol_enq(fspe, fs);
+	}
+	DEBUGMSG4("%s.%d: calling TRYXMIT()", __FUNCTION__, __LINE__);
+	TRYXMIT(fspe);
+	AUDITFSPE(fspe);
+	DEBUGMSG3("%s.%d: returning %s", __FUNCTION__, __LINE__, (ret ? "TRUE" : "FALSE"));
+	return ret;
+}
+
+/// Put a FrameSet on the output queue of an FsProtoElem - starting the retransmit clock if need be
+FSTATIC gboolean
+_fsprotocol_enq(FsProtoElem* fspe	///< The FrameSet protocol element to operate on
+,		FrameSet* fs)		///< FrameSet to enqueue
+{
+	FsProtocol*	self = fspe->parent;
+	gboolean	ret;
+
 	if (fspe->outq->_q->length == 0) {
 		guint64 now = g_get_monotonic_time();
 		///@todo: This might be slow if we send a lot of packets to an endpoint
@@ -1225,12 +1298,320 @@ _fsprotocol_send1(FsProtocol* self	///< Our object
 	DEBUGMSG4("%s.%d: calling fspe->outq->enq()", __FUNCTION__, __LINE__);
 	ret =  fspe->outq->enq(fspe->outq, fs);
 	self->io->stats.reliablesends++;
-	DEBUGMSG4("%s.%d: calling TRYXMIT()", __FUNCTION__, __LINE__);
-	TRYXMIT(fspe);
-	AUDITFSPE(fspe);
-	DEBUGMSG3("%s.%d: returning %s", __FUNCTION__, __LINE__, (ret ? "TRUE" : "FALSE"));
 	return ret;
 }
+
+/// Return the (uncompressed) size of the packet this FrameSet would turn into
+FSTATIC gsize
+_fsprotocol_fssize(FrameSet* fs)	///< FrameSet to size up
+{
+	gsize	size = FRAMESET_INITSIZE;
+	GSList*	curframe;
+
+	for (curframe=fs->framelist; curframe != NULL; curframe = g_slist_next(curframe)) {
+		Frame* frame = CASTTOCLASS(Frame, curframe->data);
+		size += frame->dataspace(frame);
+	}
+	return size;
+}
+
+/**
+ * Return TRUE if this FrameSet is too big to send as a single packet.
+ * What matters is how big it is <i>after</i> compression.  But compressing the whole thing
+ * to find out would double the cost of sending it - it gets compressed again when it's sent,
+ * maybe by our MarshalPool, off the main loop.  So we compress just the first
+ * @ref FSPROTO_CMPSAMPLE bytes of it, and only send it whole if that says it will fit with
+ * room to spare (@ref FSPROTO_CMPMARGIN).
+ * We do that on a copy of the FrameSet, so the FrameSet itself is left as it was.
+ */
+FSTATIC gboolean
+_fsprotocol_needsfragmenting(FsProtocol* self	///< Our object
+,			     FrameSet* fs)	///< FrameSet we're about to send
+{
+	gsize		fssize = _fsprotocol_fssize(fs);
+	CompressFrame*	compressframe;
+	SignFrame*	sigframe;
+	FrameSet*	trialfs;
+	GSList*		curframe;
+	gsize		pktlen;
+	gsize		samplelen;
+	gsize		compressedsize;
+	gsize		estimate;
+
+	if (fssize <= self->maxpktsize) {
+		return FALSE;
+	}
+	if (fssize > self->fragthreshold) {
+		return TRUE;
+	}
+	compressframe = self->io->compressframe(self->io);
+	sigframe = self->io->signframe(self->io);
+	if (NULL == compressframe || NULL == sigframe) {
+		return TRUE;
+	}
+	trialfs = frameset_new(fs->fstype);
+	for (curframe=fs->framelist; curframe != NULL; curframe = g_slist_next(curframe)) {
+		frameset_append_frame(trialfs, CASTTOCLASS(Frame, curframe->data));
+	}
+	frameset_construct_packet(trialfs, sigframe, NULL, NULL);
+	if (NULL == trialfs->packet) {
+		UNREF(trialfs);
+		return TRUE;
+	}
+	pktlen = (const guint8*)trialfs->pktend - (const guint8*)trialfs->packet;
+	samplelen = MIN(pktlen, FRAMESET_INITSIZE + FSPROTO_CMPSAMPLE);
+	compressedsize = compressframe_compressed_size(compressframe, trialfs->packet, samplelen
+	,	FRAMESET_INITSIZE, samplelen + samplelen/2);
+	UNREF(trialfs);
+	if (0 == compressedsize) {
+		return TRUE;
+	}
+	estimate = (gsize)(((double)compressedsize * pktlen) / samplelen);
+	DEBUGMSG2("%s.%d: %"G_GSIZE_FORMAT" byte FrameSet of type %d should compress to"
+	" about %"G_GSIZE_FORMAT" bytes", __FUNCTION__, __LINE__, pktlen, fs->fstype, estimate);
+	return estimate > (self->maxpktsize * FSPROTO_CMPMARGIN) / 100;
+}
+
+/**
+ * Split a FrameSet which is too large for one packet into a list of fragment FrameSets.
+ * We construct the (signed, but otherwise plain) packet for the original FrameSet,
+ * and each fragment carries a piece of that packet - along with where it goes, and
+ * how big the whole thing is.
+ * The fragments are ordinary FrameSets - they get their own sequence numbers,
+ * and are encrypted, compressed, ACKed and retransmitted individually.
+ */
+FSTATIC GSList*
+_fsprotocol_fragment(FsProtocol* self	///< Our object
+,		     FrameSet* fs)	///< FrameSet to fragment
+{
+	SignFrame*	sigframe = self->io->signframe(self->io);
+	const guint8*	pkt;
+	gsize		pktlen;
+	gsize		offset;
+	GSList*		ret = NULL;
+
+	g_return_val_if_fail(sigframe != NULL, NULL);
+	frameset_construct_packet(fs, sigframe, NULL, NULL);
+	g_return_val_if_fail(fs->packet != NULL, NULL);
+	pkt = fs->packet;
+	pktlen = (const guint8*)fs->pktend - pkt;
+
+	for (offset=0; offset < pktlen; offset += self->fragsize) {
+		gsize		len = MIN(self->fragsize, pktlen - offset);
+		FrameSet*	frag = frameset_new(FRAMESETTYPE_FRAGMENT);
+		IntFrame*	offframe = intframe_new(FRAMETYPE_FRAGOFFSET, 4);
+		IntFrame*	totalframe = intframe_new(FRAMETYPE_FRAGTOTAL, 4);
+		Frame*		dataframe = frame_new(FRAMETYPE_FRAGDATA, 0);
+
+		offframe->setint(offframe, offset);
+		totalframe->setint(totalframe, pktlen);
+		dataframe->setvalue(dataframe, g_memdup(pkt+offset, len), len
+		,	frame_default_valuefinalize);
+		frameset_append_frame(frag, &offframe->baseclass);
+		frameset_append_frame(frag, &totalframe->baseclass);
+		frameset_append_frame(frag, dataframe);
+		UNREF2(offframe);
+		UNREF2(totalframe);
+		UNREF(dataframe);
+		ret = g_slist_prepend(ret, frag);
+	}
+	DEBUGMSG2("%s.%d: Split %"G_GSIZE_FORMAT" byte FrameSet of type %d into %d fragments"
+	,	__FUNCTION__, __LINE__, pktlen, fs->fstype, g_slist_length(ret));
+	// The fragments have their own copies of the data
+	FREE(fs->packet);
+	fs->packet = NULL;
+	fs->pktend = NULL;
+	return g_slist_reverse(ret);
+}
+
+/// Fragment an oversized FrameSet and put all the fragments on our output queue.
+/// A fragmented FrameSet counts as one FrameSet against our output queue limit.
+FSTATIC gboolean
+_fsprotocol_enqfragments(FsProtoElem* fspe	///< The FrameSet protocol element to operate on
+,			 FrameSet* fs)		///< Oversized FrameSet to send
+{
+	FsQueue*	outq = fspe->outq;
+	GSList*		fragments;
+	GSList*		this;
+	guint		maxqlen;
+	gboolean	ret = TRUE;
+
+	if (!outq->hasqspace1(outq)) {
+		g_warning("%s.%d: No room to queue FrameSet of type %d"
+		,	__FUNCTION__, __LINE__, fs->fstype);
+		return FALSE;
+	}
+	fragments = _fsprotocol_fragment(fspe->parent, fs);
+	if (NULL == fragments) {
+		return FALSE;
+	}
+	maxqlen = outq->getmaxqlen(outq);
+	outq->setmaxqlen(outq, 0);
+	for (this=fragments; this; this=this->next) {
+		FrameSet*	frag = CASTTOCLASS(FrameSet, this->data);
+		if (!_fsprotocol_enq(fspe, frag)) {
+			ret = FALSE;
+		}
+		UNREF(frag);
+	}
+	outq->setmaxqlen(outq, maxqlen);
+	g_slist_free(fragments);
+	return ret;
+}
+
+/**
+ * Add a (received, in-sequence) fragment to the FrameSet this FsProtoElem is reassembling.
+ * We take ownership of the fragment.  Every fragment but the last is ACKed here - since our client
+ * never sees them.  The last one is ACKed when our client ACKs the reassembled FrameSet.
+ * @return the reassembled FrameSet once this fragment completes it, NULL otherwise.
+ */
+FSTATIC FrameSet*
+_fsprotocol_addfragment(FsProtoElem* fspe	///< The FrameSet protocol element to operate on
+,			FrameSet* fs)		///< Fragment FrameSet we just read
+{
+	FsProtocol*	self = fspe->parent;
+	SeqnoFrame*	seq = fs->getseqno(fs);
+	guint64		offset = 0;
+	guint64		total = 0;
+	Frame*		dataframe = NULL;
+	FrameSet*	ret = NULL;
+	GSList*		curframe;
+
+	for (curframe=fs->framelist; curframe != NULL; curframe = g_slist_next(curframe)) {
+		Frame* frame = CASTTOCLASS(Frame, curframe->data);
+		switch (frame->type) {
+			case FRAMETYPE_FRAGOFFSET:
+				offset = CASTTOCLASS(IntFrame, frame)->getint(CASTTOCLASS(IntFrame, frame));
+				break;
+			case FRAMETYPE_FRAGTOTAL:
+				total = CASTTOCLASS(IntFrame, frame)->getint(CASTTOCLASS(IntFrame, frame));
+				break;
+			case FRAMETYPE_FRAGDATA:
+				dataframe = frame;
+				break;
+		}
+	}
+	if (NULL == dataframe || 0 == dataframe->length || offset + dataframe->length > total) {
+		g_warning("%s.%d: Discarding malformed FrameSet fragment", __FUNCTION__, __LINE__);
+		goto ackit;
+	}
+	if (0 == offset) {
+		// The beginning of a new FrameSet
+		if (fspe->fragbuf) {
+			g_warning("%s.%d: Discarding incomplete %u byte FrameSet (%u bytes received)"
+			,	__FUNCTION__, __LINE__, fspe->fragtotal, fspe->fragrecvd);
+			_fsprotocol_fragdiscard(fspe);
+		}
+		if (total > self->fragmemlimit - self->fragmemused) {
+			char *	srcstr = fspe->endpoint->baseclass.toString(&fspe->endpoint->baseclass);
+			g_warning("%s.%d: Discarding %"G_GUINT64_FORMAT" byte FrameSet from %s"
+			": would exceed reassembly memory limit (%"G_GSIZE_FORMAT" of %"G_GSIZE_FORMAT
+			" bytes in use)"
+			,	__FUNCTION__, __LINE__, total, srcstr, self->fragmemused, self->fragmemlimit);
+			g_free(srcstr); srcstr = NULL;
+			goto ackit;
+		}
+		fspe->fragbuf = MALLOC(total);
+		if (NULL == fspe->fragbuf) {
+			goto ackit;
+		}
+		fspe->fragtotal = total;
+		fspe->fragrecvd = 0;
+		self->fragmemused += total;
+		self->reassembling = g_list_prepend(self->reassembling, fspe);
+	}
+	if (NULL == fspe->fragbuf || offset != fspe->fragrecvd || total != fspe->fragtotal) {
+		// Part of a FrameSet we've already given up on
+		DEBUGMSG2("%s.%d: Discarding fragment at offset %"G_GUINT64_FORMAT
+		,	__FUNCTION__, __LINE__, offset);
+		goto ackit;
+	}
+	memcpy(fspe->fragbuf + offset, dataframe->value, dataframe->length);
+	fspe->fragrecvd += dataframe->length;
+	fspe->fragdeadline = g_get_monotonic_time() + self->fragtimeout;
+	if (fspe->fragrecvd < fspe->fragtotal) {
+		goto ackit;
+	}
+	ret = _fsprotocol_reassemble(fspe, fs);
+	_fsprotocol_fragdiscard(fspe);
+	if (ret) {
+		UNREF(fs);
+		return ret;
+	}
+ackit:
+	if (seq) {
+		_fsprotocol_ackseqno(self, fspe->endpoint, seq);
+	}
+	UNREF(fs);
+	return NULL;
+}
+
+/// Turn a completely received reassembly buffer back into the original FrameSet.
+/// It gets the signature, encryption and sequence number frames from the last fragment - so it
+/// looks to our client just like it would have if it had arrived in a single packet.
+FSTATIC FrameSet*
+_fsprotocol_reassemble(FsProtoElem* fspe	///< The FrameSet protocol element to operate on
+,		       FrameSet* lastfrag)	///< Final fragment of this FrameSet
+{
+	PacketDecoder*	decoder = fspe->parent->io->_decoder;
+	GSList*		fslist;
+	GSList*		prefix = NULL;
+	GSList*		curframe;
+	FrameSet*	ret;
+
+	fslist = decoder->pktdata_to_framesetlist(decoder, fspe->fragbuf
+	,	fspe->fragbuf + fspe->fragtotal);
+	if (g_slist_length(fslist) != 1) {
+		g_warning("%s.%d: Reassembled %u byte FrameSet did not decode properly"
+		,	__FUNCTION__, __LINE__, fspe->fragtotal);
+		g_slist_free_full(fslist, assim_g_notify_unref);
+		return NULL;
+	}
+	ret = CASTTOCLASS(FrameSet, fslist->data);
+	g_slist_free(fslist);
+	// Get rid of the signature it was reassembled with...
+	while (ret->framelist) {
+		Frame*	item = CASTTOCLASS(Frame, ret->framelist->data);
+		if (item->type != FRAMETYPE_SIG) {
+			break;
+		}
+		UNREF(item);
+		ret->framelist->data = NULL;
+		ret->framelist = g_slist_delete_link(ret->framelist, ret->framelist);
+	}
+	// ...and replace it with the leading frames of our last fragment - through its seqno
+	for (curframe=lastfrag->framelist; curframe != NULL; curframe = g_slist_next(curframe)) {
+		Frame* frame = CASTTOCLASS(Frame, curframe->data);
+		prefix = g_slist_prepend(prefix, frame);
+		if (frame->type == FRAMETYPE_REQID) {
+			break;
+		}
+	}
+	for (curframe=prefix; curframe != NULL; curframe = g_slist_next(curframe)) {
+		frameset_prepend_frame(ret, CASTTOCLASS(Frame, curframe->data));
+	}
+	g_slist_free(prefix);
+	DEBUGMSG2("%s.%d: Reassembled %u byte FrameSet of type %d"
+	,	__FUNCTION__, __LINE__, fspe->fragtotal, ret->fstype);
+	return ret;
+}
+
+/// Discard any FrameSet this FsProtoElem is reassembling
+FSTATIC void
+_fsprotocol_fragdiscard(FsProtoElem* fspe)	///< The FrameSet protocol element to operate on
+{
+	if (NULL == fspe->fragbuf) {
+		return;
+	}
+	FREE(fspe->fragbuf);
+	fspe->fragbuf = NULL;
+	fspe->parent->fragmemused -= fspe->fragtotal;
+	fspe->parent->reassembling = g_list_remove(fspe->parent->reassembling, fspe);
+	fspe->fragtotal = 0;
+	fspe->fragrecvd = 0;
+	fspe->fragdeadline = 0;
+}
+
 /// Enqueue and send a list of reliable FrameSets (send all or none)
 FSTATIC gboolean
 _fsprotocol_send(FsProtocol* self	///< Our object
@@ -1436,6 +1817,7 @@ _fsprotocol_timeoutfun(gpointer userdata)
 	FsProtocol*	self = CASTTOCLASS(FsProtocol, userdata);
 	GList*		pending;
 	GList*		next;
+	gint64		now = g_get_monotonic_time();
 
 	g_return_val_if_fail(self != NULL, FALSE);
 
@@ -1447,6 +1829,19 @@ _fsprotocol_timeoutfun(gpointer userdata)
 		TRYXMIT(fspe);
 		AUDITFSPE(fspe);
 	}
+	// Give up on FrameSets whose fragments have stopped arriving
+	for (pending = self->reassembling; NULL != pending; pending=next) {
+		FsProtoElem*	fspe = CASTTOCLASS(FsProtoElem, pending->data);
+		next = pending->next;
+		if (now > fspe->fragdeadline) {
+			char *	srcstr = fspe->endpoint->baseclass.toString(&fspe->endpoint->baseclass);
+			g_warning("%s.%d: Timed out reassembling %u byte FrameSet from %s"
+			" (%u bytes received)"
+			,	__FUNCTION__, __LINE__, fspe->fragtotal, srcstr, fspe->fragrecvd);
+			g_free(srcstr); srcstr = NULL;
+			_fsprotocol_fragdiscard(fspe);
+		}
+	}
 	return TRUE;
 }
 
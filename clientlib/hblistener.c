@@ -3,6 +3,10 @@
  * @brief Implements the @ref HbListener class - for listening to heartbeats.
  * @details We are told what addresses to listen for, what ones to stop listening for at run time
  * and time out both warning times, and fatal (dead) times.
+ * Deadtimes are kept in a min-heap ordered by when each peer's next heartbeat is due,
+ * and a single GSource wakes us up exactly when the earliest of them expires
+ * (on the monotonic clock) - so deadtimes of a few hundred milliseconds work fine,
+ * and the cost of a wakeup doesn't depend on how many peers we're listening to.
  *
  * This file is part of the Assimilation Project.
  *
@@ -28,19 +32,36 @@
 #include <frameset.h>
 #include <hblistener.h>
 #include <stdlib.h>
+#include <math.h>
 /**
  */
-FSTATIC void _hblistener_notify_function(gpointer ignoreddata);
 FSTATIC void _hblistener_finalize(AssimObj * self);
 FSTATIC void _hblistener_addlist(HbListener* self);
 FSTATIC void _hblistener_dellist(HbListener* self);
-FSTATIC void _hblistener_checktimeouts(gboolean urgent);
+FSTATIC void _hblistener_checktimeouts(void);
+FSTATIC void _hblistener_heap_swap(guint i, guint j);
+FSTATIC void _hblistener_heap_siftup(guint index);
+FSTATIC void _hblistener_heap_siftdown(guint index);
+FSTATIC void _hblistener_heap_insert(HbListener* self);
+FSTATIC void _hblistener_heap_remove(HbListener* self);
+FSTATIC void _hblistener_heap_update(HbListener* self);
+FSTATIC void _hblistener_set_timer(void);
 FSTATIC gboolean _hblistener_got_frameset(Listener*, FrameSet*, NetAddr*);
 FSTATIC void _hblistener_set_deadtime(HbListener* self, guint64 deadtime);
 FSTATIC void _hblistener_set_warntime(HbListener* self, guint64 warntime);
 FSTATIC guint64 _hblistener_get_deadtime(HbListener* self);
 FSTATIC guint64 _hblistener_get_warntime(HbListener* self);
-FSTATIC gboolean _hblistener_gsourcefunc(gpointer);
+FSTATIC void _hblistener_set_deadtime_usec(HbListener* self, guint64 deadtime);
+FSTATIC void _hblistener_set_warntime_usec(HbListener* self, guint64 warntime);
+FSTATIC gboolean _hblistener_timer_dispatch(GSource*, GSourceFunc, gpointer);
+FSTATIC void _hblistener_arrived(HbListener* self, guint64 now);
+FSTATIC void _hblistener_set_phi_thresholds(HbListener* self, double warnphi, double deadphi);
+FSTATIC double _hblistener_get_phi(HbListener* self, guint64 now);
+FSTATIC gboolean _hblistener_phi_stats(HbListener* self, double* mean, double* stddev);
+FSTATIC double _hblistener_phi_elapsed(HbListener* self, double phi);
+FSTATIC void _hblistener_phi_record(HbListener* self, double interval);
+FSTATIC void _hblistener_hist_add(guint32* hist, guint64 usec);
+FSTATIC void _hblistener_hist_append(GString* str, const char* name, const guint32* hist);
 FSTATIC void _hblistener_set_deadtime_callback(HbListener*, void (*callback)(HbListener* who));
 FSTATIC void _hblistener_set_heartbeat_callback(HbListener*, void (*callback)(HbListener* who));
 FSTATIC void _hblistener_set_warntime_callback(HbListener*, void (*callback)(HbListener* who, guint64 howlate));
@@ -53,13 +74,23 @@ DEBUGDECLARATIONS;
 ///@{
 ///@ingroup Listener
 
-static GSList*		_hb_listeners = NULL;
-static gint		_hb_listener_count = 0;
-static guint64		_hb_listener_lastcheck = 0;
+static GHashTable*	_hb_listeners = NULL;	///< Our HbListeners - indexed by listenaddr
+static GPtrArray*	_hb_deadlines = NULL;	///< Min-heap of live HbListeners - ordered by nexttime
+static GSource*		_hb_timer = NULL;	///< Wakes us up when the earliest nexttime passes
 static void		(*_hblistener_martiancallback)(NetAddr* who) = NULL;
-static gint		hb_timeout_id = -1;
+
+/// Our timer only has a ready time - glib takes care of waking us up when it arrives
+static GSourceFuncs _hblistener_timerfuncs = {
+	NULL,
+	NULL,
+	_hblistener_timer_dispatch,
+	NULL,
+	NULL,
+	NULL
+};
 
 #define	ONESEC	1000000
+#define	HEAPITEM(index)	((HbListener*)g_ptr_array_index(_hb_deadlines, (index)))
 
 /// Add an HbListener to our global list of HBListeners,
 /// and unref (and neuter) any old HbListeners listening to this same address
@@ -68,24 +99,35 @@ _hblistener_addlist(HbListener* self)	///<[in]The listener to add
 {
 	HbListener*	old;
 	if (_hb_listeners == NULL) {
-		hb_timeout_id = g_timeout_add_seconds_full(G_PRIORITY_LOW, 1
-		,	_hblistener_gsourcefunc , NULL, _hblistener_notify_function);
-		///@todo start listening for packets...
-	}else if ((old=hblistener_find_by_address(self->listenaddr)) != NULL) {
+		// The listeners own their listenaddrs - so our keys live exactly as long as they do
+		_hb_listeners = g_hash_table_new(netaddr_g_hash_hash, netaddr_g_hash_equal);
+	}
+	if (NULL == _hb_deadlines) {
+		_hb_deadlines = g_ptr_array_new();
+	}
+	if (NULL == _hb_timer) {
+		// Timeouts run after any heartbeats which have already arrived have been processed
+		_hb_timer = g_source_new(&_hblistener_timerfuncs, sizeof(GSource));
+		g_source_set_priority(_hb_timer, G_PRIORITY_DEFAULT);
+		g_source_attach(_hb_timer, NULL);
+	}
+	if ((old=hblistener_find_by_address(self->listenaddr)) != NULL) {
 		_hblistener_dellist(old);
 	}
-	_hb_listeners = g_slist_prepend(_hb_listeners, self);
-	_hb_listener_count += 1;
+	g_hash_table_insert(_hb_listeners, self->listenaddr, self);
 	REF2(self);
+	if (self->status == HbPacketsBeingReceived) {
+		_hblistener_heap_insert(self);
+	}
 }
 
 /// Remove an HbListener from our global list of HBListeners
 FSTATIC void
 _hblistener_dellist(HbListener* self)	///<[in]The listener to remove from our list
 {
-	if (g_slist_find(_hb_listeners, self) != NULL) {
-		_hb_listeners = g_slist_remove(_hb_listeners, self);
-		_hb_listener_count -= 1;
+	if (_hb_listeners && g_hash_table_lookup(_hb_listeners, self->listenaddr) == self) {
+		_hblistener_heap_remove(self);
+		g_hash_table_remove(_hb_listeners, self->listenaddr);
 		UNREF2(self);
 		return;
 	}
@@ -95,58 +137,178 @@ _hblistener_dellist(HbListener* self)	///<[in]The listener to remove from our li
 HbListener*
 hblistener_find_by_address(const NetAddr* which)
 {
-	GSList*		obj;
-	for (obj = _hb_listeners; obj != NULL; obj=g_slist_next(obj)) {
-		HbListener* listener = CASTTOCLASS(HbListener, obj->data);
-		if (which->equal(which, listener->listenaddr)) {
-			return listener;
+	gpointer	listener;
+	if (NULL == _hb_listeners) {
+		return NULL;
+	}
+	listener = g_hash_table_lookup(_hb_listeners, which);
+	return listener ? CASTTOCLASS(HbListener, listener) : NULL;
+}
+
+
+/// Exchange two entries in our deadline heap
+FSTATIC void
+_hblistener_heap_swap(guint i, guint j)
+{
+	HbListener*	li = HEAPITEM(i);
+	HbListener*	lj = HEAPITEM(j);
+	g_ptr_array_index(_hb_deadlines, i) = lj;
+	g_ptr_array_index(_hb_deadlines, j) = li;
+	lj->_heapindex = i;
+	li->_heapindex = j;
+}
+
+/// Move an entry toward the top of our deadline heap until its parent is due no later than it is
+FSTATIC void
+_hblistener_heap_siftup(guint index)	///<[in] Index of entry to move
+{
+	while (index > 0) {
+		guint	parent = (index-1)/2;
+		if (HEAPITEM(parent)->nexttime <= HEAPITEM(index)->nexttime) {
+			break;
+		}
+		_hblistener_heap_swap(index, parent);
+		index = parent;
+	}
+}
+
+/// Move an entry toward the bottom of our deadline heap until its children are due no earlier
+FSTATIC void
+_hblistener_heap_siftdown(guint index)	///<[in] Index of entry to move
+{
+	for (;;) {
+		guint	left = 2*index+1;
+		guint	right = left+1;
+		guint	earliest = index;
+		if (left < _hb_deadlines->len
+		&&	HEAPITEM(left)->nexttime < HEAPITEM(earliest)->nexttime) {
+			earliest = left;
+		}
+		if (right < _hb_deadlines->len
+		&&	HEAPITEM(right)->nexttime < HEAPITEM(earliest)->nexttime) {
+			earliest = right;
 		}
+		if (earliest == index) {
+			break;
+		}
+		_hblistener_heap_swap(index, earliest);
+		index = earliest;
+	}
+}
+
+/// Add an HbListener to our deadline heap.
+/// The heap doesn't hold a reference - only listeners in _hb_listeners are ever in it.
+FSTATIC void
+_hblistener_heap_insert(HbListener* self)	///<[in/out] Listener to add
+{
+	if (self->_heapindex >= 0) {
+		_hblistener_heap_update(self);
+		return;
+	}
+	self->_heapindex = _hb_deadlines->len;
+	g_ptr_array_add(_hb_deadlines, self);
+	_hblistener_heap_siftup(self->_heapindex);
+	if (self->_heapindex == 0) {
+		_hblistener_set_timer();
+	}
+}
+
+/// Remove an HbListener from our deadline heap (if it's there)
+FSTATIC void
+_hblistener_heap_remove(HbListener* self)	///<[in/out] Listener to remove
+{
+	guint	index;
+	guint	last;
+	if (self->_heapindex < 0 || NULL == _hb_deadlines) {
+		return;
+	}
+	index = self->_heapindex;
+	last = _hb_deadlines->len - 1;
+	if (index != last) {
+		_hblistener_heap_swap(index, last);
+	}
+	g_ptr_array_remove_index(_hb_deadlines, last);
+	self->_heapindex = -1;
+	if (index < _hb_deadlines->len) {
+		// The entry we moved into the hole may belong above it or below it
+		HbListener*	moved = HEAPITEM(index);
+		_hblistener_heap_siftup(index);
+		_hblistener_heap_siftdown(moved->_heapindex);
+	}
+	if (index == 0) {
+		_hblistener_set_timer();
 	}
-	return NULL;
 }
 
+/// Put an HbListener back where it belongs in our heap after its nexttime has changed
+FSTATIC void
+_hblistener_heap_update(HbListener* self)	///<[in/out] Listener whose nexttime changed
+{
+	gboolean	wasfirst;
+	if (self->_heapindex < 0) {
+		return;
+	}
+	wasfirst = (self->_heapindex == 0);
+	_hblistener_heap_siftup(self->_heapindex);
+	_hblistener_heap_siftdown(self->_heapindex);
+	if (wasfirst || self->_heapindex == 0) {
+		_hblistener_set_timer();
+	}
+}
 
-/// Function called when it's time to see if anyone timed out...
+/// Arrange for our timer to go off when the earliest deadline in our heap passes
 FSTATIC void
-_hblistener_checktimeouts(gboolean urgent)	///<[in]True if you want it checked now anyway...
+_hblistener_set_timer(void)
 {
-	guint64		now = g_get_real_time();
-	GSList*		obj;
-	if (!urgent && (now - _hb_listener_lastcheck) < ONESEC) {
+	if (NULL == _hb_timer) {
+		return;
+	}
+	if (NULL == _hb_deadlines || _hb_deadlines->len == 0) {
+		g_source_set_ready_time(_hb_timer, -1);
 		return;
 	}
-	_hb_listener_lastcheck = now;
-
-	for (obj = _hb_listeners; obj != NULL; obj=g_slist_next(obj)) {
-		HbListener* listener = CASTTOCLASS(HbListener, obj->data);
-		if (now > listener->nexttime && listener->status == HbPacketsBeingReceived) {
-			if (listener->_deadtime_callback) {
-				listener->_deadtime_callback(listener);
-			}else{
-				char *	addrstr
-				= listener->listenaddr->baseclass.toString
-				(	&listener->listenaddr->baseclass);
-				g_warning("%s.%d: Unhandled deadtime for %s."
-				,	__FUNCTION__, __LINE__, addrstr);
-				FREE(addrstr);
-			}
-			listener->status = HbPacketsTimedOut;
+	g_source_set_ready_time(_hb_timer, HEAPITEM(0)->nexttime);
+}
+
+/// Time out everyone whose deadline has passed - in the order their deadlines passed
+FSTATIC void
+_hblistener_checktimeouts(void)
+{
+	guint64		now = g_get_monotonic_time();
+
+	while (_hb_deadlines != NULL && _hb_deadlines->len > 0) {
+		HbListener* listener = HEAPITEM(0);
+		if (listener->nexttime > now) {
+			break;
+		}
+		// Callbacks may unlisten this address (or others) - so get our house in order first
+		_hblistener_heap_remove(listener);
+		listener->status = HbPacketsTimedOut;
+		if (listener->_deadtime_callback) {
+			listener->_deadtime_callback(listener);
+		}else{
+			char *	addrstr
+			= listener->listenaddr->baseclass.toString
+			(	&listener->listenaddr->baseclass);
+			g_warning("%s.%d: Unhandled deadtime for %s."
+			,	__FUNCTION__, __LINE__, addrstr);
+			FREE(addrstr);
 		}
 	}
+	_hblistener_set_timer();
 }
 
-/// A GSourceFunc to be used with g_timeout_add_seconds()
+/// GSource dispatch function for our deadline timer
 FSTATIC gboolean
-_hblistener_gsourcefunc(gpointer ignored) ///<[ignored] Ignored
+_hblistener_timer_dispatch(GSource* source,	///<[unused] Our timer
+			   GSourceFunc callback,///<[unused] Unused
+			   gpointer userdata)	///<[unused] Unused
 {
-	gboolean	ret;
-	(void)ignored;
-	_hblistener_checktimeouts(TRUE);
-	ret = (_hb_listeners != NULL);
-	if (!ret) {
-		hb_timeout_id = -1;
-	}
-	return ret;
+	(void)source;
+	(void)callback;
+	(void)userdata;
+	_hblistener_checktimeouts();
+	return TRUE;
 }
 
 /// Function called when a heartbeat @ref FrameSet (fs) arrived from the given @ref NetAddr (srcaddr)
@@ -155,7 +317,6 @@ _hblistener_got_frameset(Listener* self,	///< Our 'self' Listener
 			 FrameSet* fs,		///< Frameset received
 			 NetAddr* srcaddr)	///< Address 'fs' came from
 {
-	guint64		now = g_get_real_time();
 	HbListener*	addmatch;
 
 	(void)self;  // Odd, but true - because we're a proxy for all hblisteners...
@@ -169,30 +330,14 @@ _hblistener_got_frameset(Listener* self,	///< Our 'self' Listener
 		FREE(addrstr);
 	}
 	if (addmatch != NULL) {
-		if (addmatch->status == HbPacketsTimedOut) {
-			guint64 howlate = now - addmatch->nexttime;
-			addmatch->status = HbPacketsBeingReceived;
-			howlate /= 1000;
-			if (addmatch->_comealive_callback) {
-				addmatch->_comealive_callback(addmatch, howlate);
-			}else{
-				g_message("A node is now back alive! late by "FMT_64BIT "d ms", howlate);
-			}
-		} else if (now > addmatch->warntime) {
-			guint64 howlate = now - addmatch->warntime;
-			howlate /= 1000;
-			if (addmatch->_warntime_callback) {
-				addmatch->_warntime_callback(addmatch, howlate);
-			}else{
-				g_warning("A node was " FMT_64BIT "u ms late in sending heartbeat..."
-				,	howlate);
-			}
-		}
-		if (addmatch->_heartbeat_callback) {
-			addmatch->_heartbeat_callback(addmatch);
+		// Time from the kernel getting it until now is our problem - not the network's
+		guint64	now = g_get_monotonic_time();
+		guint64	arrivaltime = now;
+		if (fs->arrivaltime > 0 && (guint64)fs->arrivaltime <= now) {
+			arrivaltime = fs->arrivaltime;
 		}
-		addmatch->nexttime = now + addmatch->_expected_interval;
-		addmatch->warntime = now + addmatch->_warn_interval;
+		_hblistener_hist_add(addmatch->_latehist, now - arrivaltime);
+		addmatch->arrived(addmatch, arrivaltime);
 		UNREF(fs);
 		return TRUE;
 	}
@@ -209,38 +354,313 @@ _hblistener_got_frameset(Listener* self,	///< Our 'self' Listener
 	return TRUE;
 }
 
-/// We get called when our gSource gets removed.  This function is probably unnecessary...
+/// Process a heartbeat which arrived at the given time (on the monotonic clock)
 FSTATIC void
-_hblistener_notify_function(gpointer ignored)	///<[unused] Unused
+_hblistener_arrived(HbListener* self,	///<[in/out] Listener the heartbeat is for
+		    guint64 now)	///<[in] When it arrived
 {
-	(void)ignored;
-	hblistener_shutdown();
+	gboolean	wasalive = (self->status == HbPacketsBeingReceived);
+
+	REF2(self);	// Our callbacks might unlisten us...
+	if (!wasalive) {
+		// We may have declared it dead while this heartbeat sat in our socket
+		guint64 howlate = (now > self->nexttime ? now - self->nexttime : 0);
+		self->status = HbPacketsBeingReceived;
+		howlate /= 1000;
+		if (self->_comealive_callback) {
+			self->_comealive_callback(self, howlate);
+		}else{
+			g_message("A node is now back alive! late by "FMT_64BIT "d ms", howlate);
+		}
+	} else if (now > self->warntime) {
+		guint64 howlate = now - self->warntime;
+		howlate /= 1000;
+		if (self->_warntime_callback) {
+			self->_warntime_callback(self, howlate);
+		}else{
+			g_warning("A node was " FMT_64BIT "u ms late in sending heartbeat..."
+			,	howlate);
+		}
+	}
+	if (self->_heartbeat_callback) {
+		self->_heartbeat_callback(self);
+	}
+	// The time it took to come back from the dead says nothing about normal heartbeats
+	if (wasalive && self->_lastarrival != 0 && now > self->_lastarrival) {
+		guint64	interval = now - self->_lastarrival;
+		if (self->_lastinterval != 0) {
+			_hblistener_hist_add(self->_jitterhist, interval > self->_lastinterval
+			?	interval - self->_lastinterval : self->_lastinterval - interval);
+		}
+		self->_lastinterval = interval;
+		if (self->_intervals) {
+			_hblistener_phi_record(self, (double)interval);
+		}
+	}else{
+		self->_lastinterval = 0;
+	}
+	self->_lastarrival = now;
+	if (self->_phidead > 0.0 && self->_nintervals >= HBLISTENER_PHI_MINSAMPLES) {
+		self->nexttime = now + (guint64)_hblistener_phi_elapsed(self, self->_phidead);
+		self->warntime = now + (self->_phiwarn > 0.0
+		?	(guint64)_hblistener_phi_elapsed(self, self->_phiwarn)
+		:	self->_warn_interval);
+	}else{
+		self->nexttime = now + self->_expected_interval;
+		self->warntime = now + self->_warn_interval;
+	}
+	if (self->_heapindex >= 0) {
+		_hblistener_heap_update(self);
+	}else if (hblistener_find_by_address(self->listenaddr) == self) {
+		// It just came back alive (and our callbacks didn't unlisten it)
+		_hblistener_heap_insert(self);
+	}
+	UNREF2(self);
+}
+
+/// Switch this listener to (or from) phi-accrual failure detection.
+/// Until we have HBLISTENER_PHI_MINSAMPLES intervals to go on, we keep using our fixed deadtime.
+FSTATIC void
+_hblistener_set_phi_thresholds(HbListener* self,	///<[in/out] Listener to set thresholds for
+			       double warnphi,		///<[in] Warn at this phi (0 to use warntime)
+			       double deadphi)		///<[in] Dead at this phi (0 to use deadtime)
+{
+	self->_phiwarn = (deadphi > 0.0 ? warnphi : 0.0);
+	self->_phidead = (deadphi > 0.0 ? deadphi : 0.0);
+	if (self->_phidead > 0.0 && NULL == self->_intervals) {
+		self->_intervals = g_new0(double, HBLISTENER_PHI_WINDOW);
+		self->_nintervals = 0;
+		self->_nextinterval = 0;
+		self->_intervalsum = 0.0;
+		self->_intervalsumsq = 0.0;
+	}
+}
+
+/// Remember the time between two heartbeats - forgetting the oldest one if our window is full
+FSTATIC void
+_hblistener_phi_record(HbListener* self,	///<[in/out] Listener to record the interval for
+		       double interval)		///<[in] Microseconds between heartbeats
+{
+	guint	j;
+	if (self->_nintervals == HBLISTENER_PHI_WINDOW) {
+		double	oldest = self->_intervals[self->_nextinterval];
+		self->_intervalsum -= oldest;
+		self->_intervalsumsq -= oldest*oldest;
+	}else{
+		self->_nintervals += 1;
+	}
+	self->_intervals[self->_nextinterval] = interval;
+	self->_intervalsum += interval;
+	self->_intervalsumsq += interval*interval;
+	self->_nextinterval = (self->_nextinterval + 1) % HBLISTENER_PHI_WINDOW;
+	if (self->_nextinterval == 0) {
+		// Recompute our sums every so often so rounding errors can't pile up
+		self->_intervalsum = 0.0;
+		self->_intervalsumsq = 0.0;
+		for (j=0; j < self->_nintervals; ++j) {
+			self->_intervalsum += self->_intervals[j];
+			self->_intervalsumsq += self->_intervals[j]*self->_intervals[j];
+		}
+	}
+}
+
+/// Compute the mean and standard deviation of our heartbeat intervals.
+/// @return FALSE if we don't have enough intervals to go on yet.
+FSTATIC gboolean
+_hblistener_phi_stats(HbListener* self,	///<[in] Listener whose intervals we want
+		      double* mean,	///<[out] Mean interval
+		      double* stddev)	///<[out] Standard deviation of the intervals
+{
+	double	variance;
+	if (NULL == self->_intervals || self->_nintervals < HBLISTENER_PHI_MINSAMPLES) {
+		return FALSE;
+	}
+	*mean = self->_intervalsum / self->_nintervals;
+	variance = self->_intervalsumsq / self->_nintervals - (*mean)*(*mean);
+	*stddev = (variance > 0.0 ? sqrt(variance) : 0.0);
+	// A suspiciously regular network shouldn't make us trigger-happy
+	*stddev = MAX(*stddev, (*mean)*HBLISTENER_PHI_MINSTDDEV);
+	return TRUE;
+}
+
+/// Return our suspicion level (phi) that this peer is dead, as of 'now' (monotonic clock).
+/// We assume the time between heartbeats is normally distributed.
+FSTATIC double
+_hblistener_get_phi(HbListener* self,	///<[in] Listener to return phi for
+		    guint64 now)	///<[in] Time to compute phi for
+{
+	double	mean;
+	double	stddev;
+	double	plater;
+	if (now <= self->_lastarrival || !_hblistener_phi_stats(self, &mean, &stddev)) {
+		return 0.0;
+	}
+	// Probability of a heartbeat arriving even later than this
+	plater = 0.5 * erfc(((double)(now - self->_lastarrival) - mean) / (stddev * G_SQRT2));
+	if (plater <= 0.0) {
+		return G_MAXDOUBLE;
+	}
+	return -log10(plater);
+}
+
+/// Return how long (in microseconds) after a heartbeat it takes our suspicion to reach 'phi'
+FSTATIC double
+_hblistener_phi_elapsed(HbListener* self,	///<[in] Listener to compute it for
+			double phi)		///<[in] Suspicion level we're interested in
+{
+	double	mean;
+	double	stddev;
+	double	plater = pow(10.0, -phi);
+	double	low = -10.0;	// In standard deviations from the mean
+	double	high = 40.0;
+	int	j;
+	if (!_hblistener_phi_stats(self, &mean, &stddev)) {
+		return (double)self->_expected_interval;
+	}
+	// erfc() is monotonic, so a binary search gets us as close as we like
+	for (j=0; j < 60; ++j) {
+		double	mid = (low + high) / 2.0;
+		if (0.5 * erfc(mid / G_SQRT2) > plater) {
+			low = mid;
+		}else{
+			high = mid;
+		}
+	}
+	return MAX(mean + low*stddev, 0.0);
+}
+
+/// Count 'usec' in the proper log2(milliseconds) bucket of 'hist'
+FSTATIC void
+_hblistener_hist_add(guint32* hist,	///<[in/out] HBLISTENER_HISTBUCKETS buckets
+		     guint64 usec)	///<[in] Value to count
+{
+	guint64	ms = usec / 1000;
+	guint	bucket = (ms == 0 ? 0 : g_bit_storage(ms));
+
+	if (bucket >= HBLISTENER_HISTBUCKETS) {
+		bucket = HBLISTENER_HISTBUCKETS-1;
+	}
+	if (hist[bucket] < G_MAXUINT32) {
+		hist[bucket] += 1;
+	}
+}
+
+/// Return the upper bound (in ms) of the histogram bucket 'fraction' of its counts fall into.
+/// That is, fraction 0.99 gives you "99% of them were under this many ms".
+/// @return 0 for an empty histogram, G_MAXUINT if it's in our last (unbounded) bucket
+guint
+hblistener_hist_percentile(const guint32* hist,	///<[in] HBLISTENER_HISTBUCKETS buckets
+			   double fraction)	///<[in] Fraction of counts we want (0.0 to 1.0)
+{
+	guint64	total = 0;
+	guint64	sofar = 0;
+	guint	j;
+
+	for (j=0; j < HBLISTENER_HISTBUCKETS; ++j) {
+		total += hist[j];
+	}
+	if (total == 0) {
+		return 0;
+	}
+	for (j=0; j < HBLISTENER_HISTBUCKETS-1; ++j) {
+		sofar += hist[j];
+		if ((double)sofar >= fraction*(double)total) {
+			return 1U << j;
+		}
+	}
+	return G_MAXUINT;
+}
+
+/// Append the nonempty buckets of a histogram to 'str' - as "name: <lower bound>ms:count ..."
+/// followed by its median and 99th percentile
+FSTATIC void
+_hblistener_hist_append(GString* str, const char* name, const guint32* hist)
+{
+	guint	j;
+	guint	p50 = hblistener_hist_percentile(hist, 0.50);
+	guint	p99 = hblistener_hist_percentile(hist, 0.99);
+
+	g_string_append_printf(str, "%s%s:", (str->len > 0 ? " " : ""), name);
+	for (j=0; j < HBLISTENER_HISTBUCKETS; ++j) {
+		if (hist[j] != 0) {
+			g_string_append_printf(str, " %ums:%u", (j == 0 ? 0U : 1U << (j-1)), hist[j]);
+		}
+	}
+	if (p99 == G_MAXUINT) {
+		g_string_append_printf(str, " (p50<%ums p99>=%ums)", p50, 1U << (HBLISTENER_HISTBUCKETS-2));
+	}else if (p99 != 0) {
+		g_string_append_printf(str, " (p50<%ums p99<%ums)", p50, p99);
+	}
+}
+
+/// Return the jitter and lateness histograms for this listener as a string - g_free it when done
+char *
+hblistener_histograms_string(HbListener* self)	///<[in] Listener whose histograms we want
+{
+	GString*	str = g_string_new("");
+
+	_hblistener_hist_append(str, "jitter", self->_jitterhist);
+	_hblistener_hist_append(str, "lateness", self->_latehist);
+	return g_string_free(str, FALSE);
+}
+
+/// Log the jitter and lateness histograms for every peer we're listening to.
+/// Lots of jitter means network trouble, lots of lateness means we were too busy to listen.
+/// The nanoprobe calls this every hbstats_interval seconds and at shutdown.
+void
+hblistener_dump_histograms(void)
+{
+	GHashTableIter	iter;
+	gpointer	value;
+
+	if (NULL == _hb_listeners) {
+		return;
+	}
+	g_hash_table_iter_init(&iter, _hb_listeners);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		HbListener*	listener = CASTTOCLASS(HbListener, value);
+		char*		histstr = hblistener_histograms_string(listener);
+		char*		addrstr = listener->listenaddr->baseclass.toString(&listener->listenaddr->baseclass);
+
+		g_info("Heartbeats from %s - %s", addrstr, histstr);
+		g_free(addrstr);
+		g_free(histstr);
+	}
 }
 
 /// Shuts down all our hblisteners...
 FSTATIC void
 hblistener_shutdown(void)
 {
-	GSList* this;
-	GSList* next = NULL;
+	GHashTable*	listeners = _hb_listeners;
+	GHashTableIter	iter;
+	gpointer	value;
 	static gboolean shuttingdown = FALSE;
 
 	if (shuttingdown) {
 		return;
 	}
 	shuttingdown = TRUE;
-	// Unref all our listener objects...
-	for (this = _hb_listeners; this; this=next) {
-		HbListener* listener = CASTTOCLASS(HbListener, this->data);
-		next = this->next;
-		UNREF2(listener);
+	if (_hb_timer) {
+		g_source_destroy(_hb_timer);
+		g_source_unref(_hb_timer);
+		_hb_timer = NULL;
 	}
-	if (_hb_listeners) {
-		g_slist_free(_hb_listeners);
-		_hb_listeners = NULL;
+	// Unref all our listener objects...
+	_hb_listeners = NULL;
+	if (_hb_deadlines) {
+		g_ptr_array_free(_hb_deadlines, TRUE);
+		_hb_deadlines = NULL;
 	}
-	if (hb_timeout_id > 0) {
-		g_source_remove(hb_timeout_id);
+	if (listeners) {
+		g_hash_table_iter_init(&iter, listeners);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			HbListener* listener = CASTTOCLASS(HbListener, value);
+			g_hash_table_iter_steal(&iter);
+			listener->_heapindex = -1;
+			UNREF2(listener);
+		}
+		g_hash_table_destroy(listeners);
 	}
 	shuttingdown = FALSE;
 }
@@ -253,6 +673,10 @@ _hblistener_finalize(AssimObj * self) ///<[in/out] Listener to finalize
 	HbListener *hbself = CASTTOCLASS(HbListener, self);
 	DEBUGMSG3("%s.%d - finalizing.", __FUNCTION__, __LINE__);
 	UNREF(hbself->listenaddr);
+	if (hbself->_intervals) {
+		g_free(hbself->_intervals);
+		hbself->_intervals = NULL;
+	}
 	_listener_finalize(self);
 	self = NULL; hbself = NULL;
 }
@@ -279,16 +703,22 @@ hblistener_new(NetAddr*	listenaddr,	///<[in] Address to listen to
 	}
 	base->baseclass._finalize = _hblistener_finalize;
 	base->got_frameset = _hblistener_got_frameset;
+	newlistener->_heapindex = -1;
 	newlistener->listenaddr = listenaddr;
 	REF(listenaddr);
 	newlistener->get_deadtime = _hblistener_get_deadtime;
 	newlistener->set_deadtime = _hblistener_set_deadtime;
 	newlistener->get_warntime = _hblistener_get_warntime;
 	newlistener->set_warntime = _hblistener_set_warntime;
+	newlistener->set_deadtime_usec = _hblistener_set_deadtime_usec;
+	newlistener->set_warntime_usec = _hblistener_set_warntime_usec;
 	newlistener->set_deadtime_callback = _hblistener_set_deadtime_callback;
 	newlistener->set_warntime_callback = _hblistener_set_warntime_callback;
 	newlistener->set_comealive_callback = _hblistener_set_comealive_callback;
 	newlistener->set_heartbeat_callback = _hblistener_set_heartbeat_callback;
+	newlistener->set_phi_thresholds = _hblistener_set_phi_thresholds;
+	newlistener->get_phi = _hblistener_get_phi;
+	newlistener->arrived = _hblistener_arrived;
 
 	if (cfg->getint(cfg, CONFIGNAME_TIMEOUT) > 0) {
 		newlistener->set_deadtime(newlistener, cfg->getint(cfg, CONFIGNAME_TIMEOUT));
@@ -304,11 +734,11 @@ hblistener_new(NetAddr*	listenaddr,	///<[in] Address to listen to
 	_hblistener_addlist(newlistener);
 	if (DEBUG) {
 		char *	addrstr = listenaddr->baseclass.toString(&listenaddr->baseclass);
-		g_debug("%s.%d: Start expecting heartbeats from %s. Interval: "FMT_64BIT"d"
-		" Warntime: "FMT_64BIT"d"
+		g_debug("%s.%d: Start expecting heartbeats from %s. Interval: %g"
+		" Warntime: %g"
 		,	__FUNCTION__, __LINE__, addrstr
-		,	newlistener->_expected_interval/1000000
-		,	newlistener->_warn_interval/1000000);
+		,	(double)newlistener->_expected_interval/ONESEC
+		,	(double)newlistener->_warn_interval/ONESEC);
 		FREE(addrstr);
 	}
         return newlistener;
@@ -319,10 +749,19 @@ FSTATIC void
 _hblistener_set_deadtime(HbListener* self,	///<[in/out] Object to set deadtime for
 			guint64 deadtime)	///<[in] deadtime to set in seconds
 {
-	guint64		now = g_get_real_time();
-	self->_expected_interval = deadtime*1000000L;
+	_hblistener_set_deadtime_usec(self, deadtime*ONESEC);
+}
+
+/// Set deadtime in microseconds
+FSTATIC void
+_hblistener_set_deadtime_usec(HbListener* self,	///<[in/out] Object to set deadtime for
+			guint64 deadtime)	///<[in] deadtime to set in microseconds
+{
+	guint64		now = g_get_monotonic_time();
+	self->_expected_interval = deadtime;
 	self->nexttime = now + self->_expected_interval;
-	//g_debug("Setting HbListener deadtime to " FMT_64BIT "d secs", deadtime);
+	_hblistener_heap_update(self);
+	//g_debug("Setting HbListener deadtime to " FMT_64BIT "d usecs", deadtime);
 }
 
 /// Return deadtime
@@ -337,8 +776,16 @@ FSTATIC void
 _hblistener_set_warntime(HbListener* self,	///<[in/out] Object to set warntime for
 			guint64 warntime)	///<[in] warntime to set in seconds
 {
-	guint64		now = g_get_real_time();
-	self->_warn_interval = warntime*1000000;
+	_hblistener_set_warntime_usec(self, warntime*ONESEC);
+}
+
+/// Set warntime in microseconds
+FSTATIC void
+_hblistener_set_warntime_usec(HbListener* self,	///<[in/out] Object to set warntime for
+			guint64 warntime)	///<[in] warntime to set in microseconds
+{
+	guint64		now = g_get_monotonic_time();
+	self->_warn_interval = warntime;
 	self->warntime = now + self->_warn_interval;
 }
 /// Return warntime
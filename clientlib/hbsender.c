@@ -2,6 +2,9 @@
  * @file
  * @brief Implements the @ref HbSender class - for sending heartbeats.
  * @details We are told what addresses to send to, and how often to send them.
+ * A heartbeat never changes, so unless it's encrypted, we build each destination's packet once
+ * and send that same packet every time - until our packet signing or compression changes.
+ * Encrypted heartbeats are re-encrypted (with a new nonce) every time they're sent.
  *
  * This file is part of the Assimilation Project.
  *
@@ -27,26 +30,53 @@
 #include <hbsender.h>
 /**
  */
-FSTATIC void _hbsender_notify_function(gpointer data);
 FSTATIC void _hbsender_finalize(HbSender * self);
 FSTATIC void _hbsender_ref(HbSender * self);
 FSTATIC void _hbsender_unref(HbSender * self);
 FSTATIC void _hbsender_addlist(HbSender* self);
 FSTATIC void _hbsender_dellist(HbSender* self);
 FSTATIC void _hbsender_sendheartbeat(HbSender* self);
-FSTATIC gboolean _hbsender_gsourcefunc(gpointer);
+FSTATIC void _hbsender_sendbatch(HbSender** senders, guint count);
+FSTATIC void _hbsender_checkpacket(HbSender* self);
+FSTATIC guint64 _hbsender_nextinterval(HbSender* self);
+FSTATIC void _hbsender_heap_swap(guint i, guint j);
+FSTATIC void _hbsender_heap_siftup(guint index);
+FSTATIC void _hbsender_heap_siftdown(guint index);
+FSTATIC void _hbsender_heap_insert(HbSender* self);
+FSTATIC void _hbsender_heap_remove(HbSender* self);
+FSTATIC void _hbsender_set_timer(void);
+FSTATIC gboolean _hbsender_timer_dispatch(GSource*, GSourceFunc, gpointer);
 
 DEBUGDECLARATIONS
 
 ///@defgroup HbSender HbSender class.
-/// Class for heartbeat Senders - We send heartbeats to the chosen few
+/// Class for heartbeat Senders - We send heartbeats to the chosen few.
+/// All our HbSenders share a single timer.  It goes off when the earliest heartbeat is due,
+/// and sends every heartbeat due in the same tick as one batch.
+/// Each interval is randomly stretched or shrunk (by up to our jitter fraction) so that
+/// heartbeats from a whole fleet of machines don't stay lined up with each other.
 ///@{
 ///@ingroup C_Classes
 
-static GSList*	_hb_senders = NULL;
-static gint	_hb_sender_count = 0;
+static GSList*		_hb_senders = NULL;
+static gint		_hb_sender_count = 0;
+static GPtrArray*	_hb_senddue = NULL;	///< Min-heap of HbSenders - ordered by nexttime
+static GSource*		_hb_sendtimer = NULL;	///< Goes off when the earliest heartbeat is due
+static double		_hb_jitter = HBSENDER_DEFAULT_JITTER;
+
+/// Our timer only has a ready time - glib takes care of waking us up when it arrives
+static GSourceFuncs _hbsender_timerfuncs = {
+	NULL,
+	NULL,
+	_hbsender_timer_dispatch,
+	NULL,
+	NULL,
+	NULL
+};
 
 #define	ONESEC	1000000
+#define	HBSENDER_TICK	(ONESEC/100)	///< Heartbeats due this close together go out together
+#define	HEAPITEM(index)	((HbSender*)g_ptr_array_index(_hb_senddue, (index)))
 
 /// Add an HbSender to our global list of HbSenders
 FSTATIC void
@@ -54,6 +84,15 @@ _hbsender_addlist(HbSender* self)	///<[in]The sender to add
 {
 	_hb_senders = g_slist_prepend(_hb_senders, self);
 	_hb_sender_count += 1;
+	if (NULL == _hb_senddue) {
+		_hb_senddue = g_ptr_array_new();
+	}
+	if (NULL == _hb_sendtimer) {
+		_hb_sendtimer = g_source_new(&_hbsender_timerfuncs, sizeof(GSource));
+		g_source_set_priority(_hb_sendtimer, G_PRIORITY_HIGH);
+		g_source_attach(_hb_sendtimer, NULL);
+	}
+	_hbsender_heap_insert(self);
 }
 
 /// Remove an HbSender from our global list of HbSenders
@@ -63,17 +102,162 @@ _hbsender_dellist(HbSender* self)	///<[in]The sender to remove from our list
 	if (g_slist_find(_hb_senders, self) != NULL) {
 		_hb_senders = g_slist_remove(_hb_senders, self);
 		_hb_sender_count -= 1;
+		_hbsender_heap_remove(self);
+		if (_hb_sender_count == 0 && _hb_sendtimer) {
+			// No point in keeping our timer around with no one to send to...
+			g_source_destroy(_hb_sendtimer);
+			g_source_unref(_hb_sendtimer);
+			_hb_sendtimer = NULL;
+		}
 		return;
 	}
 	g_warn_if_reached();
 }
 
-/// A GSourceFunc to be used with g_timeout_add_seconds()
+/// Exchange two entries in our heap of due times
+FSTATIC void
+_hbsender_heap_swap(guint i, guint j)
+{
+	HbSender*	si = HEAPITEM(i);
+	HbSender*	sj = HEAPITEM(j);
+	g_ptr_array_index(_hb_senddue, i) = sj;
+	g_ptr_array_index(_hb_senddue, j) = si;
+	sj->_heapindex = i;
+	si->_heapindex = j;
+}
+
+/// Move an entry toward the top of our heap until its parent is due no later than it is
+FSTATIC void
+_hbsender_heap_siftup(guint index)	///<[in] Index of entry to move
+{
+	while (index > 0) {
+		guint	parent = (index-1)/2;
+		if (HEAPITEM(parent)->nexttime <= HEAPITEM(index)->nexttime) {
+			break;
+		}
+		_hbsender_heap_swap(index, parent);
+		index = parent;
+	}
+}
+
+/// Move an entry toward the bottom of our heap until its children are due no earlier
+FSTATIC void
+_hbsender_heap_siftdown(guint index)	///<[in] Index of entry to move
+{
+	for (;;) {
+		guint	left = 2*index+1;
+		guint	right = left+1;
+		guint	earliest = index;
+		if (left < _hb_senddue->len
+		&&	HEAPITEM(left)->nexttime < HEAPITEM(earliest)->nexttime) {
+			earliest = left;
+		}
+		if (right < _hb_senddue->len
+		&&	HEAPITEM(right)->nexttime < HEAPITEM(earliest)->nexttime) {
+			earliest = right;
+		}
+		if (earliest == index) {
+			break;
+		}
+		_hbsender_heap_swap(index, earliest);
+		index = earliest;
+	}
+}
+
+/// Add an HbSender to our heap of due times - it doesn't hold a reference.
+FSTATIC void
+_hbsender_heap_insert(HbSender* self)	///<[in/out] Sender to add
+{
+	self->_heapindex = _hb_senddue->len;
+	g_ptr_array_add(_hb_senddue, self);
+	_hbsender_heap_siftup(self->_heapindex);
+	if (self->_heapindex == 0) {
+		_hbsender_set_timer();
+	}
+}
+
+/// Remove an HbSender from our heap of due times (if it's there)
+FSTATIC void
+_hbsender_heap_remove(HbSender* self)	///<[in/out] Sender to remove
+{
+	guint	index;
+	guint	last;
+	if (self->_heapindex < 0 || NULL == _hb_senddue) {
+		return;
+	}
+	index = self->_heapindex;
+	last = _hb_senddue->len - 1;
+	if (index != last) {
+		_hbsender_heap_swap(index, last);
+	}
+	g_ptr_array_remove_index(_hb_senddue, last);
+	self->_heapindex = -1;
+	if (index < _hb_senddue->len) {
+		// The entry we moved into the hole may belong above it or below it
+		HbSender*	moved = HEAPITEM(index);
+		_hbsender_heap_siftup(index);
+		_hbsender_heap_siftdown(moved->_heapindex);
+	}
+	if (index == 0) {
+		_hbsender_set_timer();
+	}
+}
+
+/// Arrange for our timer to go off when the earliest heartbeat is due
+FSTATIC void
+_hbsender_set_timer(void)
+{
+	if (NULL == _hb_sendtimer) {
+		return;
+	}
+	if (NULL == _hb_senddue || _hb_senddue->len == 0) {
+		g_source_set_ready_time(_hb_sendtimer, -1);
+		return;
+	}
+	g_source_set_ready_time(_hb_sendtimer, HEAPITEM(0)->nexttime);
+}
+
+/// Return how long until this sender's next heartbeat - its interval, give or take our jitter
+FSTATIC guint64
+_hbsender_nextinterval(HbSender* self)	///<[in] Sender to compute the interval for
+{
+	double	interval = (double)self->_expected_interval * ONESEC;
+	if (_hb_jitter > 0.0) {
+		interval *= g_random_double_range(1.0 - _hb_jitter, 1.0 + _hb_jitter);
+	}
+	return (guint64)interval;
+}
+
+/// GSource dispatch function for our timer - send every heartbeat that's due this tick
 FSTATIC gboolean
-_hbsender_gsourcefunc(gpointer gself) ///<[in/out] Pointer to 'self'
+_hbsender_timer_dispatch(GSource* source,	///<[unused] Our timer
+			 GSourceFunc callback,	///<[unused] Unused
+			 gpointer userdata)	///<[unused] Unused
 {
-	HbSender* self = CASTTOCLASS(HbSender, gself);
-	_hbsender_sendheartbeat(self);
+	guint64		now = g_get_monotonic_time();
+	GPtrArray*	due = g_ptr_array_new();
+	guint		j;
+
+	(void)source;
+	(void)callback;
+	(void)userdata;
+	while (_hb_senddue && _hb_senddue->len > 0 && HEAPITEM(0)->nexttime <= now + HBSENDER_TICK) {
+		HbSender*	sender = HEAPITEM(0);
+		_hbsender_heap_remove(sender);
+		g_ptr_array_add(due, sender);
+	}
+	_hbsender_sendbatch((HbSender**)due->pdata, due->len);
+	for (j=0; j < due->len; ++j) {
+		HbSender*	sender = g_ptr_array_index(due, j);
+		// Keep our phase - unless we've fallen so far behind that we'd have to catch up
+		sender->nexttime += _hbsender_nextinterval(sender);
+		if (sender->nexttime < now) {
+			sender->nexttime = now + _hbsender_nextinterval(sender);
+		}
+		_hbsender_heap_insert(sender);
+	}
+	g_ptr_array_free(due, TRUE);
+	_hbsender_set_timer();
 	return TRUE;
 }
 
@@ -97,13 +281,6 @@ _hbsender_unref(HbSender* self)	///<[in/out] Object to decrement reference count
 		self = NULL;
 	}
 }
-// Callback function from the GSource world - notifying us when we're getting shut down from their end
-FSTATIC void
-_hbsender_notify_function(gpointer data)
-{
-	HbSender* self = CASTTOCLASS(HbSender, data);
-	self->timeout_source = 0;
-}
 
 /// Finalize an HbSender
 FSTATIC void
@@ -112,9 +289,14 @@ _hbsender_finalize(HbSender * self) ///<[in/out] Sender to finalize
 	if (self->_sendaddr) {
 		UNREF(self->_sendaddr);
 	}
-	if (self->timeout_source != 0) {
-		g_source_remove(self->timeout_source);
-		self->timeout_source = 0;
+	if (self->_heartbeat) {
+		UNREF(self->_heartbeat);
+	}
+	if (self->_hbsignframe) {
+		UNREF2(self->_hbsignframe);
+	}
+	if (self->_hbcompressframe) {
+		UNREF2(self->_hbcompressframe);
 	}
 	memset(self, 0x00, sizeof(*self));
 	FREECLASSOBJ(self);
@@ -123,6 +305,8 @@ _hbsender_finalize(HbSender * self) ///<[in/out] Sender to finalize
 
 /// Construct a new HbSender - setting up timeout data structures for it.
 /// This can be used directly or by derived classes.
+/// Our first heartbeat goes out (with any others just created) as soon as we get back to
+/// the main loop.
 HbSender*
 hbsender_new(NetAddr* sendaddr,		///<[in] Address to send to
 	     NetGSource* outmethod,	///<[in] Mechanism for sending packets
@@ -144,9 +328,8 @@ hbsender_new(NetAddr* sendaddr,		///<[in] Address to send to
 		newsender->unref = _hbsender_unref;
 		newsender->_finalize = _hbsender_finalize;
 		newsender->_expected_interval = interval;
-		newsender->timeout_source = g_timeout_add_seconds_full
-					    (G_PRIORITY_HIGH, interval, _hbsender_gsourcefunc
-					,    newsender, _hbsender_notify_function);
+		newsender->nexttime = g_get_monotonic_time();
+		newsender->_heapindex = -1;
 		if (DEBUG) {
 			char *	addrstr = sendaddr->baseclass.toString(&sendaddr->baseclass);
 			g_debug("%s.%d: Start sending heartbeats to %s at interval "FMT_64BIT"d"
@@ -154,7 +337,6 @@ hbsender_new(NetAddr* sendaddr,		///<[in] Address to send to
 			FREE(addrstr);
 		}
 		_hbsender_addlist(newsender);
-		_hbsender_sendheartbeat(newsender);
 	}
 	return newsender;
 }
@@ -185,17 +367,98 @@ hbsender_stopsend(NetAddr* sendaddr)///<[in/out] Sender to remove from list
 FSTATIC void
 _hbsender_sendheartbeat(HbSender* self)
 {
-	FrameSet*	heartbeat = frameset_new(FRAMESETTYPE_HEARTBEAT);
-	//g_debug("Sending a heartbeat...");
-	if (DEBUG >= 4) {
-		char *	addrstr = self->_sendaddr->baseclass.toString(self->_sendaddr);
-		g_debug("%s.%d: Sending heartbeat to %s at interval "FMT_64BIT"d"
-		,	__FUNCTION__, __LINE__, addrstr, self->_expected_interval);
-		FREE(addrstr);
+	_hbsender_sendbatch(&self, 1);
+}
+
+/// Send out a heartbeat for each of the given senders - in as few system calls as possible
+FSTATIC void
+_hbsender_sendbatch(HbSender** senders,	///<[in] Senders whose heartbeats are due
+		    guint count)	///<[in] How many of them there are
+{
+	FrameSet**	heartbeats;
+	NetAddr**	dests;
+	guint		first;
+	guint		j;
+
+	if (count == 0) {
+		return;
 	}
-	self->_outmethod->sendaframeset(self->_outmethod, self->_sendaddr, heartbeat);
-	UNREF(heartbeat);
+	heartbeats = g_new(FrameSet*, count);
+	dests = g_new(NetAddr*, count);
+	for (j=0; j < count; ++j) {
+		_hbsender_checkpacket(senders[j]);
+		heartbeats[j] = senders[j]->_heartbeat;
+		dests[j] = senders[j]->_sendaddr;
+		if (DEBUG >= 4) {
+			char *	addrstr = dests[j]->baseclass.toString(dests[j]);
+			g_debug("%s.%d: Sending heartbeat to %s at interval "FMT_64BIT"d"
+			,	__FUNCTION__, __LINE__, addrstr, senders[j]->_expected_interval);
+			FREE(addrstr);
+		}
+	}
+	// Everyone going out the same way goes out together
+	for (first=0; first < count; first = j) {
+		NetGSource*	outmethod = senders[first]->_outmethod;
+		for (j=first+1; j < count && senders[j]->_outmethod == outmethod; ++j) {
+			/* Nothing */
+		}
+		outmethod->sendbatch(outmethod, dests+first, heartbeats+first, j-first);
+	}
+	g_free(heartbeats);
+	g_free(dests);
 }
+
+/// Make sure our heartbeat's packet is still good to send as it is - or rebuild it.
+/// Our heartbeat has nothing in it that changes, so its packet is good for as long as our
+/// signature and compression methods and our keys stay the same - a few comparisons.
+/// That goes for encrypted packets too: our peer can't tell a resent copy from a new one,
+/// but then it can't tell a replayed one either - heartbeats have no sequence numbers.
+FSTATIC void
+_hbsender_checkpacket(HbSender* self)	///<[in/out] Sender whose packet we're checking
+{
+	NetIO*		io = self->_outmethod->_netio;
+	SignFrame*	signframe = io->signframe(io);
+	CompressFrame*	compressframe = io->compressframe(io);
+	guint64		keygen = cryptframe_key_generation();
+	CryptFrame*	cryptframe;
+
+	if (NULL == self->_heartbeat) {
+		self->_heartbeat = frameset_new(FRAMESETTYPE_HEARTBEAT);
+	}
+	// We hold references to these frames - so neither of their addresses can be reused
+	if (self->_heartbeat->packet && keygen == self->_hbkeygen
+	&&	signframe == self->_hbsignframe
+	&&	compressframe == self->_hbcompressframe) {
+		return;
+	}
+	DEBUGMSG3("%s.%d: heartbeat packet will be (re)built", __FUNCTION__, __LINE__);
+	if (self->_hbsignframe) {
+		UNREF2(self->_hbsignframe);
+	}
+	if (self->_hbcompressframe) {
+		UNREF2(self->_hbcompressframe);
+	}
+	self->_hbsignframe = signframe;
+	REF2(signframe);
+	self->_hbcompressframe = compressframe;
+	if (compressframe) {
+		REF2(compressframe);
+	}
+	self->_hbkeygen = keygen;
+	cryptframe = cryptframe_new_by_destaddr(self->_sendaddr);
+	frameset_construct_packet(self->_heartbeat, signframe, cryptframe, compressframe);
+	if (cryptframe) {
+		UNREF2(cryptframe);
+	}
+}
+
+/// Set the fraction of its interval by which each heartbeat interval is randomly varied
+void
+hbsender_set_jitter(double jitter)	///<[in] Fraction of the interval (0 to disable)
+{
+	_hb_jitter = CLAMP(jitter, 0.0, 0.5);
+}
+
 /// Stop sending heartbeats to anyone...
 void
 hbsender_stopallsenders(void)
@@ -204,5 +467,9 @@ hbsender_stopallsenders(void)
 		HbSender* sender = CASTTOCLASS(HbSender, _hb_senders->data);
 		sender->unref(sender);
 	}
+	if (_hb_senddue) {
+		g_ptr_array_free(_hb_senddue, TRUE);
+		_hb_senddue = NULL;
+	}
 }
 ///@}
@@ -35,9 +35,15 @@
 #include <jsondiscovery.h>
 #include <assert.h>
 #include <fsprotocol.h>
+#include <misc.h>
+#include <discoverytrigger.h>
 ///@defgroup JsonDiscoveryClass JSON discovery class.
 /// JSONDiscovery class - supporting the discovery of various things through scripts that
 /// produce JSON output to stdout.  Parameters are passed to these scripts through the environment.
+/// When there is a native (in-process) version of a script (see nativediscovery_register()),
+/// we call it instead - unless @ref CONFIGNAME_NATIVEDISC is false.
+/// Discovery instances are rerun when the events in their @ref CONFIGNAME_TRIGGERS parameter happen.
+/// Without that parameter, they get the default triggers for their discovery type (if any).
 /// @{
 /// @ingroup DiscoveryClass
 
@@ -46,8 +52,33 @@ FSTATIC void		_jsondiscovery_finalize(AssimObj* self);
 FSTATIC gboolean	_jsondiscovery_discover(Discovery* dself);
 FSTATIC void		_jsondiscovery_childwatch(ChildProcess*, enum HowDied, int rc, int signal, gboolean core_dumped);
 FSTATIC void		_jsondiscovery_fullpath(JsonDiscovery* self);
+FSTATIC gboolean	_jsondiscovery_native(JsonDiscovery* self);
+FSTATIC gpointer	_jsondiscovery_nativethread(gpointer vself);
+FSTATIC gboolean	_jsondiscovery_nativedone(gpointer vself);
+FSTATIC gboolean	_jsondiscovery_runagent(JsonDiscovery* self);
+FSTATIC void		_jsondiscovery_subscribe(JsonDiscovery* self, const char * discoverytype);
 DEBUGDECLARATIONS;
 
+/// Where package managers keep track of what's installed
+#define	JSONDISCOVERY_PKGDBS	"/var/lib/dpkg/status /var/lib/rpm/Packages /var/lib/rpm/rpmdb.sqlite"
+
+/// Default triggers (blank-separated) for discovery types - see discoverytrigger.h
+static const struct {
+	const char *	discoverytype;
+	const char *	triggers;
+} _jsondiscovery_deftriggers[] = {
+	{"netconfig",		"netlink:link netlink:addr"},
+	{"tcpdiscovery",	"netlink:addr " JSONDISCOVERY_PKGDBS},
+	{"packages",		JSONDISCOVERY_PKGDBS},
+	{"commands",		JSONDISCOVERY_PKGDBS},
+	{"monitoringagents",	JSONDISCOVERY_PKGDBS},
+	{"checksums",		JSONDISCOVERY_PKGDBS},
+	{"sshd",		"/etc/ssh/sshd_config"},
+	{"nsswitch",		"/etc/nsswitch.conf"},
+	{"pam",			"/etc/pam.d"},
+	{"ulimit",		"/etc/security/limits.conf /etc/security/limits.d"},
+};
+
 /// Return how often we are scheduled to perform this particular discovery action
 FSTATIC guint
 _jsondiscovery_discoverintervalsecs(const Discovery* dself)	///<[in] Object whose interval to return
@@ -75,22 +106,120 @@ _jsondiscovery_finalize(AssimObj* dself)	///<[in/out] Object to finalize (free)
 	_discovery_finalize(dself);
 }
 
+/// Perform our discovery in-process - if we have a native version of our agent, and we're allowed to.
+/// Native discovery runs in a thread of its own so it can take its time without holding up our
+/// main loop.  It gets the environment our agent would have gotten, and never sees any of our objects.
+/// @return TRUE if we started it
+FSTATIC gboolean
+_jsondiscovery_native(JsonDiscovery* self)	///<[in/out] Object to discover for
+{
+	ConfigContext*	cfg = self->baseclass._config;
+	GThread*	thread;
+	GError*		err = NULL;
+
+	if (NULL == self->_native
+	||	(cfg->gettype(cfg, CONFIGNAME_NATIVEDISC) == CFG_BOOL
+	&&	 !cfg->getbool(cfg, CONFIGNAME_NATIVEDISC))) {
+		return FALSE;
+	}
+	DEBUGMSG1("Running native discovery [%s]", self->_fullpath);
+	self->_nativeenv = assim_merge_environ(NULL, self->jsonparams);
+	self->_nativeout = g_string_sized_new(4096);
+	self->_nativeok = FALSE;
+	// Don't want us going away while our thread is out there...
+	REF2(self);
+	thread = g_thread_try_new(self->logprefix, _jsondiscovery_nativethread, self, &err);
+	if (NULL == thread) {
+		g_warning("%s.%d: Cannot create native discovery thread for [%s]: %s"
+		,	__FUNCTION__, __LINE__, self->_fullpath, err->message);
+		g_clear_error(&err);
+		assim_free_environ(self->_nativeenv);
+		self->_nativeenv = NULL;
+		g_string_free(self->_nativeout, TRUE);
+		self->_nativeout = NULL;
+		UNREF2(self);
+		return FALSE;
+	}
+	g_thread_unref(thread);
+	// Our discovery scheduler counts us as running until _jsondiscovery_nativedone
+	self->baseclass._inprogress = TRUE;
+	return TRUE;
+}
+
+/// Native discovery thread - runs our native discovery function, then hands its output
+/// back to the main loop.  No CASTTOCLASS here - our class system isn't thread-safe.
+FSTATIC gpointer
+_jsondiscovery_nativethread(gpointer vself)	///<[in/out] JsonDiscovery object to discover for
+{
+	JsonDiscovery*	self = (JsonDiscovery*)vself;
+
+	self->_nativeok = self->_native(self->_nativeout, self->_fullpath
+	,			(const gchar* const*)self->_nativeenv);
+	g_idle_add(_jsondiscovery_nativedone, self);
+	return NULL;
+}
+
+/// Called from the main loop when our native discovery thread finishes
+FSTATIC gboolean
+_jsondiscovery_nativedone(gpointer vself)	///<[in/out] JsonDiscovery object we discovered for
+{
+	JsonDiscovery*	self = CASTTOCLASS(JsonDiscovery, vself);
+	GString*	json = self->_nativeout;
+	gsize		jsonlen = json->len;
+
+	self->_nativeout = NULL;
+	assim_free_environ(self->_nativeenv);
+	self->_nativeenv = NULL;
+	if (!self->_nativeok) {
+		// It couldn't do it this time - our agent will have to
+		DEBUGMSG1("Native discovery [%s] declined - running agent.", self->_fullpath);
+		g_string_free(json, TRUE);
+		if (!_jsondiscovery_runagent(self)) {
+			discovery_complete(&self->baseclass);
+		}
+	}else{
+		++ self->baseclass.discovercount;
+		if (jsonlen == 0) {
+			g_warning("Native JSON discovery [%s] produced no output.", self->_fullpath);
+			g_string_free(json, TRUE);
+		}else{
+			self->baseclass.sendjson(&self->baseclass, g_string_free(json, FALSE), jsonlen);
+		}
+		discovery_complete(&self->baseclass);
+	}
+	// We did a 'ref' in _jsondiscovery_native above
+	UNREF2(self);
+	return FALSE;
+}
+
 /// Perform the requested discovery action
 FSTATIC gboolean
 _jsondiscovery_discover(Discovery* dself)
 {
 	JsonDiscovery*	self = CASTTOCLASS(JsonDiscovery, dself);
-	gchar*		argv[3];
-	static char	discoverword [] =  "discover";
-	ConfigContext*	cfg = dself->_config;
 
 	dself->starttime = g_get_real_time();
 	
-	if (NULL != self->child) {
-		g_warning("%s.%d: JSON discovery process still running - skipping this iteration."
+	if (NULL != self->child || NULL != self->_nativeout) {
+		g_warning("%s.%d: JSON discovery still running - skipping this iteration."
 		,	  __FUNCTION__, __LINE__);
 		return TRUE;
 	}
+	if (_jsondiscovery_native(self)) {
+		return TRUE;
+	}
+	return _jsondiscovery_runagent(self);
+}
+
+/// Run our discovery agent
+/// @return TRUE if we started it
+FSTATIC gboolean
+_jsondiscovery_runagent(JsonDiscovery* self)	///<[in/out] Object to discover for
+{
+	gchar*		argv[3];
+	static char	discoverword [] =  "discover";
+	ConfigContext*	cfg = self->baseclass._config;
+
 	++ self->baseclass.discovercount;
 	if (cfg->getaddr(cfg, CONFIGNAME_CMADISCOVER) == NULL) {
 		DEBUGMSG2("%s.%d: don't have [%s] address yet - continuing." 
@@ -125,6 +254,8 @@ _jsondiscovery_discover(Discovery* dself)
 	
 	// Don't want us going away while we have a child out there...
 	REF2(self);
+	// Our discovery scheduler counts us as running until _jsondiscovery_childwatch
+	self->baseclass._inprogress = TRUE;
 	return TRUE;
 }
 /// Watch our child - we get called when our child process exits
@@ -170,12 +301,48 @@ _jsondiscovery_childwatch(ChildProcess* child			///< The @ref ChildProcess objec
 quitchild:
 	UNREF(self->child);
 	self->child = child = NULL;
+	discovery_complete(&self->baseclass);
 	// We did a 'ref' in _jsondiscovery_discover above to keep us from disappearing while
 	// our child process was running.
 	UNREF2(self);
 }
 
 
+/// Subscribe to the events which should trigger this discovery instance
+FSTATIC void
+_jsondiscovery_subscribe(JsonDiscovery* self,		///<[in/out] Object to trigger
+			 const char * discoverytype)	///<[in] Its discovery type
+{
+	ConfigContext*	params = self->jsonparams;
+	GSList*		triggers;
+	guint		j;
+
+	if (params->gettype(params, CONFIGNAME_TRIGGERS) == CFG_ARRAY) {
+		// An empty array means no triggers at all
+		for (triggers = params->getarray(params, CONFIGNAME_TRIGGERS); triggers
+		;	triggers = triggers->next) {
+			ConfigValue*	trigger = CASTTOCLASS(ConfigValue, triggers->data);
+			if (trigger->valtype == CFG_STRING) {
+				discoverytrigger_subscribe(&self->baseclass, trigger->u.strvalue);
+			}
+		}
+		return;
+	}
+	for (j=0; j < DIMOF(_jsondiscovery_deftriggers); ++j) {
+		char **	defaults;
+		int	k;
+		if (strcmp(discoverytype, _jsondiscovery_deftriggers[j].discoverytype) != 0) {
+			continue;
+		}
+		defaults = g_strsplit(_jsondiscovery_deftriggers[j].triggers, " ", -1);
+		for (k=0; defaults[k]; ++k) {
+			discoverytrigger_subscribe(&self->baseclass, defaults[k]);
+		}
+		g_strfreev(defaults);
+		break;
+	}
+}
+
 /// JsonDiscovery constructor.
 JsonDiscovery*
 jsondiscovery_new(const char *  discoverytype,	///<[in] type of this JSON discovery object
@@ -186,10 +353,12 @@ jsondiscovery_new(const char *  discoverytype,	///<[in] type of this JSON discov
 		  ConfigContext*context,	///<[in/out] Configuration context
 		  gsize		objsize)	///<[in] number of bytes to malloc for the object (or zero)
 {
+	static gboolean	pluginsloaded = FALSE;
 	const char *	basedir = NULL;
 	ConfigContext*	jsonparams;
 	JsonDiscovery*	ret;
 	char *		fullpath;
+	NativeDiscoveryFunc native;
 
 	BINDDEBUG(JsonDiscovery);
 	g_return_val_if_fail(jsoninst != NULL, NULL);
@@ -200,9 +369,16 @@ jsondiscovery_new(const char *  discoverytype,	///<[in] type of this JSON discov
 	if (NULL == basedir) {
 		basedir = JSONAGENTROOT;
 	}
+	if (!pluginsloaded) {
+		const char *	plugindir = context->getstring(context, "NATIVEDISCOVERYROOT");
+		pluginsloaded = TRUE;
+		nativediscovery_loadplugins(plugindir ? plugindir : NATIVEDISCOVERYROOT);
+	}
+	native = nativediscovery_find(discoverytype);
 	fullpath = g_build_filename(basedir, discoverytype, NULL);
-	if (	!g_file_test(fullpath, G_FILE_TEST_IS_REGULAR)
-	||	!g_file_test(fullpath, G_FILE_TEST_IS_EXECUTABLE)) {
+	// Plugins may implement discovery types which have no agent at all
+	if (NULL == native && (!g_file_test(fullpath, G_FILE_TEST_IS_REGULAR)
+	||	!g_file_test(fullpath, G_FILE_TEST_IS_EXECUTABLE))) {
 		g_warning("%s.%d: No such JSON discovery agent [%s]", __FUNCTION__, __LINE__
 		,	fullpath);
 		g_free(fullpath); fullpath = NULL;
@@ -213,6 +389,7 @@ jsondiscovery_new(const char *  discoverytype,	///<[in] type of this JSON discov
 			,	      objsize < sizeof(JsonDiscovery) ? sizeof(JsonDiscovery) : objsize));
 	g_return_val_if_fail(ret != NULL, NULL);
 	ret->_fullpath = fullpath;
+	ret->_native = native;
 	ret->baseclass.discoverintervalsecs	= _jsondiscovery_discoverintervalsecs;
 	ret->baseclass.baseclass._finalize	= _jsondiscovery_finalize;
 	ret->baseclass.discover			= _jsondiscovery_discover;
@@ -223,6 +400,7 @@ jsondiscovery_new(const char *  discoverytype,	///<[in] type of this JSON discov
 	DEBUGMSG2("%s.%d: FULLPATH=[%s] discoverytype[%s]"
 	,	__FUNCTION__, __LINE__, ret->_fullpath, discoverytype);
 	discovery_register(&ret->baseclass);
+	_jsondiscovery_subscribe(ret, discoverytype);
 	return ret;
 }
 ///@}
@@ -0,0 +1,447 @@
+/**
+ * @file
+ * @brief Implements the @ref MarshalPool class - threads for marshalling and unmarshalling packets
+ * @details Large @ref FrameSet objects are signed, encrypted and compressed (and their packets are
+ * verified, decrypted and decompressed) by our worker threads instead of on the main loop.
+ * Finished work is handed back to the main loop through an idle source.
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+#include <projectcommon.h>
+#include <memory.h>
+#include <proj_classes.h>
+#include <marshalpool.h>
+#include <misc.h>
+
+DEBUGDECLARATIONS
+
+/// @defgroup MarshalPool MarshalPool class
+///@{
+/// @ingroup C_Classes
+/// A @ref MarshalPool is a set of threads which build packets from large @ref FrameSet objects,
+/// and decode large packets back into @ref FrameSet objects.
+/// To keep per-connection ordering intact, all the work for a given peer (address and port)
+/// goes through a single queue, and only the head of that queue is ever being worked on.
+/// Once a peer has work queued, even small work for that peer goes through our queue.
+/// Everything except the actual marshalling and unmarshalling happens on the main loop thread.
+
+typedef struct _MarshalJob MarshalJob;
+/// One unit of marshalling or unmarshalling work
+struct _MarshalJob {
+	MarshalPool*	pool;		///< Pool this work belongs to
+	GQueue*		peerq;		///< Per-peer queue we're on - we're running if we're its head
+	gboolean	forsending;	///< TRUE if marshalling, FALSE if unmarshalling
+	NetAddr*	addr;		///< Destination or source address
+	FrameSet*	fs;		///< Our private copy of the FrameSet to marshal
+	SignFrame*	signframe;	///< Signature frame to marshal with
+	CryptFrame*	cryptframe;	///< Encryption frame to marshal with (or NULL)
+	CompressFrame*	compressframe;	///< Compression frame to marshal with (or NULL)
+	gpointer	pkt;		///< Packet to unmarshal
+	gpointer	pktend;		///< One byte past the end of pkt
+	gint64		arrivaltime;	///< When pkt arrived (monotonic clock)
+	GSList*		result;		///< Unmarshalled FrameSets
+};
+
+FSTATIC void		_marshalpool_finalize(AssimObj* aself);
+FSTATIC gboolean	_marshalpool_marshal(MarshalPool* self, const NetAddr* dest, FrameSet* fs
+,			SignFrame* signframe, CryptFrame* cryptframe, CompressFrame* compressframe);
+FSTATIC gboolean	_marshalpool_unmarshal(MarshalPool* self, gpointer pkt, gpointer pktend
+,			NetAddr* srcaddr, gint64 arrivaltime);
+FSTATIC gboolean	_marshalpool_recvready(const MarshalPool* self);
+FSTATIC GSList*		_marshalpool_nextrecv(MarshalPool* self, NetAddr** srcaddr);
+FSTATIC gsize		_marshalpool_fssize(FrameSet* fs);
+FSTATIC void		_marshalpool_enqueue(MarshalPool* self, GHashTable* peers, MarshalJob* job);
+FSTATIC void		_marshalpool_work(gpointer vjob, gpointer vself);
+FSTATIC gboolean	_marshalpool_deliver(gpointer vself);
+FSTATIC void		_marshalpool_job_free(MarshalJob* job);
+FSTATIC void		_marshalpool_peerq_free(gpointer vpeerq);
+
+/// Return the approximate size of the packet this FrameSet will make
+FSTATIC gsize
+_marshalpool_fssize(FrameSet* fs)
+{
+	gsize	size = FRAMESET_INITSIZE;
+	GSList*	curframe;
+
+	for (curframe=fs->framelist; curframe != NULL; curframe = g_slist_next(curframe)) {
+		Frame* frame = CASTTOCLASS(Frame, curframe->data);
+		size += frame->dataspace(frame);
+	}
+	return size;
+}
+
+/// Free a @ref MarshalJob and everything it holds on to
+FSTATIC void
+_marshalpool_job_free(MarshalJob* job)
+{
+	if (job->fs) {
+		UNREF(job->fs);
+	}
+	if (job->signframe) {
+		UNREF2(job->signframe);
+	}
+	if (job->cryptframe) {
+		UNREF2(job->cryptframe);
+	}
+	if (job->compressframe) {
+		UNREF2(job->compressframe);
+	}
+	if (job->addr) {
+		UNREF(job->addr);
+	}
+	if (job->pkt) {
+		FREE(job->pkt);
+		job->pkt = NULL;
+	}
+	if (job->result) {
+		g_slist_free_full(job->result, assim_g_notify_unref);
+		job->result = NULL;
+	}
+	FREE(job);
+}
+
+/// Put a job on the queue for its peer - starting it if the peer was idle
+FSTATIC void
+_marshalpool_enqueue(MarshalPool* self, GHashTable* peers, MarshalJob* job)
+{
+	GQueue*	peerq = g_hash_table_lookup(peers, job->addr);
+
+	if (NULL == peerq) {
+		peerq = g_queue_new();
+		REF(job->addr);
+		g_hash_table_insert(peers, job->addr, peerq);
+	}
+	job->peerq = peerq;
+	g_queue_push_tail(peerq, job);
+	if (g_queue_get_length(peerq) == 1) {
+		g_thread_pool_push(self->_threads, job, NULL);
+	}
+}
+
+/// Take a FrameSet to marshal and send (if it's large, or its destination already has work queued)
+/// @return TRUE if we took it, FALSE if the caller should marshal it inline as usual
+FSTATIC gboolean
+_marshalpool_marshal(MarshalPool* self		///<[in/out] us
+,		const NetAddr* dest		///<[in] Where to send it
+,		FrameSet* fs			///<[in] FrameSet to send
+,		SignFrame* signframe		///<[in] Signature frame
+,		CryptFrame* cryptframe		///<[in] Encryption frame or NULL
+,		CompressFrame* compressframe)	///<[in] Compression frame or NULL
+{
+	MarshalJob*	job;
+	NetAddr*	addr;
+	GSList*		curframe;
+
+	g_return_val_if_fail(self != NULL && dest != NULL && fs != NULL && signframe != NULL, FALSE);
+	addr = dest->toIPv6(dest);
+	if (NULL == g_hash_table_lookup(self->_sendpeers, addr)
+	&&	_marshalpool_fssize(fs) < self->threshold) {
+		UNREF(addr);
+		return FALSE;
+	}
+	job = MALLOC0(sizeof(*job));
+	if (NULL == job) {
+		UNREF(addr);
+		return FALSE;
+	}
+	job->pool = self;
+	job->forsending = TRUE;
+	job->addr = addr;
+	// Our caller (or FsProtocol) can keep using the original while we marshal this one.
+	job->fs = frameset_new(fs->fstype);
+	job->fs->fsflags = fs->fsflags;
+	for (curframe=fs->framelist; curframe != NULL; curframe = g_slist_next(curframe)) {
+		frameset_append_frame(job->fs, CASTTOCLASS(Frame, curframe->data));
+	}
+	REF2(signframe);
+	job->signframe = signframe;
+	if (cryptframe) {
+		REF2(cryptframe);
+		job->cryptframe = cryptframe;
+	}
+	if (compressframe) {
+		REF2(compressframe);
+		job->compressframe = compressframe;
+	}
+	DEBUGMSG3("%s.%d: queueing FrameSet of type %d for marshalling", __FUNCTION__, __LINE__
+	,	fs->fstype);
+	_marshalpool_enqueue(self, self->_sendpeers, job);
+	return TRUE;
+}
+
+/// Take a packet to unmarshal (if it's large, or its source already has work queued)
+/// @return TRUE if we took it (and the packet now belongs to us), FALSE if the caller should
+/// decode it inline as usual
+FSTATIC gboolean
+_marshalpool_unmarshal(MarshalPool* self	///<[in/out] us
+,		gpointer pkt			///<[in] MALLOCed packet
+,		gpointer pktend			///<[in] One byte past end of pkt
+,		NetAddr* srcaddr		///<[in] Where it came from
+,		gint64 arrivaltime)		///<[in] When it arrived (monotonic clock)
+{
+	MarshalJob*	job;
+
+	g_return_val_if_fail(self != NULL && pkt != NULL && srcaddr != NULL, FALSE);
+	if (NULL == g_hash_table_lookup(self->_recvpeers, srcaddr)
+	&&	(gsize)((guint8*)pktend - (guint8*)pkt) < self->threshold) {
+		return FALSE;
+	}
+	job = MALLOC0(sizeof(*job));
+	if (NULL == job) {
+		return FALSE;
+	}
+	job->pool = self;
+	job->forsending = FALSE;
+	REF(srcaddr);
+	job->addr = srcaddr;
+	job->pkt = pkt;
+	job->pktend = pktend;
+	job->arrivaltime = arrivaltime;
+	_marshalpool_enqueue(self, self->_recvpeers, job);
+	return TRUE;
+}
+
+/// Worker thread function: marshal or unmarshal a single job, then ask the main loop to deliver it
+/// Nothing in here may touch anything other than the job itself.
+FSTATIC void
+_marshalpool_work(gpointer vjob, gpointer vself)
+{
+	MarshalJob*	job = vjob;
+	MarshalPool*	self = vself;
+	GSList*		fsl;
+
+	if (job->forsending) {
+		// Encryption looks up keys too - and the main thread might be changing them
+		cryptframe_lock_keys();
+		frameset_construct_packet(job->fs, job->signframe, job->cryptframe, job->compressframe);
+		cryptframe_unlock_keys();
+	}else{
+		// Decryption looks up (and might cache) keys
+		cryptframe_lock_keys();
+		job->result = self->_decoder->pktdata_to_framesetlist(self->_decoder
+		,	job->pkt, job->pktend);
+		cryptframe_unlock_keys();
+		for (fsl = job->result; fsl != NULL; fsl = fsl->next) {
+			((FrameSet*)fsl->data)->arrivaltime = job->arrivaltime;
+		}
+		FREE(job->pkt);
+		job->pkt = NULL;
+	}
+	g_mutex_lock(self->_lock);
+	g_queue_push_tail(self->_done, job);
+	if (0 == self->_doneid) {
+		GSource*	src = g_idle_source_new();
+		g_source_set_callback(src, _marshalpool_deliver, self, NULL);
+		self->_doneid = g_source_attach(src, self->_context);
+		g_source_unref(src);
+	}
+	g_mutex_unlock(self->_lock);
+}
+
+/// Main loop idle function: hand back finished work in the order it finished,
+/// and start the next job queued for each peer we finished something for.
+FSTATIC gboolean
+_marshalpool_deliver(gpointer vself)
+{
+	MarshalPool*	self = CASTTOCLASS(MarshalPool, vself);
+	GQueue*		done;
+	MarshalJob*	job;
+
+	g_mutex_lock(self->_lock);
+	done = self->_done;
+	self->_done = g_queue_new();
+	self->_doneid = 0;
+	g_mutex_unlock(self->_lock);
+
+	while (NULL != (job = g_queue_pop_head(done))) {
+		GHashTable*	peers = (job->forsending ? self->_sendpeers : self->_recvpeers);
+		GQueue*		peerq = job->peerq;
+
+		if (g_queue_pop_head(peerq) != job) {
+			g_critical("%s.%d: MarshalPool peer queue out of order", __FUNCTION__, __LINE__);
+		}
+		if (job->forsending) {
+			self->marshalcount++;
+			if (job->fs->packet) {
+				self->_sendfunc(self->_owner, job->fs, job->addr);
+			}
+		}else{
+			self->unmarshalcount++;
+		}
+		if (g_queue_is_empty(peerq)) {
+			// Frees the queue too
+			g_hash_table_remove(peers, job->addr);
+		}else{
+			g_thread_pool_push(self->_threads, g_queue_peek_head(peerq), NULL);
+		}
+		if (job->forsending) {
+			_marshalpool_job_free(job);
+		}else if (NULL == job->result) {
+			g_warning("%s.%d: Received a packet that didn't make any FrameSets"
+			,	__FUNCTION__, __LINE__);
+			_marshalpool_job_free(job);
+		}else{
+			job->peerq = NULL;
+			g_queue_push_tail(self->_received, job);
+		}
+	}
+	g_queue_free(done);
+	return FALSE;
+}
+
+/// Return TRUE if we have unmarshalled FrameSets ready to read
+FSTATIC gboolean
+_marshalpool_recvready(const MarshalPool* self)
+{
+	return !g_queue_is_empty(self->_received);
+}
+
+/// Return the next list of unmarshalled FrameSets - and where they came from
+FSTATIC GSList*
+_marshalpool_nextrecv(MarshalPool* self		///<[in/out] us
+,		      NetAddr** srcaddr)	///<[out] source address of returned FrameSets
+{
+	MarshalJob*	job = g_queue_pop_head(self->_received);
+	GSList*		ret;
+
+	if (NULL == job) {
+		*srcaddr = NULL;
+		return NULL;
+	}
+	ret = job->result;
+	job->result = NULL;
+	*srcaddr = job->addr;
+	job->addr = NULL;
+	_marshalpool_job_free(job);
+	return ret;
+}
+
+/// Free one of our per-peer queues (and any work left in it)
+FSTATIC void
+_marshalpool_peerq_free(gpointer vpeerq)
+{
+	GQueue*		peerq = vpeerq;
+	MarshalJob*	job;
+
+	while (NULL != (job = g_queue_pop_head(peerq))) {
+		_marshalpool_job_free(job);
+	}
+	g_queue_free(peerq);
+}
+
+/// Finalize (free) our @ref MarshalPool object - discarding any work still in progress
+FSTATIC void
+_marshalpool_finalize(AssimObj* aself)
+{
+	MarshalPool*	self = CASTTOCLASS(MarshalPool, aself);
+	MarshalJob*	job;
+
+	if (self->_threads) {
+		// Wait for running jobs to finish - and drop those which haven't started
+		g_thread_pool_free(self->_threads, TRUE, TRUE);
+		self->_threads = NULL;
+	}
+	g_mutex_lock(self->_lock);
+	if (self->_doneid) {
+		GSource*	src = g_main_context_find_source_by_id(self->_context, self->_doneid);
+		if (src) {
+			g_source_destroy(src);
+		}
+		self->_doneid = 0;
+	}
+	g_mutex_unlock(self->_lock);
+	// Jobs in _done are still on their peer queues - and get freed with them
+	g_queue_free(self->_done);
+	self->_done = NULL;
+	g_hash_table_destroy(self->_sendpeers);
+	self->_sendpeers = NULL;
+	g_hash_table_destroy(self->_recvpeers);
+	self->_recvpeers = NULL;
+	while (NULL != (job = g_queue_pop_head(self->_received))) {
+		_marshalpool_job_free(job);
+	}
+	g_queue_free(self->_received);
+	self->_received = NULL;
+	g_mutex_clear(self->_lock);
+	FREE(self->_lock);
+	self->_lock = NULL;
+	if (self->_decoder) {
+		UNREF(self->_decoder);
+	}
+	if (self->_context) {
+		g_main_context_unref(self->_context);
+		self->_context = NULL;
+	}
+	_assimobj_finalize(aself);
+}
+
+/// Construct a new @ref MarshalPool object
+MarshalPool*
+marshalpool_new(gsize objsize			///<[in] size of object to create (or zero)
+,		guint nthreads			///<[in] number of worker threads
+,		gsize threshold			///<[in] Work at least this large goes to our threads
+,		PacketDecoder* decoder		///<[in] Decoder for unmarshalling packets
+,		MarshalPoolSendFunc sendfunc	///<[in] Function to send marshalled packets
+,		gpointer owner			///<[in] First argument to sendfunc
+,		GMainContext* context)		///<[in] Context to deliver results in (NULL: default)
+{
+	AssimObj*	aself;
+	MarshalPool*	self;
+	GError*		err = NULL;
+
+	BINDDEBUG(MarshalPool);
+	g_return_val_if_fail(nthreads > 0 && decoder != NULL && sendfunc != NULL, NULL);
+	if (objsize < sizeof(MarshalPool)) {
+		objsize = sizeof(MarshalPool);
+	}
+	// Our threads create, cast and free objects...
+	proj_class_enable_threads();
+	aself = assimobj_new(objsize);
+	self = NEWSUBCLASS(MarshalPool, aself);
+	aself->_finalize = _marshalpool_finalize;
+	self->marshal = _marshalpool_marshal;
+	self->unmarshal = _marshalpool_unmarshal;
+	self->recvready = _marshalpool_recvready;
+	self->nextrecv = _marshalpool_nextrecv;
+	self->threshold = threshold;
+	self->_lock = MALLOC0(sizeof(GMutex));
+	g_mutex_init(self->_lock);
+	self->_done = g_queue_new();
+	self->_received = g_queue_new();
+	self->_sendpeers = g_hash_table_new_full(netaddr_g_hash_hash, netaddr_g_hash_equal
+	,	assim_g_notify_unref, _marshalpool_peerq_free);
+	self->_recvpeers = g_hash_table_new_full(netaddr_g_hash_hash, netaddr_g_hash_equal
+	,	assim_g_notify_unref, _marshalpool_peerq_free);
+	REF(decoder);
+	self->_decoder = decoder;
+	self->_sendfunc = sendfunc;
+	self->_owner = owner;
+	self->_context = (context ? g_main_context_ref(context) : NULL);
+	self->_threads = g_thread_pool_new(_marshalpool_work, self, nthreads, FALSE, &err);
+	if (NULL == self->_threads) {
+		g_warning("%s.%d: Cannot create %d marshalling threads: %s", __FUNCTION__, __LINE__
+		,	nthreads, (err ? err->message : "unknown error"));
+		if (err) {
+			g_error_free(err);
+		}
+		UNREF(self);
+		return NULL;
+	}
+	return self;
+}
+///@}
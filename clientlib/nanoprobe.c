@@ -46,6 +46,7 @@
 #include <configcontext.h>
 #include <pcap_min.h>
 #include <jsondiscovery.h>
+#include <discoverytrigger.h>
 #include <switchdiscovery.h>
 #include <arpdiscovery.h>
 #include <fsprotocol.h>
@@ -80,6 +81,7 @@ FSTATIC void		nanoobey_incrdebug(AuthListener*, FrameSet*, NetAddr*);
 FSTATIC void		nanoobey_decrdebug(AuthListener*, FrameSet*, NetAddr*);
 FSTATIC void		nanoobey_startdiscover(AuthListener*, FrameSet*, NetAddr*);
 FSTATIC void		nanoobey_stopdiscover(AuthListener*, FrameSet*, NetAddr*);
+FSTATIC void		nanoobey_discfull(AuthListener*, FrameSet*, NetAddr*);
 FSTATIC void		nanoobey_dorscoperation(AuthListener*, FrameSet*, NetAddr*);
 FSTATIC void		_nano_send_rscexitstatus(ConfigContext* request, gpointer user_data
 ,				enum HowDied reason, int rc, int signal, gboolean core_dumped
@@ -102,6 +104,11 @@ FSTATIC gboolean	shutdown_when_outdone(gpointer unused);
 FSTATIC gboolean	_nano_initconfig_OK(ConfigContext* config);
 FSTATIC gboolean	_nanoprobe_is_cma_frameset(const FrameSet * fs, NetAddr*);
 FSTATIC void		_nanoprobe_associate_cma_addrs(const char *key_id, ConfigContext *cfg);
+FSTATIC guint64		_nano_cfg_usecs(const ConfigContext* cfg, const char * name, guint64 defaultval);
+FSTATIC void		_nano_set_hbjitter(const ConfigContext* cfg);
+FSTATIC double		_nano_cfg_double(const ConfigContext* cfg, const char * name, double defaultval);
+FSTATIC gboolean	_nano_log_hbstats(gpointer unused);
+FSTATIC void		_nano_set_hbstats_interval(guint interval);
 
 HbListener* (*nanoprobe_hblistener_new)(NetAddr*, ConfigContext*) = _real_hblistener_new;
 
@@ -115,6 +122,7 @@ static AuthListener*	obeycollective = NULL;
 static NetAddr*		nanofailreportaddr = NULL;
 static NetGSource*	nanotransport = NULL;
 static guint		idle_shutdown_gsource = 0;
+static guint		nano_hbstats_timer = 0;
 static ResourceQueue*	RscQ = NULL;
 static gboolean		is_encryption_enabled = FALSE;
 
@@ -220,8 +228,8 @@ _real_deadtime_agent(HbListener* who)
 		char *		addrstring;
 
 		addrstring = who->listenaddr->baseclass.toString(who->listenaddr);
-		g_warning("Peer at address %s is dead (has timed out: %ld seconds).", addrstring
-		,	(long)(who->get_deadtime(who)/1000000L));
+		g_warning("Peer at address %s is dead (has timed out: %g seconds).", addrstring
+		,	(double)who->get_deadtime(who)/1000000.0);
 		g_free(addrstring);
 
 		nanoprobe_report_upstream(FRAMESETTYPE_HBDEAD, who->listenaddr, NULL, 0);
@@ -269,8 +277,8 @@ _real_comealive_agent(HbListener* who, guint64 howlate)
 		char *	addrstring;
 		double secsdead = ((double)((howlate+5000) / 10000))/100.0; // Round to nearest .01
 		addrstring = who->listenaddr->baseclass.toString(who->listenaddr);
-		g_warning("Peer at address %s came alive after being dead for %g seconds (deadtime=%ld secs)."
-		,	addrstring, secsdead, (long)(who->get_deadtime(who)/1000000));
+		g_warning("Peer at address %s came alive after being dead for %g seconds (deadtime=%g secs)."
+		,	addrstring, secsdead, (double)who->get_deadtime(who)/1000000.0);
 		g_free(addrstring);
 		nanoprobe_report_upstream(FRAMESETTYPE_HBBACKALIVE, who->listenaddr, NULL, howlate);
 	}
@@ -283,6 +291,45 @@ nanoobey_connshut(AuthListener* ignoreauth, FrameSet* ignorefs, NetAddr* fromadd
 	DUMP1("Received a CONNSHUT packet from ", &fromaddr->baseclass, "")
 }
 
+/// Set our heartbeat jitter - if this @ref ConfigContext tells us what it should be
+FSTATIC void
+_nano_set_hbjitter(const ConfigContext* cfg)	///<[in] Where to look for CONFIGNAME_HBJITTER
+{
+	switch (cfg->gettype(cfg, CONFIGNAME_HBJITTER)) {
+		case CFG_FLOAT:
+			hbsender_set_jitter(cfg->getdouble(cfg, CONFIGNAME_HBJITTER));
+			break;
+		case CFG_INT64:	// Zero is how you turn it off
+			hbsender_set_jitter((double)cfg->getint(cfg, CONFIGNAME_HBJITTER));
+			break;
+		default:
+			break;
+	}
+}
+
+/// Log our heartbeat histograms - so you don't have to wait for us to shut down to see them
+FSTATIC gboolean
+_nano_log_hbstats(gpointer unused)
+{
+	(void)unused;
+	hblistener_dump_histograms();
+	return TRUE;
+}
+
+/// Log our heartbeat histograms every 'interval' seconds from now on (never if it's zero)
+FSTATIC void
+_nano_set_hbstats_interval(guint interval)	///<[in] Seconds between logging them
+{
+	if (nano_hbstats_timer) {
+		g_source_remove(nano_hbstats_timer);
+		nano_hbstats_timer = 0;
+	}
+	if (interval > 0) {
+		nano_hbstats_timer = g_timeout_add_seconds_full(G_PRIORITY_LOW, interval
+		,	_nano_log_hbstats, NULL, NULL);
+	}
+}
+
 /**
  * Act on (obey) a @ref FrameSet telling us to send heartbeats.
  * Such FrameSets are sent when the Collective Authority wants us to send
@@ -315,6 +362,7 @@ nanoobey_sendhb(AuthListener* parent	///<[in] @ref AuthListener object invoking
 	
 	intvalue = config->getint(config, CONFIGNAME_INTERVAL);
 	sendinterval = (intvalue > 0 ? intvalue : CONFIG_DEFAULT_HBTIME);
+	_nano_set_hbjitter(config);
 
 	for (slframe = fs->framelist; slframe != NULL; slframe = g_slist_next(slframe)) {
 		Frame* frame = CASTTOCLASS(Frame, slframe->data);
@@ -339,6 +387,7 @@ nanoobey_sendhb(AuthListener* parent	///<[in] @ref AuthListener object invoking
 				g_return_if_fail(cfg != NULL);
 				intvalue = cfg->getint(cfg, CONFIGNAME_INTERVAL);
 				sendinterval = (intvalue > 0 ? intvalue : sendinterval);
+				_nano_set_hbjitter(cfg);
 				UNREF(cfg);
 				break;
 			}
@@ -356,6 +405,46 @@ nanoobey_sendhb(AuthListener* parent	///<[in] @ref AuthListener object invoking
 		}
 	}
 }
+/// Return a (positive) time interval from a @ref ConfigContext - in microseconds.
+/// The value is in seconds, and may be fractional - so sub-second deadtimes can be configured.
+FSTATIC guint64
+_nano_cfg_usecs(const ConfigContext* cfg,	///<[in] Where to look for 'name'
+		const char * name,		///<[in] Name of the interval (in seconds)
+		guint64 defaultval)		///<[in] Value to return if not there (in microseconds)
+{
+	gint64	intvalue;
+	double	floatvalue;
+
+	switch (cfg->gettype(cfg, name)) {
+		case CFG_INT64:
+			intvalue = cfg->getint(cfg, name);
+			return (intvalue > 0 ? (guint64)intvalue*1000000 : defaultval);
+
+		case CFG_FLOAT:
+			floatvalue = cfg->getdouble(cfg, name);
+			return (floatvalue > 0.0 ? (guint64)(floatvalue*1000000.0) : defaultval);
+
+		default:
+			return defaultval;
+	}
+}
+
+/// Return a (positive) number from a @ref ConfigContext - whether it was given as an integer or not
+FSTATIC double
+_nano_cfg_double(const ConfigContext* cfg,	///<[in] Where to look for 'name'
+		 const char * name,		///<[in] Name of the value
+		 double defaultval)		///<[in] Value to return if not there
+{
+	switch (cfg->gettype(cfg, name)) {
+		case CFG_INT64:
+			return (cfg->getint(cfg, name) > 0 ? (double)cfg->getint(cfg, name) : defaultval);
+		case CFG_FLOAT:
+			return (cfg->getdouble(cfg, name) > 0.0 ? cfg->getdouble(cfg, name) : defaultval);
+		default:
+			return defaultval;
+	}
+}
+
 /**
  * Act on (obey) a @ref FrameSet telling us to expect heartbeats.
  * Such framesets are sent when the Collective Authority wants us to expect
@@ -363,6 +452,9 @@ nanoobey_sendhb(AuthListener* parent	///<[in] @ref AuthListener object invoking
  * FrameSet or a FRAMESETTYPE_SENDEXPECTHB FrameSet.
  * The deadtime, warntime can come from the FrameSet or the
  * @ref ConfigContext parameter we're given - with the FrameSet taking priority.
+ * Times in JSON may be fractional seconds (the integer frames are whole seconds).
+ * If a "phidead" suspicion level is given, we use phi-accrual failure detection
+ * (warning at "phiwarn") instead of fixed deadtimes and warntimes.
  *
  * If these parameters are in the FrameSet, they have to precede the FRAMETYPE_IPPORT
  * @ref IpPortFrame in the FrameSet.
@@ -377,8 +469,10 @@ nanoobey_expecthb(AuthListener* parent	///<[in] @ref AuthListener object invokin
 	ConfigContext*	config = parent->baseclass.config;
 	guint		addrcount = 0;
 
-	guint64		deadtime;
-	guint64		warntime;
+	guint64		deadtime;	// microseconds
+	guint64		warntime;	// microseconds
+	double		phiwarn;
+	double		phidead;
 	gint64		intvalue;
 
 	(void)fromaddr;
@@ -388,10 +482,10 @@ nanoobey_expecthb(AuthListener* parent	///<[in] @ref AuthListener object invokin
 	}
 
 	g_return_if_fail(fs != NULL);
-	intvalue = config->getint(config, CONFIGNAME_TIMEOUT);
-	deadtime = (intvalue > 0 ? intvalue : CONFIG_DEFAULT_DEADTIME);
-	intvalue = config->getint(config, CONFIGNAME_WARNTIME);
-	warntime = (intvalue > 0 ? intvalue : CONFIG_DEFAULT_WARNTIME);
+	deadtime = _nano_cfg_usecs(config, CONFIGNAME_TIMEOUT, CONFIG_DEFAULT_DEADTIME*1000000);
+	warntime = _nano_cfg_usecs(config, CONFIGNAME_WARNTIME, CONFIG_DEFAULT_WARNTIME*1000000);
+	phiwarn = _nano_cfg_double(config, CONFIGNAME_PHIWARN, 0.0);
+	phidead = _nano_cfg_double(config, CONFIGNAME_PHIDEAD, 0.0);
 
 	for (slframe = fs->framelist; slframe != NULL; slframe = g_slist_next(slframe)) {
 		Frame* frame = CASTTOCLASS(Frame, slframe->data);
@@ -401,13 +495,13 @@ nanoobey_expecthb(AuthListener* parent	///<[in] @ref AuthListener object invokin
 
 			case FRAMETYPE_HBDEADTIME:
 				iframe = CASTTOCLASS(IntFrame, frame);
-				deadtime = iframe->getint(iframe);
+				deadtime = iframe->getint(iframe)*1000000;
 				break;
 
 			case FRAMETYPE_HBWARNTIME:
 				iframe = CASTTOCLASS(IntFrame, frame);
 				intvalue = iframe->getint(iframe);
-				warntime = (intvalue > 0 ? (guint64)intvalue : warntime);
+				warntime = (intvalue > 0 ? (guint64)intvalue*1000000 : warntime);
 				break;
 
 			case FRAMETYPE_RSCJSON: {
@@ -419,10 +513,10 @@ nanoobey_expecthb(AuthListener* parent	///<[in] @ref AuthListener object invokin
 				,	__LINE__, json);
 				cfg = configcontext_new_JSON_string(json);
 				g_return_if_fail(cfg != NULL);
-				intvalue = cfg->getint(cfg, CONFIGNAME_TIMEOUT);
-				deadtime = (intvalue > 0 ? (guint64)intvalue : deadtime);
-				intvalue = cfg->getint(cfg, CONFIGNAME_WARNTIME);
-				warntime = (intvalue > 0 ? (guint64)intvalue : warntime);
+				deadtime = _nano_cfg_usecs(cfg, CONFIGNAME_TIMEOUT, deadtime);
+				warntime = _nano_cfg_usecs(cfg, CONFIGNAME_WARNTIME, warntime);
+				phiwarn = _nano_cfg_double(cfg, CONFIGNAME_PHIWARN, phiwarn);
+				phidead = _nano_cfg_double(cfg, CONFIGNAME_PHIDEAD, phidead);
 				UNREF(cfg);
 			}
 			break;
@@ -437,11 +531,14 @@ nanoobey_expecthb(AuthListener* parent	///<[in] @ref AuthListener object invokin
 				hblisten->baseclass.associate(&hblisten->baseclass, transport);
 				if (deadtime > 0) {
 					// Otherwise we get the default deadtime
-					hblisten->set_deadtime(hblisten, deadtime);
+					hblisten->set_deadtime_usec(hblisten, deadtime);
 				}
 				if (warntime > 0) {
 					// Otherwise we get the default warntime
-					hblisten->set_warntime(hblisten, warntime);
+					hblisten->set_warntime_usec(hblisten, warntime);
+				}
+				if (phidead > 0.0) {
+					hblisten->set_phi_thresholds(hblisten, phiwarn, phidead);
 				}
 				hblisten->set_deadtime_callback(hblisten, _real_deadtime_agent);
 				hblisten->set_heartbeat_callback(hblisten, _real_heartbeat_agent);
@@ -614,6 +711,19 @@ nanoobey_setconfig(AuthListener* parent	///<[in] @ref AuthListener object invoki
 							cf->compression_threshold = cprs_thresh;
 						}
 					}
+					// Once the CMA knows everyone understands them,
+					// it can tell us to use AEAD-only signatures
+					if (newconfig->gettype(newconfig, CONFIGNAME_AEADSIGN)
+					==	CFG_BOOL) {
+						signframe_set_aead_signatures(newconfig->getbool
+						(	newconfig, CONFIGNAME_AEADSIGN));
+					}
+					if (newconfig->gettype(newconfig, CONFIGNAME_HBSTATS)
+					==	CFG_INT64) {
+						gint64 interval = newconfig->getint(newconfig
+						,	CONFIGNAME_HBSTATS);
+						_nano_set_hbstats_interval(interval > 0 ? (guint)interval : 0);
+					}
 				}
 				goto endloop;
 			}
@@ -1012,6 +1122,32 @@ nanoobey_stopdiscover(AuthListener* parent	///<[in] @ref AuthListener object inv
 	}
 }
 
+/**
+ * Act on (obey) a @ref FrameSet telling us the CMA can't apply our JSON patches
+ * to a discovery instance, and wants to see everything instead.
+ * <b>FRAMETYPE_DISCNAME</b> - Name of this particular discovery action
+ */
+FSTATIC void
+nanoobey_discfull(AuthListener* parent	///<[in] @ref AuthListener object invoking us
+	,	  FrameSet*	fs		///<[in] @ref FrameSet giving operational details
+	,	  NetAddr*	fromaddr)	///<[in/out] Address this message came from
+{
+	GSList*		slframe;
+
+	(void)parent;
+	(void)fromaddr;
+
+	for (slframe = fs->framelist; slframe != NULL; slframe = g_slist_next(slframe)) {
+		Frame* frame = CASTTOCLASS(Frame, slframe->data);
+
+		if (frame->type == FRAMETYPE_DISCNAME) {
+			CstringFrame* strf = CASTTOCLASS(CstringFrame, frame);
+			g_return_if_fail(strf->baseclass.value != NULL);
+			discovery_sendfull(strf->baseclass.value);
+		}
+	}
+}
+
 /**
  * Schedule a discovery instance, potentially repetitively.
  */
@@ -1106,6 +1242,8 @@ nano_startupidle(gpointer gcruft)
 		,	jsondata
 		,	cruft->iosource, obeycollective->baseclass.config, 0);
 		if (jd) {
+			// We send its JSON in our STARTUP requests
+			jd->baseclass.keepjson = TRUE;
 			UNREF2(jd);
 		}else{
 			g_critical("%s.%d: Cannot execute initial startup discovery script %s. Exiting."
@@ -1276,6 +1414,7 @@ ObeyFrameSetTypeMap collective_obeylist [] = {
 	{FRAMESETTYPE_DECRDEBUG,	nanoobey_decrdebug},
 	{FRAMESETTYPE_DODISCOVER,	nanoobey_startdiscover},
 	{FRAMESETTYPE_STOPDISCOVER,	nanoobey_stopdiscover},
+	{FRAMESETTYPE_DISCFULL,		nanoobey_discfull},
 	{FRAMESETTYPE_DORSCOP,		nanoobey_dorscoperation},
 	{FRAMESETTYPE_STOPRSCOP,	nanoobey_cancelrscoperation},
 	{FRAMESETTYPE_CONNSHUT,		nanoobey_connshut},
@@ -1352,6 +1491,7 @@ nano_start_full(const char *initdiscoverpath	///<[in] pathname of initial networ
 	obeycollective = authlistener_new(0, collective_obeylist, config, TRUE, authfunc);
 	obeycollective->baseclass.associate(&obeycollective->baseclass, io);
 	nanoprobe_initialize_keys();
+	_nano_set_hbstats_interval(DEFAULT_HBSTATS_INTERVAL);
 	// Initiate the startup process
 	g_idle_add(nano_startupidle, &cruftiness);
 }
@@ -1377,6 +1517,7 @@ nano_shutdown(gboolean report)
 		g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of reliable framesets recvd:", ts->reliablereads);
 		g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of ACKs sent:", ts->ackssent);
 		g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of ACKs recvd:", ts->acksrecvd);
+		hblistener_dump_histograms();
 	}
 	hbsender_stopallsenders();
 	hblistener_shutdown();
@@ -1420,6 +1561,8 @@ nano_initiate_shutdown(void)
 		nano_shutting_down = TRUE;
 		// Unregister all discovery modules.  Keep us from starting any new ones...
 		discovery_unregister_all();
+		discoverytrigger_shutdown();
+		nativediscovery_unregister_all();
 		// Let's not start any more resource operations either...
 		if (RscQ) {
 			RscQ->cancelall(RscQ);
@@ -1476,6 +1619,7 @@ _nano_final_shutdown(gpointer unused)
 		g_source_remove(idle_shutdown_gsource);
 		idle_shutdown_gsource = 0;
 	}
+	_nano_set_hbstats_interval(0);
 	if (nano_random) {
 		g_rand_free(nano_random);
 		nano_random = NULL;
@@ -1533,7 +1677,7 @@ nanoprobe_initialize_keys(void)
 			is_encryption_enabled = TRUE;
 		}
 	}
-	g_list_free(key_id_list); key_id_list = NULL;
+	g_list_free_full(key_id_list, g_free); key_id_list = NULL;
 	g_free(sysname); sysname = NULL;
 }
 
@@ -0,0 +1,135 @@
+/**
+ * @file
+ * @brief Registry of discovery types implemented as C functions inside the nanoprobe.
+ * @details Our built in discovery functions are registered the first time anyone asks for one.
+ * Plugins are shared objects which export a NATIVEDISCOVERY_PLUGIN_INIT function that registers
+ * their discovery types with nativediscovery_register().
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <projectcommon.h>
+#include <string.h>
+#include <gmodule.h>
+#include <nativediscovery.h>
+
+///@{
+/// @ingroup DiscoveryClass
+
+static GHashTable*	_nativediscovery_types = NULL;	///< NativeDiscoveryFuncs - indexed by discovery type
+
+FSTATIC void _nativediscovery_init(void);
+
+/// Create our registry - and register our built in discovery types
+FSTATIC void
+_nativediscovery_init(void)
+{
+	if (_nativediscovery_types) {
+		return;
+	}
+	_nativediscovery_types = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+#ifdef __linux__
+	nativediscovery_register("cpu", nativediscovery_cpu);
+	nativediscovery_register("checksums", nativediscovery_checksums);
+	nativediscovery_register("tcpdiscovery", nativediscovery_tcp);
+#endif
+}
+
+/// Register a native discovery function for this discovery type - replacing any previous one
+void
+nativediscovery_register(const char * discoverytype,	///<[in] discovery type (agent name)
+			 NativeDiscoveryFunc func)	///<[in] function implementing it
+{
+	g_return_if_fail(discoverytype != NULL && func != NULL);
+	_nativediscovery_init();
+	g_hash_table_replace(_nativediscovery_types, g_strdup(discoverytype), func);
+}
+
+/// Return the native discovery function for this discovery type - or NULL if there isn't one
+NativeDiscoveryFunc
+nativediscovery_find(const char * discoverytype)	///<[in] discovery type (agent name)
+{
+	g_return_val_if_fail(discoverytype != NULL, NULL);
+	_nativediscovery_init();
+	return (NativeDiscoveryFunc)g_hash_table_lookup(_nativediscovery_types, discoverytype);
+}
+
+/// Load all the native discovery plugins in this directory.
+/// Plugins stay loaded - since there's no telling who still has pointers into them.
+/// @return the number of plugins loaded
+guint
+nativediscovery_loadplugins(const char * dirname)	///<[in] directory to load plugins from
+{
+	GDir*		dir;
+	const char *	filename;
+	guint		count = 0;
+
+	g_return_val_if_fail(dirname != NULL, 0);
+	if (!g_module_supported()) {
+		return 0;
+	}
+	dir = g_dir_open(dirname, 0, NULL);
+	if (NULL == dir) {
+		// No plugins directory - no plugins
+		return 0;
+	}
+	_nativediscovery_init();
+	while (NULL != (filename = g_dir_read_name(dir))) {
+		char *		pathname;
+		GModule*	module;
+		gpointer	initfunc = NULL;
+
+		if (!g_str_has_suffix(filename, "." G_MODULE_SUFFIX)) {
+			continue;
+		}
+		pathname = g_build_filename(dirname, filename, NULL);
+		module = g_module_open(pathname, G_MODULE_BIND_LOCAL);
+		if (NULL == module) {
+			g_warning("%s.%d: Cannot load native discovery plugin %s: %s"
+			,	__FUNCTION__, __LINE__, pathname, g_module_error());
+			g_free(pathname);
+			continue;
+		}
+		if (!g_module_symbol(module, NATIVEDISCOVERY_PLUGIN_INIT, &initfunc)
+		||	NULL == initfunc
+		||	!((NativeDiscoveryPluginInit)initfunc)()) {
+			g_warning("%s.%d: Native discovery plugin %s did not initialize."
+			,	__FUNCTION__, __LINE__, pathname);
+			g_module_close(module);
+			g_free(pathname);
+			continue;
+		}
+		g_module_make_resident(module);
+		g_info("Loaded native discovery plugin %s", pathname);
+		++count;
+		g_free(pathname);
+	}
+	g_dir_close(dir);
+	return count;
+}
+
+/// Forget all our native discovery types - in preparation for shutting down
+void
+nativediscovery_unregister_all(void)
+{
+	if (_nativediscovery_types) {
+		g_hash_table_destroy(_nativediscovery_types);
+		_nativediscovery_types = NULL;
+	}
+}
+///@}
@@ -0,0 +1,597 @@
+/**
+ * @file
+ * @brief Native (in-process) version of the "checksums" discovery agent.
+ * @details The checksums agent hashes every file on its list - and every library they depend on -
+ * each time it runs.  Almost always nothing has changed, so this version keeps a cache of checksums
+ * (and library dependencies) across runs, keyed by each file's device, inode, size, mtime and ctime.
+ * Only files whose metadata has changed get hashed again.  Those are hashed by a few threads
+ * which together stay within an I/O budget (bytes/second).
+ *
+ * Parameters (all optional) - the first two are the same ones the agent takes:
+ * - ASSIM_sumcmds	sum commands to choose from - we use the first one which exists
+ * - ASSIM_filelist	files to checksum (along with their ldd dependencies)
+ * - ASSIM_cachefile	where to keep our cache (default: CKSUM_CACHEFILE)
+ * - ASSIM_ldsocache	the dynamic linker's cache (default: CKSUM_LDSOCACHE) - when it changes
+ *			we forget all the ldd dependencies we know
+ * - ASSIM_hashthreads	how many threads to hash with (default: CKSUM_DEFAULT_THREADS)
+ * - ASSIM_iobudget	how many bytes/second we may read while hashing - 0 means no limit
+ *			(default: CKSUM_DEFAULT_IOBUDGET)
+ *
+ * Our output is what the agent produces.  How many files we rehashed and how many checksums came
+ * from our cache go to our log instead - they'd make every report look different.
+ * We only know how to compute the md5sum and sha*sum checksums GChecksum supports.
+ * For anything else (cksum, for example) we return FALSE, and the agent does the job.
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <projectcommon.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <misc.h>
+#include <nativediscovery.h>
+
+///@{
+/// @ingroup DiscoveryClass
+
+#define	CKSUM_DEFAULTSUMLIST	"/usr/bin/sha384sum /usr/bin/sha512sum /usr/bin/sha256sum /usr/bin/sha224sum " \
+				"/usr/bin/sha1sum /usr/bin/shasum /usr/bin/md5sum /usr/bin/cksum /usr/bin/crc32"
+/// The agent computes its MINLIST before it picks its sum command - so it always lists sha512sum
+#define	CKSUM_MINLIST		"/usr/bin/sha512sum /usr/sbin/nanoprobe"
+#define	CKSUM_CACHEFILE		NANOSTATE_DIR DIRDELIM "checksums.cache"
+#define	CKSUM_CACHEHEADER	"assimilation checksum cache 2"
+#define	CKSUM_LDSOCACHE		"/etc/ld.so.cache"
+#define	CKSUM_DEFAULT_THREADS	2
+#define	CKSUM_MAX_THREADS	16
+#define	CKSUM_DEFAULT_IOBUDGET	(32*1024*1024)	///< Bytes/second
+#define	CKSUM_BUFSIZE		(64*1024)
+
+/// What we know about one file
+typedef struct _CksumEntry {
+	const char *	path;		///< Its pathname (our key in the cache)
+	guint64		dev;		///< Device it lives on
+	guint64		ino;		///< Its inode
+	gint64		size;		///< Its size
+	gint64		mtime;		///< Modification time (ns)
+	gint64		ctime;		///< Inode change time (ns)
+	char *		sum;		///< Its checksum - NULL if we don't know it
+	char **		deps;		///< Its ldd dependencies - NULL if we don't know them
+	gboolean	checked;	///< Have we checked its metadata this time around?
+	gboolean	valid;		///< Could we stat it?  Only valid entries are worth keeping
+} CksumEntry;
+
+/// Things our hashing threads share
+typedef struct _CksumRun {
+	GChecksumType	type;		///< What kind of checksum to compute
+	GMutex		lock;		///< Protects 'bytes'
+	gint64		budget;		///< How many bytes/second we may read (<= 0: no limit)
+	gint64		start;		///< When we started hashing (monotonic uS)
+	gint64		bytes;		///< How many bytes we've read so far
+	gint		rehashed;	///< How many files we've hashed
+} CksumRun;
+
+FSTATIC void		_cksum_entry_free(gpointer ventry);
+FSTATIC CksumEntry*	_cksum_entry_new(void);
+FSTATIC const char *	_cksum_getenv(const gchar* const* env, const char * name, const char * deflt);
+FSTATIC gint64		_cksum_getint(const gchar* const* env, const char * name, gint64 deflt);
+FSTATIC gboolean	_cksum_sumtype(const char * sumcmd, GChecksumType* type);
+FSTATIC gboolean	_cksum_stat(const char * path, CksumEntry* meta);
+FSTATIC char *		_cksum_ldstamp(const char * ldsocache);
+FSTATIC GHashTable*	_cksum_load(const char * cachefile, const char * sumcmd, const char * ldstamp);
+FSTATIC void		_cksum_save(const char * cachefile, const char * sumcmd, const char * ldstamp
+,				GHashTable* cache);
+FSTATIC CksumEntry*	_cksum_check(GHashTable* cache, const char * path);
+FSTATIC char **		_cksum_ldd(const char * path);
+FSTATIC void		_cksum_throttle(CksumRun* run, gsize nbytes);
+FSTATIC void		_cksum_hashfile(gpointer ventry, gpointer vrun);
+FSTATIC gint		_cksum_strcmp(gconstpointer a, gconstpointer b);
+
+/// Free a CksumEntry
+FSTATIC void
+_cksum_entry_free(gpointer ventry)
+{
+	CksumEntry*	entry = (CksumEntry*)ventry;
+	g_free(entry->sum);
+	g_strfreev(entry->deps);
+	g_free(entry);
+}
+
+/// Create an empty CksumEntry
+FSTATIC CksumEntry*
+_cksum_entry_new(void)
+{
+	return g_new0(CksumEntry, 1);
+}
+
+/// Return the value of this parameter - or our default if it's missing or empty
+FSTATIC const char *
+_cksum_getenv(const gchar* const* env, const char * name, const char * deflt)
+{
+	const char *	value = env ? g_environ_getenv((gchar**)env, name) : NULL;
+	return (NULL == value || EOS == *value) ? deflt : value;
+}
+
+/// Return the integer value of this parameter - or our default if it's missing or malformed
+FSTATIC gint64
+_cksum_getint(const gchar* const* env, const char * name, gint64 deflt)
+{
+	const char *	value = _cksum_getenv(env, name, NULL);
+	char *		end = NULL;
+	gint64		ret;
+
+	if (NULL == value) {
+		return deflt;
+	}
+	ret = g_ascii_strtoll(value, &end, 10);
+	return (end == value || EOS != *end || ret < 0) ? deflt : ret;
+}
+
+/// Figure out which GChecksumType our sum command computes
+/// @return FALSE if it's not one we know how to compute
+FSTATIC gboolean
+_cksum_sumtype(const char * sumcmd, GChecksumType* type)
+{
+	char *		base = g_path_get_basename(sumcmd);
+	gboolean	ret = TRUE;
+
+	if (strcmp(base, "md5sum") == 0) {
+		*type = G_CHECKSUM_MD5;
+	}else if (strcmp(base, "sha1sum") == 0) {
+		*type = G_CHECKSUM_SHA1;
+	}else if (strcmp(base, "sha256sum") == 0) {
+		*type = G_CHECKSUM_SHA256;
+	}else if (strcmp(base, "sha512sum") == 0) {
+		*type = G_CHECKSUM_SHA512;
+#if GLIB_CHECK_VERSION(2,51,0)
+	}else if (strcmp(base, "sha384sum") == 0) {
+		*type = G_CHECKSUM_SHA384;
+#endif
+	}else{
+		ret = FALSE;
+	}
+	g_free(base);
+	return ret;
+}
+
+/// Fill in the dev, ino, size, mtime and ctime of this CksumEntry from this file's metadata
+/// @return FALSE if we can't stat it
+FSTATIC gboolean
+_cksum_stat(const char * path, CksumEntry* meta)
+{
+	struct stat	sb;
+
+	if (stat(path, &sb) < 0) {
+		return FALSE;
+	}
+	meta->dev = sb.st_dev;
+	meta->ino = sb.st_ino;
+	meta->size = sb.st_size;
+#ifdef __linux__
+	meta->mtime = ((gint64)sb.st_mtim.tv_sec)*1000000000 + sb.st_mtim.tv_nsec;
+	meta->ctime = ((gint64)sb.st_ctim.tv_sec)*1000000000 + sb.st_ctim.tv_nsec;
+#else
+	meta->mtime = ((gint64)sb.st_mtime)*1000000000;
+	meta->ctime = ((gint64)sb.st_ctime)*1000000000;
+#endif
+	return TRUE;
+}
+
+/// Describe the dynamic linker's cache the way our cache file does.  What ldd says a binary depends
+/// on can change whenever this does - even when the binary doesn't.
+FSTATIC char *
+_cksum_ldstamp(const char * ldsocache)
+{
+	CksumEntry	meta;
+
+	memset(&meta, 0, sizeof(meta));
+	if (!_cksum_stat(ldsocache, &meta)) {
+		return g_strdup("-");
+	}
+	return g_strdup_printf("%"G_GUINT64_FORMAT"\t%"G_GUINT64_FORMAT
+	"\t%"G_GINT64_FORMAT"\t%"G_GINT64_FORMAT"\t%"G_GINT64_FORMAT
+	,	meta.dev, meta.ino, meta.size, meta.mtime, meta.ctime);
+}
+
+/// Load our cache.  A missing or malformed cache - or one made with a different sum command - is empty.
+/// If the dynamic linker's cache has changed since we saved ours, we keep our checksums, but forget
+/// every file's dependencies.
+/// Cache lines look like this (fields are tab separated):
+/// - S sumcmd
+/// - L dev ino size mtime ctime (of the dynamic linker's cache - or "-")
+/// - F dev ino size mtime ctime checksum pathname
+/// - D pathname dependency...
+FSTATIC GHashTable*
+_cksum_load(const char * cachefile, const char * sumcmd, const char * ldstamp)
+{
+	GHashTable*	cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _cksum_entry_free);
+	gchar*		contents = NULL;
+	char **		lines;
+	gboolean	keepdeps;
+	int		j;
+
+	if (!g_file_get_contents(cachefile, &contents, NULL, NULL)) {
+		return cache;
+	}
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents); contents = NULL;
+	if (NULL == lines[0] || strcmp(lines[0], CKSUM_CACHEHEADER) != 0
+	||	NULL == lines[1] || !g_str_has_prefix(lines[1], "S\t")
+	||	strcmp(lines[1]+2, sumcmd) != 0
+	||	NULL == lines[2] || !g_str_has_prefix(lines[2], "L\t")) {
+		g_strfreev(lines);
+		return cache;
+	}
+	keepdeps = (strcmp(lines[2]+2, ldstamp) == 0);
+	for (j=3; lines[j]; ++j) {
+		char **		fields = g_strsplit(lines[j], "\t", -1);
+		guint		nfields = g_strv_length(fields);
+		CksumEntry*	entry;
+
+		if (nfields == 8 && strcmp(fields[0], "F") == 0) {
+			entry = _cksum_entry_new();
+			entry->dev = g_ascii_strtoull(fields[1], NULL, 10);
+			entry->ino = g_ascii_strtoull(fields[2], NULL, 10);
+			entry->size = g_ascii_strtoll(fields[3], NULL, 10);
+			entry->mtime = g_ascii_strtoll(fields[4], NULL, 10);
+			entry->ctime = g_ascii_strtoll(fields[5], NULL, 10);
+			entry->sum = g_strdup(fields[6]);
+			g_hash_table_replace(cache, g_strdup(fields[7]), entry);
+		}else if (keepdeps && nfields >= 2 && strcmp(fields[0], "D") == 0) {
+			entry = (CksumEntry*)g_hash_table_lookup(cache, fields[1]);
+			if (entry && NULL == entry->deps) {
+				entry->deps = g_strdupv(fields+2);
+			}
+		}
+		g_strfreev(fields);
+	}
+	g_strfreev(lines);
+	return cache;
+}
+
+/// Save the entries we used this time around in our cache
+FSTATIC void
+_cksum_save(const char * cachefile, const char * sumcmd, const char * ldstamp, GHashTable* cache)
+{
+	GString*	out = g_string_new(CKSUM_CACHEHEADER "\n");
+	GHashTableIter	iter;
+	gpointer	key;
+	gpointer	value;
+	char *		dirname = g_path_get_dirname(cachefile);
+	GError*		err = NULL;
+
+	g_string_append_printf(out, "S\t%s\nL\t%s\n", sumcmd, ldstamp);
+	g_hash_table_iter_init(&iter, cache);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		const char *	path = (const char *)key;
+		CksumEntry*	entry = (CksumEntry*)value;
+		int		j;
+
+		// We can't represent names with tabs or newlines in them - so we don't save them
+		if (!entry->checked || !entry->valid || NULL == entry->sum || EOS == entry->sum[0]
+		||	strpbrk(path, "\t\n")) {
+			continue;
+		}
+		g_string_append_printf(out, "F\t%"G_GUINT64_FORMAT"\t%"G_GUINT64_FORMAT
+		"\t%"G_GINT64_FORMAT"\t%"G_GINT64_FORMAT"\t%"G_GINT64_FORMAT"\t%s\t%s\n"
+		,	entry->dev, entry->ino, entry->size, entry->mtime, entry->ctime, entry->sum, path);
+		if (NULL == entry->deps) {
+			continue;
+		}
+		g_string_append_printf(out, "D\t%s", path);
+		for (j=0; entry->deps[j]; ++j) {
+			g_string_append_printf(out, "\t%s", entry->deps[j]);
+		}
+		g_string_append_c(out, '\n');
+	}
+	if (g_mkdir_with_parents(dirname, 0755) < 0
+	||	!g_file_set_contents(cachefile, out->str, out->len, &err)) {
+		g_warning("%s.%d: Cannot save checksum cache %s: %s", __FUNCTION__, __LINE__
+		,	cachefile, err ? err->message : g_strerror(errno));
+		g_clear_error(&err);
+	}
+	g_free(dirname);
+	g_string_free(out, TRUE);
+}
+
+/// Check this file's metadata against what's cached for it - forgetting anything out of date
+/// @return its (possibly new) cache entry
+FSTATIC CksumEntry*
+_cksum_check(GHashTable* cache, const char * path)
+{
+	CksumEntry*	entry = (CksumEntry*)g_hash_table_lookup(cache, path);
+	CksumEntry	meta;
+
+	if (NULL == entry) {
+		entry = _cksum_entry_new();
+		g_hash_table_insert(cache, g_strdup(path), entry);
+	}
+	if (NULL == entry->path) {
+		gpointer	key = NULL;
+		g_hash_table_lookup_extended(cache, path, &key, NULL);
+		entry->path = (const char *)key;
+	}
+	if (entry->checked) {
+		return entry;
+	}
+	entry->checked = TRUE;
+	memset(&meta, 0, sizeof(meta));
+	if (!_cksum_stat(path, &meta)) {
+		entry->valid = FALSE;
+		g_free(entry->sum);	entry->sum = NULL;
+		g_strfreev(entry->deps); entry->deps = NULL;
+		return entry;
+	}
+	entry->valid = TRUE;
+	if (entry->dev != meta.dev || entry->ino != meta.ino
+	||	entry->size != meta.size || entry->mtime != meta.mtime || entry->ctime != meta.ctime) {
+		entry->dev = meta.dev;
+		entry->ino = meta.ino;
+		entry->size = meta.size;
+		entry->mtime = meta.mtime;
+		entry->ctime = meta.ctime;
+		g_free(entry->sum);	entry->sum = NULL;
+		g_strfreev(entry->deps); entry->deps = NULL;
+	}
+	return entry;
+}
+
+/// Mimic lddependencies(): return the libraries this binary depends on - according to ldd
+FSTATIC char **
+_cksum_ldd(const char * path)
+{
+	gchar*		argv[3];
+	gchar*		lddout = NULL;
+	GPtrArray*	deps = g_ptr_array_new();
+	char **		lines;
+	int		j;
+
+	argv[0] = g_strdup("ldd");
+	argv[1] = g_strdup(path);
+	argv[2] = NULL;
+	if (!g_spawn_sync(NULL, argv, NULL, G_SPAWN_SEARCH_PATH|G_SPAWN_STDERR_TO_DEV_NULL
+	,	NULL, NULL, &lddout, NULL, NULL, NULL)) {
+		lddout = NULL;
+	}
+	g_free(argv[0]);
+	g_free(argv[1]);
+	lines = g_strsplit(lddout ? lddout : "", "\n", -1);
+	g_free(lddout);
+	for (j=0; lines[j]; ++j) {
+		char *		line = g_strstrip(lines[j]);
+		char *		dep = NULL;
+		char *		paren;
+
+		if (g_pattern_match_simple("*=>*/* (*", line)) {
+			// libc.so.6 => /lib/x86_64-linux-gnu/libc.so.6 (0x00007f8615253000)
+			dep = g_strrstr(line, "=>") + 2;
+			while (' ' == *dep) {
+				++dep;
+			}
+		}else if (g_pattern_match_simple("*=>*(*", line)) {
+			// linux-vdso.so.1 =>  (0x00007fff7e1fe000)
+			continue;
+		}else if (g_pattern_match_simple("*/* *(*", line)) {
+			// /lib64/ld-linux-x86-64.so.2 (0x00007f8615640000)
+			dep = line;
+		}else{
+			continue;
+		}
+		paren = strchr(dep, '(');
+		if (paren) {
+			while (paren > dep && ' ' == paren[-1]) {
+				--paren;
+			}
+			*paren = EOS;
+		}
+		g_ptr_array_add(deps, g_strdup(dep));
+	}
+	g_strfreev(lines);
+	g_ptr_array_add(deps, NULL);
+	return (char **)g_ptr_array_free(deps, FALSE);
+}
+
+/// Sleep long enough to keep all our hashing threads together within our I/O budget
+FSTATIC void
+_cksum_throttle(CksumRun* run, gsize nbytes)
+{
+	gint64	ahead;	// How far (uS) we are ahead of our budget
+
+	if (run->budget <= 0) {
+		return;
+	}
+	g_mutex_lock(&run->lock);
+	run->bytes += nbytes;
+	ahead = (run->bytes*G_USEC_PER_SEC)/run->budget - (g_get_monotonic_time() - run->start);
+	g_mutex_unlock(&run->lock);
+	if (ahead > 0) {
+		g_usleep(ahead);
+	}
+}
+
+/// Thread pool function: compute the checksum of one file.
+/// If we can't read it, its checksum is empty - just like the agent's.
+FSTATIC void
+_cksum_hashfile(gpointer ventry, gpointer vrun)
+{
+	CksumEntry*	entry = (CksumEntry*)ventry;
+	CksumRun*	run = (CksumRun*)vrun;
+	GChecksum*	cksum = g_checksum_new(run->type);
+	guchar*		buf = g_malloc(CKSUM_BUFSIZE);
+	FILE*		f = fopen(entry->path, "rb");
+	gsize		nbytes;
+	gboolean	ok = (NULL != f);
+
+	while (ok && (nbytes = fread(buf, 1, CKSUM_BUFSIZE, f)) > 0) {
+		g_checksum_update(cksum, buf, nbytes);
+		_cksum_throttle(run, nbytes);
+	}
+	if (f) {
+		ok = !ferror(f);
+		fclose(f);
+	}
+	entry->sum = g_strdup(ok ? g_checksum_get_string(cksum) : "");
+	if (!ok) {
+		entry->valid = FALSE;
+	}
+	g_checksum_free(cksum);
+	g_free(buf);
+	g_atomic_int_inc(&run->rehashed);
+}
+
+/// Compare two (char*) pointers the way strcmp does
+FSTATIC gint
+_cksum_strcmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/// Checksum our list of files - and everything they depend on
+gboolean
+nativediscovery_checksums(GString* json,		///<[out] where to put our JSON
+			  const char * source,		///<[in] pathname of the checksums agent
+			  const gchar* const* env)	///<[in] our parameters
+{
+	const char *	cachefile = _cksum_getenv(env, "ASSIM_cachefile", CKSUM_CACHEFILE);
+	char *		ldstamp;
+	gint64		nthreads = _cksum_getint(env, "ASSIM_hashthreads", CKSUM_DEFAULT_THREADS);
+	char **		sumcmds = g_strsplit_set(_cksum_getenv(env, "ASSIM_sumcmds", CKSUM_DEFAULTSUMLIST)
+			,	" \t\n", -1);
+	char *		args = g_strdup_printf("%s %s", CKSUM_MINLIST
+			,	_cksum_getenv(env, "ASSIM_filelist", ""));
+	char **		filelist = g_strsplit_set(args, " \t\n", -1);
+	const char *	sumcmd = NULL;
+	GHashTable*	cache;
+	GHashTable*	files;
+	GPtrArray*	sorted;
+	GPtrArray*	tohash;
+	CksumRun	run;
+	GThreadPool*	pool = NULL;
+	GHashTableIter	iter;
+	gpointer	key;
+	char *		host;
+	const char *	comma = "  ";
+	guint		j;
+
+	g_free(args); args = NULL;
+	memset(&run, 0, sizeof(run));
+	// find_sumcmd()
+	for (j=0; sumcmds[j]; ++j) {
+		if (sumcmds[j][0] != EOS && g_file_test(sumcmds[j], G_FILE_TEST_IS_REGULAR)
+		&&	g_file_test(sumcmds[j], G_FILE_TEST_IS_EXECUTABLE)) {
+			sumcmd = sumcmds[j];
+			break;
+		}
+	}
+	if (NULL == sumcmd || !_cksum_sumtype(sumcmd, &run.type)) {
+		// Let the agent complain - or compute a checksum we don't know how to
+		g_strfreev(sumcmds);
+		g_strfreev(filelist);
+		return FALSE;
+	}
+	ldstamp = _cksum_ldstamp(_cksum_getenv(env, "ASSIM_ldsocache", CKSUM_LDSOCACHE));
+	cache = _cksum_load(cachefile, sumcmd, ldstamp);
+
+	// expandlist()
+	files = g_hash_table_new(g_str_hash, g_str_equal);
+	for (j=0; filelist[j]; ++j) {
+		const char *	arg = filelist[j];
+		CksumEntry*	entry;
+		int		k;
+
+		if (arg[0] == EOS || !g_file_test(arg, G_FILE_TEST_IS_REGULAR)) {
+			continue;
+		}
+		g_hash_table_add(files, (gpointer)arg);
+		entry = _cksum_check(cache, arg);
+		if (NULL == entry->deps) {
+			entry->deps = _cksum_ldd(arg);
+		}
+		for (k=0; entry->deps[k]; ++k) {
+			g_hash_table_add(files, entry->deps[k]);
+		}
+	}
+	// Our file names belong to filelist and the cache - which won't change until we're done
+	sorted = g_ptr_array_new();
+	g_hash_table_iter_init(&iter, files);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		g_ptr_array_add(sorted, key);
+	}
+	g_ptr_array_sort(sorted, _cksum_strcmp);
+	g_hash_table_destroy(files); files = NULL;
+
+	// Hash everything whose checksum we don't know
+	tohash = g_ptr_array_new();
+	for (j=0; j < sorted->len; ++j) {
+		CksumEntry*	entry = _cksum_check(cache, g_ptr_array_index(sorted, j));
+		if (NULL == entry->sum) {
+			g_ptr_array_add(tohash, entry);
+		}
+	}
+	g_mutex_init(&run.lock);
+	run.budget = _cksum_getint(env, "ASSIM_iobudget", CKSUM_DEFAULT_IOBUDGET);
+	run.start = g_get_monotonic_time();
+	if (tohash->len > 1 && nthreads > 1) {
+		pool = g_thread_pool_new(_cksum_hashfile, &run, MIN(nthreads, CKSUM_MAX_THREADS), TRUE, NULL);
+	}
+	for (j=0; j < tohash->len; ++j) {
+		if (NULL == pool || !g_thread_pool_push(pool, g_ptr_array_index(tohash, j), NULL)) {
+			_cksum_hashfile(g_ptr_array_index(tohash, j), &run);
+		}
+	}
+	if (pool) {
+		// Wait for them all to finish
+		g_thread_pool_free(pool, FALSE, TRUE);
+		pool = NULL;
+	}
+	g_mutex_clear(&run.lock);
+
+	// sumfiles()
+	host = proj_get_sysname();
+	g_string_append_printf(json
+	,	"{\n"
+		" \"discovertype\": \"checksum\",\n"
+		" \"description\": \"Checksum information for files and dependent libraries\",\n"
+		" \"host\": \"%s\",\n"
+		" \"source\": \"%s\",\n"
+		" \"sumcmd\": \"%s\",\n"
+		" \"data\": {\n"
+	,	host, source, sumcmd);
+	g_free(host);
+	g_info("%s: %d files rehashed, %d checksums cached", source, run.rehashed
+	,	(gint)(sorted->len - run.rehashed));
+	for (j=0; j < sorted->len; ++j) {
+		const char *	path = g_ptr_array_index(sorted, j);
+		CksumEntry*	entry = (CksumEntry*)g_hash_table_lookup(cache, path);
+		g_string_append_printf(json, "%s\"%s\": \"%s\"", comma, path, entry->sum);
+		comma = ",\n  ";
+	}
+	g_string_append(json, "\n }\n}\n");
+
+	_cksum_save(cachefile, sumcmd, ldstamp, cache);
+	g_free(ldstamp);
+	g_ptr_array_free(tohash, TRUE);
+	g_ptr_array_free(sorted, TRUE);
+	g_hash_table_destroy(cache);
+	g_strfreev(sumcmds);
+	g_strfreev(filelist);
+	return TRUE;
+}
+///@}
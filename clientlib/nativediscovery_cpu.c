@@ -0,0 +1,395 @@
+/**
+ * @file
+ * @brief Native (in-process) version of the "cpu" discovery agent.
+ * @details This produces the same output as discovery_agents/cpu does - without the dozens of
+ * processes that script runs for every line of /proc/cpuinfo.
+ * The comments below say which part of the script each piece of code mimics.
+ * Where the script would produce invalid JSON, we don't: we escape names and values, we quote
+ * values which aren't valid JSON numbers (like "1.5*" or "007"), and we put a comma between
+ * fields which come before the first processor (like ARM's "Processor") and that processor.
+ *
+ * Parameters (optional - the agent takes none):
+ * - ASSIM_cpuinfo	where to read CPU information from (default: CPU_CPUINFO)
+ * - ASSIM_meminfo	where to read memory information from (default: CPU_MEMINFO)
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <projectcommon.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <misc.h>
+#include <nativediscovery.h>
+
+///@{
+/// @ingroup DiscoveryClass
+
+#define	CPU_CPUINFO	"/proc/cpuinfo"
+#define	CPU_MEMINFO	"/proc/meminfo"
+#define	CPU_BC		"/usr/bin/bc"
+#define	CPU_ISBLANK(c)	((c) == ' ' || (c) == '\t')
+
+FSTATIC gboolean _cpu_readline(const char ** pos, GString* line);
+FSTATIC gboolean _cpu_isfloating(const char * value);
+FSTATIC gboolean _cpu_isanumber(const char * value);
+FSTATIC gboolean _cpu_isjsonnumber(const char * value);
+FSTATIC void _cpu_jsonstring(GString* json, const char * value, gsize len);
+FSTATIC const char * _cpu_getenv(const gchar* const* env, const char * name, const char * deflt);
+FSTATIC void _cpu_scalarfmt(GString* json, const char * value);
+FSTATIC void _cpu_fmtflags(GString* json, const char * value);
+FSTATIC void _cpu_procname(GString* json, const char * line);
+
+/// Read the next line the way the shell's "read line" does.
+/// Backslashes quote the next character (a backslash-newline continues the line),
+/// and unquoted leading and trailing blanks are dropped.
+/// @return FALSE at end of input - including when the last line has no newline
+FSTATIC gboolean
+_cpu_readline(const char ** pos,	///<[in/out] where we are in our input
+	      GString* line)		///<[out] the line we read
+{
+	const char *	p = *pos;
+	gsize		quotedlen = 0;	// Length through the last quoted character
+
+	g_string_truncate(line, 0);
+	for (;;) {
+		if (EOS == *p) {
+			*pos = p;
+			return FALSE;
+		}
+		if ('\\' == *p) {
+			++p;
+			if (EOS == *p) {
+				*pos = p;
+				return FALSE;
+			}
+			if ('\n' != *p) {
+				g_string_append_c(line, *p);
+				quotedlen = line->len;
+			}
+			++p;
+			continue;
+		}
+		if ('\n' == *p) {
+			++p;
+			break;
+		}
+		if (line->len > 0 || !CPU_ISBLANK(*p)) {
+			g_string_append_c(line, *p);
+		}
+		++p;
+	}
+	*pos = p;
+	while (line->len > quotedlen && CPU_ISBLANK(line->str[line->len-1])) {
+		g_string_truncate(line, line->len-1);
+	}
+	return TRUE;
+}
+
+/// Mimic isfloating(): with bc it's a number if bc can evaluate it, without bc, everything is
+FSTATIC gboolean
+_cpu_isfloating(const char * value)
+{
+	char *	end = NULL;
+
+	if (!g_file_test(CPU_BC, G_FILE_TEST_IS_EXECUTABLE)) {
+		return TRUE;
+	}
+	(void)g_ascii_strtod(value, &end);
+	return end != value && EOS == *end;
+}
+
+/// Mimic isanumber(): letters, colons and multiple dots aren't numbers, things that look like
+/// decimal fractions are checked by isfloating(), and everything else has to be an integer "test"
+/// is happy with.
+FSTATIC gboolean
+_cpu_isanumber(const char * value)
+{
+	gsize		len = strlen(value);
+	const char *	firstdot = strchr(value, '.');
+	const char *	p;
+	char *		end = NULL;
+
+	// *.*.*|*[A-Za-z]*|*:*
+	if (firstdot && strchr(firstdot+1, '.')) {
+		return FALSE;
+	}
+	for (p = value; *p; ++p) {
+		if (g_ascii_isalpha(*p) || ':' == *p) {
+			return FALSE;
+		}
+	}
+	// [0-9]*.*[0-9*]
+	if (len >= 2 && g_ascii_isdigit(value[0]) && firstdot && firstdot > value
+	&&	firstdot < value+len-1
+	&&	(g_ascii_isdigit(value[len-1]) || '*' == value[len-1])) {
+		return _cpu_isfloating(value);
+	}
+	// test "$1" -le 0 ...
+	errno = 0;
+	(void)g_ascii_strtoll(value, &end, 10);
+	return errno == 0 && end != value && EOS == *end && g_ascii_isdigit(end[-1]);
+}
+
+/// Is this a number as far as JSON is concerned?  isanumber() says yes to things like "1.5*" and "007".
+FSTATIC gboolean
+_cpu_isjsonnumber(const char * value)
+{
+	const char *	p = value;
+
+	if ('-' == *p) {
+		++p;
+	}
+	if ('0' == *p) {
+		++p;
+	}else if (g_ascii_isdigit(*p)) {
+		while (g_ascii_isdigit(*p)) {
+			++p;
+		}
+	}else{
+		return FALSE;
+	}
+	if ('.' == *p) {
+		++p;
+		if (!g_ascii_isdigit(*p)) {
+			return FALSE;
+		}
+		while (g_ascii_isdigit(*p)) {
+			++p;
+		}
+	}
+	return EOS == *p;
+}
+
+/// Append this text to 'json' as a JSON string - quoted and escaped
+FSTATIC void
+_cpu_jsonstring(GString* json,		///<[in/out] where to put it
+		const char * value,	///<[in] text to quote
+		gsize len)		///<[in] its length
+{
+	gsize	j;
+
+	g_string_append_c(json, '"');
+	for (j=0; j < len; ++j) {
+		guchar	c = (guchar)value[j];
+		switch (c) {
+			case '\\':	g_string_append(json, "\\\\");	break;
+			case '"':	g_string_append(json, "\\\"");	break;
+			case '\n':	g_string_append(json, "\\n");	break;
+			case '\r':	g_string_append(json, "\\r");	break;
+			case '\t':	g_string_append(json, "\\t");	break;
+			default:
+				if (c < 0x20) {
+					g_string_append_printf(json, "\\u%04x", c);
+				}else{
+					g_string_append_c(json, c);
+				}
+				break;
+		}
+	}
+	g_string_append_c(json, '"');
+}
+
+/// Return the value of this parameter - or our default if it's missing or empty
+FSTATIC const char *
+_cpu_getenv(const gchar* const* env, const char * name, const char * deflt)
+{
+	const char *	value = env ? g_environ_getenv((gchar**)env, name) : NULL;
+	return (NULL == value || EOS == *value) ? deflt : value;
+}
+
+/// Mimic scalarfmt(): format a value as a JSON scalar of the type it seems to be
+FSTATIC void
+_cpu_scalarfmt(GString* json, const char * value)
+{
+	if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0 || strcmp(value, "null") == 0) {
+		g_string_append(json, value);
+	}else if (strcmp(value, "yes") == 0) {
+		g_string_append(json, "true");
+	}else if (strcmp(value, "no") == 0) {
+		g_string_append(json, "false");
+	}else if (_cpu_isanumber(value) && _cpu_isjsonnumber(value)) {
+		g_string_append(json, value);
+	}else{
+		_cpu_jsonstring(json, value, strlen(value));
+	}
+}
+
+/// Mimic fmtflags(): format blank-separated flag names as an object of 'true' values
+FSTATIC void
+_cpu_fmtflags(GString* json, const char * value)
+{
+	const char *	p = value;
+	const char *	flagcomma = "";
+
+	g_string_append_c(json, '{');
+	while (*p) {
+		const char *	start;
+		while (CPU_ISBLANK(*p)) {
+			++p;
+		}
+		if (EOS == *p) {
+			break;
+		}
+		start = p;
+		while (*p && !CPU_ISBLANK(*p)) {
+			++p;
+		}
+		g_string_append(json, flagcomma);
+		_cpu_jsonstring(json, start, p-start);
+		g_string_append(json, ":true");
+		flagcomma = ",";
+	}
+	g_string_append_c(json, '}');
+}
+
+/// Mimic: echo $line | sed -e 's%.*:[<tab> ]*%"%' -e 's%$%":%'
+/// (except that without a colon the script leaves off the opening quote - and we don't)
+FSTATIC void
+_cpu_procname(GString* json, const char * line)
+{
+	char **		words = g_strsplit_set(line, " \t", -1);
+	GString*	collapsed = g_string_new("");
+	const char *	lastcolon;
+	int		j;
+
+	// Unquoted $line gets split into words and put back together with single blanks
+	for (j=0; words[j]; ++j) {
+		if (words[j][0] == EOS) {
+			continue;
+		}
+		if (collapsed->len > 0) {
+			g_string_append_c(collapsed, ' ');
+		}
+		g_string_append(collapsed, words[j]);
+	}
+	g_strfreev(words);
+	lastcolon = strrchr(collapsed->str, ':');
+	if (lastcolon) {
+		const char *	value = lastcolon + 1;
+		while (CPU_ISBLANK(*value)) {
+			++value;
+		}
+		_cpu_jsonstring(json, value, strlen(value));
+	}else{
+		_cpu_jsonstring(json, collapsed->str, collapsed->len);
+	}
+	g_string_append_c(json, ':');
+	g_string_free(collapsed, TRUE);
+}
+
+/// Discover our CPU info from /proc/cpuinfo (and a little from /proc/meminfo)
+gboolean
+nativediscovery_cpu(GString* json,		///<[out] where to put our JSON
+		    const char * source,	///<[in] pathname of the cpu agent
+		    const gchar* const* env)	///<[in] parameters
+{
+	GString*	input = g_string_new("");
+	GString*	line = g_string_new("");
+	gchar*		contents = NULL;
+	gchar*		host = proj_get_sysname();
+	const char *	pos;
+	const char *	comma = "";
+	gboolean	inproc = FALSE;
+
+	g_string_append_printf(json
+	,	"{\n"
+		"  \"discovertype\": \"cpu\",\n"
+		"  \"description\": \"CPU information\",\n"
+		"  \"host\": \"%s\",\n"
+		"  \"source\": \"%s\",\n"
+		"  \"data\": {\n"
+	,	host, source);
+	g_free(host);
+
+	// (cat $CPUINFO; egrep '^(MemTotal|Hugepagesize):' <$MEMINFO | sed 's% kB$%%')
+	if (g_file_get_contents(_cpu_getenv(env, "ASSIM_cpuinfo", CPU_CPUINFO), &contents, NULL, NULL)) {
+		g_string_append(input, contents);
+		g_free(contents); contents = NULL;
+	}
+	if (g_file_get_contents(_cpu_getenv(env, "ASSIM_meminfo", CPU_MEMINFO), &contents, NULL, NULL)) {
+		char **	lines = g_strsplit(contents, "\n", -1);
+		int	j;
+		for (j=0; lines[j] && lines[j+1]; ++j) {
+			char *	memline = lines[j];
+			if (g_str_has_prefix(memline, "MemTotal:")
+			||	g_str_has_prefix(memline, "Hugepagesize:")) {
+				if (g_str_has_suffix(memline, " kB")) {
+					memline[strlen(memline)-3] = EOS;
+				}
+				g_string_append_printf(input, "%s\n", memline);
+			}
+		}
+		g_strfreev(lines);
+		g_free(contents); contents = NULL;
+	}
+
+	pos = input->str;
+	while (_cpu_readline(&pos, line)) {
+		const char *	firstcolon;
+		const char *	lastcolon;
+		const char *	value;
+		GString*	name;
+
+		if (g_str_has_prefix(line->str, "processor")) {
+			if (inproc) {
+				g_string_append(json, "\n    },\n");
+			}else if (EOS != comma[0]) {
+				// The script leaves out this comma
+				g_string_append(json, ",\n");
+			}
+			g_string_append(json, "    ");
+			_cpu_procname(json, line->str);
+			g_string_append(json, " {\n        ");
+			inproc = TRUE;
+			comma = "";
+			continue;
+		}
+		if (line->len == 0) {
+			continue;
+		}
+		// name=$(echo "$line" | sed -e 's%[<tab> ]*:.*%%')
+		firstcolon = strchr(line->str, ':');
+		name = g_string_new_len(line->str, firstcolon ? firstcolon - line->str : (gssize)line->len);
+		while (name->len > 0 && CPU_ISBLANK(name->str[name->len-1])) {
+			g_string_truncate(name, name->len-1);
+		}
+		// value=$(echo "$line" | sed -e 's%.*:[<tab> ]*%%')
+		lastcolon = strrchr(line->str, ':');
+		value = lastcolon ? lastcolon + 1 : line->str;
+		while (lastcolon && CPU_ISBLANK(*value)) {
+			++value;
+		}
+		g_string_append(json, comma);
+		_cpu_jsonstring(json, name->str, name->len);
+		g_string_append(json, ": ");
+		if (strcmp(name->str, "flags") == 0 || strcmp(name->str, "power management") == 0) {
+			_cpu_fmtflags(json, value);
+		}else{
+			_cpu_scalarfmt(json, value);
+		}
+		g_string_free(name, TRUE);
+		comma = ",\n        ";
+	}
+	// The script always closes a processor - even if it never opened one
+	g_string_append(json, (inproc ? "\n    }\n  }\n}\n" : "\n  }\n}\n"));
+	g_string_free(line, TRUE);
+	g_string_free(input, TRUE);
+	return TRUE;
+}
+///@}
@@ -0,0 +1,737 @@
+/**
+ * @file
+ * @brief Native (in-process) version of the "tcpdiscovery" discovery agent.
+ * @details The tcpdiscovery agent parses netstat output, and runs several commands for every
+ * socket it finds.  This version gets the sockets straight from the kernel with NETLINK_SOCK_DIAG,
+ * and finds the processes they belong to in a single pass over /proc/[pid]/fd - which stops as soon
+ * as it has found them all.
+ *
+ * The output has the same schema as the agent's - including the same process names - so the CMA
+ * can't tell which one it came from.  There are two deliberate differences:
+ * - Connections accepted by our own listeners aren't reported as client connections.
+ *   Those are the server end of someone else's client connection - and on a busy server there
+ *   can be hundreds of thousands of them.
+ * - Processes and addresses are listed in strcmp order, not in the order of the current locale.
+ *
+ * If the ASSIM_udp parameter is true, we also report UDP "listeners" (bound, unconnected UDP
+ * sockets) in listenaddrs - with "udp" or "udp6" as their protocol.
+ * If the kernel doesn't support NETLINK_SOCK_DIAG, we return FALSE - and the agent does the job.
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <projectcommon.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#	include <unistd.h>
+#endif
+#include <misc.h>
+#include <nativediscovery.h>
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pwd.h>
+#include <grp.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+///@{
+/// @ingroup DiscoveryClass
+
+/// Client processes we don't bother reporting - same as the agent's 'exestoskip'
+#define	TCP_SKIPEXES	".*/(firefox|thunderbird|chromium-browser|konquerer|rekonq)( *\\(deleted\\) *)?$"
+#define	TCP_BUFSIZE	32768
+#define	TCP_NAMEBUFSIZE	16384	///< Buffer size for getpwuid_r() and getgrgid_r()
+
+/// What we want to know about a socket
+typedef struct _TcpSock {
+	guint64		inode;		///< Its inode - how we find its process
+	const char *	proto;		///< "tcp", "tcp6", "udp" or "udp6"
+	char *		local;		///< Local address:port - the way netstat -n formats it
+	char *		remote;		///< Remote address:port
+	guint16		localport;	///< Local port
+	gboolean	localany;	///< Is its local address the ANY address?
+	gboolean	listening;	///< TRUE for listeners, FALSE for connections
+	gboolean	wanted;		///< Are we going to report it?
+} TcpSock;
+
+/// What we report about a process
+typedef struct _TcpProc {
+	char *		name;		///< Name we report it under - shared by all processes just like it
+	char *		exe;		///< Its executable
+	char *		cmdline;	///< Its command line - as a JSON array
+	char *		uid;		///< User it runs as
+	char *		gid;		///< Group it runs as
+	char *		cwd;		///< Its current directory
+} TcpProc;
+
+/// Everything we report under one process name
+typedef struct _TcpEntry {
+	TcpProc*	proc;		///< Process whose details we report
+	gboolean	fromlistener;	///< Is 'proc' a listener?
+	GHashTable*	listenaddrs;	///< "address<tab>protocol" strings it listens on
+	GHashTable*	clientaddrs;	///< "address<tab>protocol" strings it connects to
+} TcpEntry;
+
+FSTATIC void		_tcp_sock_free(gpointer vsock);
+FSTATIC void		_tcp_proc_free(gpointer vproc);
+FSTATIC void		_tcp_entry_free(gpointer ventry);
+FSTATIC char *		_tcp_fmtaddr(int family, const guint32* addr, guint16 port, gboolean* isany);
+FSTATIC void		_tcp_addsock(GPtrArray* socks, const struct inet_diag_msg* msg, int protocol);
+FSTATIC gboolean	_tcp_diag(int family, int protocol, guint32 states, GPtrArray* socks);
+FSTATIC gboolean	_tcp_skipaddr(const char * addr);
+FSTATIC guint		_tcp_findpids(GHashTable* inodes, guint wanted);
+FSTATIC char *		_tcp_readlink(const char * path);
+FSTATIC void		_tcp_jsonescape(GString* json, const char * value, gsize len);
+FSTATIC void		_tcp_jsonfield(GString* json, const char * name, const char * value);
+FSTATIC char *		_tcp_cmdline(const char * path);
+FSTATIC char *		_tcp_username(uid_t uid);
+FSTATIC char *		_tcp_groupname(gid_t gid);
+FSTATIC TcpProc*	_tcp_getproc(GHashTable* procs, gint pid);
+FSTATIC gint		_tcp_strcmp(gconstpointer a, gconstpointer b);
+FSTATIC GPtrArray*	_tcp_sortedkeys(GHashTable* table);
+FSTATIC void		_tcp_fmtaddrs(GString* data, const char * name, GHashTable* addrs);
+
+/// Free a TcpSock
+FSTATIC void
+_tcp_sock_free(gpointer vsock)
+{
+	TcpSock*	sock = (TcpSock*)vsock;
+	g_free(sock->local);
+	g_free(sock->remote);
+	g_free(sock);
+}
+
+/// Free a TcpProc
+FSTATIC void
+_tcp_proc_free(gpointer vproc)
+{
+	TcpProc*	proc = (TcpProc*)vproc;
+	if (NULL == proc) {
+		return;
+	}
+	g_free(proc->name);
+	g_free(proc->exe);
+	g_free(proc->cmdline);
+	g_free(proc->uid);
+	g_free(proc->gid);
+	g_free(proc->cwd);
+	g_free(proc);
+}
+
+/// Free a TcpEntry (but not its TcpProc)
+FSTATIC void
+_tcp_entry_free(gpointer ventry)
+{
+	TcpEntry*	entry = (TcpEntry*)ventry;
+	if (entry->listenaddrs) {
+		g_hash_table_destroy(entry->listenaddrs);
+	}
+	if (entry->clientaddrs) {
+		g_hash_table_destroy(entry->clientaddrs);
+	}
+	g_free(entry);
+}
+
+/// Format an address and port the way netstat -n -W does - address:port with no brackets.
+/// IPv4-mapped IPv6 addresses (like Java listeners have) keep their ::ffff: prefix - so
+/// "::ffff:127.0.0.1" isn't localhost as far as _tcp_skipaddr() is concerned.  Netstat agrees.
+FSTATIC char *
+_tcp_fmtaddr(int family,		///<[in] AF_INET or AF_INET6
+	     const guint32* addr,	///<[in] address (in network byte order)
+	     guint16 port,		///<[in] port (in host byte order)
+	     gboolean* isany)		///<[out] TRUE if it's the ANY address
+{
+	char	ip[INET6_ADDRSTRLEN];
+	int	words = (AF_INET == family ? 1 : 4);
+	int	j;
+
+	*isany = TRUE;
+	for (j=0; j < words; ++j) {
+		if (addr[j] != 0) {
+			*isany = FALSE;
+		}
+	}
+	if (NULL == inet_ntop(family, addr, ip, sizeof(ip))) {
+		ip[0] = EOS;
+	}
+	return g_strdup_printf("%s:%u", ip, port);
+}
+
+/// Add a socket we got from NETLINK_SOCK_DIAG to our collection
+FSTATIC void
+_tcp_addsock(GPtrArray* socks,			///<[in/out] where to put it
+	     const struct inet_diag_msg* msg,	///<[in] what the kernel told us about it
+	     int protocol)			///<[in] IPPROTO_TCP or IPPROTO_UDP
+{
+	TcpSock*	sock;
+	gboolean	remoteany;
+
+	if (0 == msg->idiag_inode || 0 == msg->id.idiag_sport) {
+		// Orphaned (TIME_WAIT, for example) or unbound
+		return;
+	}
+	sock = g_new0(TcpSock, 1);
+	sock->inode = msg->idiag_inode;
+	if (IPPROTO_TCP == protocol) {
+		sock->proto = (AF_INET == msg->idiag_family ? "tcp" : "tcp6");
+		sock->listening = (TCP_LISTEN == msg->idiag_state);
+	}else{
+		sock->proto = (AF_INET == msg->idiag_family ? "udp" : "udp6");
+		sock->listening = TRUE;
+	}
+	sock->localport = ntohs(msg->id.idiag_sport);
+	sock->local = _tcp_fmtaddr(msg->idiag_family, msg->id.idiag_src, sock->localport, &sock->localany);
+	sock->remote = _tcp_fmtaddr(msg->idiag_family, msg->id.idiag_dst, ntohs(msg->id.idiag_dport)
+	,			    &remoteany);
+	if (IPPROTO_UDP == protocol && 0 != msg->id.idiag_dport) {
+		// Connected UDP sockets aren't listening for anything
+		_tcp_sock_free(sock);
+		return;
+	}
+	g_ptr_array_add(socks, sock);
+}
+
+/// Ask the kernel (NETLINK_SOCK_DIAG) for all its sockets of this kind in these states
+/// @return FALSE if we couldn't
+FSTATIC gboolean
+_tcp_diag(int family,		///<[in] AF_INET or AF_INET6
+	  int protocol,		///<[in] IPPROTO_TCP or IPPROTO_UDP
+	  guint32 states,	///<[in] bit mask of (1 << TCP_*) states we want
+	  GPtrArray* socks)	///<[in/out] where to put them
+{
+	struct {
+		struct nlmsghdr		nlh;
+		struct inet_diag_req_v2	req;
+	}		request;
+	union {
+		struct nlmsghdr	hdr;
+		char		buf[TCP_BUFSIZE];
+	}		reply;
+	int		fd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+	gboolean	done = FALSE;
+	gboolean	ok = TRUE;
+
+	if (fd < 0) {
+		return FALSE;
+	}
+	memset(&request, 0, sizeof(request));
+	request.nlh.nlmsg_len = sizeof(request);
+	request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	request.nlh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+	request.req.sdiag_family = family;
+	request.req.sdiag_protocol = protocol;
+	request.req.idiag_states = states;
+	if (send(fd, &request, sizeof(request), 0) < 0) {
+		close(fd);
+		return FALSE;
+	}
+	while (!done) {
+		ssize_t	len = recv(fd, reply.buf, sizeof(reply.buf), 0);
+		gsize	offset = 0;
+		if (len < 0 && EINTR == errno) {
+			continue;
+		}
+		if (len <= 0) {
+			ok = FALSE;
+			break;
+		}
+		while (offset + sizeof(struct nlmsghdr) <= (gsize)len) {
+			const struct nlmsghdr*	nh = (const struct nlmsghdr*)(reply.buf + offset);
+			if (nh->nlmsg_len < sizeof(struct nlmsghdr) || offset + nh->nlmsg_len > (gsize)len) {
+				break;
+			}
+			if (NLMSG_DONE == nh->nlmsg_type) {
+				done = TRUE;
+				break;
+			}
+			if (NLMSG_ERROR == nh->nlmsg_type) {
+				ok = FALSE;
+				done = TRUE;
+				break;
+			}
+			if (SOCK_DIAG_BY_FAMILY == nh->nlmsg_type
+			&&	nh->nlmsg_len >= NLMSG_LENGTH(sizeof(struct inet_diag_msg))) {
+				_tcp_addsock(socks, (const struct inet_diag_msg*)NLMSG_DATA(nh), protocol);
+			}
+			offset += NLMSG_ALIGN(nh->nlmsg_len);
+		}
+	}
+	close(fd);
+	return ok;
+}
+
+/// Mimic shouldskipaddr(): we don't report IPv4 or IPv6 localhost (the agent's skiplocal=yes)
+FSTATIC gboolean
+_tcp_skipaddr(const char * addr)
+{
+	const char *	p;
+
+	if (g_str_has_prefix(addr, "127.0.0.1:")) {
+		return TRUE;
+	}
+	if (!g_str_has_prefix(addr, "::1:") || EOS == addr[4]) {
+		return FALSE;
+	}
+	for (p = addr+4; *p; ++p) {
+		if (!g_ascii_isdigit(*p)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/// Find which process each of these socket inodes belongs to - in a single pass over /proc.
+/// Like netstat, we give sockets shared by several processes to the first one we find.
+/// @return how many we couldn't find
+FSTATIC guint
+_tcp_findpids(GHashTable* inodes,	///<[in/out] maps inodes to pids (NULL: not found yet)
+	      guint wanted)		///<[in] how many pids we're looking for
+{
+	GDir*		procdir = g_dir_open("/proc", 0, NULL);
+	const char *	pidname;
+
+	if (NULL == procdir) {
+		return wanted;
+	}
+	while (wanted > 0 && NULL != (pidname = g_dir_read_name(procdir))) {
+		char		fddirname[64];
+		GDir*		fddir;
+		const char *	fdname;
+		gint		pid;
+
+		if (!g_ascii_isdigit(pidname[0])) {
+			continue;
+		}
+		pid = (gint)g_ascii_strtoll(pidname, NULL, 10);
+		g_snprintf(fddirname, sizeof(fddirname), "/proc/%s/fd", pidname);
+		if (NULL == (fddir = g_dir_open(fddirname, 0, NULL))) {
+			// Gone - or not ours to look at
+			continue;
+		}
+		while (wanted > 0 && NULL != (fdname = g_dir_read_name(fddir))) {
+			char		fdpath[128];
+			char		link[64];
+			ssize_t		linklen;
+			guint64		inode;
+			gpointer	key;
+			gpointer	value;
+
+			g_snprintf(fdpath, sizeof(fdpath), "%s/%s", fddirname, fdname);
+			linklen = readlink(fdpath, link, sizeof(link)-1);
+			if (linklen <= 0) {
+				continue;
+			}
+			link[linklen] = EOS;
+			if (!g_str_has_prefix(link, "socket:[")) {
+				continue;
+			}
+			inode = g_ascii_strtoull(link + 8, NULL, 10);
+			if (g_hash_table_lookup_extended(inodes, &inode, &key, &value) && NULL == value) {
+				g_hash_table_insert(inodes, key, GINT_TO_POINTER(pid));
+				--wanted;
+			}
+		}
+		g_dir_close(fddir);
+	}
+	g_dir_close(procdir);
+	return wanted;
+}
+
+/// Return what this symlink points to - or "" (like the agent's readlink) if we can't
+FSTATIC char *
+_tcp_readlink(const char * path)
+{
+	char *	ret = g_file_read_link(path, NULL);
+	return ret ? ret : g_strdup("");
+}
+
+/// Append this text to 'json' - escaped so that it's valid inside a JSON string
+FSTATIC void
+_tcp_jsonescape(GString* json,		///<[in/out] where to put it
+		const char * value,	///<[in] text to escape
+		gsize len)		///<[in] its length
+{
+	gsize	j;
+
+	for (j=0; j < len; ++j) {
+		guchar	c = (guchar)value[j];
+		switch (c) {
+			case '\\':	g_string_append(json, "\\\\");	break;
+			case '"':	g_string_append(json, "\\\"");	break;
+			case '\n':	g_string_append(json, "\\n");	break;
+			case '\r':	g_string_append(json, "\\r");	break;
+			case '\t':	g_string_append(json, "\\t");	break;
+			default:
+				if (c < 0x20) {
+					g_string_append_printf(json, "\\u%04x", c);
+				}else{
+					g_string_append_c(json, c);
+				}
+				break;
+		}
+	}
+}
+
+/// Append a (JSON-escaped) string field of a process to 'json'
+FSTATIC void
+_tcp_jsonfield(GString* json, const char * name, const char * value)
+{
+	g_string_append_printf(json, "    \"%s\": \"", name);
+	_tcp_jsonescape(json, value, strlen(value));
+	g_string_append(json, "\",\n");
+}
+
+/// Mimic slashproc_cmdline(): return a process' command line as a JSON array of strings
+/// @return NULL if the process is gone - or has no command line
+FSTATIC char *
+_tcp_cmdline(const char * path)	///<[in] its /proc/[pid]/cmdline
+{
+	gchar*		contents = NULL;
+	gsize		len = 0;
+	GString*	ret;
+	gsize		j;
+
+	if (!g_file_get_contents(path, &contents, &len, NULL) || 0 == len) {
+		g_free(contents);
+		return NULL;
+	}
+	// tr '\0' '\001' | sed -e 's%\001$%%' ...
+	if (EOS == contents[len-1]) {
+		--len;
+	}
+	ret = g_string_new("[\"");
+	for (j=0; j < len; ++j) {
+		if (EOS == contents[j]) {
+			g_string_append(ret, "\", \"");
+		}else{
+			_tcp_jsonescape(ret, contents+j, 1);
+		}
+	}
+	g_string_append(ret, "\"]");
+	g_free(contents);
+	return g_string_free(ret, FALSE);
+}
+
+/// Return the name of this user - or its number if it hasn't got one (like ls does)
+FSTATIC char *
+_tcp_username(uid_t uid)
+{
+	struct passwd	pw;
+	struct passwd*	result = NULL;
+	char *		buf = g_malloc(TCP_NAMEBUFSIZE);
+	char *		ret;
+
+	if (getpwuid_r(uid, &pw, buf, TCP_NAMEBUFSIZE, &result) == 0 && NULL != result) {
+		ret = g_strdup(pw.pw_name);
+	}else{
+		ret = g_strdup_printf("%lu", (unsigned long)uid);
+	}
+	g_free(buf);
+	return ret;
+}
+
+/// Return the name of this group - or its number if it hasn't got one (like ls does)
+FSTATIC char *
+_tcp_groupname(gid_t gid)
+{
+	struct group	gr;
+	struct group*	result = NULL;
+	char *		buf = g_malloc(TCP_NAMEBUFSIZE);
+	char *		ret;
+
+	if (getgrgid_r(gid, &gr, buf, TCP_NAMEBUFSIZE, &result) == 0 && NULL != result) {
+		ret = g_strdup(gr.gr_name);
+	}else{
+		ret = g_strdup_printf("%lu", (unsigned long)gid);
+	}
+	g_free(buf);
+	return ret;
+}
+
+/// Return what we report about this process - or NULL if it's gone
+FSTATIC TcpProc*
+_tcp_getproc(GHashTable* procs,	///<[in/out] TcpProcs we already know about - indexed by pid
+	     gint pid)		///<[in] process we want
+{
+	TcpProc*	proc;
+	gpointer	value;
+	char		path[64];
+	struct stat	sb;
+	GChecksum*	cksum;
+	char *		base;
+
+	if (g_hash_table_lookup_extended(procs, GINT_TO_POINTER(pid), NULL, &value)) {
+		return (TcpProc*)value;
+	}
+	g_snprintf(path, sizeof(path), "/proc/%d", pid);
+	if (stat(path, &sb) < 0) {
+		g_hash_table_insert(procs, GINT_TO_POINTER(pid), NULL);
+		return NULL;
+	}
+	proc = g_new0(TcpProc, 1);
+	g_snprintf(path, sizeof(path), "/proc/%d/exe", pid);
+	proc->exe = _tcp_readlink(path);
+	g_snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+	proc->cmdline = _tcp_cmdline(path);
+	g_snprintf(path, sizeof(path), "/proc/%d/cwd", pid);
+	proc->cwd = _tcp_readlink(path);
+	proc->uid = _tcp_username(sb.st_uid);
+	proc->gid = _tcp_groupname(sb.st_gid);
+
+	// Mimic procsuminfo(): the basename of its executable, and a checksum of its
+	// command line, executable, user and group.  Processes that are all the same get the same name.
+	cksum = g_checksum_new(G_CHECKSUM_MD5);
+	if (proc->cmdline) {
+		g_checksum_update(cksum, (const guchar*)proc->cmdline, -1);
+		g_checksum_update(cksum, (const guchar*)"\n", 1);
+	}
+	g_checksum_update(cksum, (const guchar*)proc->exe, -1);
+	g_checksum_update(cksum, (const guchar*)"\n", 1);
+	g_checksum_update(cksum, (const guchar*)proc->uid, -1);
+	g_checksum_update(cksum, (const guchar*)"\n", 1);
+	g_checksum_update(cksum, (const guchar*)proc->gid, -1);
+	g_checksum_update(cksum, (const guchar*)"\n", 1);
+	base = (proc->exe[0] ? g_path_get_basename(proc->exe) : g_strdup(""));
+	proc->name = g_strdup_printf("%s:%s", base, g_checksum_get_string(cksum));
+	g_free(base);
+	g_checksum_free(cksum);
+	if (NULL == proc->cmdline) {
+		proc->cmdline = g_strdup("[]");
+	}
+	g_hash_table_insert(procs, GINT_TO_POINTER(pid), proc);
+	return proc;
+}
+
+/// Compare two (char*) pointers the way strcmp does
+FSTATIC gint
+_tcp_strcmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/// Return the (string) keys of this hash table - sorted
+FSTATIC GPtrArray*
+_tcp_sortedkeys(GHashTable* table)
+{
+	GPtrArray*	keys = g_ptr_array_new();
+	GHashTableIter	iter;
+	gpointer	key;
+
+	g_hash_table_iter_init(&iter, table);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		g_ptr_array_add(keys, key);
+	}
+	g_ptr_array_sort(keys, _tcp_strcmp);
+	return keys;
+}
+
+/// Mimic format_addrs(): format a set of "address<tab>protocol" strings as a JSON object
+FSTATIC void
+_tcp_fmtaddrs(GString* data, const char * name, GHashTable* addrs)
+{
+	GPtrArray*	keys = _tcp_sortedkeys(addrs);
+	const char *	comma = "";
+	guint		j;
+
+	g_string_append_printf(data, "    \"%s\":{", name);
+	for (j=0; j < keys->len; ++j) {
+		const char *	addr = g_ptr_array_index(keys, j);
+		const char *	tab = strchr(addr, '\t');
+		g_string_append_printf(data, "%s\"%.*s\":\"%s\"", comma, (int)(tab - addr), addr, tab+1);
+		comma = ",";
+	}
+	g_string_append_c(data, '}');
+	g_ptr_array_free(keys, TRUE);
+}
+
+/// Discover our TCP (and optionally UDP) servers and clients
+gboolean
+nativediscovery_tcp(GString* json,		///<[out] where to put our JSON
+		    const char * source,	///<[in] pathname of the tcpdiscovery agent
+		    const gchar* const* env)	///<[in] our parameters
+{
+	const char *	udpparam = env ? g_environ_getenv((gchar**)env, "ASSIM_udp") : NULL;
+	GPtrArray*	socks = g_ptr_array_new_with_free_func(_tcp_sock_free);
+	GHashTable*	listenports;	// Ports we listen on with ANY address
+	GHashTable*	listenaddrs;	// Addresses we listen on
+	GHashTable*	inodes;		// Maps inodes of sockets we want to their pids
+	GHashTable*	procs;		// Maps pids to TcpProcs
+	GHashTable*	entries;	// Maps process names to TcpEntrys
+	GRegex*		skipexes;
+	GPtrArray*	names;
+	GString*	data;
+	char **		lines;
+	char *		host;
+	char *		us;
+	const char *	comma = "";
+	guint		wanted = 0;
+	guint		j;
+
+	if (!_tcp_diag(AF_INET, IPPROTO_TCP, (1<<TCP_LISTEN)|(1<<TCP_ESTABLISHED), socks)) {
+		// Let the agent do it the old-fashioned way
+		g_ptr_array_free(socks, TRUE);
+		return FALSE;
+	}
+	// No IPv6 means no IPv6 sockets
+	(void)_tcp_diag(AF_INET6, IPPROTO_TCP, (1<<TCP_LISTEN)|(1<<TCP_ESTABLISHED), socks);
+	if (udpparam && (g_ascii_strcasecmp(udpparam, "true") == 0 || g_ascii_strcasecmp(udpparam, "yes") == 0
+	||	strcmp(udpparam, "1") == 0)) {
+		(void)_tcp_diag(AF_INET, IPPROTO_UDP, 1<<TCP_CLOSE, socks);
+		(void)_tcp_diag(AF_INET6, IPPROTO_UDP, 1<<TCP_CLOSE, socks);
+	}
+
+	// Which connections are the server ends of connections to our listeners?
+	listenports = g_hash_table_new(g_direct_hash, g_direct_equal);
+	listenaddrs = g_hash_table_new(g_str_hash, g_str_equal);
+	for (j=0; j < socks->len; ++j) {
+		TcpSock*	sock = g_ptr_array_index(socks, j);
+		if (!sock->listening || sock->proto[0] != 't') {
+			continue;
+		}
+		if (sock->localany) {
+			g_hash_table_add(listenports, GUINT_TO_POINTER((guint)sock->localport));
+		}else{
+			g_hash_table_add(listenaddrs, sock->local);
+		}
+	}
+	inodes = g_hash_table_new(g_int64_hash, g_int64_equal);
+	for (j=0; j < socks->len; ++j) {
+		TcpSock*	sock = g_ptr_array_index(socks, j);
+		if (sock->listening) {
+			sock->wanted = !_tcp_skipaddr(sock->local);
+		}else{
+			sock->wanted = !_tcp_skipaddr(sock->remote)
+			&&	!g_hash_table_contains(listenports, GUINT_TO_POINTER((guint)sock->localport))
+			&&	!g_hash_table_contains(listenaddrs, sock->local);
+		}
+		if (sock->wanted && !g_hash_table_contains(inodes, &sock->inode)) {
+			g_hash_table_insert(inodes, &sock->inode, NULL);
+			++wanted;
+		}
+	}
+	g_hash_table_destroy(listenports);
+	g_hash_table_destroy(listenaddrs);
+	(void)_tcp_findpids(inodes, wanted);
+
+	procs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, _tcp_proc_free);
+	entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _tcp_entry_free);
+	skipexes = g_regex_new(TCP_SKIPEXES, 0, 0, NULL);
+	for (j=0; j < socks->len; ++j) {
+		TcpSock*	sock = g_ptr_array_index(socks, j);
+		gint		pid;
+		TcpProc*	proc;
+		TcpEntry*	entry;
+		GHashTable**	addrs;
+
+		if (!sock->wanted
+		||	0 == (pid = GPOINTER_TO_INT(g_hash_table_lookup(inodes, &sock->inode)))
+		||	NULL == (proc = _tcp_getproc(procs, pid))) {
+			continue;
+		}
+		if (!sock->listening && skipexes && g_regex_match(skipexes, proc->exe, 0, NULL)) {
+			continue;
+		}
+		entry = (TcpEntry*)g_hash_table_lookup(entries, proc->name);
+		if (NULL == entry) {
+			entry = g_new0(TcpEntry, 1);
+			entry->proc = proc;
+			g_hash_table_insert(entries, proc->name, entry);
+		}
+		if (sock->listening && !entry->fromlistener) {
+			// The agent reports the details of a listening process if there is one
+			entry->proc = proc;
+			entry->fromlistener = TRUE;
+		}
+		addrs = (sock->listening ? &entry->listenaddrs : &entry->clientaddrs);
+		if (NULL == *addrs) {
+			*addrs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		}
+		g_hash_table_add(*addrs, g_strdup_printf("%s\t%s"
+		,	sock->listening ? sock->local : sock->remote, sock->proto));
+	}
+	if (skipexes) {
+		g_regex_unref(skipexes);
+	}
+
+	// format_netstatinfo()
+	data = g_string_new("{");
+	names = _tcp_sortedkeys(entries);
+	for (j=0; j < names->len; ++j) {
+		TcpEntry*	entry = g_hash_table_lookup(entries, g_ptr_array_index(names, j));
+		TcpProc*	proc = entry->proc;
+		g_string_append_printf(data, "%s\n  \"", comma);
+		_tcp_jsonescape(data, proc->name, strlen(proc->name));
+		g_string_append(data, "\": {\n");
+		comma = ",";
+		_tcp_jsonfield(data, "exe", proc->exe);
+		g_string_append_printf(data, "    \"cmdline\": %s,\n", proc->cmdline);
+		_tcp_jsonfield(data, "uid", proc->uid);
+		_tcp_jsonfield(data, "gid", proc->gid);
+		_tcp_jsonfield(data, "cwd", proc->cwd);
+		if (entry->listenaddrs) {
+			_tcp_fmtaddrs(data, "listenaddrs", entry->listenaddrs);
+		}
+		if (entry->clientaddrs) {
+			if (entry->listenaddrs) {
+				g_string_append(data, ",\n");
+			}
+			_tcp_fmtaddrs(data, "clientaddrs", entry->clientaddrs);
+		}
+		g_string_append(data, "\n  }");
+	}
+	g_string_append(data, "\n}\n");
+	g_ptr_array_free(names, TRUE);
+
+	// discover()
+	host = proj_get_sysname();
+	us = g_path_get_basename(source);
+	g_string_append_printf(json
+	,	"{\n"
+		"  \"discovertype\": \"tcpdiscovery\",\n"
+		"  \"description\": \"TCP client and server processes\",\n"
+		"  \"source\": \"%s\",\n"
+		"  \"host\": \"%s\",\n"
+		"  \"data\":\n"
+	,	us, host);
+	g_free(us);
+	g_free(host);
+	// format_netstatinfo | sed 's%^%    %'
+	lines = g_strsplit(data->str, "\n", -1);
+	for (j=0; lines[j] && lines[j+1]; ++j) {
+		g_string_append_printf(json, "    %s\n", lines[j]);
+	}
+	g_string_append(json, "}\n");
+	g_strfreev(lines);
+	g_string_free(data, TRUE);
+
+	g_hash_table_destroy(entries);
+	g_hash_table_destroy(procs);
+	g_hash_table_destroy(inodes);
+	g_ptr_array_free(socks, TRUE);
+	return TRUE;
+}
+///@}
+#endif /* __linux__ */
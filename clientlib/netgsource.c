@@ -50,6 +50,7 @@ FSTATIC void	_netgsource_addListener(NetGSource*, guint16, Listener*);
 FSTATIC void	_netgsource_del_listener(gpointer);
 FSTATIC void	_netgsource_sendaframeset(NetGSource*,const NetAddr*, FrameSet*);
 FSTATIC void	_netgsource_sendframesets(NetGSource*,const NetAddr*, GSList*);
+FSTATIC void	_netgsource_sendbatch(NetGSource*, NetAddr**, FrameSet**, guint);
 
 static GSourceFuncs _netgsource_gsourcefuncs = {
 	_netgsource_prepare,
@@ -113,6 +114,7 @@ netgsource_new(NetIO* iosrc,			///<[in/out] Network I/O object
 	ret->addListener = _netgsource_addListener;
 	ret->sendframesets = _netgsource_sendframesets;
 	ret->sendaframeset = _netgsource_sendaframeset;
+	ret->sendbatch = _netgsource_sendbatch;
 
 	g_source_add_poll(gsret, &ret->_gfd);
 	g_source_set_priority(gsret, priority);
@@ -242,6 +244,16 @@ _netgsource_sendframesets(NetGSource*		self,	///< @ref NetGSource object to send
 	NetIO* nio = self->_netio;
 	nio->sendframesets(nio, addr, fslist);
 }
+/// Send each of a batch of @ref FrameSet "FrameSet"s to its own address
+FSTATIC void
+_netgsource_sendbatch(NetGSource*	self,		///< @ref NetGSource object to send via
+		      NetAddr**		addrs,		///< @ref NetAddr addresses to send to
+		      FrameSet**	framesets,	///< @ref FrameSet objects to send (one per address)
+		      guint		count)		///< How many addresses and FrameSets
+{
+	NetIO* nio = self->_netio;
+	nio->sendbatch(nio, addrs, framesets, count);
+}
 FSTATIC void
 _netgsource_addListener(NetGSource* self,	///<[in/out] Object being modified
 			guint16 fstype,		///<[in] FrameSet fstype
@@ -22,6 +22,7 @@
  *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
  */
 
+#define _GNU_SOURCE /* Needed for the sendmmsg(2) definitions */
 #include <projectcommon.h>
 #include <errno.h>
 #include <memory.h>
@@ -42,6 +43,7 @@
 #else
 #	include <sys/socket.h>
 #	include <netinet/in.h>
+#	include <time.h>
 #endif
 #include <glib.h>
 #include <packetdecoder.h>
@@ -61,9 +63,15 @@ FSTATIC gboolean _netio_input_queued(const NetIO* self);
 FSTATIC NetAddr* _netio_boundaddr(const NetIO* self);
 FSTATIC void _netio_sendframesets(NetIO* self, const NetAddr* destaddr, GSList* framesets);
 FSTATIC void _netio_sendaframeset(NetIO* self, const NetAddr* destaddr, FrameSet* frameset);
+FSTATIC void _netio_sendbatch(NetIO* self, NetAddr** destaddrs, FrameSet** framesets, guint count);
+FSTATIC void _netio_sendpackets(NetIO* self, NetAddr** destaddrs, FrameSet** framesets, guint count);
 FSTATIC void _netio_finalize(AssimObj* self);
 FSTATIC void _netio_sendapacket(NetIO* self, gconstpointer packet, gconstpointer pktend, const NetAddr* destaddr);
-FSTATIC gpointer _netio_recvapacket(NetIO*, gpointer*, struct sockaddr_in6*, socklen_t*addrlen);
+FSTATIC gpointer _netio_recvapacket(NetIO*, gpointer*, struct sockaddr_in6*, socklen_t*addrlen
+,			gint64* arrivaltime);
+#ifdef SO_TIMESTAMPNS
+FSTATIC gint64 _netio_kerneltime(const struct timespec* kerneltime);
+#endif
 FSTATIC gsize _netio_getmaxpktsize(const NetIO* self);
 FSTATIC gsize _netio_setmaxpktsize(NetIO* self, gsize maxpktsize);
 FSTATIC GSList* _netio_recvframesets(NetIO*self , NetAddr** src);
@@ -77,9 +85,12 @@ FSTATIC gboolean _netio_sendareliablefs(NetIO*self, NetAddr*dest, guint16 queuei
 FSTATIC gboolean _netio_sendreliablefs(NetIO*self, NetAddr* dest, guint16 queueid, GSList* fslist);
 FSTATIC gboolean _netio_ackmessage(NetIO* self, NetAddr* dest, FrameSet* frameset);
 FSTATIC gboolean _netio_supportsreliable(NetIO* self); 
+FSTATIC guint _netio_outputqlen(NetIO* self);
 FSTATIC void  _netio_closeconn(NetIO* self, guint16 qid, const NetAddr* destaddr);
 FSTATIC void _netio_netaddr_destroy(gpointer addrptr);
 FSTATIC void _netio_addalias(NetIO* self, NetAddr * fromaddr, NetAddr* toaddr);
+FSTATIC void _netio_marshalpool_send(gpointer vself, FrameSet* fs, const NetAddr* destaddr);
+FSTATIC NetAddr* _netio_unalias(NetIO* self, NetAddr* src);
 
 DEBUGDECLARATIONS
 
@@ -334,8 +345,8 @@ _netio_maximize_sockbufsize(const NetIO* self, gboolean forinput, int desiredsiz
 FSTATIC gboolean
 _netio_input_queued(const NetIO* self)		///<[in] The NetIO object being queried
 {
-	(void)self;
-	return FALSE;	// By default we don't have any input queues
+	// By default the only input we might have queued is from our MarshalPool
+	return (self->_marshalpool != NULL && self->_marshalpool->recvready(self->_marshalpool));
 }
 
 /// Member function to bind this NewIO object to a NetAddr address
@@ -395,6 +406,9 @@ FSTATIC void
 _netio_finalize(AssimObj* aself)	///<[in/out] The object being freed
 {
 	NetIO*	self = CASTTOCLASS(NetIO, aself);
+	if (self->_marshalpool) {
+		UNREF(self->_marshalpool);
+	}
 	if (self->giosock) {
 		g_io_channel_shutdown(self->giosock, TRUE, NULL);
 		g_io_channel_unref(self->giosock);
@@ -453,6 +467,7 @@ netio_new(gsize objsize			///<[in] The size of the object to construct (or zero)
 {
 	NetIO* ret;
 	Frame*	f;
+	gint64	marshalthreads;
 
 	BINDDEBUG(NetIO);
 	if (objsize < sizeof(NetIO)) {
@@ -466,6 +481,8 @@ netio_new(gsize objsize			///<[in] The size of the object to construct (or zero)
 	ret->bindaddr = _netio_bindaddr;
 	ret->sendframesets = _netio_sendframesets;
 	ret->sendaframeset = _netio_sendaframeset;
+	ret->sendbatch = _netio_sendbatch;
+	ret->sendpackets = _netio_sendpackets;
 	ret->getmaxpktsize = _netio_getmaxpktsize;
 	ret->setmaxpktsize = _netio_setmaxpktsize;
 	ret->recvframesets = _netio_recvframesets;
@@ -481,6 +498,7 @@ netio_new(gsize objsize			///<[in] The size of the object to construct (or zero)
 	ret->ackmessage = _netio_ackmessage;
 	ret->supportsreliable  = _netio_supportsreliable;	// It just returns FALSE
 	ret->outputpending  = _netio_supportsreliable;		// It just returns FALSE
+	ret->outputqlen  = _netio_outputqlen;
 	ret->addalias = _netio_addalias;
 	ret->closeconn = _netio_closeconn;
 	ret->setsockbufsize = _netio_setsockbufsize;
@@ -500,6 +518,16 @@ netio_new(gsize objsize			///<[in] The size of the object to construct (or zero)
 	ret->aliases = g_hash_table_new_full(netaddr_g_hash_hash, netaddr_g_hash_equal
         ,		_netio_netaddr_destroy, _netio_netaddr_destroy);  // Keys and data are same type...
 	memset(&ret->stats, 0, sizeof(ret->stats));
+	marshalthreads = config->getint(config, CONFIGNAME_MARSHALTHREADS);
+	if (marshalthreads > 0) {
+		gint64	threshold = config->getint(config, CONFIGNAME_MARSHALTHRESH);
+		if (threshold <= 0) {
+			threshold = DEFAULT_MARSHALPOOL_THRESHOLD;
+		}
+		// If this fails, we just do everything on the main loop as before
+		ret->_marshalpool = marshalpool_new(0, (guint)marshalthreads, (gsize)threshold
+		,	decoder, _netio_marshalpool_send, ret, NULL);
+	}
 	return ret;
 }
 
@@ -588,6 +616,18 @@ _netio_sendframesets(NetIO* self,		///< [in/out] The NetIO object doing the send
 		}
 		cryptframe = cryptframe_new_by_destaddr(destaddr);
 		DEBUGMSG3("%s.%d: cryptframe: %p", __FUNCTION__, __LINE__, cryptframe);
+		if (self->_marshalpool
+		&&	self->_marshalpool->marshal(self->_marshalpool, destaddr, curfs
+		,		signframe, cryptframe, compressframe)) {
+			// Our MarshalPool will send it for us - in order...
+			if (cryptframe) {
+				UNREF2(cryptframe);
+			}
+			if (compressframe) {
+				UNREF2(compressframe);
+			}
+			continue;
+		}
 		frameset_construct_packet(curfs, signframe, cryptframe, compressframe);
 		if (cryptframe) {
 			DEBUGMSG3("%s.%d: Sending encrypted packet.", __FUNCTION__, __LINE__);
@@ -613,6 +653,15 @@ _netio_sendaframeset(NetIO* self,		///< [in/out] The NetIO object doing the send
 
 	cryptframe = cryptframe_new_by_destaddr(destaddr);
 	DEBUGMSG3("%s.%d: cryptframe: %p", __FUNCTION__, __LINE__, cryptframe);
+	if (self->_marshalpool
+	&&	self->_marshalpool->marshal(self->_marshalpool, destaddr, frameset
+	,		signframe, cryptframe, compressframe)) {
+		// Our MarshalPool will send it for us - in order...
+		if (cryptframe) {
+			UNREF2(cryptframe);
+		}
+		return;
+	}
 	frameset_construct_packet(frameset, signframe, cryptframe, compressframe);
 	DEBUGMSG3("%s.%d: packet constructed (marshalled)", __FUNCTION__, __LINE__);
 	if (cryptframe) {
@@ -625,11 +674,162 @@ _netio_sendaframeset(NetIO* self,		///< [in/out] The NetIO object doing the send
 	_netio_sendapacket(self, frameset->packet, frameset->pktend, destaddr);
 }
 
+/// NetIO member function to send a batch of FrameSets - each to its own destination.
+/// This is intended for things like heartbeats, where we send lots of little FrameSets
+/// to lots of different places all at once.
+/// A FrameSet whose packet is already built is sent as it is - encrypted or not.  Whoever built
+/// it has to throw it away when keys change (see cryptframe_key_generation()).
+/// Heartbeats aren't sequenced, so those don't have to wait behind our MarshalPool either.
+FSTATIC void
+_netio_sendbatch(NetIO* self,			///< [in/out] The NetIO object doing the sending
+		 NetAddr** destaddrs,		///< [in] Where to send each FrameSet
+		 FrameSet** framesets,		///< [in] The FrameSets being sent
+		 guint count)			///< [in] How many of each we were given
+{
+	SignFrame*	signframe	= self->signframe(self);
+	CompressFrame*	compressframe	= self->compressframe(self);
+	FrameSet**	tosend;
+	NetAddr**	dests;
+	guint		nsend = 0;
+	guint		j;
+	g_return_if_fail(self != NULL);
+	g_return_if_fail(self->_signframe != NULL);
+	g_return_if_fail(destaddrs != NULL && framesets != NULL);
+
+	if (count == 0) {
+		return;
+	}
+	tosend = g_new(FrameSet*, count);
+	dests = g_new(NetAddr*, count);
+	for (j=0; j < count; ++j) {
+		FrameSet*	fs = framesets[j];
+		NetAddr*	destaddr = destaddrs[j];
+		CryptFrame*	cryptframe;
+		if (NULL != fs->packet) {
+			tosend[nsend] = fs;
+			dests[nsend] = destaddr;
+			++nsend;
+			continue;
+		}
+		cryptframe = cryptframe_new_by_destaddr(destaddr);
+		if (self->_marshalpool
+		&&	self->_marshalpool->marshal(self->_marshalpool, destaddr, fs
+		,		signframe, cryptframe, compressframe)) {
+			// Our MarshalPool is busy with this destination - let it keep things in order
+			if (cryptframe) {
+				UNREF2(cryptframe);
+			}
+			continue;
+		}
+		frameset_construct_packet(fs, signframe, cryptframe, compressframe);
+		if (cryptframe) {
+			UNREF2(cryptframe);
+		}
+		tosend[nsend] = fs;
+		dests[nsend] = destaddr;
+		++nsend;
+	}
+	self->sendpackets(self, dests, tosend, nsend);
+	g_free(tosend);
+	g_free(dests);
+}
+
+#define	NETIO_MAXBATCH	64	///< Most packets we hand sendmmsg(2) at once
+
+/// NetIO member function to send FrameSets whose packets have already been constructed -
+/// each to its own destination - with sendmmsg(2) if we have it.
+/// The packets are sent straight from the FrameSets - nothing is copied.
+FSTATIC void
+_netio_sendpackets(NetIO* self,		///< [in/out] The NetIO object doing the sending
+		   NetAddr** destaddrs,	///< [in] Where to send each of them
+		   FrameSet** framesets,	///< [in] FrameSets whose packets we're sending
+		   guint count)		///< [in] How many FrameSets (and addresses)
+{
+	guint			j = 0;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr		msgs[NETIO_MAXBATCH];
+	struct iovec		iovs[NETIO_MAXBATCH];
+	struct sockaddr_in6	addrs[NETIO_MAXBATCH];
+	guint			which[NETIO_MAXBATCH];	// Index in framesets of each message
+
+	// Our packet loss simulation is done in _netio_sendapacket()
+	while (j < count && !self->_shouldlosepkts) {
+		guint	nmsgs = 0;
+		int	rc;
+
+		memset(msgs, 0, sizeof(msgs));
+		for (; j < count && nmsgs < NETIO_MAXBATCH; ++j) {
+			FrameSet*	fs = framesets[j];
+			if (NULL == fs->packet) {
+				g_warning("%s.%d: FrameSet of type %d has no packet - not sent"
+				,	__FUNCTION__, __LINE__, fs->fstype);
+				continue;
+			}
+			which[nmsgs] = j;
+			addrs[nmsgs] = destaddrs[j]->ipv6sockaddr(destaddrs[j]);
+			iovs[nmsgs].iov_base = fs->packet;
+			iovs[nmsgs].iov_len = (guint8*)fs->pktend - (guint8*)fs->packet;
+			msgs[nmsgs].msg_hdr.msg_name = &addrs[nmsgs];
+			msgs[nmsgs].msg_hdr.msg_namelen = sizeof(addrs[nmsgs]);
+			msgs[nmsgs].msg_hdr.msg_iov = &iovs[nmsgs];
+			msgs[nmsgs].msg_hdr.msg_iovlen = 1;
+			++nmsgs;
+		}
+		if (nmsgs == 0) {
+			break;
+		}
+		rc = sendmmsg(self->getfd(self), msgs, nmsgs, 0);
+		self->stats.sendcalls ++;
+		if (rc <= 0) {
+			// Let _netio_sendapacket() report on (or retry) the one which failed
+			j = which[0];
+			break;
+		}
+		self->stats.pktswritten += rc;
+		self->stats.fswritten += rc;
+		if ((guint)rc < nmsgs) {
+			// Pick up where the kernel left off
+			j = which[rc];
+		}
+	}
+#endif
+	// Anything left over (or everything, if we don't have sendmmsg) goes one at a time
+	for (; j < count; ++j) {
+		if (NULL == framesets[j]->packet) {
+			g_warning("%s.%d: FrameSet of type %d has no packet - not sent"
+			,	__FUNCTION__, __LINE__, framesets[j]->fstype);
+			continue;
+		}
+		DUMP3(__FUNCTION__, &framesets[j]->baseclass, "is the frameset being sent");
+		_netio_sendapacket(self, framesets[j]->packet, framesets[j]->pktend, destaddrs[j]);
+		self->stats.fswritten++;
+	}
+}
+
+#ifdef SO_TIMESTAMPNS
+/// Convert the time the kernel says a packet arrived (CLOCK_REALTIME) to our monotonic clock.
+/// That way the time our main loop took to get around to the packet doesn't count against it.
+FSTATIC gint64
+_netio_kerneltime(const struct timespec* kerneltime)	///<[in] Kernel arrival timestamp
+{
+	gint64	kernelreal = (gint64)kerneltime->tv_sec*G_GINT64_CONSTANT(1000000)
+	+			 kerneltime->tv_nsec/1000;
+	gint64	age = g_get_real_time() - kernelreal;
+	gint64	now = g_get_monotonic_time();
+
+	// If the wall clock has been stepped, the best we can say is "just now"
+	if (age < 0 || age > 60*G_GINT64_CONSTANT(1000000)) {
+		return now;
+	}
+	return now - age;
+}
+#endif
+
 /// Internal function to receive a packet from our NetIO object
 /// General method:
 /// - use MSG_PEEK to get message length
 /// - malloc the amount of memory indicated by MSG_PEEK
-/// - receive message into malloced buffer
+/// - receive message into malloced buffer (along with its kernel timestamp, if we can)
 /// - check for errors
 /// - return received message, length, etc.
 #include <stdlib.h>
@@ -638,7 +838,8 @@ FSTATIC gpointer
 _netio_recvapacket(NetIO* self,			///<[in/out] Transport to receive packet from
 		   gpointer* pktend,		///<[out] Pointer to one past end of packet
 		   struct sockaddr_in6* srcaddr,///<[*out] Pointer to source address as sockaddr
-		   socklen_t* addrlen)		///<[out] length of address in 'srcaddr'
+		   socklen_t* addrlen,		///<[out] length of address in 'srcaddr'
+		   gint64* arrivaltime)		///<[out] When it arrived (monotonic clock)
 {
 	char		dummy[8]; // Make GCC stack protection happy...
 #ifndef __FUNCTION__
@@ -648,7 +849,17 @@ _netio_recvapacket(NetIO* self,			///<[in/out] Transport to receive packet from
 	gssize		msglen2;
 	guint8*		msgbuf;
 	const guint8 v4any[16] = CONST_IPV6_IPV4START;
+#ifdef SO_TIMESTAMPNS
+	struct msghdr	msg;
+	struct iovec	iov;
+	struct cmsghdr*	cmsg;
+	union {
+		struct cmsghdr	align;
+		char		buf[CMSG_SPACE(sizeof(struct timespec))];
+	}		control;
+#endif
 
+	*arrivaltime = 0;
 	// First we peek and see how long the message is...
 	*addrlen = sizeof(*srcaddr);
 	memset(srcaddr, 0, sizeof(*srcaddr));
@@ -673,9 +884,35 @@ _netio_recvapacket(NetIO* self,			///<[in/out] Transport to receive packet from
 
 	// Receive the message
 	*addrlen = sizeof(*srcaddr);
+#ifdef SO_TIMESTAMPNS
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = msgbuf;
+	iov.iov_len = msglen;
+	msg.msg_name = srcaddr;
+	msg.msg_namelen = *addrlen;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = &control;
+	msg.msg_controllen = sizeof(control);
+	msglen2 = recvmsg(self->getfd(self), &msg, MSG_DONTWAIT|MSG_TRUNC);
+	*addrlen = msg.msg_namelen;
+	if (msglen2 >= 0) {
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+				struct timespec	kerneltime;
+				memcpy(&kerneltime, CMSG_DATA(cmsg), sizeof(kerneltime));
+				*arrivaltime = _netio_kerneltime(&kerneltime);
+			}
+		}
+	}
+#else
 	msglen2 = recvfrom(self->getfd(self), msgbuf, msglen, MSG_DONTWAIT|MSG_TRUNC,
 			   (struct sockaddr *)srcaddr, addrlen);
+#endif
 	self->stats.recvcalls ++;
+	if (0 == *arrivaltime) {
+		*arrivaltime = g_get_monotonic_time();
+	}
 
 	// Was there an error?
 	if (msglen2 < 0) {
@@ -718,6 +955,25 @@ _netio_recvapacket(NetIO* self,			///<[in/out] Transport to receive packet from
 	self->stats.pktsread ++;
 	return msgbuf;
 }
+/// Map a received source address through our alias table.
+/// Some addresses can confuse our clients -- so we replace them with their aliases.
+/// @return the address to give our clients (which might be <i>src</i>).
+FSTATIC NetAddr*
+_netio_unalias(NetIO* self, NetAddr* src)
+{
+	NetAddr*	aliasaddr;
+
+	if (NULL != (aliasaddr = g_hash_table_lookup(self->aliases, src))) {
+		// This is a good-enough way to make a copy.
+		NetAddr* aliascopy = aliasaddr->toIPv6(aliasaddr);
+		// Keep the incoming port - since that's always right...
+		aliascopy->_addrport = src->_addrport;
+		UNREF(src);
+		src = aliascopy;
+	}
+	return src;
+}
+
 /// Member function to receive a collection of FrameSets (GSList*) out of our NetIO object
 FSTATIC GSList*
 _netio_recvframesets(NetIO* self,	///<[in/out] NetIO routine to receive a set of FrameSets
@@ -729,24 +985,43 @@ _netio_recvframesets(NetIO* self,	///<[in/out] NetIO routine to receive a set of
 	gpointer		pktend;
 	socklen_t		addrlen;
 	struct sockaddr_in6	srcaddr;
+	gint64			arrivaltime;
+	GSList*			fsl;
 
 	*src = NULL;	// Make python happy in case we fail...
-	pkt = _netio_recvapacket(self, &pktend, &srcaddr, &addrlen);
-
+	if (self->_marshalpool) {
+		// Anything our MarshalPool has finished comes ahead of what's in the socket.
+		ret = self->_marshalpool->nextrecv(self->_marshalpool, src);
+		if (NULL != ret) {
+			*src = _netio_unalias(self, *src);
+			self->stats.fsreads += g_slist_length(ret);
+			return ret;
+		}
+	}
+	pkt = _netio_recvapacket(self, &pktend, &srcaddr, &addrlen, &arrivaltime);
+
+	while (NULL != pkt && NULL != self->_marshalpool) {
+		NetAddr*	pktsrc = netaddr_sockaddr_new(&srcaddr, addrlen);
+		gboolean	taken;
+		taken = self->_marshalpool->unmarshal(self->_marshalpool, pkt, pktend, pktsrc
+		,	arrivaltime);
+		UNREF(pktsrc);
+		if (!taken) {
+			break;
+		}
+		// We'll see what it turns into when our MarshalPool is done with it.
+		// Returning NULL would tell our caller the socket is empty - so keep reading.
+		// (_netio_recvapacket() never blocks)
+		pkt = _netio_recvapacket(self, &pktend, &srcaddr, &addrlen, &arrivaltime);
+	}
 	if (NULL != pkt) {
 		ret = self->_decoder->pktdata_to_framesetlist(self->_decoder, pkt, pktend);
+		for (fsl = ret; fsl != NULL; fsl = fsl->next) {
+			CASTTOCLASS(FrameSet, fsl->data)->arrivaltime = arrivaltime;
+		}
 		if (NULL != ret) {
-			NetAddr*	aliasaddr;
 			*src = netaddr_sockaddr_new(&srcaddr, addrlen);
-			// Some addresses can confuse our clients -- let's check our alias table...
-			if (NULL != (aliasaddr = g_hash_table_lookup(self->aliases, *src))) {
-				// This is a good-enough way to make a copy.
-				NetAddr* aliascopy = aliasaddr->toIPv6(aliasaddr);
-				// Keep the incoming port - since that's always right...
-				aliascopy->_addrport = (*src)->_addrport;
-				UNREF(*src);
-				*src = aliascopy;
-			}
+			*src = _netio_unalias(self, *src);
 			if (DEBUG >= 3) {
 				char * srcstr = (*src)->baseclass.toString(&(*src)->baseclass);
 				DEBUGMSG("%s.%d: Received %d bytes making %d FrameSets from %s"
@@ -770,6 +1045,17 @@ badret:
 	ret = NULL;
 	return ret;
 }
+
+/// Function our MarshalPool calls (from the main loop) to send a packet it has built for us
+FSTATIC void
+_netio_marshalpool_send(gpointer vself, FrameSet* fs, const NetAddr* destaddr)
+{
+	NetIO*	self = CASTTOCLASS(NetIO, vself);
+
+	DUMP3(__FUNCTION__, &fs->baseclass, "is the frameset being sent");
+	_netio_sendapacket(self, fs->packet, fs->pktend, destaddr);
+	self->stats.fswritten++;
+}
 /// Set the desired level of packet loss - doesn't take effect from this call alone
 FSTATIC void
 _netio_setpktloss (NetIO* self, double rcvloss, double xmitloss)
@@ -883,6 +1169,13 @@ _netio_supportsreliable(NetIO* self)
 	(void)self;
 	return FALSE;
 }
+/// We don't queue output - so there is never any queued up
+FSTATIC guint
+_netio_outputqlen(NetIO* self)
+{
+	(void)self;
+	return 0;
+}
 FSTATIC void
  _netio_closeconn(NetIO* self, guint16 qid, const NetAddr* destaddr)
 {
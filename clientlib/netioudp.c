@@ -62,6 +62,15 @@ netioudp_new(gsize objsize		///<[in] Size of NetIOudp object, or zero.
 	proj_class_register_subclassed(iret, "NetIOudp");
 	ret = CASTTOCLASS(NetIOudp, iret);
 	sockfd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+#ifdef SO_TIMESTAMPNS
+	{
+		// Have the kernel tell us when each packet arrived - see _netio_recvapacket()
+		int	on = 1;
+		if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+			g_warning("%s.%d: Cannot enable SO_TIMESTAMPNS", __FUNCTION__, __LINE__);
+		}
+	}
+#endif
 #ifdef WIN32
 	{
 		u_long iMode=1;
@@ -62,6 +62,9 @@ FSTATIC gboolean g_source_pcap_check(GSource* source);
 FSTATIC gboolean g_source_pcap_dispatch(GSource* source, GSourceFunc callback, gpointer user_data);
 FSTATIC void     g_source_pcap_finalize(GSource* source);
 FSTATIC guint64 proj_timeval_to_g_real_time(const struct timeval * tv);
+FSTATIC GSource* _g_source_pcap_attach(GSource* src, pcap_t* captureobj, const char * dev
+,		unsigned listenmask, GSourcePcapDispatch dispatch, GDestroyNotify notify
+,		gint priority, gboolean can_recurse, GMainContext* context, gpointer userdata);
 
 static GSourceFuncs g_source_pcap_gsourcefuncs = {
 	g_source_pcap_prepare,
@@ -85,6 +88,8 @@ static GSourceFuncs g_source_pcap_gsourcefuncs = {
 GSource*
 g_source_pcap_new(const char * dev,	///<[in]Capture device name
 		  unsigned listenmask,	///<[in] bit mask of @ref pcap_protocols "supported protocols"
+		  guint bufsize,	///<[in] kernel capture buffer size - 0 for the default
+		  guint snaplen,	///<[in] snapshot length - 0 for what listenmask needs
 					///[in] called when new pcap data has arrived
         	  gboolean (*dispatch)(GSource_pcap_t*	gsource, ///< Gsource object causing dispatch
 			     pcap_t* capstruct,		///<[in] Pointer to structure capturing for us
@@ -121,11 +126,67 @@ g_source_pcap_new(const char * dev,	///<[in]Capture device name
 
 	ret = CASTTOCLASS(GSource_pcap_t, src);
 	// OK, now create the capture object to associate with it
-	if (NULL == (captureobj = create_pcap_listener(dev, FALSE, listenmask, &ret->pcprog))) {
+	if (NULL == (captureobj = create_pcap_listener(dev, FALSE, listenmask, &ret->pcprog
+	,						bufsize, snaplen))) {
 		// OOPS! Didn't work...  Give up.
 		g_source_unref(src);
 		return NULL;
 	}
+	return _g_source_pcap_attach(src, captureobj, dev, listenmask, dispatch, notify
+	,	priority, can_recurse, context, userdata);
+}
+
+/// Construct a new GSource which replays packets from a pcap file - as fast as it can.
+/// Packets are filtered just as they would be for g_source_pcap_new(), and the source
+/// goes away once the file has been read.  Handy for testing dispatch functions.
+GSource*
+g_source_pcap_replay_new(const char * filename,	///<[in] pcap file to replay
+		  unsigned listenmask,		///<[in] bit mask of @ref pcap_protocols "protocols"
+		  GSourcePcapDispatch dispatch,	///<[in] called for each packet
+		  GDestroyNotify notify,	///<[in] called when we're destroyed (or NULL)
+		  gint priority,		///<[in] g_main_loop dispatch priority
+		  GMainContext* context,	///<[in] GMainContext or NULL
+		  gsize objectsize,		///<[in] size of object to create (or zero)
+		  gpointer userdata)		///<[in/out] user object for dispatch function
+{
+	pcap_t*		captureobj;
+	GSource*	src;
+	GSource_pcap_t*	ret;
+
+	if (objectsize < sizeof(GSource_pcap_t)) {
+		objectsize = sizeof(GSource_pcap_t);
+	}
+	src = g_source_new(&g_source_pcap_gsourcefuncs, objectsize);
+	g_return_val_if_fail(src != NULL, NULL);
+
+	proj_class_register_object(src, "GSource");
+	proj_class_register_subclassed(src, "GSource_pcap_t");
+
+	ret = CASTTOCLASS(GSource_pcap_t, src);
+	if (NULL == (captureobj = create_pcap_replay(filename, listenmask, &ret->pcprog))) {
+		g_source_unref(src);
+		return NULL;
+	}
+	ret->replay = TRUE;
+	return _g_source_pcap_attach(src, captureobj, filename, listenmask, dispatch, notify
+	,	priority, FALSE, context, userdata);
+}
+
+/// Finish constructing a pcap GSource around its capture object - and attach it to 'context'
+FSTATIC GSource*
+_g_source_pcap_attach(GSource* src		///<[in/out] Our GSource_pcap_t object
+,		      pcap_t* captureobj	///<[in] capture object to read from
+,		      const char * dev		///<[in] capture device (or file) name
+,		      unsigned listenmask	///<[in] bit mask of @ref pcap_protocols "protocols"
+,		      GSourcePcapDispatch dispatch	///<[in] called for each packet
+,		      GDestroyNotify notify	///<[in] called when we're destroyed (or NULL)
+,		      gint priority		///<[in] g_main_loop dispatch priority
+,		      gboolean can_recurse	///<[in] TRUE if dispatch recursion is allowed
+,		      GMainContext* context	///<[in] GMainContext or NULL
+,		      gpointer userdata)	///<[in/out] user object for dispatch function
+{
+	GSource_pcap_t*	ret = CASTTOCLASS(GSource_pcap_t, src);
+
 	ret->capture = captureobj;
 	ret->capturedev = g_strdup(dev);
 	ret->listenmask = listenmask;
@@ -200,12 +261,33 @@ g_source_pcap_dispatch(GSource* src, ///<[in] source being <i>dispatch</i>ed
 			return FALSE;
 		}
 	}
+	if (rc == PCAP_ERROR_BREAK && psrc->replay) {
+		// End of our pcap file
+		return FALSE;
+	}
 	if (rc < 0) {
 		g_warning("%s.%d: pcap_next_ex() returned %d [%s]. Returning FALSE."
 		,	__FUNCTION__, __LINE__, rc, pcap_geterr(psrc->capture));
 	}
 	return rc >= 0;
 }
+
+/// Retrieve libpcap's statistics for this capture - including how many packets the kernel dropped
+/// @return TRUE if 'stats' was filled in
+gboolean
+g_source_pcap_getstats(GSource_pcap_t* src,	///<[in/out] capture to get statistics for
+		       struct pcap_stat* stats)	///<[out] where to put them
+{
+	if (NULL == src->capture || src->replay) {
+		return FALSE;
+	}
+	if (pcap_stats(src->capture, stats) < 0) {
+		g_warning("%s.%d: pcap_stats() failed: [%s]", __FUNCTION__, __LINE__
+		,	pcap_geterr(src->capture));
+		return FALSE;
+	}
+	return TRUE;
+}
 /// The GMainLoop <i>finalize</i> function for libpcap packet capturing
 /// Called when this object is 'finalized' (destroyed)
 void
@@ -216,7 +298,17 @@ g_source_pcap_finalize(GSource* src)
 		psrc->destroynote(psrc);
 	}
 	if (psrc->capture) {
-		close_pcap_listener(psrc->capture, psrc->capturedev, psrc->listenmask);
+		struct pcap_stat	stats;
+		if (g_source_pcap_getstats(psrc, &stats)) {
+			g_info("%s.%d: %s: %u packets received, %u dropped by kernel"
+			", %u dropped by interface", __FUNCTION__, __LINE__, psrc->capturedev
+			,	stats.ps_recv, stats.ps_drop, stats.ps_ifdrop);
+		}
+		if (psrc->replay) {
+			pcap_close(psrc->capture);
+		}else{
+			close_pcap_listener(psrc->capture, psrc->capturedev, psrc->listenmask);
+		}
 		pcap_freecode(&psrc->pcprog);
 		psrc->capture = NULL;
 		g_free(psrc->capturedev);
@@ -235,31 +327,26 @@ proj_timeval_to_g_real_time(const struct timeval * tv)
 	return ret;
 }
 
-/// Construct a PCAP capture FrameSet from a PCAP packet
+/// Construct a PCAP capture FrameSet from a PCAP packet.
+/// If 'pkt' is NULL, we construct one with everything but the packet data.
 FrameSet*
 construct_pcap_frameset(guint16 framesettype,		  ///<[in] type to create FrameSet with
-			gconstpointer pkt,		  ///<[in] captured packet
+			gconstpointer pkt,		  ///<[in] captured packet (or NULL)
 			gconstpointer pktend,		  ///<[in] one byte past end of pkt
 			const struct pcap_pkthdr* pkthdr, ///<[in] libpcap packet header
 			const char * interfacep)	  ///<[in] interface it was captured on
 {
 	IntFrame*	timeframe = intframe_new(FRAMETYPE_WALLCLOCK, sizeof(proj_timeval_to_g_real_time(NULL)));
-	Frame* 		pktframe = frame_new(FRAMETYPE_PKTDATA, 0);
 	CstringFrame*	intfname = cstringframe_new(FRAMETYPE_INTERFACE, 0);
 	CstringFrame*	fsysname = cstringframe_new(FRAMETYPE_HOSTNAME, 0);
 	FrameSet*	fs = frameset_new(framesettype);
-	const guint8*	bpkt = (const guint8*) pkt;
-	gsize		pktlen = ((const guint8*)pktend-bpkt);
-	guint8*		cppkt = MALLOC0(pktlen);
 	gchar*		sysname;
 
 	sysname = proj_get_sysname();
 	g_return_val_if_fail(NULL != sysname, NULL);
 	g_return_val_if_fail(fsysname != NULL, NULL);
 	g_return_val_if_fail(timeframe != NULL, NULL);
-	g_return_val_if_fail(pktframe != NULL, NULL);
 	g_return_val_if_fail(intfname != NULL, NULL);
-	g_return_val_if_fail(cppkt != NULL, NULL);
 
 	// System name
 	fsysname->baseclass.setvalue(&fsysname->baseclass, sysname, strlen(sysname)+1, g_free);
@@ -277,11 +364,19 @@ construct_pcap_frameset(guint16 framesettype,		  ///<[in] type to create FrameSe
 	UNREF2(timeframe);
 
 	// Packet data
-	memcpy(cppkt, pkt, pktlen);
-	pktframe->setvalue(pktframe, cppkt, pktlen, g_free);
-	frameset_append_frame(fs, pktframe);
-	UNREF(pktframe);
+	if (pkt != NULL) {
+		Frame* 		pktframe = frame_new(FRAMETYPE_PKTDATA, 0);
+		const guint8*	bpkt = (const guint8*) pkt;
+		gsize		pktlen = ((const guint8*)pktend-bpkt);
+		guint8*		cppkt = MALLOC0(pktlen);
 
+		g_return_val_if_fail(pktframe != NULL, NULL);
+		g_return_val_if_fail(cppkt != NULL, NULL);
+		memcpy(cppkt, pkt, pktlen);
+		pktframe->setvalue(pktframe, cppkt, pktlen, g_free);
+		frameset_append_frame(fs, pktframe);
+		UNREF(pktframe);
+	}
 	return fs;
 }
 ///@}
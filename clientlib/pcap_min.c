@@ -56,35 +56,17 @@ static struct pcap_filter_info {
 
 DEBUGDECLARATIONS
 FSTATIC gboolean _enable_mcast_address(const char * addrstring, const char * dev, gboolean enable);
+FSTATIC char * _pcap_filter_expression(unsigned listenmask);
 
-/**
- *  Set up pcap listener for the given interfaces and protocols.
- *  @return a properly configured pcap_t* object for listening for the given protocols - NULL on error
- *  @see pcap_protocols
- */
-pcap_t*
-create_pcap_listener(const char * dev		///<[in] Device name to listen on
-,		     gboolean blocking		///<[in] TRUE if this is a blocking connection
-,		     unsigned listenmask	///<[in] Bit mask of protocols to listen for
-						///< (see @ref pcap_protocols "list of valid bits")
-,		     struct bpf_program*prog)	///<[out] Compiled PCAP program
+/// Construct the (malloced) libpcap filter expression for the given set of protocols - NULL on error
+FSTATIC char *
+_pcap_filter_expression(unsigned listenmask)	///<[in] Bit mask of protocols to listen for
 {
-	pcap_t*			pcdescr = NULL;
-	bpf_u_int32		maskp = 0;
-	bpf_u_int32		netp = 0;
-	char			errbuf[PCAP_ERRBUF_SIZE];
 	char *			expr = NULL;
 	int			filterlen = 1;
 	unsigned		j;
 	int			cnt=0;
-	int			rc;
 	const char ORWORD [] = " or ";
-	gboolean		need_promisc = FALSE;
-
-	BINDDEBUG(pcap_t);
-//	setbuf(stdout, NULL);
-	setvbuf(stdout, NULL, _IONBF, 0);
-	errbuf[0] = '\0';
 
 	// Search the list of valid bits so we can construct the libpcap filter
 	// for the given set of protocols on the fly...
@@ -119,6 +101,50 @@ create_pcap_listener(const char * dev		///<[in] Device name to listen on
 			g_strlcat(expr, filterinfo[j].filter, filterlen);
 		}
 	}
+	return expr;
+}
+
+/// Return the snapshot length the given protocols need
+guint
+pcap_snaplen_for(unsigned listenmask)	///<[in] Bit mask of @ref pcap_protocols "protocols"
+{
+	return ((listenmask & ~ENABLE_ARP) ? PCAP_SNAPLEN_FULL : PCAP_SNAPLEN_ARP);
+}
+
+/**
+ *  Set up pcap listener for the given interfaces and protocols.
+ *  On Linux, libpcap captures through a memory-mapped (TPACKET_V3) ring, whose size is
+ *  our buffer size.  Keeping the snapshot length down to what our protocols need lets many
+ *  more packets fit in that ring.
+ *  @return a properly configured pcap_t* object for listening for the given protocols - NULL on error
+ *  @see pcap_protocols
+ */
+pcap_t*
+create_pcap_listener(const char * dev		///<[in] Device name to listen on
+,		     gboolean blocking		///<[in] TRUE if this is a blocking connection
+,		     unsigned listenmask	///<[in] Bit mask of protocols to listen for
+						///< (see @ref pcap_protocols "list of valid bits")
+,		     struct bpf_program*prog	///<[out] Compiled PCAP program
+,		     guint bufsize		///<[in] Kernel buffer (ring) size - 0 for default
+,		     guint snaplen)		///<[in] Snapshot length - 0 for what our protocols need
+{
+	pcap_t*			pcdescr = NULL;
+	bpf_u_int32		maskp = 0;
+	bpf_u_int32		netp = 0;
+	char			errbuf[PCAP_ERRBUF_SIZE];
+	char *			expr = NULL;
+	unsigned		j;
+	int			rc;
+	gboolean		need_promisc = FALSE;
+
+	BINDDEBUG(pcap_t);
+//	setbuf(stdout, NULL);
+	setvbuf(stdout, NULL, _IONBF, 0);
+	errbuf[0] = '\0';
+
+	if (NULL == (expr = _pcap_filter_expression(listenmask))) {
+		return NULL;
+	}
 	if (pcap_lookupnet(dev, &netp, &maskp, errbuf) != 0) {
 		// This is not a problem for non-IPv4 protocols...
 		// It just looks up the ipv4 address - which we mostly don't care about.
@@ -152,14 +178,23 @@ create_pcap_listener(const char * dev		///<[in] Device name to listen on
 		g_warning("Have no idea why this happens - current blocking state is: %d."
 		,	pcap_getnonblock(pcdescr, errbuf));
 	}
-	pcap_set_snaplen(pcdescr, 1500);
+	if (0 == snaplen) {
+		snaplen = pcap_snaplen_for(listenmask);
+	}
+	pcap_set_snaplen(pcdescr, snaplen);
 	/// @todo deal with pcap_set_timeout() call here.
 	if (blocking) {
 		pcap_set_timeout(pcdescr, 240*1000);
 	}else{
 		pcap_set_timeout(pcdescr, 1);
+#ifdef HAVE_PCAP_SET_IMMEDIATE_MODE
+		// Hand us each ring block as soon as it has anything in it
+		pcap_set_immediate_mode(pcdescr, TRUE);
+#endif
+	}
+	if (bufsize > 0) {
+		pcap_set_buffer_size(pcdescr, bufsize);
 	}
-	//pcap_set_buffer_size(pcdescr, 1500);
       
 	if (pcap_activate(pcdescr) != 0) {
 		g_warning("pcap_activate failed: [%s]", pcap_geterr(pcdescr));
@@ -193,6 +228,131 @@ oopsie:	// Some kind of failure - free things up and return NULL
 	return NULL;
 }
 
+/**
+ *  Open a pcap file to replay packets from - filtered just as create_pcap_listener() would.
+ *  @return a pcap_t* object for reading the given protocols from 'filename' - NULL on error
+ */
+pcap_t*
+create_pcap_replay(const char * filename	///<[in] pcap file to replay
+,		   unsigned listenmask		///<[in] Bit mask of protocols to pass through
+,		   struct bpf_program*prog)	///<[out] Compiled PCAP program
+{
+	pcap_t*			pcdescr;
+	char			errbuf[PCAP_ERRBUF_SIZE];
+	char *			expr;
+
+	BINDDEBUG(pcap_t);
+	if (NULL == (expr = _pcap_filter_expression(listenmask))) {
+		return NULL;
+	}
+	errbuf[0] = '\0';
+	if (NULL == (pcdescr = pcap_open_offline(filename, errbuf))) {
+		g_warning("%s.%d: pcap_open_offline(\"%s\") failed: [%s]"
+		,	__FUNCTION__, __LINE__, filename, errbuf);
+		free(expr);
+		return NULL;
+	}
+	if (pcap_compile(pcdescr, prog, expr, FALSE, 0) < 0) {
+		g_warning("%s.%d: pcap_compile of [%s] failed: [%s]", __FUNCTION__, __LINE__
+		,	expr, pcap_geterr(pcdescr));
+		free(expr);
+		pcap_close(pcdescr);
+		return NULL;
+	}
+	if (pcap_setfilter(pcdescr, prog) < 0) {
+		g_warning("%s.%d: pcap_setfilter on [%s] failed: [%s]", __FUNCTION__, __LINE__
+		,	expr, pcap_geterr(pcdescr));
+		free(expr);
+		pcap_freecode(prog);
+		pcap_close(pcdescr);
+		return NULL;
+	}
+	free(expr);
+	return pcdescr;
+}
+
+/**
+ *  Change the set of protocols an existing pcap listener listens for - without reopening it.
+ *  We replace its filter, and listen to any new multicast addresses (and stop listening to old ones).
+ *  Note that we can't turn on promiscuous mode at this point, so if we can't listen to a new
+ *  multicast address we may miss some of those packets.
+ *  @return TRUE on success - on failure the old filter stays in place
+ */
+gboolean
+change_pcap_listener(pcap_t* pcdescr		///<[in/out] Listener to change
+,		     const char* dev		///<[in] device it's listening on
+,		     unsigned oldmask		///<[in] protocols it's listening for now
+,		     unsigned newmask		///<[in] protocols it should listen for
+,		     struct bpf_program*prog)	///<[in/out] its compiled PCAP program
+{
+	struct bpf_program	newprog;
+	char *			expr;
+	unsigned		j;
+
+	if (NULL == (expr = _pcap_filter_expression(newmask))) {
+		return FALSE;
+	}
+	if (pcap_compile(pcdescr, &newprog, expr, FALSE, 0) < 0) {
+		g_warning("%s.%d: pcap_compile of [%s] failed: [%s]", __FUNCTION__, __LINE__
+		,	expr, pcap_geterr(pcdescr));
+		free(expr);
+		return FALSE;
+	}
+	for (j = 0; j < DIMOF(filterinfo); ++j) {
+		const char * addrstring = filterinfo[j].mcastaddr;
+		if (addrstring && (newmask & filterinfo[j].filterbit)
+		&&	!(oldmask & filterinfo[j].filterbit)
+		&&	!_enable_mcast_address(addrstring, dev, TRUE)) {
+			g_warning("%s.%d: Cannot listen to %s on %s - may miss packets"
+			,	__FUNCTION__, __LINE__, addrstring, dev);
+		}
+	}
+	if (pcap_setfilter(pcdescr, &newprog) < 0) {
+		g_warning("%s.%d: pcap_setfilter on [%s] failed: [%s]", __FUNCTION__, __LINE__
+		,	expr, pcap_geterr(pcdescr));
+		pcap_freecode(&newprog);
+		free(expr);
+		return FALSE;
+	}
+	for (j = 0; j < DIMOF(filterinfo); ++j) {
+		if ((oldmask & filterinfo[j].filterbit) && !(newmask & filterinfo[j].filterbit)
+		&&	filterinfo[j].mcastaddr) {
+			_enable_mcast_address(filterinfo[j].mcastaddr, dev, FALSE);
+		}
+	}
+	DEBUGMSG1("%s.%d: %s now listening with [%s]", __FUNCTION__, __LINE__, dev, expr);
+	pcap_freecode(prog);
+	*prog = newprog;
+	free(expr);
+	return TRUE;
+}
+
+/// Return which of our @ref pcap_protocols a captured packet belongs to (0 if none)
+unsigned
+pcap_packet_protocol(gconstpointer pkt		///<[in] captured (ethernet) packet
+,		     gconstpointer pend)	///<[in] first byte past 'pkt'
+{
+	static const guint8	lldpaddr[6] = {0x01, 0x80, 0xc2, 0x00, 0x00, 0x0e};
+	static const guint8	cdpaddr[6] = {0x01, 0x00, 0x0c, 0xcc, 0xcc, 0xcc};
+	const guint8*		bpkt = (const guint8*)pkt;
+	guint16			ethertype;
+
+	if ((const guint8*)pend - bpkt < 14) {
+		return 0;
+	}
+	ethertype = (guint16)((bpkt[12] << 8) | bpkt[13]);
+	if (memcmp(bpkt, lldpaddr, sizeof(lldpaddr)) == 0 && ethertype == 0x88cc) {
+		return ENABLE_LLDP;
+	}
+	if (memcmp(bpkt, cdpaddr, sizeof(cdpaddr)) == 0) {
+		return ENABLE_CDP;
+	}
+	if (ethertype == 0x0806) {
+		return ENABLE_ARP;
+	}
+	return 0;
+}
+
 /// Close this pcap_listener, and undo listens for multicast addresses
 void
 close_pcap_listener(pcap_t*	pcapdev		///< Pcap device structure
@@ -0,0 +1,398 @@
+/**
+ * @file
+ * @brief Shares one packet capture per interface among all the discovery types that want it.
+ * @details We keep one @ref GSource_pcap_t per interface.  Its filter is the combination of the
+ * protocols all its consumers asked for, and we change it as consumers attach and detach -
+ * without reopening the device.  Each packet is handed only to the consumers which
+ * asked for its protocol.
+ * An interface can also be set up without any capture at all, so that test and benchmark code
+ * can inject packets into exactly the same code path without needing privileges.
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+#include <projectcommon.h>
+#include <proj_classes.h>
+#include <pcap_min.h>
+#include <pcap_mux.h>
+
+///@{
+/// @ingroup GSource_Pcap
+
+typedef struct _PcapMux	PcapMux;
+/// The shared capture for one interface - and everyone who is listening to it
+struct _PcapMux {
+	char*		dev;		///< Interface we're capturing on (our hash table key)
+	GSource_pcap_t*	source;		///< Our shared capture (NULL if we're offline)
+	GSList*		consumers;	///< PcapConsumers attached to us
+	unsigned	listenmask;	///< Protocols our consumers want
+	guint		snaplen;	///< Largest snapshot length our consumers want
+	guint		bufsize;	///< Largest kernel buffer size our consumers want
+	gint		priority;	///< Current priority of our GSource
+	GMainContext*	context;	///< GMainContext our GSource is attached to
+	gboolean	dispatching;	///< TRUE while we're handing out a packet
+};
+
+/// One consumer of packets from a @ref PcapMux
+struct _PcapConsumer {
+	PcapMux*		mux;		///< Capture we're attached to (NULL once it dropped us)
+	unsigned		listenmask;	///< @ref pcap_protocols we want
+	guint			snaplen;	///< Snapshot length we need
+	GSourcePcapDispatch	dispatch;	///< Who to give them to (NULL once they've had enough)
+	gpointer		userdata;	///< Passed to dispatch
+	gboolean		detached;	///< TRUE if our owner is done with us
+};
+
+static GHashTable*	_pcap_muxes = NULL;	///< Our PcapMuxes - indexed by interface name
+
+FSTATIC gboolean _pcap_mux_dispatch(GSource_pcap_t* gsource, pcap_t* capstruct
+,		gconstpointer pkt, gconstpointer pend, const struct pcap_pkthdr* pkthdr
+,		const char * capturedev, gpointer userdata);
+FSTATIC unsigned _pcap_mux_wantmask(PcapMux* mux);
+FSTATIC gboolean _pcap_mux_setmask(PcapMux* mux);
+FSTATIC gboolean _pcap_mux_reopen(PcapMux* mux, guint snaplen);
+FSTATIC void _pcap_mux_sweep(PcapMux* mux);
+FSTATIC void _pcap_mux_close(PcapMux* mux, gboolean indispatch);
+
+/// Return the protocols our (still interested) consumers want
+FSTATIC unsigned
+_pcap_mux_wantmask(PcapMux* mux)
+{
+	GSList*		this;
+	unsigned	newmask = 0;
+
+	for (this = mux->consumers; this; this = this->next) {
+		PcapConsumer*	consumer = (PcapConsumer*)this->data;
+		if (consumer->dispatch) {
+			newmask |= consumer->listenmask;
+		}
+	}
+	return newmask;
+}
+
+/// Change our filter to match what our consumers want now
+/// @return FALSE if we couldn't change it
+FSTATIC gboolean
+_pcap_mux_setmask(PcapMux* mux)
+{
+	unsigned	newmask = _pcap_mux_wantmask(mux);
+
+	if (0 == newmask) {
+		// Everyone's leaving - we'll be closed shortly
+		return TRUE;
+	}
+	if (NULL == mux->source) {
+		// Offline - nothing to filter.  pcap_mux_inject() callers get what they give us.
+		mux->listenmask = newmask;
+		return TRUE;
+	}
+	if (newmask != mux->source->listenmask
+	&&	!change_pcap_listener(mux->source->capture, mux->dev, mux->source->listenmask
+	,		newmask, &mux->source->pcprog)) {
+		return FALSE;
+	}
+	mux->source->listenmask = newmask;
+	mux->listenmask = newmask;
+	return TRUE;
+}
+
+/// Replace our capture with one which captures 'snaplen' bytes of each packet.
+/// libpcap can't change the snapshot length of an open capture.
+/// @return FALSE if we couldn't open the new one (we keep the old one)
+FSTATIC gboolean
+_pcap_mux_reopen(PcapMux* mux		///<[in/out] Capture to reopen
+,		 guint snaplen)		///<[in] New snapshot length
+{
+	unsigned	newmask = _pcap_mux_wantmask(mux);
+	GSource*	src;
+
+	if (NULL == mux->source) {
+		mux->listenmask = newmask;
+		mux->snaplen = snaplen;
+		return TRUE;
+	}
+	src = g_source_pcap_new(mux->dev, newmask, mux->bufsize, snaplen, _pcap_mux_dispatch, NULL
+	,	mux->priority, FALSE, mux->context, 0, mux);
+	if (NULL == src) {
+		return FALSE;
+	}
+	g_source_destroy(&mux->source->gs);
+	g_source_unref(&mux->source->gs);
+	mux->source = CASTTOCLASS(GSource_pcap_t, src);
+	mux->listenmask = newmask;
+	mux->snaplen = snaplen;
+	return TRUE;
+}
+
+/// Drop the consumers which detached from us, or no longer want packets.
+/// We free those whose owners are done with them - the others are freed by pcap_mux_detach().
+FSTATIC void
+_pcap_mux_sweep(PcapMux* mux)
+{
+	GSList*	this = mux->consumers;
+
+	while (this) {
+		GSList*		next = this->next;
+		PcapConsumer*	consumer = (PcapConsumer*)this->data;
+		if (NULL == consumer->dispatch) {
+			mux->consumers = g_slist_delete_link(mux->consumers, this);
+			if (consumer->detached) {
+				g_free(consumer);
+			}else{
+				consumer->mux = NULL;
+			}
+		}
+		this = next;
+	}
+}
+
+/// Forget about this PcapMux - and shut down its capture.
+/// When we're called from our own dispatch function, g_source_pcap_dispatch() drops our
+/// reference to our GSource for us when we return FALSE.
+FSTATIC void
+_pcap_mux_close(PcapMux* mux		///<[in/out] Capture to close
+,		gboolean indispatch)	///<[in] TRUE if we're in _pcap_mux_dispatch()
+{
+	g_hash_table_remove(_pcap_muxes, mux->dev);
+	if (g_hash_table_size(_pcap_muxes) == 0) {
+		g_hash_table_destroy(_pcap_muxes);
+		_pcap_muxes = NULL;
+	}
+	if (mux->source) {
+		g_source_destroy(&mux->source->gs);
+		if (!indispatch) {
+			g_source_unref(&mux->source->gs);
+		}
+	}
+	mux->source = NULL;
+	g_free(mux->dev);
+	mux->dev = NULL;
+	g_free(mux);
+}
+
+/// Dispatch function for our shared capture - hand the packet to everyone who wants its protocol.
+/// A consumer whose dispatch function returns FALSE gets no more packets - just like a GSource.
+FSTATIC gboolean
+_pcap_mux_dispatch(GSource_pcap_t* gsource,	///<[in] Our capture
+		   pcap_t* capstruct,		///<[in] libpcap capture object
+		   gconstpointer pkt,		///<[in] the packet just read in
+		   gconstpointer pend,		///<[in] first byte past 'pkt'
+		   const struct pcap_pkthdr* pkthdr,	///<[in] libpcap packet header
+		   const char * capturedev,	///<[in] device being captured
+		   gpointer userdata)		///<[in/out] our PcapMux
+{
+	PcapMux*	mux = (PcapMux*)userdata;
+	unsigned	protocol = pcap_packet_protocol(pkt, pend);
+	GSList*		this;
+
+	// Consumers may detach while we're in here - we clean up after them below
+	mux->dispatching = TRUE;
+	for (this = mux->consumers; this; this = this->next) {
+		PcapConsumer*	consumer = (PcapConsumer*)this->data;
+		if (consumer->dispatch && (consumer->listenmask & protocol)
+		&&	!consumer->dispatch(gsource, capstruct, pkt, pend, pkthdr, capturedev
+		,				consumer->userdata)) {
+			consumer->dispatch = NULL;
+		}
+	}
+	mux->dispatching = FALSE;
+	_pcap_mux_sweep(mux);
+	if (NULL == mux->consumers) {
+		_pcap_mux_close(mux, TRUE);
+		return FALSE;
+	}
+	_pcap_mux_setmask(mux);
+	return TRUE;
+}
+
+/// Start receiving packets for the given protocols on the given interface.
+/// The first consumer for an interface opens its capture.  Later ones change its filter - or
+/// reopen it, if they need a larger snapshot length or buffer than it has.
+/// (We can't reopen it while it's handing out a packet - so attach from a dispatch function
+/// gets what the capture already has).
+/// @return a handle to give to pcap_mux_detach() when you're done - NULL on failure
+PcapConsumer*
+pcap_mux_attach(const char * dev,	///<[in] interface to capture on
+		unsigned listenmask,	///<[in] bit mask of @ref pcap_protocols "protocols" we want
+		guint bufsize,		///<[in] kernel capture buffer size - 0 for default
+		guint snaplen,		///<[in] snapshot length - 0 for what 'listenmask' needs
+		GSourcePcapDispatch dispatch,	///<[in] called for each packet we want
+		gpointer userdata,	///<[in/out] passed to 'dispatch'
+		gint priority,		///<[in] g_main_loop dispatch priority
+		GMainContext* context)	///<[in] GMainContext or NULL
+{
+	PcapMux*	mux = NULL;
+	PcapConsumer*	consumer;
+	gboolean	ok;
+
+	g_return_val_if_fail(dev != NULL && dispatch != NULL && listenmask != 0, NULL);
+	if (NULL == _pcap_muxes) {
+		_pcap_muxes = g_hash_table_new(g_str_hash, g_str_equal);
+	}else{
+		mux = (PcapMux*)g_hash_table_lookup(_pcap_muxes, dev);
+	}
+	consumer = g_new0(PcapConsumer, 1);
+	consumer->listenmask = listenmask;
+	consumer->snaplen = (snaplen ? snaplen : pcap_snaplen_for(listenmask));
+	consumer->dispatch = dispatch;
+	consumer->userdata = userdata;
+
+	if (NULL == mux) {
+		GSource*	src;
+		mux = g_new0(PcapMux, 1);
+		src = g_source_pcap_new(dev, listenmask, bufsize, consumer->snaplen
+		,	_pcap_mux_dispatch, NULL, priority, FALSE, context, 0, mux);
+		if (NULL == src) {
+			g_free(mux);
+			g_free(consumer);
+			if (g_hash_table_size(_pcap_muxes) == 0) {
+				g_hash_table_destroy(_pcap_muxes);
+				_pcap_muxes = NULL;
+			}
+			return NULL;
+		}
+		mux->dev = g_strdup(dev);
+		mux->source = CASTTOCLASS(GSource_pcap_t, src);
+		mux->listenmask = listenmask;
+		mux->snaplen = consumer->snaplen;
+		mux->bufsize = bufsize;
+		mux->priority = priority;
+		mux->context = context;
+		g_hash_table_insert(_pcap_muxes, mux->dev, mux);
+		consumer->mux = mux;
+		mux->consumers = g_slist_append(mux->consumers, consumer);
+		return consumer;
+	}
+	consumer->mux = mux;
+	mux->consumers = g_slist_append(mux->consumers, consumer);
+	if (priority < mux->priority) {
+		mux->priority = priority;
+		if (mux->source) {
+			g_source_set_priority(&mux->source->gs, priority);
+		}
+	}
+	if ((consumer->snaplen > mux->snaplen || bufsize > mux->bufsize) && !mux->dispatching) {
+		mux->bufsize = MAX(bufsize, mux->bufsize);
+		ok = _pcap_mux_reopen(mux, MAX(consumer->snaplen, mux->snaplen));
+	}else{
+		ok = _pcap_mux_setmask(mux);
+	}
+	if (!ok) {
+		mux->consumers = g_slist_remove(mux->consumers, consumer);
+		g_free(consumer);
+		return NULL;
+	}
+	return consumer;
+}
+
+/// Stop receiving packets - 'consumer' is freed, and the capture closes when its last consumer leaves
+void
+pcap_mux_detach(PcapConsumer* consumer)	///<[in/out] consumer to detach
+{
+	PcapMux*	mux;
+
+	g_return_if_fail(consumer != NULL);
+	mux = consumer->mux;
+	if (NULL == mux) {
+		// Our capture dropped us already - when our dispatch function returned FALSE
+		g_free(consumer);
+		return;
+	}
+	consumer->detached = TRUE;
+	consumer->dispatch = NULL;
+	if (mux->dispatching) {
+		// _pcap_mux_dispatch will clean up after us
+		return;
+	}
+	_pcap_mux_sweep(mux);
+	if (NULL == mux->consumers) {
+		_pcap_mux_close(mux, FALSE);
+		return;
+	}
+	_pcap_mux_setmask(mux);
+}
+
+/// Return the protocols and snapshot length currently being captured on an interface
+/// @return FALSE if nobody is capturing on 'dev'
+gboolean
+pcap_mux_filter(const char * dev,	///<[in] interface to ask about
+		unsigned* listenmask,	///<[out] @ref pcap_protocols being captured
+		guint* snaplen)		///<[out] snapshot length
+{
+	PcapMux*	mux;
+
+	g_return_val_if_fail(dev != NULL, FALSE);
+	mux = (_pcap_muxes ? (PcapMux*)g_hash_table_lookup(_pcap_muxes, dev) : NULL);
+	if (NULL == mux) {
+		return FALSE;
+	}
+	if (listenmask) {
+		*listenmask = mux->listenmask;
+	}
+	if (snaplen) {
+		*snaplen = mux->snaplen;
+	}
+	return TRUE;
+}
+
+/// Return the (shared) capture GSource a consumer gets its packets from - for statistics.
+/// Returns NULL for an offline interface.
+GSource_pcap_t*
+pcap_mux_source(PcapConsumer* consumer)
+{
+	g_return_val_if_fail(consumer != NULL, NULL);
+	return (consumer->mux ? consumer->mux->source : NULL);
+}
+
+/// Set up an interface with no capture behind it - packets only arrive via pcap_mux_inject().
+/// Consumers then attach to it with pcap_mux_attach() exactly as they would to a real interface.
+/// This lets tests and benchmarks exercise our consumers without any privileges.
+/// @return FALSE if this interface is already in use
+gboolean
+pcap_mux_offline(const char * dev)	///<[in] (fake) interface name
+{
+	PcapMux*	mux;
+
+	g_return_val_if_fail(dev != NULL, FALSE);
+	if (NULL == _pcap_muxes) {
+		_pcap_muxes = g_hash_table_new(g_str_hash, g_str_equal);
+	}else if (g_hash_table_lookup(_pcap_muxes, dev) != NULL) {
+		return FALSE;
+	}
+	mux = g_new0(PcapMux, 1);
+	mux->dev = g_strdup(dev);
+	mux->priority = G_PRIORITY_DEFAULT;
+	g_hash_table_insert(_pcap_muxes, mux->dev, mux);
+	return TRUE;
+}
+
+/// Hand a packet to the consumers of an offline interface - just as though we'd captured it
+/// @return FALSE if there is no such interface, or its last consumer has gone away
+gboolean
+pcap_mux_inject(const char * dev,		///<[in] interface from pcap_mux_offline()
+		gconstpointer pkt,		///<[in] packet to hand out
+		gconstpointer pend,		///<[in] first byte past 'pkt'
+		const struct pcap_pkthdr* pkthdr)	///<[in] libpcap packet header
+{
+	PcapMux*	mux;
+
+	g_return_val_if_fail(dev != NULL && pkt != NULL && pend != NULL && pkthdr != NULL, FALSE);
+	mux = (_pcap_muxes ? (PcapMux*)g_hash_table_lookup(_pcap_muxes, dev) : NULL);
+	g_return_val_if_fail(mux != NULL && NULL == mux->source, FALSE);
+	return _pcap_mux_dispatch(NULL, NULL, pkt, pend, pkthdr, mux->dev, mux);
+}
+///@}
@@ -69,7 +69,14 @@ static GHashTable*	DebugClassAssociation = NULL;	///< Map of class -> debug vari
 static GHashTable*	FreedClassAssociation = NULL;	///< Map of class -> freed 
 static guint32		proj_class_obj_count = 0;
 static guint32		proj_class_max_obj_count = 0;
+static guint64		proj_class_total_obj_count = 0;
 gboolean		badfree = FALSE;
+static gboolean		proj_class_threaded = FALSE;	///< TRUE once other threads may use objects
+static GRecMutex	proj_class_lock;		///< Guards our tables once we're threaded
+
+/// Lock our class tables - but only once we've been told other threads exist
+#define	LOCKCLASSES	{if (proj_class_threaded) {g_rec_mutex_lock(&proj_class_lock);}}
+#define	UNLOCKCLASSES	{if (proj_class_threaded) {g_rec_mutex_unlock(&proj_class_lock);}}
 
 FSTATIC void _init_proj_class_module(void);
 FSTATIC void proj_class_change_debug(const char * Cclass, gint incr);
@@ -93,6 +100,16 @@ proj_class_finalize_sys(void)
 	g_hash_table_destroy(DebugClassAssociation);	DebugClassAssociation = NULL;
 }
 
+/// Tell the class system that objects may now be created, cast and freed from threads
+/// other than the main thread.  Until this is called we don't bother with any locking.
+/// It must be called from the main thread before any other thread is started,
+/// and it cannot be undone.
+void
+proj_class_enable_threads(void)
+{
+	proj_class_threaded = TRUE;
+}
+
 /// Log the creation of a new object, and its association with a given type.
 /// This involves locating (or registering) the class, and creating an
 /// association of the object with a given class (type).
@@ -103,6 +120,7 @@ proj_class_register_object(gpointer object,			///< Object to be registered
 	
 	GQuark	classquark = g_quark_from_static_string(static_classname);	// Quark for the given classname
 
+	LOCKCLASSES;
 	if (NULL == ObjectClassAssociation) {
 		_init_proj_class_module();
 	}
@@ -111,9 +129,11 @@ proj_class_register_object(gpointer object,			///< Object to be registered
 	}
 	g_hash_table_insert(ObjectClassAssociation, object, GUINT_TO_POINTER(classquark));
 	++ proj_class_obj_count;
+	++ proj_class_total_obj_count;
 	if (proj_class_obj_count > proj_class_max_obj_count) {
 		proj_class_max_obj_count = proj_class_obj_count;
 	}
+	UNLOCKCLASSES;
 }
 
 static guint	global_debug_counter = 0;
@@ -121,6 +141,7 @@ static guint	global_debug_counter = 0;
 void
 proj_class_register_debug_counter(const char * classname, guint * debugcount)
 {
+	LOCKCLASSES;
 	if (NULL == ObjectClassAssociation) {
 		_init_proj_class_module();
 	}
@@ -131,6 +152,7 @@ proj_class_register_debug_counter(const char * classname, guint * debugcount)
 	// since we we never modify the strings we were given - we expect them to be constants
 	// and we just point at them.
 	g_hash_table_replace(DebugClassAssociation, (gpointer)((guintptr)classname), debugcount);
+	UNLOCKCLASSES;
 }
 
 
@@ -160,6 +182,7 @@ proj_class_change_debug(const char * Cclass, gint incr)
 	gpointer	gdebugptr;
 	GQuark		CclassQuark = g_quark_from_static_string(Cclass);
 
+	LOCKCLASSES;
 	if (DebugClassAssociation) {
 		g_hash_table_iter_init(&iter, DebugClassAssociation);
 
@@ -184,6 +207,7 @@ proj_class_change_debug(const char * Cclass, gint incr)
 			global_debug_counter += incr;
 		}
 	}
+	UNLOCKCLASSES;
 }
 
 /// Log the creation of a subclassed object from a superclassed object.
@@ -196,6 +220,7 @@ proj_class_register_subclassed(gpointer object,				///< Object (currently regist
 	GQuark	subclassquark = g_quark_from_static_string(static_subclassname);	// Quark for the given classname
 	GQuark	superclassquark;
 
+	LOCKCLASSES;
 	if (NULL == ObjectClassAssociation) {
 		_init_proj_class_module();
 	}
@@ -206,6 +231,7 @@ proj_class_register_subclassed(gpointer object,				///< Object (currently regist
 	///todo create a superclass/subclass hierarchy...
 	proj_class_quark_add_superclass_relationship(superclassquark, subclassquark);
 	g_hash_table_replace(ObjectClassAssociation, object, GUINT_TO_POINTER(subclassquark));
+	UNLOCKCLASSES;
 	return object;
 }
 
@@ -227,7 +253,10 @@ proj_class_new(gsize objsize,				///< Size of object to be allocated
 void
 proj_class_dissociate(gpointer object) ///< Object be 'dissociated' from class
 {
-	GQuark		objquark = GPOINTER_TO_INT(g_hash_table_lookup(ObjectClassAssociation, object));
+	GQuark		objquark;
+
+	LOCKCLASSES;
+	objquark = GPOINTER_TO_INT(g_hash_table_lookup(ObjectClassAssociation, object));
 	-- proj_class_obj_count;
 	if (objquark == 0) {
 		GQuark		freedquark = GPOINTER_TO_INT(g_hash_table_lookup(FreedClassAssociation, object));
@@ -240,6 +269,7 @@ proj_class_dissociate(gpointer object) ///< Object be 'dissociated' from class
 		g_hash_table_insert(FreedClassAssociation, object, GUINT_TO_POINTER(objquark));
 		g_hash_table_remove(ObjectClassAssociation, object);
 	}
+	UNLOCKCLASSES;
 }
 
 /// Free a registered object from our class system.
@@ -259,20 +289,23 @@ proj_class_is_a(gconstpointer object,		///<[i] Object to be queried
 {
 	GQuark		objquark;
 	GQuark		classquark;
+	gboolean	retval = TRUE;
 
 	if (NULL == object) {
 		return TRUE;
 	}
 
+	LOCKCLASSES;
 	objquark = GPOINTER_TO_INT(g_hash_table_lookup(ObjectClassAssociation, object));
 	classquark = g_quark_from_static_string(Cclass);
 
 	if (objquark != classquark || classquark == 0) {
 		if (!proj_class_quark_is_a(objquark, classquark)) {
-			return FALSE;
+			retval = FALSE;
 		}
 	}
-	return TRUE;
+	UNLOCKCLASSES;
+	return retval;
 }
 
 /// "Safely" cast an object to a <i>const</i> object of the given C-class.
@@ -287,8 +320,12 @@ proj_class_castas(gpointer     object,		///< Object to be "cast" as "castclass"
 {
 	if (!OBJ_IS_A(object, castclass)) {
 		const char *	objclass =  proj_class_classname(object);
-		GQuark		freedquark = GPOINTER_TO_INT(g_hash_table_lookup(FreedClassAssociation, object));
-		const char * 	oldclass = (freedquark == 0 ? "(unknown class)" : g_quark_to_string(freedquark));
+		GQuark		freedquark;
+		const char * 	oldclass;
+		LOCKCLASSES;
+		freedquark = GPOINTER_TO_INT(g_hash_table_lookup(FreedClassAssociation, object));
+		UNLOCKCLASSES;
+		oldclass = (freedquark == 0 ? "(unknown class)" : g_quark_to_string(freedquark));
 		BADCASTMSG("Attempt to cast %s pointer at address %p to %s (formerly a %s)", objclass, object, castclass
 		,	oldclass);
 		object = NULL;
@@ -307,8 +344,12 @@ proj_class_castasconst(gconstpointer object,	///< Object to be "cast" to "castcl
 {
 	if (!proj_class_is_a(object, castclass)) {
 		const char *	objclass =  proj_class_classname(object);
-		GQuark		freedquark = GPOINTER_TO_INT(g_hash_table_lookup(FreedClassAssociation, object));
-		const char * 	oldclass = (freedquark == 0 ? "(unknown class)" : g_quark_to_string(freedquark));
+		GQuark		freedquark;
+		const char * 	oldclass;
+		LOCKCLASSES;
+		freedquark = GPOINTER_TO_INT(g_hash_table_lookup(FreedClassAssociation, object));
+		UNLOCKCLASSES;
+		oldclass = (freedquark == 0 ? "(unknown class)" : g_quark_to_string(freedquark));
 		BADCASTMSG("Attempt to cast %s pointer at address %p to a const %s (formerly a %s)", objclass, object, castclass
 		,	oldclass);
 		object = NULL;
@@ -323,7 +364,11 @@ proj_class_castasconst(gconstpointer object,	///< Object to be "cast" to "castcl
 const char *
 proj_class_classname(gconstpointer object) ///< pointer to the object whose name we want to find
 {
-	GQuark		objquark = GPOINTER_TO_INT(g_hash_table_lookup(ObjectClassAssociation, object));
+	GQuark		objquark;
+
+	LOCKCLASSES;
+	objquark = GPOINTER_TO_INT(g_hash_table_lookup(ObjectClassAssociation, object));
+	UNLOCKCLASSES;
 	return (objquark == 0 ? "(unknown class)" : g_quark_to_string(objquark));
 	
 }
@@ -333,8 +378,10 @@ void
 proj_class_quark_add_superclass_relationship(GQuark superclass,	///< Quark for Superclass
 					     GQuark subclass)	///< Quark for Subclass
 {
+	LOCKCLASSES;
 	g_hash_table_insert(SuperClassAssociation, GUINT_TO_POINTER(subclass), GUINT_TO_POINTER(superclass));
-	
+	UNLOCKCLASSES;
+
 }
 /// Determine whether an 'objectclass' ISA member of 'testclass' - with quarks of types as arguments
 /// Since this little C-class system only supports single-inheritance, this isn't exactly rocket science.
@@ -342,13 +389,18 @@ gboolean
 proj_class_quark_is_a(GQuark objectclass,	///< Object to be tested
 		      GQuark testclass)		///< Class/Superclass to test object against
 {
+	gboolean	retval = FALSE;
+
+	LOCKCLASSES;
 	while (objectclass != 0) {
 		if (objectclass == testclass) {
-			return TRUE;
+			retval = TRUE;
+			break;
 		}
 		objectclass = GPOINTER_TO_INT(g_hash_table_lookup(SuperClassAssociation, GUINT_TO_POINTER(objectclass)));
 	}
-	return FALSE;
+	UNLOCKCLASSES;
+	return retval;
 }
 
 /// Dump all live C class objects (address and Class)
@@ -360,6 +412,7 @@ proj_class_dump_live_objects(void)
 	gpointer	quarkp;
 
 	g_debug("START of live C Class object dump:");
+	LOCKCLASSES;
 	if (ObjectClassAssociation) {
 		g_hash_table_iter_init(&iter, ObjectClassAssociation);
 		while (g_hash_table_iter_next(&iter, &object, &quarkp)) {
@@ -374,6 +427,7 @@ proj_class_dump_live_objects(void)
 			}
 		}
 	}
+	UNLOCKCLASSES;
 	g_debug("END of live C Class object dump.");
 }
 
@@ -411,6 +465,7 @@ proj_class_live_object_count(void)
 	guint32		count = 0;
 	
 
+	LOCKCLASSES;
 	if (ObjectClassAssociation) {
 		g_hash_table_iter_init(&iter, ObjectClassAssociation);
 		while (g_hash_table_iter_next(&iter, &object, &quarkp)) {
@@ -418,6 +473,7 @@ proj_class_live_object_count(void)
 		}
 	}
 	g_assert(count == proj_class_obj_count);
+	UNLOCKCLASSES;
 	return count;
 }
 
@@ -428,4 +484,11 @@ proj_class_max_object_count(void)
 	return proj_class_max_obj_count;
 }
 
+/// Return the number of C class objects we've ever created - for measuring allocation rates
+guint64
+proj_class_total_object_count(void)
+{
+	return proj_class_total_obj_count;
+}
+
 ///@}
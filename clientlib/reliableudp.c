@@ -44,6 +44,7 @@ DEBUGDECLARATIONS
 // Saved base class functions - so we call them w/o storing a copy in every object
 static void (*_baseclass_finalize)(AssimObj*);
 static GSList* (*_baseclass_rcvmany)(NetIO*, NetAddr**);
+static gboolean (*_baseclass_input_queued)(const NetIO*);
 // These two could probably be eliminated...
 static void (*_baseclass_sendone)(NetIO*, const NetAddr*, FrameSet*);
 static void (*_baseclass_sendmany)(NetIO*, const NetAddr*, GSList*);
@@ -62,6 +63,7 @@ FSTATIC void _reliableudp_sendframesets(NetIO*, const NetAddr*, GSList*);
 FSTATIC GSList* _reliableudp_recvframesets(NetIO*, NetAddr**);
 FSTATIC gboolean _reliableudp_supportsreliable(NetIO*);
 FSTATIC gboolean _reliableudp_outputpending(NetIO*);
+FSTATIC guint _reliableudp_outputqlen(NetIO*);
 
 
 /// Construct new UDP NetIO object (and its socket, etc)
@@ -85,6 +87,7 @@ reliableudp_new(gsize objsize		///<[in] Size of NetIOudp object, or zero.
 			_baseclass_sendone = uret->baseclass.sendaframeset;
 			_baseclass_sendmany = uret->baseclass.sendframesets;
 			_baseclass_rcvmany = uret->baseclass.recvframesets;
+			_baseclass_input_queued = uret->baseclass.input_queued;
 		}
 		self = NEWSUBCLASS(ReliableUDP, uret);
 		// Now for the base class functions which we override
@@ -97,6 +100,7 @@ reliableudp_new(gsize objsize		///<[in] Size of NetIOudp object, or zero.
 		self->baseclass.baseclass.closeconn = _reliableudp_closeconn;
 		self->baseclass.baseclass.supportsreliable = _reliableudp_supportsreliable;
 		self->baseclass.baseclass.outputpending = _reliableudp_outputpending;
+		self->baseclass.baseclass.outputqlen = _reliableudp_outputqlen;
 		// These next two don't really do anything different - and could be eliminated
 		// as of now.
 		self->baseclass.baseclass.sendframesets = _reliableudp_sendframesets;
@@ -130,7 +134,8 @@ _reliableudp_input_queued(const NetIO* nself)
 	const ReliableUDP*	self = CASTTOCONSTCLASS(ReliableUDP, nself);
 	gboolean		retval;
 	g_return_val_if_fail(nself != NULL, FALSE);
-	retval = self->_protocol->iready(self->_protocol);
+	// Our base class might have FrameSets waiting for us to read (from its MarshalPool)
+	retval = self->_protocol->iready(self->_protocol) || _baseclass_input_queued(nself);
 	DEBUGMSG5("%s: Checking input ready: returning %s", __FUNCTION__, (retval?"True":"False"));
 	return retval;
 }
@@ -252,6 +257,13 @@ _reliableudp_outputpending(NetIO* nself)
 	ReliableUDP * self = CASTTOCLASS(ReliableUDP, nself);
 	return self->_protocol->outputpending(self->_protocol);
 }
+/// Return how many (reliable) FrameSets are queued for output
+FSTATIC guint
+_reliableudp_outputqlen(NetIO* nself)
+{
+	ReliableUDP * self = CASTTOCLASS(ReliableUDP, nself);
+	return self->_protocol->outputqlen(self->_protocol);
+}
 
 /// Dump connection information
 FSTATIC void
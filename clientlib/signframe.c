@@ -49,6 +49,10 @@
 @note
 Because of their special nature, all digital signature frames <b>must</b> have frametype <b>1</b>
 and be the first frame in the frameset.
+@note
+A signature-type whose major type is @ref SIGNTYPE_AEAD has no digital signature at all
+(f_length is 2).  It is only legal when the next frame is an encryption frame, since
+authenticated decryption already guarantees the integrity of everything after it.
  * @}
  */
 
@@ -63,6 +67,9 @@ FSTATIC gpointer _signframe_compute_cksum(GChecksumType, gconstpointer tlvptr, g
 FSTATIC gpointer _signframe_compute_cksum_glib(GChecksumType, gconstpointer tlvptr, gconstpointer pktend);
 FSTATIC gboolean _signframe_isvalid_glib(const Frame * self, gconstpointer tlvptr, gconstpointer pktend);
 FSTATIC guint16	_signframe_cksum_size(guint8 majortype, guint8 minortype);
+FSTATIC gboolean _signframe_isvalid_aead(const Frame * self, gconstpointer tlvptr, gconstpointer pktend);
+FSTATIC GChecksum* _signframe_thread_cksumobj(GChecksumType cksumtype);
+FSTATIC void	_signframe_free_thread_cksum(gpointer cksum);
 #ifdef SODIUM_H
 FSTATIC SignFrame* signframe_sodium_new(guint8 minortype, char * cksumname, gsize framesize);
 FSTATIC gpointer _signframe_compute_cksum_sodium(GChecksumType, gconstpointer tlvptr, gconstpointer pktend);
@@ -74,6 +81,68 @@ static	guint8	default_checksum_minor_type = 0;
 static char*	default_checksum_keyname = NULL;
 static guint8*	default_checksum_signkey = NULL;
 static guint8	default_checksum_keylen = 0;
+static gint	aead_signatures = FALSE;	///< Use SIGNTYPE_AEAD frames when encrypting?
+
+/// Per-thread reusable checksum context.
+/// Packets may be signed by @ref MarshalPool threads as well as the main loop,
+/// so each thread gets its own (rather than creating a new one for every packet).
+typedef struct _SignFrameCksum {
+	GChecksumType	cksumtype;	///< What kind of checksum is cksumobj?
+	GChecksum*	cksumobj;	///< Our (reusable) checksum object
+}SignFrameCksum;
+static GPrivate	thread_cksum = G_PRIVATE_INIT(_signframe_free_thread_cksum);
+
+/// Free a per-thread checksum context (called at thread exit)
+FSTATIC void
+_signframe_free_thread_cksum(gpointer vcksum)
+{
+	SignFrameCksum*	cksum = vcksum;
+	g_checksum_free(cksum->cksumobj);
+	cksum->cksumobj = NULL;
+	FREE(cksum);
+}
+
+/// Return this thread's checksum object of the given type - reset and ready for use.
+FSTATIC GChecksum*
+_signframe_thread_cksumobj(GChecksumType cksumtype)	///<[in] checksum type
+{
+	SignFrameCksum*	cksum = g_private_get(&thread_cksum);
+
+	if (NULL != cksum && cksum->cksumtype == cksumtype) {
+		g_checksum_reset(cksum->cksumobj);
+		return cksum->cksumobj;
+	}
+	if (NULL == cksum) {
+		cksum = MALLOC0(sizeof(*cksum));
+		g_return_val_if_fail(NULL != cksum, NULL);
+	}else{
+		g_checksum_free(cksum->cksumobj);
+	}
+	cksum->cksumtype = cksumtype;
+	cksum->cksumobj = g_checksum_new(cksumtype);
+	if (NULL == cksum->cksumobj) {
+		FREE(cksum);
+		cksum = NULL;
+	}
+	// g_private_replace() would free our old value - which might be this same object
+	g_private_set(&thread_cksum, cksum);
+	return (NULL == cksum ? NULL : cksum->cksumobj);
+}
+
+/// Enable or disable sending @ref SIGNTYPE_AEAD signatures on encrypted packets.
+/// Only turn this on once every peer we talk to understands @ref SIGNTYPE_AEAD.
+void
+signframe_set_aead_signatures(gboolean enabled)	///<[in] TRUE to skip digests on encrypted packets
+{
+	g_atomic_int_set(&aead_signatures, enabled ? TRUE : FALSE);
+}
+
+/// Return TRUE if encrypted packets get @ref SIGNTYPE_AEAD signatures.
+gboolean
+signframe_aead_signatures(void)
+{
+	return g_atomic_int_get(&aead_signatures);
+}
 
 ///< Return the checksum size for this type of checksum...
 FSTATIC guint16
@@ -82,6 +151,8 @@ _signframe_cksum_size(guint8 majortype, guint8 minortype)
 	switch(majortype) {
 		case SIGNTYPE_GLIB:
 			return g_checksum_type_get_length(minortype);
+		case SIGNTYPE_AEAD:
+			return 0;
 #ifdef HAVE_SODIUM_H
 		case SIGNTYPE_SODIUM: {
 			switch(minortype) {
@@ -173,8 +244,8 @@ _signframe_compute_cksum_glib(GChecksumType cksumtype,	///<[in] checksum type
 	remainsize = (const guint8*)pktend - nextframe;
 	g_return_val_if_fail(remainsize > 0, NULL);
 
-	// Create a new checksum object
-	cksumobj = g_checksum_new(cksumtype);
+	// Get our (reusable) checksum object
+	cksumobj = _signframe_thread_cksumobj(cksumtype);
 	g_return_val_if_fail(NULL != cksumobj, NULL);
 
 	// Compute the checksum on the remainder of the packet
@@ -191,7 +262,6 @@ _signframe_compute_cksum_glib(GChecksumType cksumtype,	///<[in] checksum type
 			cksumbuf=NULL;
 		}
 	}
-	g_checksum_free(cksumobj);
 	return cksumbuf;
 }
 /// @ref SignFrame 'isvalid' member function - verifies a Glib digital signature
@@ -207,6 +277,8 @@ _signframe_isvalid(const Frame * self,		///< SignFrame object ('this')
 		const SignFrame*	sframe = CASTTOCONSTCLASS(SignFrame, self);
 		if (sframe->majortype == SIGNTYPE_GLIB) {
 			return _signframe_isvalid_glib(self, tlvptr, pktend);
+		}else if (sframe->majortype == SIGNTYPE_AEAD) {
+			return _signframe_isvalid_aead(self, tlvptr, pktend);
 #ifdef HAVE_SODIUM_H
 		}else if (sframe->majortype == SIGNTYPE_SODIUM) {
 			return _signframe_isvalid_sodium(self, tlvptr, pktend);
@@ -217,12 +289,14 @@ _signframe_isvalid(const Frame * self,		///< SignFrame object ('this')
 	framedata = get_generic_tlv_value(tlvptr, pktend);
 	framelen  = get_generic_tlv_len(tlvptr, pktend);
 	g_return_val_if_fail(framedata != NULL, FALSE);
-	g_return_val_if_fail(framelen > 2, FALSE);
+	g_return_val_if_fail(framelen >= 2, FALSE);
 	
 	// Verify that we are majortype 1 (byte 0)
 	majortype   = tlv_get_guint8(framedata,   pktend);
 	if (majortype == SIGNTYPE_GLIB) {
 		return _signframe_isvalid_glib(self, tlvptr, pktend);
+	}else if (majortype == SIGNTYPE_AEAD) {
+		return _signframe_isvalid_aead(self, tlvptr, pktend);
 #ifdef SODIUM_H
 	}else if (majortype == SIGNTYPE_SODIUM) {
 		return _signframe_isvalid_sodium(self, tlvptr, pktend);
@@ -283,6 +357,35 @@ _signframe_isvalid_glib(const Frame * self,		///< SignFrame object ('this')
 	return ret;
 }
 
+/// @ref SignFrame 'isvalid' member function - verifies a @ref SIGNTYPE_AEAD signature.
+/// These carry no digest at all.  They are only valid when immediately followed by an
+/// encryption frame whose (authenticated) decryption vouches for the rest of the packet.
+/// If the decryption fails, the packet is discarded - just like a bad digest.
+FSTATIC gboolean
+_signframe_isvalid_aead(const Frame * self,	///< SignFrame object ('this')
+		   gconstpointer tlvptr,	///< Pointer to the TLV for this SignFrame
+		   gconstpointer pktend)	///< Pointer to one byte past the end of the packet
+{
+	const guint8*	framedata;
+	gconstpointer	nextframe;
+
+	if (tlvptr == NULL) {
+		const SignFrame*	sframe = CASTTOCONSTCLASS(SignFrame, self);
+		return sframe->majortype == SIGNTYPE_AEAD
+		&&	sframe->minortype == SIGNTYPE_AEAD_CRYPTFRAME;
+	}
+	framedata = get_generic_tlv_value(tlvptr, pktend);
+	g_return_val_if_fail(framedata != NULL, FALSE);
+	if (get_generic_tlv_len(tlvptr, pktend) != 2
+	||	tlv_get_guint8(framedata, pktend) != SIGNTYPE_AEAD
+	||	tlv_get_guint8(framedata+1, pktend) != SIGNTYPE_AEAD_CRYPTFRAME) {
+		return FALSE;
+	}
+	nextframe = get_generic_tlv_next(tlvptr, pktend);
+	return nextframe != NULL
+	&&	get_generic_tlv_type(nextframe, pktend) == FRAMETYPE_CRYPTCURVE25519;
+}
+
 /// Write/update digital signature in packet.
 /// This is based on all the data that follows this frame in the packet.
 /// Since this is always the first frame in the packet, that means all data
@@ -302,8 +405,15 @@ _signframe_updatedata(Frame* fself,		///<[in] SignFrame signature Frame
 	guint8*		framedata = get_generic_tlv_nonconst_value(tlvptr, pktend);
 
 	(void)fs;
-	g_return_if_fail(self->majortype == SIGNTYPE_GLIB);
 	g_return_if_fail(framedata != NULL);
+	if (self->majortype == SIGNTYPE_AEAD) {
+		// No digest - the encryption frame which follows us authenticates the packet
+		g_return_if_fail(self->baseclass.length == 2);
+		tlv_set_guint8(framedata, self->majortype, pktend);
+		tlv_set_guint8(framedata+1, self->minortype, pktend);
+		return;
+	}
+	g_return_if_fail(self->majortype == SIGNTYPE_GLIB);
 	
 	// Compute the checksum
 	cksumbuf = _signframe_compute_cksum(cksumtype, tlvptr, pktend);
@@ -360,6 +470,30 @@ signframe_glib_new(GChecksumType sigtype,	///< signature type
 }
 
 
+/// Construct a new @ref SIGNTYPE_AEAD SignFrame - for packets protected by authenticated encryption.
+/// It has no digest of its own, so it must be immediately followed by an encryption frame.
+WINEXPORT SignFrame*
+signframe_aead_new(gsize framesize)	///< size of frame structure (or zero for sizeof(SignFrame))
+{
+	Frame*		baseframe;
+	SignFrame*	ret;
+
+	if (framesize < sizeof(SignFrame)) {
+		framesize = sizeof(SignFrame);
+	}
+	baseframe = frame_new(FRAMETYPE_SIG, framesize);
+	baseframe->isvalid = _signframe_isvalid;
+	baseframe->updatedata = _signframe_updatedata;
+	baseframe->length = 2;
+	baseframe->value = NULL;
+	proj_class_register_subclassed (baseframe, "SignFrame");
+
+	ret = CASTTOCLASS(SignFrame, baseframe);
+	ret->majortype = SIGNTYPE_AEAD;
+	ret->minortype = SIGNTYPE_AEAD_CRYPTFRAME;
+	return ret;
+}
+
 /// Given marshalled data corresponding to a SignFrame (signature frame), return that corresponding Frame
 /// In other words, un-marshall the data...
 /// @note when we add more subtypes to signatures (which will surely happen), then
@@ -376,7 +510,7 @@ signframe_tlvconstructor(gpointer tlvstart,		///<[in] beginning of the SignFrame
 	GChecksumType	minortype;
 
 	(void)newpkt; (void)newpktend;
-	g_return_val_if_fail(framelength > 2, NULL);
+	g_return_val_if_fail(framelength >= 2, NULL);
 	majortype = tlv_get_guint8(framevalue, pktend);
 	minortype = tlv_get_guint8(framevalue+1, pktend);
 
@@ -388,6 +522,17 @@ signframe_tlvconstructor(gpointer tlvstart,		///<[in] beginning of the SignFrame
 		ret->baseclass.length = framelength;
 		//ret->baseclass.value = framevalue; // @TODO Should .value be set???
 		return CASTTOCLASS(Frame, ret);
+	}else if (majortype == SIGNTYPE_AEAD) {
+		SignFrame *	ret;
+		// Nothing to verify here - but we insist on an encryption frame right after us
+		if (!_signframe_isvalid_aead(NULL, tlvstart, pktend)) {
+			g_warning("%s.%d: AEAD signature frame not followed by encryption frame"
+			,	__FUNCTION__, __LINE__);
+			return NULL;
+		}
+		ret = signframe_aead_new(0);
+		g_return_val_if_fail(NULL != ret, NULL);
+		return CASTTOCLASS(Frame, ret);
 #ifdef HAVE_SODIUM_H
 	}else if (majortype == SIGNTYPE_SODIUM) {
 		return signframe_sodium_tlvconstructor(tlvstart, pktend, newpkt, newpktend);
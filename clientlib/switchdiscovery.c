@@ -23,13 +23,38 @@
 
 #include <projectcommon.h>
 #include <memory.h>
+#include <stdlib.h>
+#include <string.h>
 #include <switchdiscovery.h>
 #include <lldp.h>
 #include <cdp.h>
+#include <tlvhelper.h>
+#include <address_family_numbers.h>
 #include <fsprotocol.h>
 FSTATIC gboolean _switchdiscovery_discover(Discovery* self);
 FSTATIC void _switchdiscovery_finalize(AssimObj* self);
-FSTATIC gboolean _switchdiscovery_cache_info(SwitchDiscovery* self, gconstpointer pkt, gconstpointer pend);
+FSTATIC guint _switchdiscovery_cache_info(SwitchDiscovery* self, gconstpointer pkt, gconstpointer pend
+,		gint64 now);
+FSTATIC void _switchdiscovery_lldp_digest(GChecksum* cksum, gconstpointer pkt, gconstpointer pktend);
+FSTATIC void _switchdiscovery_cdp_digest(GChecksum* cksum, gconstpointer pkt, gconstpointer pktend);
+FSTATIC gint64 _switchdiscovery_cfgsecs(ConfigContext* cfg, const char* name, gint64 defvalue);
+FSTATIC gboolean _switchdiscovery_sendjson(SwitchDiscovery* self, gconstpointer pkt, gconstpointer pend
+,		const struct pcap_pkthdr* pkthdr, const char * capturedev);
+FSTATIC gchar* _switchdiscovery_tlvstring(const guint8* value, gsize len);
+FSTATIC gchar* _switchdiscovery_tlvhex(const guint8* value, gsize len);
+FSTATIC NetAddr* _switchdiscovery_netaddr(const guint8* addr, gsize addrlen);
+FSTATIC void _switchdiscovery_setstring(ConfigContext* cfg, const char* name, const guint8* value
+,		gsize len);
+FSTATIC void _switchdiscovery_setport(ConfigContext* switchinfo, ConfigContext* portinfo
+,		const guint8* value, gsize len);
+FSTATIC void _switchdiscovery_setcaps(ConfigContext* switchinfo, const char * const * capnames
+,		gsize ncaps, guint32 present, guint32 enabled);
+FSTATIC void _switchdiscovery_cdpaddrs(ConfigContext* cfg, const char* name, const guint8* body
+,		gsize len);
+FSTATIC void _switchdiscovery_lldp_decode(ConfigContext* switchinfo, ConfigContext* portinfo
+,		gconstpointer pkt, gconstpointer pktend);
+FSTATIC void _switchdiscovery_cdp_decode(ConfigContext* switchinfo, ConfigContext* portinfo
+,		gconstpointer pkt, gconstpointer pktend);
 FSTATIC gboolean _switchdiscovery_dispatch(GSource_pcap_t* gsource, pcap_t*, gconstpointer, gconstpointer, const struct pcap_pkthdr* pkthdr, const char * capturedev, gpointer selfptr);
 FSTATIC guint _switchdiscovery_setprotocols(ConfigContext* cfg);
 ///@defgroup SwitchDiscoveryClass SwitchDiscovery class
@@ -40,27 +65,34 @@ FSTATIC guint _switchdiscovery_setprotocols(ConfigContext* cfg);
 
 DEBUGDECLARATIONS
 
+/// What _switchdiscovery_cache_info() says to do with a packet
+#define	SWDISC_SUPPRESS		0	///< Nothing to tell the CMA (yet)
+#define	SWDISC_REPORT		1	///< Send the whole packet - something meaningful changed
+#define	SWDISC_KEEPALIVE	2	///< Tell the CMA nothing has changed
+
 /// finalize a SwitchDiscovery object
 FSTATIC void
 _switchdiscovery_finalize(AssimObj* dself)
 {
 	SwitchDiscovery * self = CASTTOCLASS(SwitchDiscovery, dself);
+	int		j;
 	g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of LLDP/CDP pkts sent:"
 	,	self->baseclass.reportcount);
 	g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of LLDP/CDP pkts received:"
 	,	self->baseclass.discovercount);
+	g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of LLDP/CDP pkts suppressed:"
+	,	self->suppresscount);
+	g_info("%-35s %8"G_GINT64_MODIFIER"d", "Count of LLDP/CDP keepalives sent:"
+	,	self->keepalivecount);
 	if (self->source) {
-		g_source_unref(self->source);
-		g_source_destroy(self->source);
+		pcap_mux_detach(self->source);
 		self->source = NULL;
 	}
-	if (self->switchid) {
-		g_free(self->switchid);
-		self->switchid = NULL;
-	}
-	if (self->portid) {
-		g_free(self->portid);
-		self->portid = NULL;
+	for (j=0; j < SWITCHDISCOVERY_NTYPES; ++j) {
+		if (self->digest[j]) {
+			g_free(self->digest[j]);
+			self->digest[j] = NULL;
+		}
 	}
 	
 	// Call base object finalization routine (which we saved away)
@@ -77,11 +109,12 @@ _switchdiscovery_discover(Discovery* self)  ///<[in/out]
 
 
 /// Internal pcap gsource dispatch routine - called when we get a packet.
-/// It examines the packet and sees if it is the same switch id and port ID as previously.
-/// If there is no previous packet, or something has changed, it constructs a packet
-/// encapsulating the captured packet, then sends this encapsulated packet "upstream"
-/// to the CMA.
-/// All we care about about are those two fields - the rest we leave to the CMA.
+/// It examines the packet and sees if its meaningful fields are the same as the last ones we reported.
+/// If there is no previous packet, or something has changed (and we haven't reported a change too
+/// recently), it constructs a packet encapsulating the captured packet, then sends this
+/// encapsulated packet "upstream" to the CMA.
+/// If nothing has changed in a long time, we send the CMA a keepalive without the packet in it.
+/// Normally we decode the packet into JSON ourselves, and send that instead of the packet.
 FSTATIC gboolean
 _switchdiscovery_dispatch(GSource_pcap_t* gsource, ///<[in] Gsource object causing dispatch
                           pcap_t* capstruct,	   ///<[in] Pointer to structure capturing for us
@@ -102,12 +135,31 @@ _switchdiscovery_dispatch(GSource_pcap_t* gsource, ///<[in] Gsource object causi
 	DEBUGMSG2("Got an incoming LLDP/CDP packet - dest is %p", dest);
 	/// Don't cache if we can't send - and don't send if we have sent this info previously.
 	++ self->baseclass.discovercount;
-	if (!dest || !_switchdiscovery_cache_info(self, pkt, pend)) {
+	if (!dest) {
 		return TRUE;
 	}
-	++ self->baseclass.reportcount;
-	DEBUGMSG2("Sending out LLDP/CDP packet - hurray!");
-	fs = construct_pcap_frameset(FRAMESETTYPE_SWDISCOVER, pkt, pend, pkthdr, capturedev);
+	switch (_switchdiscovery_cache_info(self, pkt, pend, g_get_monotonic_time())) {
+		case SWDISC_REPORT:
+			// sendjson() counts the reports it sends - we count the ones we send ourselves
+			if (self->localdecode
+			&&	_switchdiscovery_sendjson(self, pkt, pend, pkthdr, capturedev)) {
+				return TRUE;
+			}
+			++ self->baseclass.reportcount;
+			DEBUGMSG2("Sending out LLDP/CDP packet - hurray!");
+			fs = construct_pcap_frameset(FRAMESETTYPE_SWDISCOVER, pkt, pend, pkthdr
+			,	capturedev);
+			break;
+		case SWDISC_KEEPALIVE:
+			++ self->keepalivecount;
+			DEBUGMSG2("Sending LLDP/CDP keepalive - nothing has changed");
+			fs = construct_pcap_frameset(FRAMESETTYPE_SWDISCOVER, NULL, NULL, pkthdr
+			,	capturedev);
+			break;
+		default:
+			++ self->suppresscount;
+			return TRUE;
+	}
 	transport->_netio->sendareliablefs(transport->_netio, dest, DEFAULT_FSP_QID, fs);
 	UNREF(fs);
 	return TRUE;
@@ -157,6 +209,16 @@ _switchdiscovery_setprotocols(ConfigContext* cfg)
 
 }
 
+/// Return a (positive) configuration value in seconds - as microseconds
+FSTATIC gint64
+_switchdiscovery_cfgsecs(ConfigContext* cfg, const char* name, gint64 defvalue)
+{
+	if (cfg->gettype(cfg, name) == CFG_INT64 && cfg->getint(cfg, name) >= 0) {
+		return cfg->getint(cfg, name) * G_USEC_PER_SEC;
+	}
+	return defvalue * G_USEC_PER_SEC;
+}
+
 /// SwitchDiscovery constructor.
 /// Good for discovering switch information via pcap-enabled discovery protocols (like LLDP and CDP)
 SwitchDiscovery*
@@ -170,6 +232,8 @@ switchdiscovery_new(ConfigContext*swconfig	///<[in] Switch discoveryconfiguratio
 	const char *	instance;	///<[in] instance name
 	const char *	dev;		///<[in] device to listen on
 	guint listenmask;		///<[in] what protocols to listen to
+	guint bufsize = 0;		///<[in] pcap buffer size (0 for default)
+	guint snaplen = 0;		///<[in] pcap snapshot length (0 for default)
 	Discovery * dret;
 	SwitchDiscovery* ret;
 	BINDDEBUG(SwitchDiscovery);
@@ -191,7 +255,24 @@ switchdiscovery_new(ConfigContext*swconfig	///<[in] Switch discoveryconfiguratio
 
 	listenmask = _switchdiscovery_setprotocols(swconfig);
 	DEBUGMSG("%s.%d: dev=%s, listenmask = 0x%04x", __FUNCTION__, __LINE__, dev, listenmask);
-	ret->source = g_source_pcap_new(dev, listenmask, _switchdiscovery_dispatch, NULL, priority, FALSE, mcontext, 0, ret);
+	if (swconfig->gettype(swconfig, CONFIGNAME_PCAPBUFSIZE) == CFG_INT64
+	&&	swconfig->getint(swconfig, CONFIGNAME_PCAPBUFSIZE) > 0) {
+		bufsize = (guint)swconfig->getint(swconfig, CONFIGNAME_PCAPBUFSIZE);
+	}
+	if (swconfig->gettype(swconfig, CONFIGNAME_PCAPSNAPLEN) == CFG_INT64
+	&&	swconfig->getint(swconfig, CONFIGNAME_PCAPSNAPLEN) > 0) {
+		snaplen = (guint)swconfig->getint(swconfig, CONFIGNAME_PCAPSNAPLEN);
+	}
+	ret->minreportusecs = _switchdiscovery_cfgsecs(swconfig, CONFIGNAME_SWMINREPORT
+	,	DEFAULT_SWDISCOVERY_MINREPORT);
+	ret->keepaliveusecs = _switchdiscovery_cfgsecs(swconfig, CONFIGNAME_SWKEEPALIVE
+	,	DEFAULT_SWDISCOVERY_KEEPALIVE);
+	ret->localdecode = TRUE;
+	if (swconfig->gettype(swconfig, CONFIGNAME_SWJSON) == CFG_BOOL) {
+		ret->localdecode = swconfig->getbool(swconfig, CONFIGNAME_SWJSON);
+	}
+	ret->source = pcap_mux_attach(dev, listenmask, bufsize, snaplen
+	,	_switchdiscovery_dispatch, ret, priority, mcontext);
 
 	if (objsize == sizeof(SwitchDiscovery)) {
 		// Subclass constructors need to register themselves, but we'll register
@@ -199,8 +280,6 @@ switchdiscovery_new(ConfigContext*swconfig	///<[in] Switch discoveryconfiguratio
 		DUMP3("Registering switch discovery", &dret->baseclass, dret->instancename(dret));
 		discovery_register(dret);
 	}
-	ret->switchid = NULL;	ret->switchidlen = -1;
-	ret->portid = NULL;	ret->portidlen = -1;
 	return ret;
 }
 
@@ -210,54 +289,580 @@ static struct _SwitchDiscoveryType {
 	gboolean (*isthistype)(gconstpointer tlv_vp, gconstpointer pktend);
 	gconstpointer (*get_switch_id)(gconstpointer tlv_vp, gssize* idlength, gconstpointer pktend);
 	gconstpointer (*get_port_id)(gconstpointer tlv_vp, gssize* idlength, gconstpointer pktend);
-} discovery_types[] = {
-	{"lldp", is_valid_lldp_packet, get_lldp_chassis_id, get_lldp_port_id},
-	{"cdp", is_valid_cdp_packet, get_cdp_chassis_id, get_cdp_port_id}
+	void (*digest)(GChecksum* cksum, gconstpointer pkt, gconstpointer pktend);
+	void (*decode)(ConfigContext* switchinfo, ConfigContext* portinfo
+	,		gconstpointer pkt, gconstpointer pktend);
+} discovery_types[SWITCHDISCOVERY_NTYPES] = {
+	{"lldp", is_valid_lldp_packet, get_lldp_chassis_id, get_lldp_port_id
+	,	_switchdiscovery_lldp_digest, _switchdiscovery_lldp_decode},
+	{"cdp", is_valid_cdp_packet, get_cdp_chassis_id, get_cdp_port_id
+	,	_switchdiscovery_cdp_digest, _switchdiscovery_cdp_decode}
 };
 
-///
-///@return TRUE if this data is new or has changed from our previously cached version.
+/// Capability names for LLDP_TLV_SYS_CAPS bits - the same roles the CMA uses
+static const char * const lldp_capnames[] = {
+	NULL, "repeater", "bridge", "WLANAP", "router", "phone", "DOCSIS"
+};
+/// Capability names for CDP_TLV_CAPS bits - the same roles the CMA uses
+static const char * const cdp_capnames[] = {
+	"router", "tb_bridge", "srcbridge", "bridge", "host", "igmp-filter", "repeater"
+};
+
+/// Add the meaningful fields of an LLDP packet to 'cksum'.
+/// That's the chassis and port ids, capabilities, management addresses and VLANs.
+/// Things like TTLs and descriptions don't tell the CMA anything new.
+FSTATIC void
+_switchdiscovery_lldp_digest(GChecksum* cksum,		///<[in/out] checksum to add to
+			     gconstpointer pkt,		///<[in] LLDP packet
+			     gconstpointer pktend)	///<[in] first byte past 'pkt'
+{
+	static const guint8	oui802_1[3] = {0x00, 0x80, 0xc2};
+	gconstpointer		tlv;
+
+	for (tlv = get_lldptlv_first(pkt, pktend); tlv != NULL; tlv = get_lldptlv_next(tlv, pktend)) {
+		const guint8*	body = (const guint8*)get_lldptlv_body(tlv, pktend);
+		gsize		bodylen = get_lldptlv_len(tlv, pktend);
+
+		switch (get_lldptlv_type(tlv, pktend)) {
+			case LLDP_TLV_CHID:
+			case LLDP_TLV_PID:
+			case LLDP_TLV_SYS_CAPS:
+			case LLDP_TLV_MGMT_ADDR:
+				break;
+			case LLDP_TLV_ORG_SPECIFIC:
+				// Of these, we only care about the 802.1 VLAN TLVs
+				if (bodylen >= 4 && memcmp(body, oui802_1, sizeof(oui802_1)) == 0
+				&&	body[3] >= LLDP_ORG802_1_VLAN_PVID
+				&&	body[3] <= LLDP_ORG802_1_VLAN_NAME) {
+					break;
+				}
+				continue;
+			default:
+				continue;
+		}
+		g_checksum_update(cksum, (const guchar*)tlv
+		,	(gssize)((body + bodylen) - (const guint8*)tlv));
+	}
+}
+
+/// Add the meaningful fields of a CDP packet to 'cksum' - like _switchdiscovery_lldp_digest()
+FSTATIC void
+_switchdiscovery_cdp_digest(GChecksum* cksum,		///<[in/out] checksum to add to
+			    gconstpointer pkt,		///<[in] CDP packet
+			    gconstpointer pktend)	///<[in] first byte past 'pkt'
+{
+	gconstpointer		tlv;
+
+	for (tlv = get_cdptlv_first(pkt, pktend); tlv != NULL; tlv = get_cdptlv_next(tlv, pktend)) {
+		const guint8*	body = (const guint8*)get_cdptlv_body(tlv, pktend);
+		gsize		tlvlen = get_cdptlv_len(tlv, pktend);
+
+		if (tlvlen < (gsize)(body - (const guint8*)tlv)) {
+			// Malformed - and would loop forever...
+			break;
+		}
+		switch (get_cdptlv_type(tlv, pktend)) {
+			case CDP_TLV_DEVID:
+			case CDP_TLV_ADDRESS:
+			case CDP_TLV_PORTID:
+			case CDP_TLV_CAPS:
+			case CDP_TLV_NATIVEVLAN:
+			case CDP_TLV_VLREPLY:
+			case CDP_TLV_MANAGEMENT_ADDR:
+				g_checksum_update(cksum, (const guchar*)tlv, (gssize)tlvlen);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+/// Convert a TLV string value into a string we can safely put into JSON.
+/// Control characters which JSON can escape (like the newlines in Cisco version strings)
+/// are kept - so we say the same thing the CMA would have.
+FSTATIC gchar*
+_switchdiscovery_tlvstring(const guint8* value, gsize len)
+{
+	gchar*		ret = g_strndup((const gchar*)value, len);
+	gboolean	isutf8 = g_utf8_validate(ret, -1, NULL);
+	gchar*		cp;
+
+	for (cp = ret; *cp; ++cp) {
+		guchar	c = (guchar)*cp;
+		if ((c < 0x20 && strchr("\b\f\n\r\t", c) == NULL) || c == 0x7f) {
+			*cp = ' ';
+		}else if (c >= 0x80 && !isutf8) {
+			*cp = '?';
+		}
+	}
+	return ret;
+}
+
+/// Convert an opaque TLV value into a hex string (0x...)
+FSTATIC gchar*
+_switchdiscovery_tlvhex(const guint8* value, gsize len)
+{
+	GString*	ret = g_string_sized_new(2+2*len);
+	gsize		j;
+
+	g_string_append(ret, "0x");
+	for (j=0; j < len; ++j) {
+		g_string_append_printf(ret, "%02x", value[j]);
+	}
+	return g_string_free(ret, FALSE);
+}
+
+/// Construct a NetAddr from an address which starts with its (IANA) address family
+/// @return NetAddr object (or NULL if we don't understand it)
+FSTATIC NetAddr*
+_switchdiscovery_netaddr(const guint8* addr, gsize addrlen)
+{
+	if (addrlen < 1) {
+		return NULL;
+	}
+	switch (addr[0]) {
+		case ADDR_FAMILY_IPV4:
+			return addrlen == 5 ? netaddr_ipv4_new(addr+1, 0) : NULL;
+		case ADDR_FAMILY_IPV6:
+			return addrlen == 17 ? netaddr_ipv6_new(addr+1, 0) : NULL;
+		case ADDR_FAMILY_802:
+			if (addrlen == 7) {
+				return netaddr_mac48_new(addr+1);
+			}
+			if (addrlen == 9) {
+				return netaddr_mac64_new(addr+1);
+			}
+			break;
+	}
+	return NULL;
+}
+
+/// Set 'name' in 'cfg' to the given TLV string value
+FSTATIC void
+_switchdiscovery_setstring(ConfigContext* cfg, const char* name, const guint8* value, gsize len)
+{
+	gchar*	str = _switchdiscovery_tlvstring(value, len);
+	cfg->setstring(cfg, name, str);
+	g_free(str);
+}
+
+/// Record which port we're connected to - and its port number, if its name ends in one
+FSTATIC void
+_switchdiscovery_setport(ConfigContext* switchinfo, ConfigContext* portinfo
+,			const guint8* value, gsize len)
+{
+	ConfigContext*	ports = switchinfo->getconfig(switchinfo, "ports");
+	gchar*		portid = _switchdiscovery_tlvstring(value, len);
+	gsize		idlen = strlen(portid);
+	gsize		ndigits = 0;
+
+	if (idlen > 0) {
+		ports->setconfig(ports, portid, portinfo);
+		portinfo->setstring(portinfo, "PortId", portid);
+		while (ndigits < idlen && g_ascii_isdigit(portid[idlen-ndigits-1])) {
+			++ndigits;
+		}
+		if (ndigits > 0 && ndigits < 10) {
+			portinfo->setint(portinfo, "PORTNUM", atoi(portid+idlen-ndigits));
+		}
+	}
+	g_free(portid);
+}
+
+/// Set the SystemCapabilities of our switch from a pair of capability bit masks
+FSTATIC void
+_switchdiscovery_setcaps(ConfigContext* switchinfo, const char * const * capnames, gsize ncaps
+,			guint32 present, guint32 enabled)
+{
+	ConfigContext*	caps = configcontext_new(0);
+	gsize		j;
+
+	for (j=0; j < ncaps; ++j) {
+		guint32	mask = 1U << j;
+		if (capnames[j] != NULL && (present & mask)) {
+			caps->setbool(caps, capnames[j], (enabled & mask) != 0);
+		}
+	}
+	switchinfo->setconfig(switchinfo, "SystemCapabilities", caps);
+	UNREF(caps);
+}
+
+/// Decode a CDP address list (CDP_TLV_ADDRESS or CDP_TLV_MANAGEMENT_ADDR) into 'name' in 'cfg'.
+/// It's a 4 byte count followed by that many addresses, each one looking like this:
+/// protocol type (1 byte), protocol length (1 byte), protocol, address length (2 bytes), address.
+/// A single address is stored as an address, more than one as an array of them.
+FSTATIC void
+_switchdiscovery_cdpaddrs(ConfigContext* cfg, const char* name, const guint8* body, gsize len)
+{
+	const guint8*	bodyend = body + len;
+	guint32		count;
+	guint32		j;
+	gsize		offset = 4;
+	GSList*		addrs = NULL;
+	GSList*		this;
+
+	if (len < 4) {
+		return;
+	}
+	count = tlv_get_guint32(body, bodyend);
+	for (j=0; j < count && offset + 2 <= len; ++j) {
+		gsize		protolen = body[offset+1];
+		const guint8*	proto = body + offset + 2;
+		gsize		addrlen;
+		const guint8*	addr;
+		NetAddr*	netaddr = NULL;
+
+		offset += 2 + protolen;
+		if (offset + 2 > len) {
+			break;
+		}
+		addrlen = tlv_get_guint16(body+offset, bodyend);
+		offset += 2;
+		if (offset + addrlen > len) {
+			break;
+		}
+		addr = body + offset;
+		offset += addrlen;
+		if (protolen == 1 && proto[0] == 0xCC && addrlen == 4) {
+			netaddr = netaddr_ipv4_new(addr, 0);
+		}else if (protolen == 8 && proto[6] == 0x86 && proto[7] == 0xDD && addrlen == 16) {
+			netaddr = netaddr_ipv6_new(addr, 0);
+		}
+		if (netaddr != NULL) {
+			addrs = g_slist_append(addrs, netaddr);
+		}
+	}
+	if (addrs != NULL && addrs->next == NULL) {
+		cfg->setaddr(cfg, name, CASTTOCLASS(NetAddr, addrs->data));
+	}else if (addrs != NULL) {
+		cfg->setarray(cfg, name, NULL);
+		for (this = addrs; this; this = this->next) {
+			cfg->appendaddr(cfg, name, CASTTOCLASS(NetAddr, this->data));
+		}
+	}
+	for (this = addrs; this; this = this->next) {
+		NetAddr*	netaddr = CASTTOCLASS(NetAddr, this->data);
+		UNREF(netaddr);
+	}
+	g_slist_free(addrs);
+}
+
+/// Decode the TLVs of an LLDP packet into 'switchinfo' and 'portinfo'
+FSTATIC void
+_switchdiscovery_lldp_decode(ConfigContext* switchinfo	///<[in/out] switch-wide information
+,			     ConfigContext* portinfo	///<[in/out] information about our port
+,			     gconstpointer pkt		///<[in] LLDP packet
+,			     gconstpointer pktend)	///<[in] first byte past 'pkt'
+{
+	gconstpointer	tlv;
+
+	for (tlv = get_lldptlv_first(pkt, pktend); tlv != NULL; tlv = get_lldptlv_next(tlv, pktend)) {
+		const guint8*	body = (const guint8*)get_lldptlv_body(tlv, pktend);
+		gsize		len = get_lldptlv_len(tlv, pktend);
+		NetAddr*	addr = NULL;
+
+		if ((gconstpointer)(body + len) > pktend) {
+			break;
+		}
+		switch (get_lldptlv_type(tlv, pktend)) {
+			case LLDP_TLV_PORT_DESCR:
+				_switchdiscovery_setstring(portinfo, "PortDescription", body, len);
+				break;
+			case LLDP_TLV_SYS_NAME:
+				_switchdiscovery_setstring(switchinfo, "SystemName", body, len);
+				break;
+			case LLDP_TLV_SYS_DESCR:
+				_switchdiscovery_setstring(switchinfo, "SystemDescription", body, len);
+				break;
+			case LLDP_TLV_PID:
+				if (len >= 2 && (body[0] == LLDP_PIDTYPE_ALIAS
+				||	body[0] == LLDP_PIDTYPE_IFNAME || body[0] == LLDP_PIDTYPE_LOCAL)) {
+					_switchdiscovery_setport(switchinfo, portinfo, body+1, len-1);
+				}
+				break;
+			case LLDP_TLV_CHID:
+				if (len < 2) {
+					break;
+				}
+				switch (body[0]) {
+					case LLDP_CHIDTYPE_COMPONENT:
+					case LLDP_CHIDTYPE_ALIAS:
+					case LLDP_CHIDTYPE_IFNAME:
+					case LLDP_CHIDTYPE_LOCAL:
+						_switchdiscovery_setstring(switchinfo, "ChassisId"
+						,	body+1, len-1);
+						break;
+					case LLDP_CHIDTYPE_MACADDR:
+						addr = (len == 7 ? netaddr_mac48_new(body+1)
+						:	len == 9 ? netaddr_mac64_new(body+1) : NULL);
+						break;
+					case LLDP_CHIDTYPE_NETADDR:
+						addr = _switchdiscovery_netaddr(body+1, len-1);
+						break;
+				}
+				if (addr) {
+					switchinfo->setaddr(switchinfo, "ChassisId", addr);
+				}
+				break;
+			case LLDP_TLV_MGMT_ADDR:
+				if (len >= 1 && (gsize)body[0] + 1 <= len) {
+					addr = _switchdiscovery_netaddr(body+1, body[0]);
+				}
+				if (addr) {
+					switchinfo->setaddr(switchinfo, "ManagementAddress", addr);
+				}
+				break;
+			case LLDP_TLV_SYS_CAPS:
+				if (len >= 4) {
+					_switchdiscovery_setcaps(switchinfo, lldp_capnames
+					,	DIMOF(lldp_capnames)
+					,	(guint32)((body[0] << 8) | body[1])
+					,	(guint32)((body[2] << 8) | body[3]));
+				}
+				break;
+		}
+		if (addr) {
+			UNREF(addr);
+		}
+	}
+}
+
+/// Decode the TLVs of a CDP packet into 'switchinfo' and 'portinfo'
+FSTATIC void
+_switchdiscovery_cdp_decode(ConfigContext* switchinfo	///<[in/out] switch-wide information
+,			    ConfigContext* portinfo	///<[in/out] information about our port
+,			    gconstpointer pkt		///<[in] CDP packet
+,			    gconstpointer pktend)	///<[in] first byte past 'pkt'
+{
+	gconstpointer	tlv;
+
+	for (tlv = get_cdptlv_first(pkt, pktend); tlv != NULL; tlv = get_cdptlv_next(tlv, pktend)) {
+		const guint8*	body = (const guint8*)get_cdptlv_body(tlv, pktend);
+		gsize		hdrlen = (gsize)(body - (const guint8*)tlv);
+		gsize		tlvlen = get_cdptlv_len(tlv, pktend);
+		guint16		tlvtype = get_cdptlv_type(tlv, pktend);
+		const char *	name = NULL;
+		ConfigContext*	where = portinfo;
+		gchar*		hexvalue;
+		gsize		len;
+
+		if (tlvlen < hdrlen || (gconstpointer)((const guint8*)tlv + tlvlen) > pktend) {
+			break;
+		}
+		len = tlvlen - hdrlen;
+		switch (tlvtype) {
+			case CDP_TLV_DEVID:
+				_switchdiscovery_setstring(switchinfo, "ChassisId", body, len);
+				continue;
+			case CDP_TLV_ADDRESS:
+				_switchdiscovery_cdpaddrs(switchinfo, "SystemAddress", body, len);
+				continue;
+			case CDP_TLV_MANAGEMENT_ADDR:
+				_switchdiscovery_cdpaddrs(switchinfo, "ManagementAddress", body, len);
+				continue;
+			case CDP_TLV_PORTID:
+				_switchdiscovery_setport(switchinfo, portinfo, body, len);
+				continue;
+			case CDP_TLV_CAPS:
+				if (len >= 4) {
+					guint32	caps = tlv_get_guint32(body, pktend);
+					_switchdiscovery_setcaps(switchinfo, cdp_capnames
+					,	DIMOF(cdp_capnames), caps, caps);
+				}
+				continue;
+			case CDP_TLV_VERS:
+				_switchdiscovery_setstring(switchinfo, "SystemVersion", body, len);
+				continue;
+			case CDP_TLV_PLATFORM:
+				_switchdiscovery_setstring(switchinfo, "SystemPlatform", body, len);
+				continue;
+			case CDP_TLV_SYSTEM_NAME:
+				_switchdiscovery_setstring(switchinfo, "SystemName", body, len);
+				continue;
+			case CDP_TLV_EXT_PORTID:
+				_switchdiscovery_setstring(portinfo, "PortDescription", body, len);
+				continue;
+			case CDP_TLV_DUPLEX:
+				if (len >= 1) {
+					portinfo->setstring(portinfo, "Duplex", body[0] ? "full" : "half");
+				}
+				continue;
+			case CDP_TLV_POWER:
+				if (len >= 2) {
+					portinfo->setint(portinfo, "PortPower", tlv_get_guint16(body, pktend));
+				}else if (len == 1) {
+					portinfo->setint(portinfo, "PortPower", body[0]);
+				}
+				continue;
+			case CDP_TLV_MTU:
+				// Big-endian integer of whatever size (up to 4 bytes) the switch sent.
+				// Anything bigger than that we pass along as hex - just like the CMA.
+				if (len >= 1 && len <= sizeof(guint32)) {
+					guint32	mtu = 0;
+					gsize	k;
+					for (k=0; k < len; ++k) {
+						mtu = (mtu << 8) | body[k];
+					}
+					portinfo->setint(portinfo, "MTU", (gint)mtu);
+					continue;
+				}
+				name = "MTU";
+				break;
+			// The rest we pass along as hex
+			case CDP_TLV_NATIVEVLAN:	name = "VlanName";	break;
+			case CDP_TLV_VLQUERY:		name = "VlanQuery";	break;
+			case CDP_TLV_VLREPLY:		name = "VlanReply";	break;
+			default:			where = switchinfo;	break;
+		}
+		hexvalue = _switchdiscovery_tlvhex(body, len);
+		if (name != NULL) {
+			where->setstring(where, name, hexvalue);
+		}else{
+			gchar*	tlvname = g_strdup_printf("TLV_0x%02x", tlvtype);
+			where->setstring(where, tlvname, hexvalue);
+			g_free(tlvname);
+		}
+		g_free(hexvalue);
+	}
+}
+
+/// Decode an LLDP or CDP packet into the same JSON discovery data the CMA would construct
+/// from it.  The switch-wide information is in "data", and information about the port we're
+/// connected to is in "data"/"ports"/<i>port-id</i>.
+/// @return ConfigContext containing the JSON discovery data (or NULL if it's neither LLDP nor CDP)
+ConfigContext*
+switchdiscovery_decode_packet(const char * host		///<[in] host we captured it on
+,			      const char * interface	///<[in] interface we captured it on
+,			      gint64 wallclock		///<[in] when we captured it (g_get_real_time)
+,			      gconstpointer pkt		///<[in] the captured packet
+,			      gconstpointer pktend)	///<[in] first byte past 'pkt'
+{
+	gsize		j;
+
+	g_return_val_if_fail(host != NULL && interface != NULL && pkt != NULL && pktend != NULL, NULL);
+	for (j=0; j < DIMOF(discovery_types); ++j) {
+		ConfigContext*	metadata;
+		ConfigContext*	switchinfo;
+		ConfigContext*	ports;
+		ConfigContext*	portinfo;
+		gchar*		value;
+
+		if (!discovery_types[j].isthistype(pkt, pktend)) {
+			continue;
+		}
+		metadata = configcontext_new(0);
+		switchinfo = configcontext_new(0);
+		ports = configcontext_new(0);
+		portinfo = configcontext_new(0);
+		portinfo->setstring(portinfo, "ConnectsToHost", host);
+		portinfo->setstring(portinfo, "ConnectsToInterface", interface);
+		switchinfo->setconfig(switchinfo, "ports", ports);
+		UNREF(ports);
+
+		metadata->setstring(metadata, "discovertype", "__LinkDiscovery");
+		value = g_strdup_printf("Link Level Switch Discovery (%s)"
+		,	discovery_types[j].discoverytype);
+		metadata->setstring(metadata, "description", value);
+		g_free(value);
+		metadata->setstring(metadata, "source", __FUNCTION__);
+		metadata->setstring(metadata, "host", host);
+		value = g_strdup_printf("%"G_GINT64_FORMAT, wallclock);
+		metadata->setstring(metadata, "localtime", value);
+		g_free(value);
+		metadata->setconfig(metadata, "data", switchinfo);
+
+		if ((const guint8*)pktend - (const guint8*)pkt >= 12) {
+			NetAddr*	sourcemac = netaddr_mac48_new((const guint8*)pkt + 6);
+			discovery_types[j].decode(switchinfo, portinfo, pkt, pktend);
+			portinfo->setaddr(portinfo, "sourceMAC", sourcemac);
+			UNREF(sourcemac);
+		}
+		UNREF(portinfo);
+		UNREF(switchinfo);
+		return metadata;
+	}
+	return NULL;
+}
+
+/// Decode this packet into JSON and send it to the CMA as ordinary JSON discovery data
+/// @return TRUE if we sent it
 FSTATIC gboolean
+_switchdiscovery_sendjson(SwitchDiscovery* self		///<[in/out] Our SwitchDiscovery object
+,			  gconstpointer pkt		///<[in] the packet just read in
+,			  gconstpointer pend		///<[in] first byte past 'pkt'
+,			  const struct pcap_pkthdr* pkthdr ///<[in] libpcap packet header
+,			  const char * capturedev)	///<[in] device it was captured on
+{
+	gchar*		sysname = proj_get_sysname();
+	gint64		wallclock = (gint64)pkthdr->ts.tv_sec * G_USEC_PER_SEC + pkthdr->ts.tv_usec;
+	ConfigContext*	json;
+	gchar*		jsonout;
+
+	json = switchdiscovery_decode_packet(sysname, capturedev, wallclock, pkt, pend);
+	g_free(sysname);
+	if (NULL == json) {
+		return FALSE;
+	}
+	jsonout = json->baseclass.toString(&json->baseclass);
+	UNREF(json);
+	DEBUGMSG2("%s.%d: Sending decoded LLDP/CDP packet: %s", __FUNCTION__, __LINE__, jsonout);
+	self->baseclass.sendjson(&self->baseclass, jsonout, strlen(jsonout));
+	return TRUE;
+}
+
+///
+/// Decide what to do with this packet - report it, send a keepalive, or nothing.
+/// We report it if its meaningful fields have changed since we last reported them - unless
+/// we've reported a change too recently.  In that case, a later advertisement will carry the
+/// change to the CMA.  We keep track of each protocol separately, since some switches send both.
+FSTATIC guint
 _switchdiscovery_cache_info(SwitchDiscovery* self,  ///<[in/out] Our SwitchDiscovery object
 			   gconstpointer pkt,	   ///<[in] Pointer to the packet just read in
-                           gconstpointer pktend)   ///<[in] Pointer to first byte past 'pkt'
+                           gconstpointer pktend,   ///<[in] Pointer to first byte past 'pkt'
+			   gint64 now)		   ///<[in] current monotonic time
 {
 	gsize	j;
-	///@todo deal with switches that send both LLDP and CDP packets
 
 	for (j=0; j < DIMOF(discovery_types); ++j) {
-		gconstpointer	curswitchid;
 		gssize		curswitchidlen = -1;
-		gconstpointer	curportid;
 		gssize		curportidlen = -1;
+		GChecksum*	cksum;
+		gchar*		digest;
 
 		if (!discovery_types[j].isthistype(pkt, pktend)) {
 			continue;
 		}
-		curswitchid = discovery_types[j].get_switch_id(pkt, &curswitchidlen, pktend);
-		curportid = discovery_types[j].get_port_id(pkt, &curportidlen, pktend);
-		g_return_val_if_fail(curswitchid != NULL, FALSE);
-		g_return_val_if_fail(curportid != NULL, FALSE);
-
-		if (self->switchid == NULL || self->portid == NULL
-                    || curportidlen != self->portidlen || curswitchidlen != self->switchidlen
-		    || memcmp(curswitchid, self->switchid, curswitchidlen) != 0
-		    || memcmp(curportid, self->portid, curportidlen) != 0) {
-
-			if (self->switchid != NULL) {
-				FREE(self->switchid); self->switchid = NULL;
+		g_return_val_if_fail(NULL != discovery_types[j].get_switch_id(pkt, &curswitchidlen, pktend)
+		,	SWDISC_SUPPRESS);
+		g_return_val_if_fail(NULL != discovery_types[j].get_port_id(pkt, &curportidlen, pktend)
+		,	SWDISC_SUPPRESS);
+		cksum = g_checksum_new(G_CHECKSUM_SHA256);
+		discovery_types[j].digest(cksum, pkt, pktend);
+		digest = g_strdup(g_checksum_get_string(cksum));
+		g_checksum_free(cksum);
+
+		if (self->digest[j] == NULL || strcmp(digest, self->digest[j]) != 0) {
+			if (self->digest[j] != NULL && (now - self->lastreport[j]) < self->minreportusecs) {
+				DEBUGMSG2("%s.%d: %s change held back - reported one too recently"
+				,	__FUNCTION__, __LINE__, discovery_types[j].discoverytype);
+				g_free(digest);
+				return SWDISC_SUPPRESS;
 			}
-			if (self->portid != NULL) {
-				FREE(self->portid); self->portid = NULL;
+			if (self->digest[j] != NULL) {
+				g_free(self->digest[j]);
 			}
-			self->switchid = g_memdup(curswitchid, curswitchidlen);
-			self->portid = g_memdup(curportid, curportidlen);
-			self->switchidlen = curswitchidlen;
-			self->portidlen = curportidlen;
-			return TRUE;
+			self->digest[j] = digest;
+			self->lastreport[j] = now;
+			self->lastsent[j] = now;
+			return SWDISC_REPORT;
+		}
+		g_free(digest);
+		if ((now - self->lastsent[j]) >= self->keepaliveusecs) {
+			self->lastsent[j] = now;
+			return SWDISC_KEEPALIVE;
 		}
 		break;
 	}
-	return FALSE;
+	return SWDISC_SUPPRESS;
 }
 ///@}
@@ -74,6 +74,7 @@ from AssimCtypes import POINTER, cast, addressof, pointer, string_at, create_str
     get_cdptlv_next, \
     get_cdptlv_type, \
     get_cdptlv_len, \
+    get_cdptlv_vlen, \
     get_cdptlv_body, \
     tlv_get_guint8, tlv_get_guint16, tlv_get_guint24, tlv_get_guint32, tlv_get_guint64, \
     CFG_EEXIST, CFG_CFGCTX, CFG_CFGCTX, CFG_STRING, CFG_NETADDR, CFG_FRAME, CFG_INT64, CFG_ARRAY, \
@@ -406,12 +407,13 @@ class pySwitchDiscovery(object):
         this = get_cdptlv_first(pktstart, pktend)
         while this and this < pktend:
             tlvtype = get_cdptlv_type(this, pktend)
-            tlvlen = get_cdptlv_len(this, pktend)
+            tlvlen = get_cdptlv_vlen(this, pktend)
             tlvptr = cast(get_cdptlv_body(this, pktend), cClass.guint8)
             this = get_cdptlv_next(this, pktend)
             value = None
             if tlvtype not in pySwitchDiscovery.cdpnames:
-                tlvtype = ('TLV_0x%02x' % tlvtype)
+                tlvname = ('TLV_0x%02x' % tlvtype)
+                tlvtype = tlvname
                 isswitchinfo = True # Gotta do _something_...
             else:
                 (tlvname, isswitchinfo)  = pySwitchDiscovery.cdpnames[tlvtype]
@@ -436,7 +438,12 @@ class pySwitchDiscovery(object):
                 tlen = tlvlen if tlvlen <= 2 else 2
                 value = pySwitchDiscovery.getNint(tlvptr, tlen, pktend)
             elif tlvtype == CDP_TLV_MTU:
-                value = pySwitchDiscovery.getNint(tlvptr, tlvlen, pktend)
+                # Too big to be an MTU?  Pass it along as hex - like the nanoprobe does
+                if tlvlen >= 1 and tlvlen <= 4:
+                    value = pySwitchDiscovery.getNint(tlvptr, tlvlen, pktend)
+                else:
+                    value = '0x' + ''.join(['%02x' % pySwitchDiscovery._byteN(tlvptr, offset)
+                                            for offset in range(0, tlvlen)])
             elif tlvtype == CDP_TLV_SYSTEM_NAME:
                 value = string_at(tlvptr, tlvlen)
             elif tlvtype == CDP_TLV_MANAGEMENT_ADDR:
@@ -516,61 +523,52 @@ class pySwitchDiscovery(object):
         Decode utterly bizarre CDP-specific address list format
         4 bytes address count
         'count' addresses in this form:
-            one bytes protocol length
-            'protocol length' bytes of protocol type
+            one byte protocol type
+            one byte protocol length
+            'protocol length' bytes of protocol
             two bytes address length
             'address length' bytes of address
             IPv4:
-                protocol length = 1, protocol type = 0xCC
+                protocol length = 1, protocol == 0xCC
             IPv6:
                 protocol length = 8 and address length = 16
-                protocol type == 0xAAAA0300000086DD ??
-            +-------+--------------------+----------+-----------------+
-            |Proto  |Protocol Type       | address  | Actual address  |
-            |Length |(protolength bytes) | length   | (addresslength  |
-            |1 byte |(1-255 bytes)       | (2 bytes)|  bytes)         |
-            +-------+--------------------+----------+-----------------+
+                protocol == 0xAAAA0300000086DD
+            +-------+-------+--------------------+----------+-----------------+
+            |Proto  |Proto  |Protocol            | address  | Actual address  |
+            |Type   |Length |(protolength bytes) | length   | (addresslength  |
+            |1 byte |1 byte |(1-255 bytes)       | (2 bytes)|  bytes)         |
+            +-------+-------+--------------------+----------+-----------------+
 
             Min length for an IPV4 address is 8 bytes
         '''
-        minlength=8
         retlist = []
-        offset = 0
+        tlvbytes = cast(tlvstart, cClass.guint8)
+        if tlvlen < 4:
+            return None
         count = pySwitchDiscovery.getNint(tlvstart, 4, pktend)
-        offset += 4
-        for j in range(0, count):
+        offset = 4
+        for _ in xrange(0, count):
             addr = None
-            if (offset+minlength) > tlvlen:
-                break
-            protolen = pySwitchDiscovery.getNint(pySwitchDiscovery._byteNaddr
-            (       cast(tlvstart, cClass.guint8), offset), 1, pktend)
-            offset += 2
-            if protolen < 1:
+            if (offset+2) > tlvlen:
                 break
-            if offset >= tlvlen:
+            protolen = pySwitchDiscovery._byteN(tlvstart, offset+1)
+            protooffset = offset + 2
+            offset += 2 + protolen
+            if (offset+2) > tlvlen:
                 break
-            if protolen == 1:
-                prototype = pySwitchDiscovery._byteN(tlvstart, offset+protolen-1)
-            elif protolen == 16:
-                prototype = pySwitchDiscovery.getNint(
-                pySwitchDiscovery._byteNaddr(cast(tlvstart, cClass.guint8), offset+protolen-2)
-                ,   2, pktend)
-            else:
-                prototype = 0xdeadbeef
-            offset += protolen
-            if offset > tlvlen:
+            addrlen = pySwitchDiscovery.getNint(pySwitchDiscovery._byteNaddr(tlvbytes, offset)
+            ,   2, pktend)
+            offset += 2
+            if (offset+addrlen) > tlvlen:
                 break
-            addrlen = pySwitchDiscovery.getNint(pySwitchDiscovery._byteNaddr
-            (           cast(tlvstart, cClass.guint8), offset), 2, pktend)
-            if protolen == 1 and addrlen == 4 and prototype == 0xCC:
-                addrstr=''
-                for j in (offset+2, offset+3, offset, offset+1):
-                    addrstr += chr(pySwitchDiscovery._byteN(tlvstart, j))
-                addr = netaddr_ipv4_new(c_char_p(addrstr), 0)
-            elif protolen == 8 and addrlen == 16 and prototype == 0x86DD:
+            if (protolen == 1 and addrlen == 4
+            and pySwitchDiscovery._byteN(tlvstart, protooffset) == 0xCC):
+                addr = netaddr_ipv4_new(pySwitchDiscovery._byteNaddr(tlvbytes, offset), 0)
+            elif (protolen == 8 and addrlen == 16
+            and pySwitchDiscovery._byteN(tlvstart, protooffset+6) == 0x86
+            and pySwitchDiscovery._byteN(tlvstart, protooffset+7) == 0xDD):
                 # protocol type == 0xAAAA0300000086DD
-                addr = netaddr_ipv6_new(pySwitchDiscovery._byteNaddr(cast(tlvstart, cClass.guint8)
-                ,   offset), 0)
+                addr = netaddr_ipv6_new(pySwitchDiscovery._byteNaddr(tlvbytes, offset), 0)
             if addr is not None:
                 pyaddr = pyNetAddr(Cstruct=addr, addrstring=None)
                 retlist.append(pyaddr)
@@ -1219,6 +1217,7 @@ class pyCryptFrame(pyFrame):
         curkeyid = keyid_gslist
         while curkeyid:
             keyid_list.append(string_at(curkeyid[0].data))
+            g_free(curkeyid[0].data)    # They're copies
             curkeyid = g_slist_next(curkeyid)
         g_slist_free(keyid_gslist)
         return keyid_list
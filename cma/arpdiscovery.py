@@ -50,7 +50,9 @@ import sys
 class ArpDiscoveryListener(DiscoveryListener):
     '''Class for processing ARP cache discovery entries.
     The data section contains (IPaddress, MACaddress) pairs as a hash table (JSON object)
-    Nanoprobes currently send their entire cache each time anything shows up
+    Nanoprobes send their entire cache now and then as an 'ARP' packet.
+    In between, they send 'ARPDELTA' packets with just what was added or changed, and an
+    'expired' list of IP addresses they've stopped hearing about.
 
     For interest, here are some default ARP cache timeouts as of this writing:
         Linux         300 seconds
@@ -63,17 +65,9 @@ class ArpDiscoveryListener(DiscoveryListener):
         VMWare       1200 seconds
         Cisco       14400 seconds
 
-    For large subnets, it would be much more efficient to send only changes --
-    additions and deletions -- but that's not what we currently do :-D
-
-    @TODO: Change ARP updates to give deltas
-
-    If we changed the nanoprobes to send delta updates, then you wouldn't particularly
-    want a 20 minute timeout - you'd want something more like a few minutes
-    so that they came a few at a time to the CMA.  This would keep the CMA from
-    being bottlenecked by massive updates if you have a subnet with a lot of IP
-    addresses on it.  It also means that we would not get 1024 entries just because
-    one came online...
+    Since we get deltas, we don't get 1024 entries just because one came online...
+    We merge each delta into the drone's saved 'ARP' JSON, so it always reflects
+    the nanoprobe's current ARP table.
 
     Of course, a lot of what causes this code to be really slow is the fact that we
     hit the database with a transaction for each IP and each MAC that we find in the
@@ -87,7 +81,8 @@ class ArpDiscoveryListener(DiscoveryListener):
     #               This is what eventually causes ARP discovery packets to be sent
     # ARP:          Packets resulting from ARP discovery - triggered by
     #               the requests we send above...
-    wantedpackets = ('ARP', 'netconfig')
+    # ARPDELTA:     Changes to ARP discovery since the previous ARP or ARPDELTA packet
+    wantedpackets = ('ARP', 'ARPDELTA', 'netconfig')
 
     ip_map = {}
     mac_map = {}
@@ -97,6 +92,9 @@ class ArpDiscoveryListener(DiscoveryListener):
         '''
         if jsonobj['discovertype'] == 'ARP':
             self.processpkt_arp(drone, srcaddr, jsonobj)
+        elif jsonobj['discovertype'] == 'ARPDELTA':
+            ArpDiscoveryListener.merge_arpdelta(drone, jsonobj)
+            self.processpkt_arp(drone, srcaddr, jsonobj)
         elif jsonobj['discovertype'] == 'netconfig':
             self.processpkt_netconfig(drone, srcaddr, jsonobj)
         else:
@@ -132,6 +130,24 @@ class ArpDiscoveryListener(DiscoveryListener):
         if discovery_args:
             drone.request_discovery(discovery_args)
 
+    @staticmethod
+    def merge_arpdelta(drone, jsonobj):
+        '''Apply an 'ARPDELTA' packet to the last full 'ARP' JSON we saved for this drone.
+        If we don't have one, the nanoprobe's next full report will take care of it.
+        '''
+        if not hasattr(drone, 'JSON_ARP'):
+            return
+        arpobj = pyConfigContext(drone.JSON_ARP)
+        arpdata = arpobj['data']
+        if 'expired' in jsonobj:
+            for ip in jsonobj['expired']:
+                if str(ip) in arpdata:
+                    del arpdata[str(ip)]
+        delta = jsonobj['data']
+        for ip in delta.keys():
+            arpdata[ip] = delta[ip]
+        drone.JSON_ARP = str(arpobj)
+
     def processpkt_arp(self, drone, unused_srcaddr, jsonobj):
         '''We want to update the database when we hear a 'ARP' discovery packet
         These discovery entries are the result of listening to ARP packets
@@ -152,6 +168,17 @@ class ArpDiscoveryListener(DiscoveryListener):
         that did the discovery is a reasonable choice.
         '''
 
+        # ARPDELTA reports only list what was added or changed since the previous report,
+        # plus the IP addresses the nanoprobe has stopped hearing about.
+        # Forget those, so we look at them again if they come back.
+        if 'expired' in jsonobj:
+            for ip in jsonobj['expired']:
+                ip = str(ip)
+                macaddr = ArpDiscoveryListener.ip_map.pop(ip, None)
+                if macaddr is not None and macaddr in ArpDiscoveryListener.mac_map:
+                    if ip in ArpDiscoveryListener.mac_map[macaddr]:
+                        ArpDiscoveryListener.mac_map[macaddr].remove(ip)
+
         data = jsonobj['data']
         maciptable = {}
         # Group the IP addresses by MAC address - reversing the map
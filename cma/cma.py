@@ -236,8 +236,9 @@ def main():
          pyPacketDecoder
     from AssimCtypes import CONFIGNAME_CMAINIT, CONFIGNAME_CMAADDR, CONFIGNAME_CMADISCOVER, \
         CONFIGNAME_CMAFAIL, CONFIGNAME_CMAPORT, CONFIGNAME_OUTSIG, CONFIGNAME_COMPRESSTYPE, \
-        CONFIGNAME_COMPRESS, CONFIGNAME_OUTSIG,\
-        proj_class_incr_debug, LONG_LICENSE_STRING, MONRULEINSTALL_DIR
+        CONFIGNAME_COMPRESS, CONFIGNAME_OUTSIG, CONFIGNAME_AEADSIGN,\
+        proj_class_incr_debug, LONG_LICENSE_STRING, MONRULEINSTALL_DIR, \
+        signframe_set_aead_signatures
 
 
     if opt.debug:
@@ -284,6 +285,8 @@ def main():
         =   pyCompressFrame(compression_method=configinfo[CONFIGNAME_COMPRESSTYPE])
     config = configinfo.complete_config()
     config[CONFIGNAME_OUTSIG] = pySignFrame(1)
+    # Our nanoprobes get the same setting in their SETCONFIG - so both directions match
+    signframe_set_aead_signatures(bool(config[CONFIGNAME_AEADSIGN]))
 
     addr = config[CONFIGNAME_CMAINIT]
     if addr.port() == 0:
@@ -71,6 +71,15 @@ class ConfigFile(object):
         'compress':             pyCompressFrame,# Packet compression frame
         'compression_method':   {'zlib'},   # Packet compression method
         'compression_threshold':{int,long}, # Threshold for when to start compressing
+        'aead_signatures':      bool,       # Skip packet digests when encrypting
+        'jsondelta':            bool,       # Accept discovery updates as JSON patches
+        'discmaxrun':           {int,long}, # Most discovery agents to run at once
+        'discjitter':           {int,long,float},# Fraction to vary discovery intervals by
+        'discmaxload':          {int,long,float},# Per-CPU load average to postpone discovery at
+        'discmaxoutq':          {int,long}, # Queued reliable packets to postpone discovery at
+        'nativediscovery':      bool,       # Use in-process versions of discovery agents
+        'discdebounce':         {int,long}, # Seconds to wait before rerunning triggered discovery (at least 1)
+        'discstretch':          {int,long}, # Interval multiplier for event-triggered discovery
         'discovery': {
                 'repeat':   {int,long},     # how often to repeat a discovery action
                 'warn':     {int,long},     # How long to wait when issuing a slow discovery warning
@@ -81,6 +90,7 @@ class ConfigFile(object):
                                     'repeat':   {int,long}, # repeat for this particular agent
                                     'warn':     {int,long}, # How long before slow discovery warning
                                     'timeout':  {int,long}, # timeout for this particular agent
+                                    'triggers': [str],      # events which rerun this agent
                                     'args':     {str: object},
                                 },
                 },
@@ -163,6 +173,14 @@ class ConfigFile(object):
             'cmainit':                  pyNetAddr("0.0.0.0:1984"),  # Our listening address
             'compression_threshold':    20000,                      # Compress packets >= 20 kbytes
             'compression_method':       "zlib",                     # Compression method
+            'aead_signatures':          False,                      # Needs all nanoprobes current
+            'jsondelta':                True,                       # Old nanoprobes ignore this
+            'discmaxrun':               2,                          # Discovery agents at once
+            'discjitter':               0.10,                       # Vary intervals by +-10%
+            'discmaxload':              2.0,                        # Postpone when loadavg/CPU > 2
+            'discmaxoutq':              20,                         # ...or 20 packets are unACKed
+            'discdebounce':             5,                          # Rerun 5s after a trigger event
+            'discstretch':              4,                          # Triggered ones repeat 4x slower
             'discovery': {
                 'repeat':           15*60,  # Default repeat interval in seconds
                 'warn':             120,    # Default slow discovery warning time
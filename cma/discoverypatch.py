@@ -0,0 +1,205 @@
+#!/usr/bin/env python
+# vim: smartindent tabstop=4 shiftwidth=4 expandtab number
+#
+# This file is part of the Assimilation Project.
+#
+# Author: Alan Robertson <alanr@unix.sh>
+# Copyright (C) 2015 - Assimilation Systems Limited
+#
+# Free support is available from the Assimilation Project community - http://assimproj.org
+# Paid support is available from Assimilation Systems Limited - http://assimilationsystems.com
+#
+# The Assimilation software is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# The Assimilation software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+#
+#
+'''
+Support for discovery data sent to us as JSON patches.
+
+Once we tell them we can handle it (the 'jsondelta' configuration value), nanoprobes
+send us a JSON patch (RFC 6902) against the previous version of their discovery data
+instead of the whole thing - when that's smaller.
+Each report carries a version number.  We remember the last version number of each discovery
+instance for each nanoprobe, and apply patches to the copy of it we saved in its Drone.
+If we don't have the version a patch applies to (we restarted, or something got lost),
+we ask the nanoprobe to send it all again.
+'''
+
+import json, hashlib
+from assimevent import AssimEvent
+
+class JSONPatchError(ValueError):
+    'Exception raised when a JSON patch cannot be applied'
+    pass
+
+def _unescape(elem):
+    'Undo JSON pointer (RFC 6901) escaping of one path element'
+    return elem.replace('~1', '/').replace('~0', '~')
+
+def _resolve(doc, path):
+    '''Return the container holding the thing 'path' points at - and its key within it.
+    'path' must not be the empty (whole document) pointer.'''
+    if not path.startswith('/'):
+        raise JSONPatchError('Invalid JSON pointer [%s]' % path)
+    elems = [_unescape(elem) for elem in path[1:].split('/')]
+    parent = doc
+    for elem in elems[:-1]:
+        parent = _child(parent, elem, path)
+    last = elems[-1]
+    if isinstance(parent, list):
+        if last != '-':
+            try:
+                last = int(last)
+            except ValueError:
+                raise JSONPatchError('Invalid array index in [%s]' % path)
+    elif not isinstance(parent, dict):
+        raise JSONPatchError('[%s] is not inside an object or array' % path)
+    return parent, last
+
+def _child(parent, elem, path):
+    'Return the element of parent named by elem'
+    try:
+        if isinstance(parent, list):
+            return parent[int(elem)]
+        return parent[elem]
+    except (KeyError, IndexError, ValueError, TypeError):
+        raise JSONPatchError('[%s] does not exist' % path)
+
+def apply_patch(doc, patch):
+    '''Apply a JSON patch (a list of operations) to 'doc' - in place.
+    We understand the "add", "remove", "replace" and "test" operations.
+    Returns the (possibly new) document.
+    '''
+    for op in patch:
+        try:
+            opname = op['op']
+            path = op['path']
+        except (KeyError, TypeError):
+            raise JSONPatchError('Invalid JSON patch operation: %s' % str(op))
+        if path == '':
+            if opname in ('add', 'replace'):
+                doc = op['value']
+                continue
+            raise JSONPatchError('Cannot %s the whole document' % opname)
+        parent, key = _resolve(doc, path)
+        if opname == 'add':
+            if isinstance(parent, list):
+                if key == '-':
+                    parent.append(op['value'])
+                elif key < 0 or key > len(parent):
+                    raise JSONPatchError('[%s] is out of range' % path)
+                else:
+                    parent.insert(key, op['value'])
+            else:
+                parent[key] = op['value']
+        elif opname == 'remove':
+            del parent[_checkkey(parent, key, path)]
+        elif opname == 'replace':
+            parent[_checkkey(parent, key, path)] = op['value']
+        elif opname == 'test':
+            if parent[_checkkey(parent, key, path)] != op['value']:
+                raise JSONPatchError('Test of [%s] failed' % path)
+        else:
+            raise JSONPatchError('Unsupported JSON patch operation [%s]' % opname)
+    return doc
+
+def _checkkey(parent, key, path):
+    'Make sure key is an existing member of parent - and return it'
+    if isinstance(parent, list):
+        if key == '-' or key < 0 or key >= len(parent):
+            raise JSONPatchError('[%s] is out of range' % path)
+    elif key not in parent:
+        raise JSONPatchError('[%s] does not exist' % path)
+    return key
+
+class DiscoveryVersions(object):
+    '''Keeps the last version number of each nanoprobe's discovery data - and where we saved it -
+    so we can apply patches to it.  The data itself is only kept in the Drone it came from
+    (as its JSON_<discovertype> attribute) - our own memory doesn't grow with it.
+    Version numbers are only kept in memory.  When we restart, each nanoprobe just has to send us
+    the whole thing once more.
+    '''
+    def __init__(self):
+        self._versions = {}
+
+    @staticmethod
+    def _addrkey(origaddr):
+        '''Return the (address, port) we know this nanoprobe by.
+        The same IPv4 address can show up as an IPv4-mapped IPv6 address - so we use that form.
+        '''
+        if hasattr(origaddr, 'toIPv6'):
+            return (str(origaddr.toIPv6(port=0)), origaddr.port())
+        return (str(origaddr), 0)
+
+    def full(self, origaddr, instance, version, designation, dtype, jsontext):
+        '''Remember that we saved 'jsontext' as this version of this discovery instance -
+        in the JSON_<dtype> attribute of the drone named 'designation'.
+        We only keep a digest of the text - so we can tell if what's saved there changes.
+        '''
+        if instance is None:
+            return
+        key = DiscoveryVersions._addrkey(origaddr) + (instance,)
+        if version is None or designation is None or dtype is None:
+            self._versions.pop(key, None)
+            return
+        self._versions[key] = (version, designation, dtype, hashlib.sha1(jsontext).digest())
+
+    def patch(self, origaddr, instance, version, patchtext, loadjson):
+        '''Apply this patch to the previous version of this discovery instance.
+        loadjson(designation, dtype) returns the JSON text we saved for that drone and discovery
+        type - or None.  If that's not the text we were told about, we don't have the previous
+        version any more (another instance of the same type may have replaced it).
+        Our caller saves the result - and tells us about it with full().
+        Returns the new JSON text - or None if we don't have the previous version.
+        '''
+        key = DiscoveryVersions._addrkey(origaddr) + (instance,)
+        if key not in self._versions:
+            return None
+        oldversion, designation, dtype, digest = self._versions.pop(key)
+        if oldversion != version - 1:
+            return None
+        oldtext = loadjson(designation, dtype)
+        if oldtext is None or hashlib.sha1(oldtext).digest() != digest:
+            return None
+        try:
+            doc = apply_patch(json.loads(oldtext), json.loads(patchtext))
+        except (ValueError, KeyError) as e:
+            # JSONPatchError is a ValueError
+            raise JSONPatchError('Cannot apply patch to %s version %d: %s'
+            %   (instance, oldversion, str(e)))
+        return json.dumps(doc, sort_keys=True, separators=(',', ':'))
+
+    def forget(self, origaddr, instance):
+        'Forget what we know about this discovery instance'
+        self._versions.pop(DiscoveryVersions._addrkey(origaddr) + (instance,), None)
+
+    def forget_address(self, origaddr):
+        '''Forget all the discovery data we have from this address.
+        If it has no port, we forget everything from that IP address.
+        '''
+        addr, port = DiscoveryVersions._addrkey(origaddr)
+        for key in self._versions.keys():
+            if key[0] == addr and (port == 0 or key[1] == port):
+                del self._versions[key]
+
+    def notifynewevent(self, event):
+        '''AssimEvent observer method: forget the discovery data of drones which go down
+        or are deleted.  They'll send us everything again when they come back.
+        '''
+        if event.eventtype not in (AssimEvent.OBJDOWN, AssimEvent.OBJDELETE):
+            return
+        drone = event.associatedobject
+        # Only drones have our kind of addresses - and not all objects have them
+        if not hasattr(drone, 'destaddr'):
+            return
+        self.forget_address(drone.destaddr())
@@ -32,6 +32,7 @@ from AssimCclasses import pyNetAddr, pyConfigContext, pySwitchDiscovery, pyCrypt
 from AssimCtypes import cryptcurve25519_save_public_key, DEFAULT_FSP_QID
 from monitoring import MonitorAction
 from assimevent import AssimEvent
+from discoverypatch import DiscoveryVersions, JSONPatchError
 
 class DispatchTarget(object):
     '''Base class for handling incoming FrameSets.
@@ -385,32 +386,88 @@ class DispatchHBBACKALIVE(DispatchTarget):
 
 @DispatchTarget.register
 class DispatchJSDISCOVERY(DispatchTarget):
-    'DispatchTarget subclass for handling incoming JSDISCOVERY FrameSets.'
+    '''DispatchTarget subclass for handling incoming JSDISCOVERY FrameSets.
+    These contain either the full JSON discovery data, or a JSON patch against the previous
+    version of it.  If we can't apply a patch, we ask the nanoprobe for the whole thing.
+    '''
+    versions = DiscoveryVersions()
+
+    def __init__(self):
+        DispatchTarget.__init__(self)
+        # Forget the versions we have of drones which go down or go away
+        AssimEvent.registerobserver(DispatchJSDISCOVERY.versions)
+
     def dispatch(self, origaddr, frameset):
         fstype = frameset.get_framesettype()
         if CMAdb.debug:
             CMAdb.log.debug("DispatchJSDISCOVERY: received [%s] FrameSet from [%s]"
             %       (FrameSetTypes.get(fstype)[0], repr(origaddr)))
         sysname = None
+        instance = None
+        version = None
         for frame in frameset.iter():
             frametype = frame.frametype()
             if frametype == FrameTypes.HOSTNAME:
                 sysname = frame.getstr()
-            if frametype == FrameTypes.JSDISCOVER:
+            elif frametype == FrameTypes.DISCNAME:
+                instance = frame.getstr()
+            elif frametype == FrameTypes.DISCVERSION:
+                version = frame.getint()
+            elif frametype == FrameTypes.JSPATCH:
+                if instance is None or version is None:
+                    CMAdb.log.warning('JSON patch from %s without instance or version'
+                    %   str(origaddr))
+                    return
+                try:
+                    json = DispatchJSDISCOVERY.versions.patch(origaddr, instance, version
+                    ,   frame.getstr(), self._savedjson)
+                except JSONPatchError as e:
+                    CMAdb.log.warning('JSON patch from %s: %s' % (str(origaddr), str(e)))
+                    json = None
+                if json is None:
+                    CMAdb.log.info('Requesting full %s discovery data from %s'
+                    %   (instance, str(origaddr)))
+                    CMAdb.transaction.add_packet(origaddr, FrameSetTypes.DISCFULL
+                    ,   (instance,), FrameTypes.DISCNAME)
+                    return
+                drone, dtype = self._logjson(origaddr, sysname, json)
+                DispatchJSDISCOVERY.versions.full(origaddr, instance, version
+                ,   drone.designation, dtype, json)
+                sysname = None
+            elif frametype == FrameTypes.JSDISCOVER:
                 json = frame.getstr()
-                #print 'JSON received: ', json
-                if sysname is None:
-                    jsonconfig = pyConfigContext(init=json)
-                    sysname = jsonconfig.getstring('host')
-                drone = self.droneinfo.find(sysname)
-                #print >> sys.stderr, 'FOUND DRONE for %s IS: %s' % (sysname, drone)
-                #print >> sys.stderr, 'LOGGING JSON FOR DRONE for %s IS: %s' % (drone, json)
-                drone.logjson(origaddr, json)
+                drone, dtype = self._logjson(origaddr, sysname, json)
+                DispatchJSDISCOVERY.versions.full(origaddr, instance, version
+                ,   drone.designation, dtype, json)
                 sysname = None
 
+    def _logjson(self, origaddr, sysname, json):
+        '''Save away this JSON discovery data for the drone it came from.
+        Return that drone - and the discovery type we saved it as (None if we didn't)'''
+        #print 'JSON received: ', json
+        if sysname is None:
+            jsonconfig = pyConfigContext(init=json)
+            sysname = jsonconfig.getstring('host')
+        drone = self.droneinfo.find(sysname)
+        #print >> sys.stderr, 'FOUND DRONE for %s IS: %s' % (sysname, drone)
+        #print >> sys.stderr, 'LOGGING JSON FOR DRONE for %s IS: %s' % (drone, json)
+        return drone, drone.logjson(origaddr, json)
+
+    def _savedjson(self, designation, dtype):
+        'Return the JSON text of this discovery type we saved for this drone - or None'
+        drone = self.droneinfo.find(designation)
+        jsonname = 'JSON_' + dtype
+        if not hasattr(drone, jsonname):
+            return None
+        return str(getattr(drone, jsonname))
+
 @DispatchTarget.register
 class DispatchSWDISCOVER(DispatchTarget):
-    'DispatchTarget subclass for handling incoming SWDISCOVER FrameSets.'
+    '''DispatchTarget subclass for handling incoming SWDISCOVER FrameSets.
+    Nanoprobes normally decode LLDP/CDP packets themselves and send us the result as
+    ordinary JSON discovery data.  Older ones (or ones configured not to) send us
+    the raw packets, which we decode here into the same JSON.
+    '''
 
     def dispatch(self, origaddr, frameset):
         fstype = frameset.get_framesettype()
@@ -440,7 +497,35 @@ class DispatchSWDISCOVER(DispatchTarget):
                     %   (interface, str(switchjson)))
                 drone = self.droneinfo.find(designation)
                 drone.logjson(origaddr, str(switchjson))
-                break
+                return
+        # No packet data: the nanoprobe is just telling us nothing has changed
+        if designation is None or interface is None or wallclock is None:
+            raise ValueError('Incomplete Switch Discovery keepalive')
+        drone = self.droneinfo.find(designation)
+        refreshed = DispatchSWDISCOVER.refresh_linkdiscovery(drone, interface, wallclock)
+        if CMAdb.debug:
+            CMAdb.log.debug('Link discovery on %s:%s unchanged%s' % (designation, interface
+            ,   ('' if refreshed else ' - but we have nothing from it to refresh')))
+
+    @staticmethod
+    def refresh_linkdiscovery(drone, interface, wallclock):
+        '''The nanoprobe says the switch it hears on 'interface' hasn't changed.
+        Update the time stamp ('localtime') on the link discovery data we saved from it -
+        so we can tell a switch that has gone silent from one that just hasn't changed.
+        Return True if we had link discovery data for this interface to update.
+        '''
+        if not hasattr(drone, 'JSON___LinkDiscovery'):
+            return False
+        jsonobj = pyConfigContext(drone.JSON___LinkDiscovery)
+        ports = jsonobj['data'].get('ports')
+        if ports is None:
+            return False
+        for portid in ports.keys():
+            if str(ports[portid].get('ConnectsToInterface')) == interface:
+                jsonobj['localtime'] = str(wallclock)
+                drone.JSON___LinkDiscovery = str(jsonobj)
+                return True
+        return False
 
 @DispatchTarget.register
 class DispatchRSCOPREPLY(DispatchTarget):
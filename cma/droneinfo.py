@@ -115,12 +115,13 @@ class Drone(SystemNode):
         return self.designation
 
     def logjson(self, origaddr, jsontext):
-        'Process and save away JSON discovery data'
+        '''Process and save away JSON discovery data.
+        Return the discovery type we saved it as - or None if it isn't valid discovery data'''
         assert CMAdb.store.has_node(self)
         jsonobj = pyConfigContext(jsontext)
         if not 'discovertype' in jsonobj or not 'data' in jsonobj:
             CMAdb.log.warning('Invalid JSON discovery packet: %s' % jsontext)
-            return
+            return None
         dtype = jsonobj['discovertype']
         jsonname = 'JSON_' + dtype
         if not hasattr(self, jsonname) or str(getattr(self, jsonname)) != jsontext:
@@ -139,8 +140,9 @@ class Drone(SystemNode):
                 if CMAdb.debug:
                     CMAdb.log.debug('Discovery type %s for endpoint %s is unchanged. ignoring'
                     %       (dtype, self.designation))
-                return
+                return dtype
         self._process_json(origaddr, jsonobj)
+        return dtype
 
     def _process_json(self, origaddr, jsonobj):
         'Pass the JSON data along to interested discovery plugins (if any)'
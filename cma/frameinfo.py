@@ -319,6 +319,27 @@ In spite of the apparent variability permitted, it is an 8-byte (64-bit) integer
   	30:  (pyFrame, 'PUBKEYCURVE25519', 'A Curve25519 Public Key',
 '''This frame provides the raw bytes of a Curve25519 Public Key.
 It is always <b>crypto_box_PUBLICKEYBYTES</b> bytes long - no more, no less.
+'''),
+  	31:  (pyIntFrame, 'FRAGOFFSET', 'Fragment offset',
+'''This frame gives the offset of the data in a @ref FRAMESETTYPE_FRAGMENT FrameSet
+within the packet of the original (oversized) FrameSet.
+'''),
+  	32:  (pyIntFrame, 'FRAGTOTAL', 'Fragmented FrameSet size',
+'''This frame gives the total size of the packet of the original (oversized) FrameSet
+that a @ref FRAMESETTYPE_FRAGMENT FrameSet is part of.
+'''),
+  	33:  (pyFrame, 'FRAGDATA', 'Fragment data',
+'''This frame carries one piece of the packet of an oversized FrameSet,
+starting at the offset given by the preceding @ref FRAMETYPE_FRAGOFFSET frame.
+'''),
+  	34:  (pyCstringFrame, 'JSPATCH', 'JSON patch to discovery data',
+'''This frame contains a JSON patch (RFC 6902) which turns the previous version of
+this discovery instance's data into the current one.  It is sent in place of a
+@ref FRAMETYPE_JSDISCOVER frame when that is smaller.
+'''),
+  	35:  (pyIntFrame, 'DISCVERSION', 'Discovery data version',
+'''This frame gives the version number of the discovery data in this FrameSet.
+A @ref FRAMETYPE_JSPATCH frame applies to the version one less than this.
 '''),
 
     }
@@ -421,6 +442,7 @@ class FrameSetTypes(object):
 	'ACK':		(16, 'Frame referred to has been acted on. (can also come from the CMA)'),
 	'CONNSHUT':	(17, 'Shutting down this connection (can also come from CMA)'),
 	'CONNNAK':	(18, 'Ignoring your connection start request (can also come from CMA)'),
+	'FRAGMENT':	(19, 'Piece of a FrameSet too large for one packet (can also come from CMA)'),
 
 	'HBDEAD':	(26, 'System named in packet appears to be dead.'),
 	'HBSHUTDOWN':	(27, 'System originating packet has shut down.'),
@@ -449,6 +471,7 @@ class FrameSetTypes(object):
 	'STOPRSCOP':	(76, 'Stop a (possibly-repeating) JSON resource action'),
 	'ACKSTARTUP':	(77, 'Acknowledge full response to STARTUP packet'),
 	'RUNSCRIPT':	(78, 'Run an arbitrary script (not yet implemented)'),
+	'DISCFULL':	(79, 'Send full discovery data next time - not a JSON patch'),
     }
     intframetypes = dict()
     for s in strframetypes.keys():
@@ -31,7 +31,9 @@ from frameinfo import *
 from AssimCclasses import *
 import gc
 import re
-from AssimCtypes import proj_class_incr_debug, proj_class_decr_debug
+import json, struct
+from ctypes import create_string_buffer, addressof, cast, c_char_p
+from AssimCtypes import proj_class_incr_debug, proj_class_decr_debug, switchdiscovery_decode_packet
 
 
 CheckForDanglingClasses = True
@@ -995,5 +997,73 @@ class pyNetIOudpTest(TestCase):
     def tearDown(self):
         assert_no_dangling_Cclasses()
 
+class pySwitchDiscoveryTest(TestCase):
+    'Make sure the nanoprobe decodes LLDP and CDP packets the same way the CMA does'
+    pcapdirs = ('../pcap', '../../pcap', 'pcap'
+    ,   os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'pcap'))
+    pcapfiles = ('lldp.detailed.pcap', 'procurve.lldp.pcap', 'lldpmed_civicloc.pcap'
+    ,   'cdp.pcap', 'cdp-BCM1100.pcap', 'n0.eth2.cdp.pcap')
+
+    @staticmethod
+    def pcap_packets(filename):
+        'Return the packets in a (little-endian, microsecond) pcap file'
+        f = open(filename, 'rb')
+        data = f.read()
+        f.close()
+        packets = []
+        offset = 24     # Skip the pcap file header
+        while offset + 16 <= len(data):
+            caplen = struct.unpack('<I', data[offset+8:offset+12])[0]
+            offset += 16
+            packets.append(data[offset:offset+caplen])
+            offset += caplen
+        return packets
+
+    @staticmethod
+    def decode_both(pkt):
+        'Decode this packet with the C and the Python decoders - returning both as JSON objects'
+        pktbuf = create_string_buffer(pkt, len(pkt))
+        pktstart = cast(pktbuf, c_char_p)
+        pktend = cast(addressof(pktbuf) + len(pkt), c_char_p)
+        try:
+            pyjson = pySwitchDiscovery.decode_discovery('host', 'eth0', 123456789
+            ,   pktstart, pktend)
+            pyjson = json.loads(str(pyjson))
+        except ValueError:
+            pyjson = None
+        Cjson = switchdiscovery_decode_packet('host', 'eth0', 123456789, pktstart, pktend)
+        if Cjson:
+            Cjson = json.loads(str(pyConfigContext(Cstruct=Cjson)))
+        else:
+            Cjson = None
+        return (Cjson, pyjson)
+
+    def test_decode_parity(self):
+        if DEBUG: print >>sys.stderr, "===============test_decode_parity(pySwitchDiscoveryTest)"
+        pcapdir = None
+        for candidate in pySwitchDiscoveryTest.pcapdirs:
+            if os.path.exists(os.path.join(candidate, 'cdp.pcap')):
+                pcapdir = candidate
+                break
+        self.assertTrue(pcapdir is not None)
+        decodecount = 0
+        for filename in pySwitchDiscoveryTest.pcapfiles:
+            for pkt in pySwitchDiscoveryTest.pcap_packets(os.path.join(pcapdir, filename)):
+                (Cjson, pyjson) = pySwitchDiscoveryTest.decode_both(pkt)
+                # Both valid - or both not
+                self.assertEqual(Cjson is None, pyjson is None)
+                if Cjson is None:
+                    continue
+                # They only differ in who says they decoded it
+                del Cjson['source']
+                del pyjson['source']
+                self.assertEqual(Cjson, pyjson)
+                decodecount += 1
+        self.assertTrue(decodecount >= 4)
+
+    @class_teardown
+    def tearDown(self):
+        assert_no_dangling_Cclasses()
+
 if __name__ == "__main__":
     run()
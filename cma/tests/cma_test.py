@@ -46,6 +46,10 @@ from cmaconfig import ConfigFile
 from graphnodeexpression import ExpressionContext
 import glib # This is now our glib bindings...
 import discoverylistener
+from discoverypatch import apply_patch, DiscoveryVersions, JSONPatchError
+from AssimCtypes import configcontext_new_JSON_string_raw, configcontext_diff, g_free
+from ctypes import string_at
+import json
 
 
 os.environ['G_MESSAGES_DEBUG'] =  'all'
@@ -453,6 +457,66 @@ class TestTestInfrastructure(TestCase):
     def tearDown(self):
         assert_no_dangling_Cclasses()
 
+class TestDiscoveryPatch(TestCase):
+    'Test applying the JSON patches nanoprobes send us'
+    def test_apply(self):
+        doc = {'data': {'/usr/sbin/sshd': {'pid': 42, 'ports': [22, 2222]}, 'ntpd': {'pid': 7}}}
+        patch = [
+            {'op': 'replace', 'path': '/data/~1usr~1sbin~1sshd/pid', 'value': 43},
+            {'op': 'remove', 'path': '/data/~1usr~1sbin~1sshd/ports/1'},
+            {'op': 'add', 'path': '/data/~1usr~1sbin~1sshd/ports/-', 'value': 8022},
+            {'op': 'remove', 'path': '/data/ntpd'},
+            {'op': 'add', 'path': '/data/named', 'value': {'pid': 9}},
+        ]
+        doc = apply_patch(doc, patch)
+        self.assertEqual(doc, {'data': {'/usr/sbin/sshd': {'pid': 43, 'ports': [22, 8022]}
+        ,   'named': {'pid': 9}}})
+        self.assertRaises(JSONPatchError, apply_patch, doc
+        ,   [{'op': 'remove', 'path': '/data/ntpd'}])
+
+    def test_versions(self):
+        'We patch the JSON our Drones have saved - as long as it is what we saved there'
+        saved = {}
+        loadjson = lambda designation, dtype: saved.get((designation, dtype))
+        versions = DiscoveryVersions()
+        addr = pyNetAddr('10.10.10.1:1984')
+        saved[('drone1', 'os')] = '{"data":{"a":1},"discovertype":"os"}'
+        versions.full(addr, 'os', 1, 'drone1', 'os', saved[('drone1', 'os')])
+        newtext = versions.patch(addr, 'os', 2
+        ,   '[{"op":"replace","path":"/data/a","value":2}]', loadjson)
+        self.assertEqual(newtext, '{"data":{"a":2},"discovertype":"os"}')
+        saved[('drone1', 'os')] = newtext
+        versions.full(addr, 'os', 2, 'drone1', 'os', newtext)
+        # Version 3 is missing - so we can't apply version 4
+        self.assertEqual(versions.patch(addr, 'os', 4, '[]', loadjson), None)
+        self.assertEqual(versions.patch(addr, 'os', 5, '[]', loadjson), None)
+        # Something else replaced what we saved
+        versions.full(addr, 'os', 1, 'drone1', 'os', newtext)
+        saved[('drone1', 'os')] = '{"data":{"a":3},"discovertype":"os"}'
+        self.assertEqual(versions.patch(addr, 'os', 2, '[]', loadjson), None)
+        # Dead (or deleted) drones have to start over
+        versions.full(addr, 'os', 1, 'drone1', 'os', saved[('drone1', 'os')])
+        versions.forget_address(pyNetAddr('::ffff:10.10.10.1'))
+        self.assertEqual(versions.patch(addr, 'os', 2, '[]', loadjson), None)
+
+    def test_nanoprobe_patch(self):
+        'Apply a patch made by the nanoprobe code - it has to give us exactly what it had'
+        oldjson = ('{"data":{"sshd":{"addr":"::ffff:10.10.10.1","mac":"00-1b-fc-a6-9d-5e",'
+        '"ports":[22,2222]},"ntpd":{"addr":"10.10.10.5:123"}},"host":"drone1"}')
+        newjson = ('{"data":{"sshd":{"addr":"::ffff:10.10.10.2","mac":"00-1b-fc-a6-9d-5e",'
+        '"ports":[22]},"named":{"addr":"[::1]:53"}},"host":"drone1"}')
+        oldcfg = pyConfigContext(Cstruct=configcontext_new_JSON_string_raw(oldjson))
+        newcfg = pyConfigContext(Cstruct=configcontext_new_JSON_string_raw(newjson))
+        Cpatch = configcontext_diff(oldcfg._Cstruct, newcfg._Cstruct)
+        patch = string_at(Cpatch.raw)
+        g_free(Cpatch)
+        self.assertEqual(apply_patch(json.loads(oldjson), json.loads(patch)), json.loads(newjson))
+        versions = DiscoveryVersions()
+        addr = pyNetAddr('10.10.10.1:1984')
+        versions.full(addr, 'tcpdiscovery', 1, 'drone1', 'tcpdiscovery', oldjson)
+        self.assertEqual(json.loads(versions.patch(addr, 'tcpdiscovery', 2, patch
+        ,   lambda designation, dtype: oldjson)), json.loads(newjson))
+
 class TestCMABasic(TestCase):
     def test_startup(self):
         '''A semi-interesting test: We send a STARTUP message and get back a
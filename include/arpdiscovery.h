@@ -25,26 +25,56 @@
 #define _ARPDISCOVERY_H
 #include <projectcommon.h>
 #include <discovery.h>
-#include <pcap_GSource.h>
+#include <pcap_mux.h>
 #include <glib.h>
 #include <configcontext.h>
 ///@{
 /// @ingroup ArpDiscovery
 
 typedef struct _ArpDiscovery ArpDiscovery;
+typedef struct _ArpEntry ArpEntry;
+
+/// One IPv4/MAC address pair we've heard about via ARP - a slot in our @ref ArpDiscovery table
+struct _ArpEntry {
+	guint32		ipaddr;				///< IPv4 address (network byte order) - 0 if unused
+	guint8		flags;				///< ARP_ENTRY_* flags
+	guint8		maclen;				///< Length of macaddr (6 or 8)
+	guint8		macaddr[8];			///< Its MAC address
+	gint64		lastseen;			///< When we last heard it (monotonic clock)
+};
+#define	ARP_ENTRY_UNREPORTED	0x01	///< New or changed since our last report
+#define	ARP_ENTRY_REPORTED	0x02	///< The CMA has heard about this entry
+
+
 /// @ref ArpDiscovery C-class - for discovering IP/MAC address resolution via the ARP protocol captured using <i>libpcap</i>.
 struct _ArpDiscovery {
 	Discovery	baseclass;			///< Base class object
-	GSource*	source;				///< GSource for the pcap data
+	PcapConsumer*	source;				///< Where our pcap data comes from
 	void		(*finalize)(AssimObj* self);	///< Saved parent class destructor
-	ConfigContext*	ArpMap;				///< Arp IP/MAC addresses hash table
-	ConfigContext*	ArpMapData;			///< The actual address portion
+	ConfigContext*	ArpMap;				///< Template for our JSON ARP report
 	ConfigContext*	arpconfig;			///< Our configuration data
         guint           timeout_source;                 ///< timeout source id
+	ArpEntry*	arptable;			///< Open-addressed IP => MAC table
+	guint		arptablebits;			///< log2(number of slots in arptable)
+	guint		arpcount;			///< How many slots in arptable are in use
+	guint		maxentries;			///< Most entries we'll keep
+	gint64		expireusecs;			///< Forget entries we haven't heard from this long
+	gint64		resyncusecs;			///< Send a full report at least this often
+	guint64		addcount;			///< How many IP addresses have we added?
+	guint64		changecount;			///< How many MAC addresses have changed?
+	guint64		expirecount;			///< How many entries have we expired?
+	guint64		overflowcount;			///< How many new entries didn't fit?
+	gboolean	_needfull;			///< Next report must be a full one
+	gint64		_lastfull;			///< When we last sent a full report (monotonic)
+	gint64		_lastreport;			///< When we last sent any report (monotonic)
 
 };
 
 #define DEFAULT_ARP_SENDINTERVAL 120	// 2 minutes
+#define ARP_TABLE_INITBITS	10	///< We start with 1024 slots - and double when 3/4 full
+#define DEFAULT_ARP_MAXENTRIES	65536	///< Default CONFIGNAME_ARPMAXENTRIES - enough for a /16
+#define DEFAULT_ARP_EXPIRE	3600	///< Default CONFIGNAME_ARPEXPIRE (seconds)
+#define DEFAULT_ARP_RESYNC	(6*3600)///< Default CONFIGNAME_ARPRESYNC (seconds)
 
 WINEXPORT ArpDiscovery* arpdiscovery_new(ConfigContext*, gint, GMainContext*,
 					       NetGSource*, ConfigContext*, gsize);
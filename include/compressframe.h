@@ -50,6 +50,8 @@ struct _CompressFrame {
 WINEXPORT CompressFrame* compressframe_new(guint16 frame_type, guint16 compression_method);
 WINEXPORT CompressFrame* compressframe_new_string(guint16 frame_type, const char* compression_name);
 WINEXPORT Frame* compressframe_tlvconstructor(gpointer, gconstpointer, gpointer*,gpointer*);
+WINEXPORT gsize compressframe_compressed_size(CompressFrame*, gconstpointer pkt, gsize pktlen, gsize offset
+,			gsize maxout);
 
 ///@}
 
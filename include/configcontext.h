@@ -104,7 +104,9 @@ struct _ConfigContext {
 };
 WINEXPORT ConfigContext*	configcontext_new(gsize objsize); // ConfigContext constructor
 WINEXPORT ConfigContext*	configcontext_new_JSON_string(const char * jsontext);// Constructor
+WINEXPORT ConfigContext*	configcontext_new_JSON_string_raw(const char * jsontext);// No NetAddrs
 WINEXPORT char * configcontext_elem_toString(ConfigValue* val);
+WINEXPORT char * configcontext_diff(const ConfigContext* oldcfg, const ConfigContext* newcfg);
 
 #define	CONFIG_DEFAULT_DEADTIME	30		///< Default "deadtime"
 #define	CONFIG_DEFAULT_HBTIME	3		///< Default heartbeat interval
@@ -133,6 +135,31 @@ WINEXPORT char * configcontext_elem_toString(ConfigValue* val);
 #define CONFIGNAME_COMPRESS	"compress"	///< Frame to use for compressing/decompressing
 #define CONFIGNAME_CPRS_THRESH	"compression_threshold"	///< Threshold for compressing (integer)
 #define CONFIGNAME_COMPRESSTYPE	"compression_method"	///< Compression method (string)
+#define CONFIGNAME_MARSHALTHREADS "marshal_threads"	///< Threads for (un)marshalling large packets (integer)
+#define CONFIGNAME_MARSHALTHRESH "marshal_threshold"	///< Packet size to use those threads for (integer)
+#define CONFIGNAME_AEADSIGN	"aead_signatures"	///< Skip digests on encrypted packets (boolean)
+#define CONFIGNAME_HBJITTER	"hbjitter"	///< Fraction to randomly vary heartbeat intervals by (float)
+#define CONFIGNAME_PHIWARN	"phiwarn"	///< Phi-accrual suspicion level to warn at (float)
+#define CONFIGNAME_PHIDEAD	"phidead"	///< Phi-accrual suspicion level to declare death at (float)
+#define CONFIGNAME_HBSTATS	"hbstats_interval"	///< Seconds between logging heartbeat histograms
+							///< (integer - 0 for never)
+#define CONFIGNAME_ARPEXPIRE	"arp_expire"	///< Seconds before forgetting a silent ARP entry (integer)
+#define CONFIGNAME_ARPRESYNC	"arp_resync"	///< Seconds between full ARP reports (integer)
+#define CONFIGNAME_ARPMAXENTRIES "arp_maxentries"	///< Most IP addresses to track via ARP (integer)
+#define CONFIGNAME_PCAPBUFSIZE	"pcap_bufsize"	///< Kernel packet capture buffer (ring) size (integer)
+#define CONFIGNAME_PCAPSNAPLEN	"pcap_snaplen"	///< Bytes of each captured packet to keep (integer)
+#define CONFIGNAME_SWMINREPORT	"swminreport"	///< Least seconds between switch discovery changes (integer)
+#define CONFIGNAME_SWKEEPALIVE	"swkeepalive"	///< Seconds between unchanged switch discovery keepalives (integer)
+#define CONFIGNAME_SWJSON	"swjson"	///< Decode switch discovery packets into JSON locally (boolean)
+#define CONFIGNAME_JSONDELTA	"jsondelta"	///< CMA accepts JSON patches for discovery data (boolean)
+#define CONFIGNAME_DISCMAXRUN	"discmaxrun"	///< Most discovery agents to run at once (integer)
+#define CONFIGNAME_DISCJITTER	"discjitter"	///< Fraction to randomly vary discovery intervals by (float)
+#define CONFIGNAME_DISCMAXLOAD	"discmaxload"	///< Load average per CPU to postpone discovery at (float)
+#define CONFIGNAME_DISCMAXOUTQ	"discmaxoutq"	///< Queued reliable output to postpone discovery at (integer)
+#define CONFIGNAME_NATIVEDISC	"nativediscovery"	///< Use in-process versions of discovery agents (boolean)
+#define CONFIGNAME_DISCDEBOUNCE	"discdebounce"	///< Seconds to wait before rerunning triggered discovery (integer)
+#define CONFIGNAME_DISCSTRETCH	"discstretch"	///< Multiplier for intervals of event-driven discovery (integer)
+#define CONFIGNAME_TRIGGERS	"triggers"	///< Events which trigger a discovery instance (array parameter)
 
 /// Default values for some (integer) configuration values
 #define	CONFIGINTDEFAULTS {					\
@@ -49,6 +49,7 @@ struct _CryptCurve25519 {
 	CryptFramePublicKey*	public_key;	///< Pointer to associated public key
 	CryptFramePrivateKey*	private_key;	///< Pointer to private key
 	gboolean		forsending;	///< TRUE if this is for sending, FALSE for receiving
+	guint8*			_shared_key;	///< Precomputed (crypto_box_beforenm) key for sending
 };
 
 #define	MAXCRYPTNAMELENGTH	64
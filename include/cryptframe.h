@@ -60,6 +60,8 @@ CryptFrame* cryptframe_new(guint16 frame_type, const char *sender_key_id, const
 ,	gsize framesize);
 WINEXPORT Frame* cryptframe_tlvconstructor(gpointer tlvstart, gconstpointer pktend, gpointer*,gpointer*);
 
+#define	CRYPTFRAME_CACHE_MAX	1024	///< Default limit on cached per-destination CryptFrames
+
 WINEXPORT CryptFramePublicKey*  cryptframe_public_key_by_id(const char* key_id);
 WINEXPORT CryptFramePrivateKey* cryptframe_private_key_by_id(const char* key_id);
 WINEXPORT CryptFramePublicKey*  cryptframe_publickey_new (const char *key_id, gpointer public_key);
@@ -71,8 +73,13 @@ WINEXPORT const char*		cryptframe_whois_public_key(const CryptFramePublicKey* pu
 WINEXPORT const char*		cryptframe_whois_key_id(const char * key_id);
 WINEXPORT GHashTable*		cryptframe_key_ids_for(const char* identity);
 WINEXPORT GList*		cryptframe_get_identities(void);	// List of String values
-WINEXPORT GList*		cryptframe_get_key_ids(void);		// List of String values
+WINEXPORT GList*		cryptframe_get_key_ids(void);		// List of String copies - g_free them
+WINEXPORT void			cryptframe_set_key_loader(CryptFramePublicKey* (*loader)(const char *)
+,							  GList* (*lister)(void));
+WINEXPORT gsize			cryptframe_key_memory(guint* public_key_count);
 WINEXPORT void			cryptframe_shutdown(void);
+WINEXPORT void			cryptframe_lock_keys(void);
+WINEXPORT void			cryptframe_unlock_keys(void);
 WINEXPORT void			cryptframe_set_signing_key_id(const char * key_id);
 WINEXPORT const char *		cryptframe_get_signing_key_id(void);
 WINEXPORT CryptFramePrivateKey*	cryptframe_get_signing_key(void);
@@ -80,6 +87,8 @@ WINEXPORT void cryptframe_set_dest_public_key(NetAddr*, CryptFramePublicKey*);
 WINEXPORT gboolean cryptframe_set_dest_key_id(NetAddr*, const char * key_id);
 WINEXPORT const char * cryptframe_get_dest_key_id(const NetAddr*);
 WINEXPORT CryptFrame*		cryptframe_new_by_destaddr(const NetAddr* destination_address);
+WINEXPORT void			cryptframe_set_cache_limit(guint maxentries);
+WINEXPORT guint64		cryptframe_key_generation(void);
 WINEXPORT void			cryptframe_set_encryption_method(CryptFrame*(*)
 					(const char* sender_key_id, const char * receiver_key_id, gboolean forsending));
 ///@}
@@ -42,6 +42,15 @@
 ///@{
 /// @ingroup DiscoveryClass
 
+#define	DISCOVERY_DEFAULT_MAXRUN	2	///< Default limit on discovery agents running at once
+#define	DISCOVERY_DEFAULT_JITTER	0.10	///< Default fraction to randomly vary discovery intervals by
+#define	DISCOVERY_DEFAULT_MAXLOAD	2.0	///< Default load average (per CPU) to back off at
+#define	DISCOVERY_DEFAULT_MAXOUTQ	20	///< Default reliable output queue length to back off at
+#define	DISCOVERY_BACKOFF_MIN		5	///< Initial backoff delay (seconds)
+#define	DISCOVERY_BACKOFF_MAX		300	///< Longest backoff delay (seconds)
+#define	DISCOVERY_DEFAULT_DEBOUNCE	5	///< Default delay (seconds) before a triggered rerun
+#define	DISCOVERY_DEFAULT_STRETCH	4	///< Default interval multiplier for event-driven discovery
+
 typedef struct _Discovery Discovery;
 /// @ref DiscoveryClass abstract C-class - it supports discovering "things" through subclasses for different kinds of things.
 struct _Discovery {
@@ -56,12 +65,25 @@ struct _Discovery {
 					///< anything new upstream.
 	guint64		discovercount;	///< How many times have we discovered
 					///< something.
-	char*		_instancename;	///< Timer id for repeating discovery
-	guint		_timerid;	///< Timer id for repeating discovery
+	char*		_instancename;	///< Our instance name
+	gint64		_nextdue;	///< When we're next due to run (monotonic clock, uS)
+	gint		_heapindex;	///< Our index in the scheduler's heap (-1 if not scheduled)
+	gboolean	_inprogress;	///< TRUE while an asynchronous discover() is still running
+					///< (set by subclasses - see discovery_complete())
+	gboolean	_phased;	///< TRUE once we've picked our random phase offset
+	gboolean	_triggered;	///< TRUE when an event has asked us to rerun
+	gboolean	_eventdriven;	///< TRUE if events trigger us (see discoverytrigger.h)
 	NetGSource*	_iosource;	///< How to send packets
 	ConfigContext*	_config;	///< Configuration Parameters -
 					///< has address of CMA.
 	gboolean	_sentyet;	///< TRUE if we've sent this yet.
+	gboolean	_sendfull;	///< TRUE if the CMA wants everything next time
+	guint64		_jsonversion;	///< Version of the last JSON we sent
+	gchar*		_lastdigest;	///< SHA256 digest of the last JSON we sent
+	gsize		_lastlen;	///< Length of the last JSON we sent
+	gboolean	keepjson;	///< Keep the text of our last JSON in _config
+					///< (under our instance name) for others to use.
+					///< Being busy doesn't postpone these.
 	guint64		starttime;	///< When this operation was started
 };
 
@@ -69,6 +91,9 @@ WINEXPORT Discovery* discovery_new(const char *,NetGSource*, ConfigContext*, gsi
 WINEXPORT void discovery_register(Discovery* self);
 WINEXPORT void discovery_unregister_all(void);
 WINEXPORT void discovery_unregister(const char *);
+WINEXPORT void discovery_sendfull(const char * instance);
+WINEXPORT void discovery_complete(Discovery* self);
+WINEXPORT void discovery_trigger(Discovery* self);
 #ifdef DISCOVERY_SUBCLASS
 WINEXPORT void		_discovery_finalize(AssimObj* self);
 #endif
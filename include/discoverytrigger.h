@@ -0,0 +1,47 @@
+/**
+ * @file
+ * @brief Kernel events which trigger rerunning discovery.
+ * @details A @ref Discovery object can subscribe to kernel events which mean that what it
+ * discovers has (probably) changed.  When one happens, we ask the discovery scheduler to rerun it
+ * soon - see discovery_trigger().
+ * A trigger is one of these strings:
+ * - "netlink:link"	network interfaces appearing, disappearing or changing state
+ * - "netlink:addr"	IP addresses being added or removed
+ * - "netlink:route"	routes being added or removed
+ * - "netlink"		any of the above
+ * - an absolute pathname - a file or directory being changed, created, replaced or removed.
+ *   For directories, any change to anything directly in the directory counts.
+ *
+ * Triggers are only supported on Linux (rtnetlink and inotify).
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef _DISCOVERYTRIGGER_H
+#define _DISCOVERYTRIGGER_H
+#include <projectcommon.h>
+#include <discovery.h>
+///@{
+/// @ingroup DiscoveryClass
+
+WINEXPORT gboolean	discoverytrigger_subscribe(Discovery* discovery, const char * trigger);
+WINEXPORT void		discoverytrigger_unsubscribe(Discovery* discovery);
+WINEXPORT void		discoverytrigger_shutdown(void);
+
+///@}
+#endif /* _DISCOVERYTRIGGER_H */
@@ -52,6 +52,7 @@ struct _FrameSet {
 	guint16		fstype;		///< Type of frameset.
 	guint16		fsflags;	///< Flags for frameset.
 	SeqnoFrame*	_seqframe;	///< sequence number for this frameset
+	gint64		arrivaltime;	///< When its packet arrived (monotonic clock) - 0 if not received
 	SeqnoFrame*	(*getseqno)(FrameSet*);	///< Return the sequence number for this frameset (if any)
 };
 #define	FRAMESET_INITSIZE	(GENERICTLV_HDRSZ+sizeof(guint16))
@@ -12,6 +12,10 @@
  *
  * In addition, we manage the initiation and termination of communication to endpoints.
  *
+ * FrameSets too large to fit into a single packet are split into a series of
+ * FRAMESETTYPE_FRAGMENT FrameSets which are sent (and ACKed and retransmitted) individually,
+ * and are reassembled on the far end before being given to our client.
+ *
  * This class is related to @ref FsQueue and @ref FrameSet objects.
  *
  * @author Copyright &copy; 2012 - Alan Robertson <alanr@unix.sh>
@@ -89,6 +93,10 @@ struct _FsProtoElem {
 	gboolean	shutdown_complete;//< TRUE if the shutdown we asked for completed
 	gboolean	is_encrypted;	///< TRUE if this channel is encrypted
 	char*		peer_identity;	///< Identity of the far end...
+	guint8*		fragbuf;	///< Buffer we're reassembling a fragmented FrameSet into
+	guint32		fragtotal;	///< Size of the FrameSet being reassembled
+	guint32		fragrecvd;	///< How much of it we've received so far
+	gint64		fragdeadline;	///< When to give up on reassembling it
 	int		hist_next;	///< current index into history circular queue
 	FsProtoState	fsa_states[FSPE_HISTSIZE];	///< history of FSA inputs
 	guint8		fsa_inputs[FSPE_HISTSIZE];	///< history of FSA inputs
@@ -114,6 +122,13 @@ struct _FsProtocol {
 	gint64		rexmit_interval;				///< How often to retransmit - in uS
 	gint64		acktimeout;					///< ACK timeout interval
 	guint		_timersrc;					///< gmainloop timer source id
+	GList*		reassembling;					///< FsProtoElems reassembling FrameSets
+	gsize		fragthreshold;					///< Always fragment FrameSets larger than this
+	gsize		maxpktsize;					///< Fragment FrameSets that won't compress this small
+	gsize		fragsize;					///< Data bytes in each fragment
+	gsize		fragmemlimit;					///< Memory limit for all reassembly
+	gsize		fragmemused;					///< Memory used for reassembly
+	gint64		fragtimeout;					///< Reassembly timeout interval
 	FsProtoElem*	(*find)(FsProtocol*,guint16,const NetAddr*);	///< Find connection to given endpoint
 	FsProtoElem*	(*findbypkt)(FsProtocol*, NetAddr*, FrameSet*);	///< Find connection to given originator
 	FsProtoElem*	(*addconn)(FsProtocol*, guint16, NetAddr*);	///< Add a connection to the given endpoint
@@ -121,6 +136,7 @@ struct _FsProtocol {
 	FsProtoState	(*connstate)(FsProtocol*, guint16,const NetAddr*);///< Return the state of this connection
 	gboolean	(*iready)(FsProtocol*);				///< TRUE if input is ready to be read
 	gboolean	(*outputpending)(FsProtocol*);			///< Return TRUE if output is pending
+	guint		(*outputqlen)(FsProtocol*);			///< How many FrameSets are queued for output?
 	FrameSet*	(*read)(FsProtocol*, NetAddr**);		///< Read the next @ref FrameSet
 	void		(*receive)(FsProtocol*, NetAddr*, FrameSet*);	///< Enqueue a received input @ref FrameSet
 	gboolean	(*send1)(FsProtocol*, FrameSet*, guint16, NetAddr*);///< Send one @ref FrameSet
@@ -135,6 +151,15 @@ WINEXPORT FsProtocol* fsprotocol_new(guint objsize, NetIO* ioobj, guint rexmit_t
 #define FSPROTO_WINDOWSIZE	2				///< FsProtocol window size
 #define FSPROTO_REXMITINTERVAL	(2000000)			///< FsProtocol rexmit interval in uS = 2 secs
 #define FSPROTO_ACKTIMEOUTINT	(60*FSPROTO_REXMITINTERVAL)	///< ACK timeout interval (2 minutes)
+#define FSPROTO_FRAGTHRESHOLD	(256*1024)			///< Always fragment FrameSets bigger than this
+#define FSPROTO_MAXPKTSIZE	(63*1024)			///< Largest compressed packet we send whole
+									///< (leaves room for encryption)
+#define FSPROTO_CMPSAMPLE	(16*1024)			///< Bytes we compress to guess how well
+									///< a whole FrameSet will compress
+#define FSPROTO_CMPMARGIN	75				///< Percent of maxpktsize that guess must fit in
+#define FSPROTO_FRAGSIZE	60000				///< Data bytes per fragment - fits in one packet
+#define FSPROTO_FRAGMEMLIMIT	(64*1024*1024)			///< Reassembly memory limit (64M)
+#define FSPROTO_FRAGTIMEOUT	FSPROTO_ACKTIMEOUTINT		///< Reassembly timeout interval
 
 ///@}
 
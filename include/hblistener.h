@@ -3,6 +3,12 @@
  * @brief Defines Heartbeat Listener interfaces
  * @details This file defines interfaces for the Heartbeat Listener class.  It listens for
  * heartbeats from designated senders - allowing them to be added and dropped at run time.
+ * By default a peer is late (or dead) when a fixed warntime (or deadtime) passes without
+ * a heartbeat.  Alternatively, each HbListener can be a phi-accrual failure detector:
+ * it keeps statistics on the times between a peer's heartbeats, and from them computes
+ * how suspicious (phi) a given silence is - so it adapts to how noisy the network is.
+ * Phi is -log10 of the probability of a heartbeat arriving this late - so a phi of 8
+ * means we would expect to be wrong about one time in 10^8.
  *
  *
  * This file is part of the Assimilation Project.
@@ -31,6 +37,8 @@
 #include <listener.h>
 typedef struct _HbListener HbListener;
 
+#define	HBLISTENER_HISTBUCKETS	16	///< [0,1ms), [1,2ms), [2,4ms) ... [2^14ms, forever)
+
 typedef enum {
 	HbPacketsBeingReceived = 1,
 	HbPacketsTimedOut = 2,
@@ -47,28 +55,54 @@ struct _HbListener {
 	void		(*set_deadtime)(HbListener*, guint64);	///< Set deadtime
 	guint64		(*get_warntime)(HbListener*);	///< Retrieve warntime
 	void		(*set_warntime)(HbListener*, guint64);	///< Set warntime
+	void		(*set_deadtime_usec)(HbListener*, guint64);	///< Set deadtime (microseconds)
+	void		(*set_warntime_usec)(HbListener*, guint64);	///< Set warntime (microseconds)
 	void		(*set_heartbeat_callback)(HbListener*, void (*)(HbListener* who));
 	void		(*set_deadtime_callback)(HbListener*, void (*)(HbListener* who));
 	void		(*set_warntime_callback)(HbListener*, void (*)(HbListener* who,  guint64 howlate));
 	void		(*set_comealive_callback)(HbListener*, void (*)(HbListener* who, guint64 howlate));
+	void		(*set_phi_thresholds)(HbListener*, double warnphi, double deadphi);
+							///< Use phi-accrual detection (deadphi <= 0 to stop)
+	double		(*get_phi)(HbListener*, guint64 now);	///< Suspicion level at 'now'
+	void		(*arrived)(HbListener*, guint64 now);	///< Process a heartbeat arriving at
+								///< 'now' (monotonic) - for simulations
 	void		(*_heartbeat_callback)(HbListener* who);
 	void		(*_deadtime_callback)(HbListener* who);
 	void		(*_warntime_callback)(HbListener* who, guint64 howlate);
 	void		(*_comealive_callback)(HbListener* who, guint64 howlate);
 	guint64		_expected_interval;		///< How often to expect heartbeats
 	guint64		_warn_interval;			///< When to warn about late heartbeats
-	guint64		nexttime;			///< When next heartbeat is due
-	guint64		warntime;			///< Warn heartbeat time
+	guint64		nexttime;			///< When next heartbeat is due (monotonic clock)
+	guint64		warntime;			///< Warn heartbeat time (monotonic clock)
 	NetAddr*	listenaddr;			///< What address are we listening for?
 	HbNodeStatus	status;				///< What status is this node in?
+	gint		_heapindex;			///< Our index in the deadline heap (-1 if not there)
+	double		_phiwarn;			///< Warn at this suspicion level (phi mode)
+	double		_phidead;			///< Dead at this suspicion level (0 if fixed deadtime)
+	guint64		_lastarrival;			///< When the last heartbeat arrived (monotonic clock)
+	double*		_intervals;			///< Recent times between heartbeats (phi mode)
+	guint		_nintervals;			///< How many _intervals are filled in
+	guint		_nextinterval;			///< Where the next interval goes in _intervals
+	double		_intervalsum;			///< Sum of _intervals
+	double		_intervalsumsq;			///< Sum of squares of _intervals
+	guint64		_lastinterval;			///< Previous time between heartbeats
+	guint32		_jitterhist[HBLISTENER_HISTBUCKETS];	///< Change in interval - log2(ms)
+	guint32		_latehist[HBLISTENER_HISTBUCKETS];	///< Kernel arrival to our
+								///< processing it - log2(ms)
 };
 #define	DEFAULT_DEADTIME	60 // seconds
+#define	HBLISTENER_PHI_WINDOW	100	///< How many heartbeat intervals phi mode remembers
+#define	HBLISTENER_PHI_MINSAMPLES 5	///< We use our fixed deadtime until we have this many
+#define	HBLISTENER_PHI_MINSTDDEV 0.1	///< Least standard deviation we believe (fraction of mean)
 
 WINEXPORT HbListener*	hblistener_new(NetAddr*, ConfigContext* config, gsize hblisten_objsize);
 WINEXPORT void 		hblistener_unlisten(NetAddr* unlistenaddr);
 WINEXPORT void		hblistener_set_martian_callback(void (*)(NetAddr* who));
 WINEXPORT HbListener*	hblistener_find_by_address(const NetAddr* which);
 WINEXPORT void		hblistener_shutdown(void);
+WINEXPORT void		hblistener_dump_histograms(void);
+WINEXPORT char *		hblistener_histograms_string(HbListener* self);
+WINEXPORT guint		hblistener_hist_percentile(const guint32* hist, double fraction);
 ///@}
 
 #endif /* _HBLISTENER_H */
@@ -29,6 +29,10 @@
 #include <netaddr.h>
 #include <netio.h>
 #include <netgsource.h>
+#include <frameset.h>
+#include <signframe.h>
+#include <cryptframe.h>
+#include <compressframe.h>
 typedef struct _HbSender HbSender;
 
 ///@{
@@ -44,13 +48,20 @@ struct _HbSender {
 	NetGSource*	_outmethod;			///< How to send out heartbeats
 	NetAddr*	_sendaddr;			///< What address are we sending to?
 	int		_refcount;			///< Current reference count
-	guint		timeout_source;			///< timeout source id
+	guint64		nexttime;			///< When our next heartbeat is due (monotonic clock)
+	gint		_heapindex;			///< Our index in the heap of due times (-1 if none)
+	FrameSet*	_heartbeat;			///< Our heartbeat - with its packet already built
+	SignFrame*	_hbsignframe;			///< SignFrame _heartbeat's packet was built with
+	CompressFrame*	_hbcompressframe;		///< CompressFrame it was built with (or NULL)
+	guint64		_hbkeygen;			///< cryptframe_key_generation() it was built in
 };
 #define	DEFAULT_DEADTIME	60 // seconds
+#define	HBSENDER_DEFAULT_JITTER	0.05	///< Default fraction to randomly vary heartbeat intervals by
 
 WINEXPORT HbSender* hbsender_new(NetAddr*, NetGSource*, guint interval, gsize hblisten_objsize);
 WINEXPORT void hbsender_stopsend(NetAddr* unlistenaddr);
 WINEXPORT void hbsender_stopallsenders(void);
+WINEXPORT void hbsender_set_jitter(double jitter);
 
 ///@}
 
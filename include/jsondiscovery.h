@@ -27,6 +27,7 @@
 #include <projectcommon.h>
 #include <discovery.h>
 #include <childprocess.h>
+#include <nativediscovery.h>
 ///@{
 /// @ingroup DiscoveryClass
 
@@ -42,6 +43,10 @@ struct _JsonDiscovery {
 	ChildProcess*	child;		///< Our current child process...
 	guint		_intervalsecs;	///< How often to run this discovery method?
 	ConfigContext*	jsonparams;	///< Parameters to the resource agent.
+	NativeDiscoveryFunc _native;	///< In-process version of our agent (or NULL)
+	gchar**		_nativeenv;	///< Environment for our running native discovery
+	GString*	_nativeout;	///< Output from our running native discovery
+	gboolean	_nativeok;	///< Did our native discovery succeed?
 	const char *	(*fullpath)(JsonDiscovery*);///< Return full pathname of agent
 };
 WINEXPORT JsonDiscovery* jsondiscovery_new(const char * discoverytype,
@@ -0,0 +1,85 @@
+/**
+ * @file
+ * @brief Implements the MarshalPool object
+ * @details @ref MarshalPool objects move the expensive part of turning @ref FrameSet objects
+ * into packets (and back again) off the main loop thread.
+ * Signing, encrypting and compressing (or verifying, decrypting and decompressing)
+ * a large @ref FrameSet can take tens of milliseconds - long enough to delay heartbeats.
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef _MARSHALPOOL_H
+#define _MARSHALPOOL_H
+#include <projectcommon.h>
+#include <assimobj.h>
+#include <glib.h>
+#include <netaddr.h>
+#include <frameset.h>
+#include <signframe.h>
+#include <cryptframe.h>
+#include <compressframe.h>
+#include <packetdecoder.h>
+
+///@{
+/// @ingroup MarshalPool
+typedef struct _MarshalPool MarshalPool;
+
+/// Function called (from the main loop) to send a @ref FrameSet whose packet has been built for us
+typedef void (*MarshalPoolSendFunc)(gpointer owner, FrameSet* fs, const NetAddr* dest);
+
+/// This is the @ref MarshalPool object - a set of worker threads for marshalling and
+/// unmarshalling large @ref FrameSet "FrameSet"s.
+/// Work for a given peer is done strictly one item at a time, in the order it was handed to us,
+/// and the results are handed back to the main loop in that same order.
+/// Small work items for idle peers are refused, so our caller can do them inline as before.
+/// It is a subclass of the @ref AssimObj, and is managed by our @ref ProjectClass system.
+struct _MarshalPool {
+	AssimObj	baseclass;		///< base @ref AssimObj object
+	gsize		threshold;		///< Work items at least this large go to our threads
+	guint64		marshalcount;		///< How many FrameSets have we marshalled?
+	guint64		unmarshalcount;		///< How many packets have we unmarshalled?
+	GThreadPool*	_threads;		///< Our worker threads
+	GMainContext*	_context;		///< Context to deliver our results in
+	GMutex*		_lock;			///< Protects _done and _doneid
+	GQueue*		_done;			///< Finished work (in completion order)
+	guint		_doneid;		///< Source id of idle source that delivers _done
+	GHashTable*	_sendpeers;		///< Destination NetAddr => GQueue of pending work
+	GHashTable*	_recvpeers;		///< Source NetAddr => GQueue of pending work
+	GQueue*		_received;		///< Finished unmarshalling results - ready to read
+	PacketDecoder*	_decoder;		///< Decodes packets into FrameSets
+	gpointer	_owner;			///< Who to pass to _sendfunc
+	MarshalPoolSendFunc _sendfunc;		///< Sends the packets we've built
+	gboolean	(*marshal)		///< Build and send a FrameSet's packet - TRUE if we took it
+				(MarshalPool* self, const NetAddr* dest, FrameSet* fs
+			,	SignFrame* signframe, CryptFrame* cryptframe
+			,	CompressFrame* compressframe);
+	gboolean	(*unmarshal)		///< Decode a packet into FrameSets - TRUE if we took it
+				(MarshalPool* self, gpointer pkt, gpointer pktend, NetAddr* srcaddr
+				,	gint64 arrivaltime);
+	gboolean	(*recvready)(const MarshalPool* self);	///< TRUE if unmarshalled results are ready
+	GSList*		(*nextrecv)		///< Return next unmarshalled FrameSet list (or NULL)
+				(MarshalPool* self, NetAddr** srcaddr);
+};
+WINEXPORT MarshalPool* marshalpool_new(gsize objsize, guint nthreads, gsize threshold
+,		PacketDecoder* decoder, MarshalPoolSendFunc sendfunc, gpointer owner
+,		GMainContext* context);
+#define	DEFAULT_MARSHALPOOL_THRESHOLD	(16*1024)	///< Default size to start using our threads
+///@}
+
+#endif /* _MARSHALPOOL_H */
@@ -68,5 +68,6 @@ void (*nanoprobe_comealive_agent)(HbListener*, guint64 howlate);
 extern HbListener* (*nanoprobe_hblistener_new)(NetAddr*, ConfigContext*);
 
 #define	MARTIAN_TIMEOUT	10
+#define	DEFAULT_HBSTATS_INTERVAL	3600	///< Seconds between logging our heartbeat histograms
 
 #endif /* _NANOPROBE_H */
@@ -0,0 +1,60 @@
+/**
+ * @file
+ * @brief Discovery types implemented as C functions inside the nanoprobe.
+ * @details Native discovery functions produce the same JSON their discovery agents would -
+ * without forking a shell and its helper processes every time they run.
+ * They are either built in, or loaded from plugins (shared objects) at startup.
+ * @ref JsonDiscovery uses a native function instead of running its agent when there is one.
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+
+#ifndef _NATIVEDISCOVERY_H
+#define _NATIVEDISCOVERY_H
+#include <projectcommon.h>
+///@{
+/// @ingroup DiscoveryClass
+
+#define NATIVEDISCOVERYROOT	NATIVEDISCOVERY_DIR	///< Where we look for native discovery plugins
+/// Every native discovery plugin must export a function by this name.
+/// It registers its discovery types by calling nativediscovery_register().
+/// If it returns FALSE, we unload the plugin.
+#define	NATIVEDISCOVERY_PLUGIN_INIT	"nativediscovery_plugin_init"
+
+/// Function implementing one discovery type in-process.
+/// It appends its JSON to 'json' - the same text its discovery agent would write to stdout.
+/// These functions run in a thread of their own, so they must not touch any of our objects.
+/// That's why they get their parameters as an environment - exactly the one their agent would get.
+/// @return FALSE if it can't do this discovery - so its agent has to
+typedef gboolean (*NativeDiscoveryFunc)(GString* json,		///<[out] where to put our JSON
+					const char * source,	///<[in] pathname of the equivalent agent
+					const gchar* const* env);///<[in] environment (parameters) - or NULL
+/// Type of a plugin's NATIVEDISCOVERY_PLUGIN_INIT function
+typedef gboolean (*NativeDiscoveryPluginInit)(void);
+
+WINEXPORT void			nativediscovery_register(const char * discoverytype, NativeDiscoveryFunc func);
+WINEXPORT NativeDiscoveryFunc	nativediscovery_find(const char * discoverytype);
+WINEXPORT guint			nativediscovery_loadplugins(const char * dirname);
+WINEXPORT void			nativediscovery_unregister_all(void);
+
+WINEXPORT gboolean		nativediscovery_cpu(GString*, const char *, const gchar* const*);
+WINEXPORT gboolean		nativediscovery_checksums(GString*, const char *, const gchar* const*);
+WINEXPORT gboolean		nativediscovery_tcp(GString*, const char *, const gchar* const*);
+
+///@}
+#endif /* _NATIVEDISCOVERY_H */
@@ -52,6 +52,7 @@ struct _NetGSource {
 	GDestroyNotify 		_finalize;	///< Function to call when we're destroyed
 	void			(*sendaframeset)(NetGSource*,const NetAddr*, FrameSet*);///< Send a single frameset
 	void			(*sendframesets)(NetGSource*,const NetAddr*, GSList*);  ///< Send a frameset list
+	void			(*sendbatch)(NetGSource*, NetAddr**, FrameSet**, guint);///< Send a frameset to each address
 	void(*addListener)(NetGSource*, guint16, Listener*);///< Register a new listener
 };
 WINEXPORT NetGSource* netgsource_new(NetIO* iosrc, GDestroyNotify notify,
@@ -34,6 +34,7 @@
 #include <compressframe.h>
 #include <configcontext.h>
 #include <packetdecoder.h>
+#include <marshalpool.h>
 
 ///@{
 /// @ingroup NetIO
@@ -65,6 +66,7 @@ struct _NetIO {
 	SignFrame*	_signframe;			///< Signature frame to use in signing FrameSets
 	CompressFrame*	_compressframe;			///< Compression frame to use in compressing FrameSets
 	GHashTable*	aliases;			///< IP address aliases for received packets
+	MarshalPool*	_marshalpool;			///< Threads for large FrameSets (or NULL)
 	double		_rcvloss;			///< private: Receive loss fraction
 	double		_xmitloss;			///< private: Transmit loss fraction
 	gboolean	_shouldlosepkts;		///< private: TRUE to enable packet loss...
@@ -120,6 +122,23 @@ struct _NetIO {
 				 const NetAddr* dest,	///<[in] destination address
 				 GSList* framesets)	///<[in] List of FrameSets to send
 						   ;	// ";" is here to work around a doxygen bug
+	void		(*sendbatch)		///< Send each FrameSet to its own destination - in as
+							///< few system calls as we can manage.
+							///< Packets which are already built
+							///< are sent as they are.
+							///< @pre must have non-NULL _signframe
+				(NetIO* self,		///<[in/out] 'this' object pointer
+				 NetAddr** dests,	///<[in] destination addresses
+				 FrameSet** framesets,	///<[in] FrameSets to send (one per destination)
+				 guint count)		///<[in] number of destinations and FrameSets
+						   ;	// ";" is here to work around a doxygen bug
+	void		(*sendpackets)		///< Send FrameSets whose packets are already built
+							///< (each to its own destination) - as is
+				(NetIO* self,		///<[in/out] 'this' object pointer
+				 NetAddr** dests,	///<[in] destination addresses
+				 FrameSet** framesets,	///<[in] FrameSets to send (one per destination)
+				 guint count)		///<[in] number of destinations and FrameSets
+						   ;	// ";" is here to work around a doxygen bug
 	GSList*		(*recvframesets)	///< Receive a single datagram's framesets
 							///<@return GSList of FrameSets from packet
 				(NetIO*,		///<[in/out] 'this' object
@@ -153,6 +172,9 @@ struct _NetIO {
 	gboolean	(*outputpending)	///< return TRUE if this object has output pending
 				(NetIO* self)		///<[in/out] 'this' object pointer
 						   ;	// ";" is here to work around a doxygen bug
+	guint		(*outputqlen)		///< return how many (reliable) FrameSets are queued for output
+				(NetIO* self)		///<[in/out] 'this' object pointer
+						   ;	// ";" is here to work around a doxygen bug
 	void		(*closeconn)		///< Flush packets in queues to this address
 			      (NetIO* self,	///< 'this' object pointer
 			       guint16 qid,		///< Queue id for this connection
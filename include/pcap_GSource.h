@@ -32,6 +32,16 @@
 #include <frameset.h>
 typedef struct _GSource_pcap	GSource_pcap_t;
 
+/// Function a @ref GSource_pcap_t calls for each packet it reads - return FALSE to stop reading
+typedef gboolean (*GSourcePcapDispatch)
+			    (GSource_pcap_t* gsource,	///<[in] Gsource object causing dispatch
+			     pcap_t* capstruct,		///<[in] Pointer to structure capturing for us
+                             gconstpointer pkt,		///<[in] Pointer to the packet just read in
+                             gconstpointer pend,	///<[in] Pointer to first byte past 'pkt'
+                             const struct pcap_pkthdr* pkthdr, ///<[in] libpcap packet header
+                             const char * capturedev,	///<[in] Device being captured
+			     gpointer userdata);	///<[in/out] user object pointer
+
 /// g_main_loop GSource object for creating events from libpcap (pcap_t) objects
 /// We manage this with our @ref ProjectClass system to help catch errors.
 /// @todo make this fit better into the @ref ProjectClass system.
@@ -43,6 +53,7 @@ struct _GSource_pcap {
 	int		capturefd;	///< Underlying file descriptor
 	char*		capturedev;	///< Capture device name
 	unsigned	listenmask;	///< Protocols selected from @ref pcap_protocols
+	gboolean	replay;		///< TRUE if we're replaying a pcap file instead of capturing
 	gint		gsourceid;	///< Source ID from g_source_attach()
 	gpointer	userdata;	///< Saved user data	
         ///[in] user dispatch function - we call it when a packet is read
@@ -59,6 +70,8 @@ struct _GSource_pcap {
 
 WINEXPORT GSource* g_source_pcap_new(const char * dev,
 		  	   unsigned listenmask,
+			   guint bufsize,
+			   guint snaplen,
         	  	   gboolean (*dispatch)
                             (GSource_pcap_t*	gsource, ///< Gsource object causing dispatch
                              pcap_t* capstruct,		///<[in] Pointer to structure capturing for us
@@ -75,6 +88,10 @@ WINEXPORT GSource* g_source_pcap_new(const char * dev,
 			   gsize objectsize,
 			   gpointer userdata
 			  );
+WINEXPORT GSource* g_source_pcap_replay_new(const char * filename, unsigned listenmask
+,			   GSourcePcapDispatch dispatch, GDestroyNotify notify, gint priority
+,			   GMainContext* context, gsize objectsize, gpointer userdata);
+WINEXPORT gboolean g_source_pcap_getstats(GSource_pcap_t* src, struct pcap_stat* stats);
 WINEXPORT void g_source_pcap_finalize(GSource* src); // Here to work around some Glib bugs/misunderstandings...
 WINEXPORT FrameSet* construct_pcap_frameset(guint16 framesettype, gconstpointer pkt, gconstpointer pktend,
 				  const struct pcap_pkthdr* pkthdr, const char * interfacep);
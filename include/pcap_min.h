@@ -43,5 +43,17 @@
 ///	Enable ARP protocol
 #	define	ENABLE_ARP	0x4 
 /// @}
-WINEXPORT pcap_t* create_pcap_listener(const char * dev, gboolean blocking, unsigned listenmask, struct bpf_program*);
+
+/// Snapshot length for ARP-only captures - ethernet + VLAN tag + ARP packet fits nicely
+#define	PCAP_SNAPLEN_ARP	64
+/// Snapshot length for LLDP and CDP - they need the whole (possibly VLAN tagged) frame
+#define	PCAP_SNAPLEN_FULL	1522
+
+WINEXPORT pcap_t* create_pcap_listener(const char * dev, gboolean blocking, unsigned listenmask
+,			struct bpf_program*, guint bufsize, guint snaplen);
+WINEXPORT pcap_t* create_pcap_replay(const char * filename, unsigned listenmask, struct bpf_program*);
+WINEXPORT gboolean change_pcap_listener(pcap_t*, const char* dev, unsigned oldmask, unsigned newmask
+,			struct bpf_program*);
+WINEXPORT unsigned pcap_packet_protocol(gconstpointer pkt, gconstpointer pend);
+WINEXPORT guint	  pcap_snaplen_for(unsigned listenmask);
 WINEXPORT void	  close_pcap_listener(pcap_t*, const char* dev, unsigned listenmask);
@@ -0,0 +1,48 @@
+/**
+ * @file
+ * @brief Shares one packet capture per interface among all the discovery types that want it
+ * @details
+ * ARP discovery and switch (LLDP/CDP) discovery both capture packets on the same interfaces.
+ * Rather than each opening its own promiscuous capture with its own filter and kernel buffer,
+ * each of them attaches to the one @ref GSource_pcap_t for that interface.  Its filter
+ * is the combination of everything its consumers want, and we hand each packet only
+ * to the consumers that asked for its protocol.
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ */
+#ifndef _PCAP_MUX_H
+#define _PCAP_MUX_H
+#include <projectcommon.h>
+#include <glib.h>
+#include <pcap_GSource.h>
+
+///@{
+/// @ingroup GSource_Pcap
+typedef struct _PcapConsumer	PcapConsumer;
+
+WINEXPORT PcapConsumer*	pcap_mux_attach(const char * dev, unsigned listenmask
+,			guint bufsize, guint snaplen, GSourcePcapDispatch dispatch
+,			gpointer userdata, gint priority, GMainContext* context);
+WINEXPORT void		pcap_mux_detach(PcapConsumer* consumer);
+WINEXPORT GSource_pcap_t* pcap_mux_source(PcapConsumer* consumer);
+WINEXPORT gboolean	pcap_mux_filter(const char * dev, unsigned* listenmask, guint* snaplen);
+WINEXPORT gboolean	pcap_mux_offline(const char * dev);
+WINEXPORT gboolean	pcap_mux_inject(const char * dev, gconstpointer pkt, gconstpointer pend
+,			const struct pcap_pkthdr* pkthdr);
+///@}
+#endif /* _PCAP_MUX_H */
@@ -44,7 +44,9 @@ WINEXPORT void		proj_class_debug_dump(const char * prefix, const AssimObj* obj,
 WINEXPORT void proj_class_dump_live_objects(void);
 WINEXPORT guint32 proj_class_live_object_count(void);
 WINEXPORT guint32 proj_class_max_object_count(void);
+WINEXPORT guint64 proj_class_total_object_count(void);
 WINEXPORT void proj_class_finalize_sys(void);
+WINEXPORT void proj_class_enable_threads(void);
 
 ///@{
 ///@ingroup ProjectClass
@@ -31,6 +31,8 @@
 /// @ingroup SignFrame
 
 #define SIGNTYPE_GLIB	1	//< Glib GCheckSum objects
+#define SIGNTYPE_AEAD	3	///< No digest: authenticated by the encryption frame after us
+#define SIGNTYPE_AEAD_CRYPTFRAME	0	///< The only SIGNTYPE_AEAD subtype
 #ifdef HAVE_SODIUM_H
 #	define SIGNTYPE_SODIUM	2		///< Sodium checksum objects
 #	define SIGNTYPE_SODIUM_SHA512256 1	///< Secret key signature
@@ -55,6 +57,9 @@ WINEXPORT SignFrame* signframe_glib_new(GChecksumType sigtype, gsize framesize);
 WINEXPORT SignFrame* signframe_sodium_new(guint8 sodiumtype, const guint8* key, gsize keylen, gsize framesize);
 #endif
 WINEXPORT SignFrame* signframe_new_default(gsize framesize);
+WINEXPORT SignFrame* signframe_aead_new(gsize framesize);
+WINEXPORT void signframe_set_aead_signatures(gboolean enabled);
+WINEXPORT gboolean signframe_aead_signatures(void);
 WINEXPORT gboolean signframe_setdefault(guint8 majortype, guint8 minortype, const char* keyname, const guint8* signkey, gsize keylen);
 WINEXPORT Frame* signframe_tlvconstructor(gpointer tlvstart, gconstpointer pktend, gpointer*,gpointer*);
 
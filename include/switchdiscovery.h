@@ -25,24 +25,33 @@
 #define _SWITCHDISCOVERY_H
 #include <projectcommon.h>
 #include <discovery.h>
-#include <pcap_GSource.h>
+#include <pcap_mux.h>
 ///@{
 /// @ingroup SwitchDiscovery
 
 typedef struct _SwitchDiscovery SwitchDiscovery;
+#define	SWITCHDISCOVERY_NTYPES	2		/// Protocols we track separately (LLDP and CDP)
 /// @ref SwitchDiscovery C-class - for discovering switch and port configuration via LLDP, CDP and similar protocols captured using <i>libpcap</i>.
 struct _SwitchDiscovery {
 	Discovery	baseclass;			/// Base class object
-	GSource*	source;				/// GSource for the pcap data
+	PcapConsumer*	source;				/// Where our pcap data comes from
 	void		(*finalize)(AssimObj* self);	/// Saved parent class destructor
-	gpointer	switchid;			/// Current switch identification information
-	gssize		switchidlen;			/// Length of 'switchid'
-	gpointer	portid;				/// Current port id information.
-	gssize		portidlen;			/// Length of 'portid'
+	gchar*		digest[SWITCHDISCOVERY_NTYPES];	/// Digest of the meaningful fields we last reported
+	gint64		lastreport[SWITCHDISCOVERY_NTYPES];	/// When we last reported them (monotonic)
+	gint64		lastsent[SWITCHDISCOVERY_NTYPES];	/// When we last sent anything (monotonic)
+	gint64		minreportusecs;			/// Don't report changes more often than this
+	gint64		keepaliveusecs;			/// Send a keepalive if we've been quiet this long
+	guint64		suppresscount;			/// How many packets we didn't need to send
+	guint64		keepalivecount;			/// How many keepalives we've sent
+	gboolean	localdecode;			/// Decode packets into JSON ourselves
 };
+#define	DEFAULT_SWDISCOVERY_MINREPORT	60	/// Default CONFIGNAME_SWMINREPORT (seconds)
+#define	DEFAULT_SWDISCOVERY_KEEPALIVE	1800	/// Default CONFIGNAME_SWKEEPALIVE (seconds)
 
 WINEXPORT SwitchDiscovery* switchdiscovery_new(ConfigContext*swconfig, gint priority
 ,	GMainContext* mcontext, NetGSource*iosrc, ConfigContext* config, gsize objsize);
+WINEXPORT ConfigContext* switchdiscovery_decode_packet(const char * host, const char * interface
+,	gint64 wallclock, gconstpointer pkt, gconstpointer pktend);
 
 ///@}
 
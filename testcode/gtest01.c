@@ -29,8 +29,10 @@
 #ifdef HAVE_UNISTD_H
 #	include <unistd.h>
 #endif
+#include <stdlib.h>
 #include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gmainfd.h>
 #include <logsourcefd.h>
 #include <configcontext.h>
@@ -38,6 +40,28 @@
 #include <resourcecmd.h>
 #include <resourcelsb.h>
 #include <resourcequeue.h>
+#include <marshalpool.h>
+#include <reliableudp.h>
+#include <compressframe.h>
+#include <hblistener.h>
+#include <hbsender.h>
+#include <arpdiscovery.h>
+#include <switchdiscovery.h>
+#include <nanoprobe.h>
+#include <misc.h>
+#include <cstringframe.h>
+#include <frametypes.h>
+#include <framesettypes.h>
+#include <jsondiscovery.h>
+#include <discoverytrigger.h>
+#include <signframe.h>
+#include <cryptcurve25519.h>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
 
 GMainLoop*	mainloop;
 FSTATIC void	test_read_command_output_at_EOF(void);
@@ -61,6 +85,68 @@ FSTATIC void	test_safe_queue_ocfops(void);
 FSTATIC void	expect_ocf_callback(ConfigContext* request, gpointer user_data, enum HowDied reason
 ,		int rc, int signal, gboolean coredump, const char * stringresult);
 FSTATIC void	test_all_freed(void);
+FSTATIC void	marshalpool_test_send(gpointer owner, FrameSet* fs, const NetAddr* dest);
+FSTATIC gboolean marshalpool_test_recvready(gpointer vpool);
+FSTATIC void	test_marshalpool(void);
+FSTATIC GSList*	aeadtest_roundtrip(PacketDecoder* decoder, FrameSet* fs, gboolean tamper);
+FSTATIC void	test_signframe_aead(void);
+FSTATIC gint	keyindex_test_strcmp(gconstpointer a, gconstpointer b);
+FSTATIC void	test_cryptcurve25519_keyindex(void);
+FSTATIC void	test_cryptframe_cache(void);
+FSTATIC gboolean fragment_test_poll(gpointer unused);
+FSTATIC gboolean fragment_test_timeout(gpointer unused);
+FSTATIC void	fragment_test_run(gsize strsize, gboolean incompressible);
+FSTATIC void	test_fsprotocol_fragments(void);
+FSTATIC void	test_fsprotocol_fragments_incompressible(void);
+FSTATIC void	phitest_warn(HbListener* who, guint64 howlate);
+FSTATIC void	test_hblistener_phi(void);
+FSTATIC void	test_hblistener_histograms(void);
+FSTATIC void	deadline_test_dead(HbListener* who);
+FSTATIC gboolean deadline_test_timeout(gpointer unused);
+FSTATIC void	test_hblistener_deadlines(void);
+FSTATIC gboolean hbsender_test_poll(gpointer unused);
+FSTATIC gboolean hbsender_test_idle(gpointer unused);
+FSTATIC void	test_hbsender_scheduler(void);
+FSTATIC FrameSet* hbpkttest_recv(NetIO* io);
+FSTATIC void	test_hbsender_packets(void);
+FSTATIC void	arptest_sendjson(Discovery* self, char* jsonout, gsize jsonlen);
+FSTATIC void	arptest_inject(guint8 iplast, guint8 maclast);
+FSTATIC ConfigContext* arptest_report(ArpDiscovery* arp, const char * discovertype
+,			guint ndata, guint nexpired);
+FSTATIC void	test_arpdiscovery_delta(void);
+FSTATIC gboolean muxtest_dispatch(GSource_pcap_t* gsource, pcap_t* capstruct, gconstpointer pkt
+,			gconstpointer pend, const struct pcap_pkthdr* pkthdr, const char * dev
+,			gpointer userdata);
+FSTATIC gboolean muxtest_inject(guint16 ethertype, gboolean lldp);
+FSTATIC void	test_pcap_mux(void);
+FSTATIC void	swtest_sendjson(Discovery* self, char* jsonout, gsize jsonlen);
+FSTATIC void	swtest_inject(char port, guint8 ttl, char sysname);
+FSTATIC void	test_switchdiscovery_changes(void);
+FSTATIC void	test_configcontext_diff(void);
+FSTATIC gboolean disctest_sendareliablefs(NetIO* self, NetAddr* dest, guint16 queueid
+,			FrameSet* frameset);
+FSTATIC void	test_discovery_digest(void);
+FSTATIC gboolean schedtest_discover(Discovery* self);
+FSTATIC guint	schedtest_outputqlen(NetIO* self);
+FSTATIC void	schedtest_spin(void);
+FSTATIC void	test_discovery_scheduler(void);
+FSTATIC void	test_discovery_backoff(void);
+FSTATIC void	test_nativediscovery_cpu(void);
+FSTATIC void	test_nativediscovery_cpu_malformed(void);
+FSTATIC void	test_nativediscovery_checksums(void);
+#ifdef __linux__
+FSTATIC ConfigContext* tcptest_entry(ConfigContext* report, const char * listenaddr, const char ** name);
+FSTATIC void	tcptest_compare(const char * native, const char * agentout, const char * listenaddr);
+FSTATIC void	test_nativediscovery_tcp(void);
+#endif
+FSTATIC gboolean trigger_test_discover(Discovery* self);
+FSTATIC gboolean trigger_test_timeout(gpointer unused);
+FSTATIC void	test_discoverytrigger_inotify(void);
+#ifdef __linux__
+FSTATIC guint	nltrigger_test_send(void);
+FSTATIC gboolean nltrigger_test_discover(Discovery* self);
+FSTATIC void	test_discoverytrigger_netlink(void);
+#endif
 
 #define	HELLOSTRING	": Hello, world."
 #define	HELLOSTRING_NL	(HELLOSTRING "\n")
@@ -736,6 +822,2080 @@ test_safe_queue_lsbops(void)
 	test_all_freed();
 }
 
+#define	MARSHALTEST_STRSIZE	20000
+static guint8*	marshalled_pkt = NULL;
+static gsize	marshalled_pktlen = 0;
+static guint	marshalled_count = 0;
+
+/// MarshalPool send function - save a copy of the first packet, quit after the second
+FSTATIC void
+marshalpool_test_send(gpointer owner, FrameSet* fs, const NetAddr* dest)
+{
+	(void)owner; (void)dest;
+	++marshalled_count;
+	if (marshalled_count == 1) {
+		marshalled_pktlen = (guint8*)fs->pktend - (guint8*)fs->packet;
+		marshalled_pkt = g_memdup(fs->packet, marshalled_pktlen);
+		// The first one was big - so the second one must wait for it
+		g_assert_cmpint(g_slist_length(fs->framelist), >, 2);
+	}else{
+		g_main_loop_quit(mainloop);
+	}
+}
+
+/// Quit once our MarshalPool has unmarshalled our packet
+FSTATIC gboolean
+marshalpool_test_recvready(gpointer vpool)
+{
+	MarshalPool*	pool = CASTTOCLASS(MarshalPool, vpool);
+	if (pool->recvready(pool)) {
+		g_main_loop_quit(mainloop);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/// Marshal and unmarshal a large FrameSet through a MarshalPool - and make sure the small
+/// FrameSet sent right after it to the same place comes out after it.
+FSTATIC void
+test_marshalpool(void)
+{
+	PacketDecoder*	decoder = packetdecoder_new(0, NULL, 0);
+	SignFrame*	signframe = signframe_glib_new(G_CHECKSUM_SHA256, 0);
+	NetAddr*	dest = netaddr_string_new("127.0.0.1:1984");
+	MarshalPool*	pool;
+	FrameSet*	bigfs = frameset_new(FRAMESETTYPE_HEARTBEAT);
+	FrameSet*	smallfs = frameset_new(FRAMESETTYPE_HEARTBEAT);
+	CstringFrame*	csf = cstringframe_new(FRAMETYPE_HOSTNAME, 0);
+	char*		bigstring = g_malloc(MARSHALTEST_STRSIZE);
+	GSList*		fslist;
+	NetAddr*	srcaddr = NULL;
+	FrameSet*	fs;
+	Frame*		f;
+
+	memset(bigstring, 'x', MARSHALTEST_STRSIZE-1);
+	bigstring[MARSHALTEST_STRSIZE-1] = '\0';
+	csf->baseclass.setvalue(&csf->baseclass, bigstring, MARSHALTEST_STRSIZE
+	,	frame_default_valuefinalize);
+	frameset_append_frame(bigfs, &csf->baseclass);
+	UNREF2(csf);
+	mainloop = g_main_loop_new(g_main_context_default(), TRUE);
+	pool = marshalpool_new(0, 2, 1024, decoder, marshalpool_test_send, NULL, NULL);
+	g_assert(pool != NULL);
+
+	// Small FrameSets to idle peers stay inline
+	g_assert(!pool->marshal(pool, dest, smallfs, signframe, NULL, NULL));
+	g_assert(pool->marshal(pool, dest, bigfs, signframe, NULL, NULL));
+	// But not when the peer has work queued...
+	g_assert(pool->marshal(pool, dest, smallfs, signframe, NULL, NULL));
+	g_main_loop_run(mainloop);
+	g_assert_cmpint(marshalled_count, ==, 2);
+	g_assert_cmpint(pool->marshalcount, ==, 2);
+	// Our originals are left alone
+	g_assert(bigfs->packet == NULL);
+
+	g_assert(pool->unmarshal(pool, marshalled_pkt, marshalled_pkt+marshalled_pktlen, dest
+	,	G_GINT64_CONSTANT(12345)));
+	marshalled_pkt = NULL;
+	g_timeout_add(10, marshalpool_test_recvready, pool);
+	g_main_loop_run(mainloop);
+	fslist = pool->nextrecv(pool, &srcaddr);
+	g_assert(fslist != NULL);
+	g_assert(srcaddr != NULL && srcaddr->equal(srcaddr, dest));
+	g_assert_cmpint(g_slist_length(fslist), ==, 1);
+	fs = CASTTOCLASS(FrameSet, fslist->data);
+	g_assert_cmpint(fs->fstype, ==, FRAMESETTYPE_HEARTBEAT);
+	g_assert_cmpint(fs->arrivaltime, ==, 12345);
+	// Signature, then our string
+	f = CASTTOCLASS(Frame, fs->framelist->next->data);
+	g_assert_cmpint(f->type, ==, FRAMETYPE_HOSTNAME);
+	g_assert_cmpstr(f->value, ==, bigstring);
+	g_slist_free_full(fslist, assim_g_notify_unref);
+	UNREF(srcaddr);
+
+	UNREF(pool);
+	UNREF(bigfs);
+	UNREF(smallfs);
+	UNREF2(signframe);
+	UNREF(decoder);
+	UNREF(dest);
+	g_main_loop_unref(mainloop);
+	mainloop=NULL;
+	test_all_freed();
+}
+
+#define	AEADTEST_SENDER		"gtest01_aead_sender"
+#define	AEADTEST_RECEIVER	"gtest01_aead_receiver"
+#define	AEADTEST_STRING		"AEAD test string"
+
+/// Decode a copy of the packet we constructed for this FrameSet - optionally damaging it first
+FSTATIC GSList*
+aeadtest_roundtrip(PacketDecoder* decoder, FrameSet* fs, gboolean tamper)
+{
+	gsize		pktlen = (guint8*)fs->pktend - (guint8*)fs->packet;
+	guint8*		pkt = g_memdup(fs->packet, pktlen);
+	GSList*		ret;
+
+	if (tamper) {
+		// The last byte is well inside the encrypted part of the packet
+		pkt[pktlen-1] ^= 0x01;
+	}
+	ret = decoder->pktdata_to_framesetlist(decoder, pkt, pkt+pktlen);
+	g_free(pkt);
+	return ret;
+}
+
+/// Make sure we only send SIGNTYPE_AEAD signatures when asked to, that both kinds of
+/// encrypted packets decode, and that damaged or unencrypted AEAD packets are rejected.
+FSTATIC void
+test_signframe_aead(void)
+{
+	PacketDecoder*	decoder = packetdecoder_new(0, NULL, 0);
+	SignFrame*	signframe = signframe_glib_new(G_CHECKSUM_SHA256, 0);
+	SignFrame*	aeadsig = signframe_aead_new(0);
+	FrameSet*	fs = frameset_new(FRAMESETTYPE_HEARTBEAT);
+	CstringFrame*	csf = cstringframe_new(FRAMETYPE_HOSTNAME, 0);
+	CryptFrame*	cryptframe;
+	GSList*		fslist;
+	GSList*		curframe;
+	SignFrame*	sf;
+
+	csf->baseclass.setvalue(&csf->baseclass, g_strdup(AEADTEST_STRING), sizeof(AEADTEST_STRING)
+	,	frame_default_valuefinalize);
+	frameset_append_frame(fs, &csf->baseclass);
+	UNREF2(csf);
+	cryptcurve25519_gen_temp_keypair(AEADTEST_SENDER);
+	cryptcurve25519_gen_temp_keypair(AEADTEST_RECEIVER);
+	cryptframe = cryptcurve25519_new_generic(AEADTEST_SENDER, AEADTEST_RECEIVER, TRUE);
+	g_assert(cryptframe != NULL);
+
+	// Off by default - so we get the old digest, which still decodes
+	g_assert(!signframe_aead_signatures());
+	frameset_construct_packet(fs, signframe, cryptframe, NULL);
+	sf = CASTTOCLASS(SignFrame, fs->framelist->data);
+	g_assert_cmpint(sf->majortype, ==, SIGNTYPE_GLIB);
+	fslist = aeadtest_roundtrip(decoder, fs, FALSE);
+	g_assert_cmpint(g_slist_length(fslist), ==, 1);
+	g_slist_free_full(fslist, assim_g_notify_unref);
+
+	// Turned on: no digest, but the packet still decodes to what we sent
+	signframe_set_aead_signatures(TRUE);
+	frameset_construct_packet(fs, signframe, cryptframe, NULL);
+	sf = CASTTOCLASS(SignFrame, fs->framelist->data);
+	g_assert_cmpint(sf->majortype, ==, SIGNTYPE_AEAD);
+	fslist = aeadtest_roundtrip(decoder, fs, FALSE);
+	g_assert_cmpint(g_slist_length(fslist), ==, 1);
+	sf = CASTTOCLASS(SignFrame, CASTTOCLASS(FrameSet, fslist->data)->framelist->data);
+	g_assert_cmpint(sf->majortype, ==, SIGNTYPE_AEAD);
+	for (curframe = CASTTOCLASS(FrameSet, fslist->data)->framelist; curframe; curframe = curframe->next) {
+		if (CASTTOCLASS(Frame, curframe->data)->type == FRAMETYPE_HOSTNAME) {
+			break;
+		}
+	}
+	g_assert(curframe != NULL);
+	g_assert_cmpstr(CASTTOCLASS(Frame, curframe->data)->value, ==, AEADTEST_STRING);
+	g_slist_free_full(fslist, assim_g_notify_unref);
+
+	// Damage it - the authenticated decryption has to catch it, since there's no digest
+	g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*could not decrypt*");
+	fslist = aeadtest_roundtrip(decoder, fs, TRUE);
+	g_test_assert_expected_messages();
+	g_assert(fslist == NULL);
+
+	// Without encryption we never use AEAD signatures...
+	frameset_construct_packet(fs, signframe, NULL, NULL);
+	sf = CASTTOCLASS(SignFrame, fs->framelist->data);
+	g_assert_cmpint(sf->majortype, ==, SIGNTYPE_GLIB);
+	// ...and we won't accept one that isn't followed by an encryption frame
+	frameset_construct_packet(fs, aeadsig, NULL, NULL);
+	g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*not followed by encryption frame*");
+	fslist = aeadtest_roundtrip(decoder, fs, FALSE);
+	g_test_assert_expected_messages();
+	g_assert(fslist == NULL);
+
+	signframe_set_aead_signatures(FALSE);
+	UNREF(fs);
+	UNREF2(cryptframe);
+	UNREF2(aeadsig);
+	UNREF2(signframe);
+	UNREF(decoder);
+	cryptframe_shutdown();
+	test_all_freed();
+}
+
+#define	KEYINDEXTEST_PREFIX	"gtest01_keyindex_"
+#define	KEYINDEXTEST_TEMPKEY	"gtest01_keyindex_temp"
+
+/// GCompareFunc for finding a key id in a GList
+FSTATIC gint
+keyindex_test_strcmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp((const char *)a, (const char *)b);
+}
+
+/// Make sure indexed public keys are loaded on demand, and that the key ids we're given
+/// outlive the index they came from.
+FSTATIC void
+test_cryptcurve25519_keyindex(void)
+{
+	char *			key_id;
+	CryptFramePublicKey*	pub;
+	gpointer		keybytes;
+	int			keysize;
+	GList*			keyids;
+	GList*			newkeyids;
+	guint			before;
+	guint			after;
+
+	if (g_access(CRYPTKEYDIR, W_OK) != 0) {
+		g_message("Skipping key index test - cannot write %s", CRYPTKEYDIR);
+		return;
+	}
+	key_id = g_strdup_printf(KEYINDEXTEST_PREFIX "%d", (int)getpid());
+	// Borrow a public key from a temporary key pair
+	cryptcurve25519_gen_temp_keypair(KEYINDEXTEST_TEMPKEY);
+	pub = cryptframe_public_key_by_id(KEYINDEXTEST_TEMPKEY);
+	g_assert(pub != NULL);
+	keysize = pub->key_size;
+	keybytes = g_memdup(pub->public_key, keysize);
+	g_assert(cryptcurve25519_save_public_key(key_id, keybytes, keysize));
+
+	// Index it, then forget everything and start over from our index
+	cryptframe_shutdown();
+	cryptcurve25519_cache_all_keypairs();
+	cryptframe_shutdown();
+	cryptcurve25519_cache_all_keypairs();
+
+	keyids = cryptframe_get_key_ids();
+	g_assert(g_list_find_custom(keyids, key_id, keyindex_test_strcmp) != NULL);
+	// Listed - but not loaded until we ask for it
+	(void)cryptframe_key_memory(&before);
+	pub = cryptframe_public_key_by_id(key_id);
+	g_assert(pub != NULL);
+	g_assert_cmpint(pub->key_size, ==, keysize);
+	g_assert(memcmp(pub->public_key, keybytes, keysize) == 0);
+	(void)cryptframe_key_memory(&after);
+	g_assert_cmpint(after, ==, before+1);
+
+	// Purging it and reindexing replaces the index our first list came from
+	g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*has been purged*");
+	g_assert(cryptcurve25519_purge_keypair(key_id));
+	g_test_assert_expected_messages();
+	cryptcurve25519_cache_all_keypairs();
+	newkeyids = cryptframe_get_key_ids();
+	g_assert(g_list_find_custom(newkeyids, key_id, keyindex_test_strcmp) == NULL);
+	g_assert(g_list_find_custom(keyids, key_id, keyindex_test_strcmp) != NULL);
+
+	g_list_free_full(newkeyids, g_free);
+	g_list_free_full(keyids, g_free);
+	g_free(keybytes);
+	g_free(key_id);
+	cryptframe_shutdown();
+	test_all_freed();
+}
+
+#define	CACHETEST_US		"gtest01_cache_us"
+#define	CACHETEST_PEER		"gtest01_cache_peer"
+#define	CACHETEST_NDEST		3
+
+/// Make sure we reuse the CryptFrame we cached for a destination - and that our cache
+/// throws out the least recently used ones when it's full.
+FSTATIC void
+test_cryptframe_cache(void)
+{
+	NetAddr*	dests[CACHETEST_NDEST];
+	CryptFrame*	first;
+	CryptFrame*	again;
+	int		j;
+
+	cryptcurve25519_gen_temp_keypair(CACHETEST_US);
+	cryptcurve25519_gen_temp_keypair(CACHETEST_PEER);
+	cryptframe_set_signing_key_id(CACHETEST_US);
+	cryptframe_set_encryption_method(cryptcurve25519_new_generic);
+	cryptframe_set_cache_limit(CACHETEST_NDEST-1);
+	for (j=0; j < CACHETEST_NDEST; ++j) {
+		char *	addrstr = g_strdup_printf("10.10.10.%d:1984", j+1);
+		dests[j] = netaddr_string_new(addrstr);
+		g_free(addrstr);
+		g_assert(cryptframe_set_dest_key_id(dests[j], CACHETEST_PEER));
+	}
+	first = cryptframe_new_by_destaddr(dests[0]);
+	g_assert(first != NULL);
+	again = cryptframe_new_by_destaddr(dests[0]);
+	g_assert(again == first);
+	UNREF2(again);
+	// Two more destinations push out the least recently used one...
+	for (j=1; j < CACHETEST_NDEST; ++j) {
+		CryptFrame*	frame = cryptframe_new_by_destaddr(dests[j]);
+		g_assert(frame != NULL && frame != first);
+		UNREF2(frame);
+	}
+	// ...so we get a new one for it.  We still hold 'first', so its address can't be reused.
+	again = cryptframe_new_by_destaddr(dests[0]);
+	g_assert(again != NULL && again != first);
+	UNREF2(again);
+	UNREF2(first);
+
+	cryptframe_set_cache_limit(CRYPTFRAME_CACHE_MAX);
+	cryptframe_set_encryption_method(NULL);
+	for (j=0; j < CACHETEST_NDEST; ++j) {
+		UNREF(dests[j]);
+	}
+	cryptframe_shutdown();
+	test_all_freed();
+}
+
+#define	FRAGTEST_STRSIZE	(3*1024*1024)
+#define	FRAGTEST_LOSS		0.05
+static ReliableUDP*	fragtest_sender = NULL;
+static ReliableUDP*	fragtest_receiver = NULL;
+static char*		fragtest_string = NULL;
+static guint		fragtest_received = 0;
+static gboolean		fragtest_timedout = FALSE;
+
+/// Read what our two endpoints have for us - checking what the receiver gets
+FSTATIC gboolean
+fragment_test_poll(gpointer unused)
+{
+	NetIO*	sender = &fragtest_sender->baseclass.baseclass;
+	NetIO*	receiver = &fragtest_receiver->baseclass.baseclass;
+	int	j;
+	(void)unused;
+
+	for (j=0; j < 20; ++j) {
+		NetAddr*	srcaddr = NULL;
+		GSList*		fslist;
+		FrameSet*	fs;
+		GSList*		curframe;
+
+		// The sender only gets ACKs - which FsProtocol consumes
+		fslist = sender->recvframesets(sender, &srcaddr);
+		g_assert(fslist == NULL);
+		fslist = receiver->recvframesets(receiver, &srcaddr);
+		if (NULL == fslist) {
+			continue;
+		}
+		g_assert_cmpint(g_slist_length(fslist), ==, 1);
+		fs = CASTTOCLASS(FrameSet, fslist->data);
+		g_assert_cmpint(fs->fstype, ==, FRAMESETTYPE_JSDISCOVERY);
+		for (curframe=fs->framelist; curframe; curframe=curframe->next) {
+			if (CASTTOCLASS(Frame, curframe->data)->type == FRAMETYPE_JSDISCOVER) {
+				break;
+			}
+		}
+		g_assert(curframe != NULL);
+		// The big one must come first...
+		g_assert_cmpstr(CASTTOCLASS(Frame, curframe->data)->value, ==
+		,	(fragtest_received == 0 ? fragtest_string : "{}"));
+		++fragtest_received;
+		receiver->ackmessage(receiver, srcaddr, fs);
+		g_slist_free_full(fslist, assim_g_notify_unref);
+		UNREF(srcaddr);
+	}
+	if (fragtest_received == 2 && !sender->outputpending(sender)) {
+		g_main_loop_quit(mainloop);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/// Give up if our FrameSets haven't made it across in a reasonable time
+FSTATIC gboolean
+fragment_test_timeout(gpointer unused)
+{
+	(void)unused;
+	fragtest_timedout = TRUE;
+	g_main_loop_quit(mainloop);
+	return FALSE;
+}
+
+/// Send a big FrameSet (followed by a small one) over a lossy loopback link
+/// and make sure they're reassembled correctly - and arrive in order.
+FSTATIC void
+fragment_test_run(gsize strsize, gboolean incompressible)
+{
+	PacketDecoder*	decoder = packetdecoder_new(0, NULL, 0);
+	SignFrame*	signframe = signframe_glib_new(G_CHECKSUM_SHA256, 0);
+	CompressFrame*	compressframe = compressframe_new(FRAMETYPE_COMPRESS, COMPRESS_ZLIB);
+	ConfigContext*	config = configcontext_new(0);
+	NetAddr*	localaddr = netaddr_string_new("127.0.0.1:0");
+	NetAddr*	destaddr;
+	FrameSet*	bigfs = frameset_new(FRAMESETTYPE_JSDISCOVERY);
+	FrameSet*	smallfs = frameset_new(FRAMESETTYPE_JSDISCOVERY);
+	CstringFrame*	csf = cstringframe_new(FRAMETYPE_JSDISCOVER, 0);
+	guint		timeoutid;
+	gsize		j;
+
+	fragtest_received = 0;
+	fragtest_timedout = FALSE;
+	config->setframe(config, CONFIGNAME_OUTSIG, &signframe->baseclass);
+	config->setframe(config, CONFIGNAME_COMPRESS, &compressframe->baseclass);
+	fragtest_sender = reliableudp_new(0, config, decoder, 10000);
+	fragtest_receiver = reliableudp_new(0, config, decoder, 10000);
+	g_assert(fragtest_sender->baseclass.baseclass.bindaddr(&fragtest_sender->baseclass.baseclass
+	,	localaddr, FALSE));
+	g_assert(fragtest_receiver->baseclass.baseclass.bindaddr(&fragtest_receiver->baseclass.baseclass
+	,	localaddr, FALSE));
+	destaddr = fragtest_receiver->baseclass.baseclass.boundaddr(&fragtest_receiver->baseclass.baseclass);
+	g_assert(destaddr != NULL);
+	fragtest_sender->_protocol->rexmit_interval = 20000;
+	fragtest_receiver->_protocol->rexmit_interval = 20000;
+	fragtest_sender->baseclass.baseclass.setpktloss(&fragtest_sender->baseclass.baseclass
+	,	FRAGTEST_LOSS, FRAGTEST_LOSS);
+	fragtest_sender->baseclass.baseclass.enablepktloss(&fragtest_sender->baseclass.baseclass, TRUE);
+	fragtest_receiver->baseclass.baseclass.setpktloss(&fragtest_receiver->baseclass.baseclass
+	,	FRAGTEST_LOSS, FRAGTEST_LOSS);
+	fragtest_receiver->baseclass.baseclass.enablepktloss(&fragtest_receiver->baseclass.baseclass, TRUE);
+
+	fragtest_string = g_malloc(strsize);
+	for (j=0; j < strsize-1; ++j) {
+		fragtest_string[j] = (incompressible
+		?	g_random_int_range(1, 256) : 'a' + g_random_int_range(0, 26));
+	}
+	fragtest_string[strsize-1] = '\0';
+	csf->baseclass.setvalue(&csf->baseclass, g_strdup(fragtest_string), strsize
+	,	frame_default_valuefinalize);
+	frameset_append_frame(bigfs, &csf->baseclass);
+	UNREF2(csf);
+	csf = cstringframe_new(FRAMETYPE_JSDISCOVER, 0);
+	csf->baseclass.setvalue(&csf->baseclass, g_strdup("{}"), 3, frame_default_valuefinalize);
+	frameset_append_frame(smallfs, &csf->baseclass);
+	UNREF2(csf);
+
+	mainloop = g_main_loop_new(g_main_context_default(), TRUE);
+	g_assert(fragtest_sender->baseclass.baseclass.sendareliablefs(&fragtest_sender->baseclass.baseclass
+	,	destaddr, DEFAULT_FSP_QID, bigfs));
+	g_assert(fragtest_sender->baseclass.baseclass.sendareliablefs(&fragtest_sender->baseclass.baseclass
+	,	destaddr, DEFAULT_FSP_QID, smallfs));
+	g_timeout_add(5, fragment_test_poll, NULL);
+	timeoutid = g_timeout_add_seconds(120, fragment_test_timeout, NULL);
+	g_main_loop_run(mainloop);
+	g_assert(!fragtest_timedout);
+	g_source_remove(timeoutid);
+	g_assert_cmpint(fragtest_received, ==, 2);
+	g_assert_cmpint(fragtest_receiver->_protocol->fragmemused, ==, 0);
+
+	UNREF(bigfs);
+	UNREF(smallfs);
+	UNREF(destaddr);
+	UNREF(localaddr);
+	UNREF3(fragtest_sender);
+	UNREF3(fragtest_receiver);
+	UNREF(config);
+	UNREF2(compressframe);
+	UNREF2(signframe);
+	UNREF(decoder);
+	g_free(fragtest_string); fragtest_string = NULL;
+	g_main_loop_unref(mainloop);
+	mainloop=NULL;
+	test_all_freed();
+}
+
+/// Multi-megabyte FrameSets are always fragmented
+FSTATIC void
+test_fsprotocol_fragments(void)
+{
+	fragment_test_run(FRAGTEST_STRSIZE, FALSE);
+}
+
+/// FrameSets under the fragmentation threshold which don't compress into one packet
+/// have to be fragmented too.  (Compressing them would fail with a warning - which is fatal here).
+FSTATIC void
+test_fsprotocol_fragments_incompressible(void)
+{
+	static const gsize	sizes[] = {70*1024, 150*1024, 250*1024};
+	gsize			j;
+
+	for (j=0; j < DIMOF(sizes); ++j) {
+		fragment_test_run(sizes[j], TRUE);
+	}
+}
+
+/// Milliseconds between heartbeats from a peer heartbeating every second over a noisy network
+static const guint	phitest_trace[] = {
+	 969, 1061,  972,  962,  888,  974, 1133, 1050, 1124, 1029,
+	1047, 1022,  800, 1102, 1060, 1059,  797,  790,  893,  943,
+	1036,  994, 1062, 1486,  848,  960,  831,  932, 1124, 1094,
+	1020, 1050,  963,  849,  896,  904,  796,  958,  734, 1058,
+	 941, 1069, 1089, 1188, 1088, 1049,  889, 1564,  920, 1326,
+	1092, 1084, 1003,  931,  966, 1002,  899,  822,  780,  891,
+	 927, 1577,  883,  936, 1154,  756,  825, 1028, 1173, 1069,
+	 772,  697, 1042,  911,  865, 1117, 1132, 1018, 1029, 1052,
+};
+static guint		phitest_warncount = 0;
+
+/// Count the late heartbeats our HbListener tells us about
+FSTATIC void
+phitest_warn(HbListener* who, guint64 howlate)
+{
+	(void)who;
+	(void)howlate;
+	++phitest_warncount;
+}
+
+/// Feed a jittery heartbeat trace to a phi-accrual HbListener.
+/// A one second deadtime would have declared this peer dead 40 times, but phi shouldn't at all.
+/// Once the heartbeats stop, our suspicion should grow, and death be declared within 2 seconds.
+FSTATIC void
+test_hblistener_phi(void)
+{
+	ConfigContext*	config = configcontext_new(0);
+	NetAddr*	addr = netaddr_string_new("10.10.10.5:1984");
+	HbListener*	hb;
+	guint64		now = g_get_monotonic_time();
+	guint		falsedeaths = 0;
+	double		deadphi;
+	guint		j;
+
+	config->setint(config, CONFIGNAME_TIMEOUT, 2);
+	config->setint(config, CONFIGNAME_WARNTIME, 1);
+	hb = hblistener_new(addr, config, 0);
+	hb->set_warntime_callback(hb, phitest_warn);
+	hb->set_phi_thresholds(hb, 3.0, 8.0);
+	hb->arrived(hb, now);
+	for (j=0; j < G_N_ELEMENTS(phitest_trace); ++j) {
+		now += phitest_trace[j]*1000;
+		if (now > hb->nexttime) {
+			++falsedeaths;
+		}
+		hb->arrived(hb, now);
+	}
+	g_assert_cmpint(falsedeaths, ==, 0);
+	g_assert_cmpint(phitest_warncount, <, 10);
+	g_assert_cmpfloat(hb->get_phi(hb, now+500000), <, 1.0);
+	g_assert_cmpfloat(hb->get_phi(hb, now+1500000), <, hb->get_phi(hb, now+1700000));
+	deadphi = hb->get_phi(hb, hb->nexttime);
+	g_assert_cmpfloat(deadphi, >, 7.99);
+	g_assert_cmpfloat(deadphi, <, 8.01);
+	g_assert_cmpint(hb->nexttime - now, <, 2000000);
+
+	hblistener_unlisten(addr);
+	UNREF2(hb);
+	hblistener_shutdown();
+	UNREF(addr);
+	UNREF(config);
+	test_all_freed();
+}
+
+/// Check our histogram percentiles, and that arrivals land in the right jitter buckets.
+FSTATIC void
+test_hblistener_histograms(void)
+{
+	ConfigContext*	config = configcontext_new(0);
+	NetAddr*	addr = netaddr_string_new("10.10.10.6:1984");
+	static const guint	arrivals_ms[] = {1000, 1000, 1003, 1000, 1010, 1000};
+	guint32		hist[HBLISTENER_HISTBUCKETS];
+	HbListener*	hb;
+	guint64		now = g_get_monotonic_time();
+	char*		histstr;
+	guint		j;
+
+	memset(hist, 0, sizeof(hist));
+	g_assert_cmpuint(hblistener_hist_percentile(hist, 0.50), ==, 0);
+	hist[0] = 50;
+	hist[2] = 45;
+	hist[5] = 5;
+	g_assert_cmpuint(hblistener_hist_percentile(hist, 0.50), ==, 1);
+	g_assert_cmpuint(hblistener_hist_percentile(hist, 0.90), ==, 4);
+	g_assert_cmpuint(hblistener_hist_percentile(hist, 0.99), ==, 32);
+	hist[HBLISTENER_HISTBUCKETS-1] = 1000;
+	g_assert_cmpuint(hblistener_hist_percentile(hist, 0.99), ==, G_MAXUINT);
+
+	config->setint(config, CONFIGNAME_TIMEOUT, 30);
+	config->setint(config, CONFIGNAME_WARNTIME, 5);
+	hb = hblistener_new(addr, config, 0);
+	hb->arrived(hb, now);
+	for (j=0; j < G_N_ELEMENTS(arrivals_ms); ++j) {
+		now += arrivals_ms[j]*1000;
+		hb->arrived(hb, now);
+	}
+	// Jitter of 0, 3, 3, 10 and 10 ms
+	histstr = hblistener_histograms_string(hb);
+	g_assert_cmpstr(histstr, ==, "jitter: 0ms:1 2ms:2 8ms:2 (p50<4ms p99<16ms) lateness:");
+	g_free(histstr);
+
+	hblistener_unlisten(addr);
+	UNREF2(hb);
+	hblistener_shutdown();
+	UNREF(addr);
+	UNREF(config);
+	test_all_freed();
+}
+
+#define	DEADLINETEST_COUNT	5
+static const guint	deadlinetest_ms[DEADLINETEST_COUNT] = {500, 100, 300, 200, 400};
+static HbListener*	deadlinetest_listeners[DEADLINETEST_COUNT];
+static guint64		deadlinetest_deathtime[DEADLINETEST_COUNT];
+static guint		deadlinetest_order[DEADLINETEST_COUNT];
+static guint		deadlinetest_deaths = 0;
+
+/// Record when (and in what order) our HbListeners die - quit once all the mortal ones have
+FSTATIC void
+deadline_test_dead(HbListener* who)
+{
+	guint	j;
+	for (j=0; j < DEADLINETEST_COUNT; ++j) {
+		if (deadlinetest_listeners[j] == who) {
+			g_assert_cmpint(deadlinetest_deathtime[j], ==, 0);
+			deadlinetest_deathtime[j] = g_get_monotonic_time();
+			deadlinetest_order[deadlinetest_deaths] = j;
+			++deadlinetest_deaths;
+			break;
+		}
+	}
+	g_assert(j < DEADLINETEST_COUNT);
+	if (deadlinetest_deaths == DEADLINETEST_COUNT-1) {
+		g_main_loop_quit(mainloop);
+	}
+}
+
+/// Give up if our HbListeners don't all die in a reasonable time
+FSTATIC gboolean
+deadline_test_timeout(gpointer unused)
+{
+	(void)unused;
+	g_main_loop_quit(mainloop);
+	return FALSE;
+}
+
+/// Give some HbListeners sub-second deadtimes (in no particular order) and make sure they die
+/// in deadline order - each one on time.  A listener we stop listening to must never die.
+FSTATIC void
+test_hblistener_deadlines(void)
+{
+	ConfigContext*	config = configcontext_new(0);
+	NetAddr*	addrs[DEADLINETEST_COUNT];
+	guint64		start;
+	guint		timeoutid;
+	guint		unlistened = 2;		// The 300ms one
+	guint		j;
+
+	mainloop = g_main_loop_new(g_main_context_default(), TRUE);
+	deadlinetest_deaths = 0;
+	start = g_get_monotonic_time();
+	for (j=0; j < DEADLINETEST_COUNT; ++j) {
+		char *	addrstr = g_strdup_printf("10.10.10.%d:1984", j+1);
+		addrs[j] = netaddr_string_new(addrstr);
+		g_free(addrstr);
+		deadlinetest_listeners[j] = hblistener_new(addrs[j], config, 0);
+		deadlinetest_listeners[j]->set_deadtime_callback(deadlinetest_listeners[j]
+		,	deadline_test_dead);
+		deadlinetest_listeners[j]->set_deadtime_usec(deadlinetest_listeners[j]
+		,	(guint64)deadlinetest_ms[j]*1000);
+		deadlinetest_deathtime[j] = 0;
+	}
+	hblistener_unlisten(addrs[unlistened]);
+	timeoutid = g_timeout_add_seconds(5, deadline_test_timeout, NULL);
+	g_main_loop_run(mainloop);
+	g_source_remove(timeoutid);
+
+	g_assert_cmpint(deadlinetest_deaths, ==, DEADLINETEST_COUNT-1);
+	g_assert_cmpint(deadlinetest_deathtime[unlistened], ==, 0);
+	for (j=0; j+1 < deadlinetest_deaths; ++j) {
+		g_assert_cmpint(deadlinetest_ms[deadlinetest_order[j]], <
+		,	deadlinetest_ms[deadlinetest_order[j+1]]);
+	}
+	for (j=0; j < DEADLINETEST_COUNT; ++j) {
+		if (j == unlistened) {
+			continue;
+		}
+		// Never early - and not much late
+		g_assert_cmpint(deadlinetest_deathtime[j], >=, start + deadlinetest_ms[j]*1000);
+		g_assert_cmpint(deadlinetest_deathtime[j], <, start + (deadlinetest_ms[j]+100)*1000);
+		g_assert(deadlinetest_listeners[j]->status == HbPacketsTimedOut);
+	}
+
+	hblistener_shutdown();
+	for (j=0; j < DEADLINETEST_COUNT; ++j) {
+		UNREF2(deadlinetest_listeners[j]);
+		UNREF(addrs[j]);
+	}
+	UNREF(config);
+	g_main_loop_unref(mainloop);
+	mainloop=NULL;
+	test_all_freed();
+}
+
+#define	HBSENDTEST_COUNT	3
+#define	HBSENDTEST_JITTER	0.2
+#define	HBSENDTEST_MAXBEATS	10
+static NetIOudp*	hbsendtest_receivers[HBSENDTEST_COUNT];
+static guint64		hbsendtest_arrivals[HBSENDTEST_COUNT][HBSENDTEST_MAXBEATS];
+static guint		hbsendtest_nbeats[HBSENDTEST_COUNT];
+static guint64		hbsendtest_start = 0;
+
+/// Note when heartbeats show up at each of our receivers - quit after two and a half seconds
+FSTATIC gboolean
+hbsender_test_poll(gpointer unused)
+{
+	guint64	now = g_get_monotonic_time();
+	guint	j;
+	(void)unused;
+
+	for (j=0; j < HBSENDTEST_COUNT; ++j) {
+		NetIO*		io = &hbsendtest_receivers[j]->baseclass;
+		NetAddr*	srcaddr = NULL;
+		GSList*		fslist;
+		while (NULL != (fslist = io->recvframesets(io, &srcaddr))) {
+			GSList*	fsl;
+			for (fsl = fslist; fsl; fsl = fsl->next) {
+				FrameSet*	fs = CASTTOCLASS(FrameSet, fsl->data);
+				g_assert_cmpint(fs->fstype, ==, FRAMESETTYPE_HEARTBEAT);
+				g_assert_cmpint(hbsendtest_nbeats[j], <, HBSENDTEST_MAXBEATS);
+				hbsendtest_arrivals[j][hbsendtest_nbeats[j]] = now;
+				++hbsendtest_nbeats[j];
+			}
+			g_slist_free_full(fslist, assim_g_notify_unref);
+			UNREF(srcaddr);
+		}
+	}
+	if (now - hbsendtest_start >= 2500000) {
+		g_main_loop_quit(mainloop);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/// Does nothing - we only want its source id
+FSTATIC gboolean
+hbsender_test_idle(gpointer unused)
+{
+	(void)unused;
+	return FALSE;
+}
+
+/// Heartbeat several peers every second with lots of jitter.  We should only add one GSource
+/// for all of them, they should all get their first heartbeat together, and after that
+/// each interval should be its own - but within our jitter of a second.
+FSTATIC void
+test_hbsender_scheduler(void)
+{
+	PacketDecoder*	decoder = packetdecoder_new(0, NULL, 0);
+	SignFrame*	signframe = signframe_glib_new(G_CHECKSUM_SHA256, 0);
+	ConfigContext*	config = configcontext_new(0);
+	NetAddr*	localaddr = netaddr_string_new("127.0.0.1:0");
+	NetIOudp*	sendio;
+	NetGSource*	netsource;
+	guint		idbefore;
+	guint		idafter;
+	guint64		firstmin = G_MAXUINT64;
+	guint64		firstmax = 0;
+	guint64		interval0 = 0;
+	gboolean	allsame = TRUE;
+	guint		j;
+	guint		k;
+
+	config->setframe(config, CONFIGNAME_OUTSIG, &signframe->baseclass);
+	mainloop = g_main_loop_new(g_main_context_default(), TRUE);
+	sendio = netioudp_new(0, config, decoder);
+	g_assert(sendio->baseclass.bindaddr(&sendio->baseclass, localaddr, FALSE));
+	netsource = netgsource_new(&sendio->baseclass, NULL, G_PRIORITY_HIGH, FALSE, NULL, 0, NULL);
+	hbsender_set_jitter(HBSENDTEST_JITTER);
+
+	// Source ids are handed out in order - so this tells us how many GSources our senders made
+	idbefore = g_idle_add(hbsender_test_idle, NULL);
+	g_source_remove(idbefore);
+	for (j=0; j < HBSENDTEST_COUNT; ++j) {
+		NetAddr*	dest;
+		hbsendtest_receivers[j] = netioudp_new(0, config, decoder);
+		g_assert(hbsendtest_receivers[j]->baseclass.bindaddr(&hbsendtest_receivers[j]->baseclass
+		,	localaddr, FALSE));
+		dest = hbsendtest_receivers[j]->baseclass.boundaddr(&hbsendtest_receivers[j]->baseclass);
+		g_assert(hbsender_new(dest, netsource, 1, 0) != NULL);
+		UNREF(dest);
+		hbsendtest_nbeats[j] = 0;
+	}
+	idafter = g_idle_add(hbsender_test_idle, NULL);
+	g_source_remove(idafter);
+	g_assert_cmpint(idafter - idbefore, <=, 2);
+
+	hbsendtest_start = g_get_monotonic_time();
+	g_timeout_add(5, hbsender_test_poll, NULL);
+	g_main_loop_run(mainloop);
+
+	for (j=0; j < HBSENDTEST_COUNT; ++j) {
+		// Sent at 0, 1 +/- 0.2 and 2 +/- 0.4 seconds
+		g_assert_cmpint(hbsendtest_nbeats[j], ==, 3);
+		firstmin = MIN(firstmin, hbsendtest_arrivals[j][0]);
+		firstmax = MAX(firstmax, hbsendtest_arrivals[j][0]);
+		for (k=1; k < hbsendtest_nbeats[j]; ++k) {
+			guint64	interval = hbsendtest_arrivals[j][k] - hbsendtest_arrivals[j][k-1];
+			g_assert_cmpint(interval, >=, (guint64)((1.0-HBSENDTEST_JITTER)*1000000) - 50000);
+			g_assert_cmpint(interval, <=, (guint64)((1.0+HBSENDTEST_JITTER)*1000000) + 50000);
+			if (interval0 == 0) {
+				interval0 = interval;
+			}else if (ABS((gint64)interval - (gint64)interval0) > 1000) {
+				allsame = FALSE;
+			}
+		}
+	}
+	// Everyone's first heartbeat went out in the same batch
+	g_assert_cmpint(firstmax - firstmin, <, 20000);
+	g_assert(!allsame);
+
+	hbsender_stopallsenders();
+	hbsender_set_jitter(HBSENDER_DEFAULT_JITTER);
+	g_source_destroy(&netsource->baseclass);
+	g_source_unref(&netsource->baseclass);
+	for (j=0; j < HBSENDTEST_COUNT; ++j) {
+		UNREF2(hbsendtest_receivers[j]);
+	}
+	UNREF2(sendio);
+	UNREF(localaddr);
+	UNREF(config);
+	UNREF2(signframe);
+	UNREF(decoder);
+	g_main_loop_unref(mainloop);
+	mainloop=NULL;
+	test_all_freed();
+}
+
+#define	HBPKTTEST_US		"gtest01_hbpkt_us"
+#define	HBPKTTEST_PEER		"gtest01_hbpkt_peer"
+
+/// Return the next FrameSet sent to us - letting the main loop run until it shows up
+FSTATIC FrameSet*
+hbpkttest_recv(NetIO* io)
+{
+	int	j;
+	for (j=0; j < 3000; ++j) {
+		NetAddr*	srcaddr = NULL;
+		GSList*		fslist = io->recvframesets(io, &srcaddr);
+		if (fslist) {
+			FrameSet*	fs = CASTTOCLASS(FrameSet, fslist->data);
+			g_assert_cmpint(g_slist_length(fslist), ==, 1);
+			g_slist_free(fslist);
+			UNREF(srcaddr);
+			return fs;
+		}
+		g_main_context_iteration(NULL, FALSE);
+		g_usleep(1000);
+	}
+	return NULL;
+}
+
+/// Make sure prebuilt heartbeat packets are resent as they are - encrypted or not - and that
+/// our HbSender rebuilds its encrypted one when our keys change.  We tell which packets were
+/// resent by building them with a different signature method than our NetIO would use.
+FSTATIC void
+test_hbsender_packets(void)
+{
+	PacketDecoder*	decoder = packetdecoder_new(0, NULL, 0);
+	SignFrame*	signframe = signframe_glib_new(G_CHECKSUM_SHA256, 0);
+	SignFrame*	sha1frame = signframe_glib_new(G_CHECKSUM_SHA1, 0);
+	ConfigContext*	config = configcontext_new(0);
+	NetAddr*	localaddr = netaddr_string_new("127.0.0.1:0");
+	NetIOudp*	sendio;
+	NetIOudp*	recvio;
+	NetIO*		snd;
+	NetIO*		rcv;
+	NetGSource*	netsource;
+	NetAddr*	dest;
+	NetAddr*	dests[2];
+	FrameSet*	batch[2];
+	FrameSet*	fs;
+	HbSender*	sender;
+	guint8*		firstpkt;
+	gsize		firstlen;
+	gsize		secondlen;
+
+	config->setframe(config, CONFIGNAME_OUTSIG, &signframe->baseclass);
+	sendio = netioudp_new(0, config, decoder);
+	recvio = netioudp_new(0, config, decoder);
+	snd = &sendio->baseclass;
+	rcv = &recvio->baseclass;
+	g_assert(snd->bindaddr(snd, localaddr, FALSE));
+	g_assert(rcv->bindaddr(rcv, localaddr, FALSE));
+	dest = rcv->boundaddr(rcv);
+	dests[0] = dests[1] = dest;
+
+	// An unencrypted packet that's already built goes out as it is...
+	batch[0] = frameset_new(FRAMESETTYPE_HEARTBEAT);
+	frameset_construct_packet(batch[0], sha1frame, NULL, NULL);
+	snd->sendbatch(snd, dests, batch, 1);
+	fs = hbpkttest_recv(rcv);
+	g_assert(fs != NULL);
+	g_assert_cmpint(CASTTOCLASS(SignFrame, fs->framelist->data)->minortype, ==, G_CHECKSUM_SHA1);
+	UNREF(fs);
+
+	// A FrameSet without a packet is skipped - without giving up on the rest of the batch
+	batch[1] = batch[0];
+	batch[0] = frameset_new(FRAMESETTYPE_HEARTBEAT);
+	g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*has no packet*");
+	snd->sendpackets(snd, dests, batch, 2);
+	g_test_assert_expected_messages();
+	fs = hbpkttest_recv(rcv);
+	g_assert(fs != NULL);
+	UNREF(fs);
+	UNREF(batch[0]);
+
+	UNREF(batch[1]);
+
+	// Our HbSender keeps its (unencrypted) heartbeat packet - and sends it through our NetGSource
+	netsource = netgsource_new(snd, NULL, G_PRIORITY_HIGH, FALSE, NULL, 0, NULL);
+	hbsender_set_jitter(0.0);
+	sender = hbsender_new(dest, netsource, 1, 0);
+	fs = hbpkttest_recv(rcv);
+	g_assert(fs != NULL);
+	UNREF(fs);
+	g_assert(sender->_heartbeat != NULL && sender->_heartbeat->packet != NULL);
+	frameset_construct_packet(sender->_heartbeat, sha1frame, NULL, NULL);
+	fs = hbpkttest_recv(rcv);
+	g_assert(fs != NULL);
+	g_assert_cmpint(CASTTOCLASS(SignFrame, fs->framelist->data)->minortype, ==, G_CHECKSUM_SHA1);
+	UNREF(fs);
+	hbsender_stopallsenders();
+
+	// It keeps its encrypted packet too - byte for byte - until our keys change
+	cryptcurve25519_gen_temp_keypair(HBPKTTEST_US);
+	cryptcurve25519_gen_temp_keypair(HBPKTTEST_PEER);
+	cryptframe_set_signing_key_id(HBPKTTEST_US);
+	cryptframe_set_encryption_method(cryptcurve25519_new_generic);
+	g_assert(cryptframe_set_dest_key_id(dest, HBPKTTEST_PEER));
+	sender = hbsender_new(dest, netsource, 1, 0);
+	fs = hbpkttest_recv(rcv);
+	g_assert(fs != NULL);
+	g_assert_cmpint(CASTTOCLASS(Frame, fs->framelist->next->data)->type, ==
+	,	FRAMETYPE_CRYPTCURVE25519);
+	UNREF(fs);
+	firstlen = (guint8*)sender->_heartbeat->pktend - (guint8*)sender->_heartbeat->packet;
+	firstpkt = g_memdup(sender->_heartbeat->packet, firstlen);
+	fs = hbpkttest_recv(rcv);
+	g_assert(fs != NULL);
+	UNREF(fs);
+	secondlen = (guint8*)sender->_heartbeat->pktend - (guint8*)sender->_heartbeat->packet;
+	g_assert_cmpint(firstlen, ==, secondlen);
+	g_assert(memcmp(firstpkt, sender->_heartbeat->packet, firstlen) == 0);
+	g_assert(cryptframe_set_dest_key_id(dest, HBPKTTEST_PEER));
+	fs = hbpkttest_recv(rcv);
+	g_assert(fs != NULL);
+	g_assert_cmpint(CASTTOCLASS(Frame, fs->framelist->next->data)->type, ==
+	,	FRAMETYPE_CRYPTCURVE25519);
+	UNREF(fs);
+	secondlen = (guint8*)sender->_heartbeat->pktend - (guint8*)sender->_heartbeat->packet;
+	g_assert(firstlen != secondlen || memcmp(firstpkt, sender->_heartbeat->packet, firstlen) != 0);
+	g_free(firstpkt);
+	hbsender_stopallsenders();
+	cryptframe_set_encryption_method(NULL);
+	cryptframe_shutdown();
+	hbsender_set_jitter(HBSENDER_DEFAULT_JITTER);
+	g_source_destroy(&netsource->baseclass);
+	g_source_unref(&netsource->baseclass);
+
+	UNREF(dest);
+	UNREF2(sendio);
+	UNREF2(recvio);
+	UNREF(localaddr);
+	UNREF(config);
+	UNREF2(sha1frame);
+	UNREF2(signframe);
+	UNREF(decoder);
+	test_all_freed();
+}
+
+#define	ARPTEST_DEV	"arptest0"
+static char*	arptest_json = NULL;
+
+/// Catch the ARP reports our ArpDiscovery would have sent to the CMA
+FSTATIC void
+arptest_sendjson(Discovery* self, char* jsonout, gsize jsonlen)
+{
+	(void)jsonlen;
+	++self->reportcount;
+	g_assert(NULL == arptest_json);
+	arptest_json = jsonout;
+}
+
+/// Hand our ARP discovery an ARP request from 10.10.10.'iplast' at 00:11:22:33:44:'maclast'
+FSTATIC void
+arptest_inject(guint8 iplast, guint8 maclast)
+{
+	guint8	pkt[42] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff,	// Ethernet destination
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x00,	// Ethernet source
+		0x08, 0x06,				// Ethertype: ARP
+		0x00, 0x01, 0x08, 0x00,			// Ethernet, IPv4
+		6, 4, 0x00, 0x01,			// Address lengths, request
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x00,	// Sender MAC address
+		10, 10, 10, 0,				// Sender IP address
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00,	// Target MAC address
+		10, 10, 10, 254				// Target IP address
+	};
+	struct pcap_pkthdr	hdr;
+
+	pkt[11] = pkt[27] = maclast;
+	pkt[31] = iplast;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.caplen = hdr.len = sizeof(pkt);
+	g_assert(pcap_mux_inject(ARPTEST_DEV, pkt, pkt + sizeof(pkt), &hdr));
+}
+
+/// Ask for an ARP report, and check that it has the expected type and number of entries.
+/// @return the report - or NULL if we expected none
+FSTATIC ConfigContext*
+arptest_report(ArpDiscovery* arp, const char * discovertype, guint ndata, guint nexpired)
+{
+	ConfigContext*	report;
+	ConfigContext*	data;
+	GSList*		keys;
+
+	arp->baseclass.discover(&arp->baseclass);
+	if (NULL == discovertype) {
+		g_assert(NULL == arptest_json);
+		return NULL;
+	}
+	g_assert(NULL != arptest_json);
+	report = configcontext_new_JSON_string(arptest_json);
+	g_free(arptest_json); arptest_json = NULL;
+	g_assert(NULL != report);
+	g_assert(NULL == report->getconfig(report, "stats"));
+	g_assert_cmpstr(report->getstring(report, "discovertype"), ==, discovertype);
+	data = report->getconfig(report, "data");
+	g_assert(NULL != data);
+	keys = data->keys(data);
+	g_assert_cmpint(g_slist_length(keys), ==, ndata);
+	g_slist_free(keys);
+	if (strcmp(discovertype, "ARP") == 0) {
+		g_assert_cmpint(report->gettype(report, "expired"), ==, CFG_EEXIST);
+	}else{
+		g_assert_cmpint(g_slist_length(report->getarray(report, "expired")), ==, nexpired);
+	}
+	return report;
+}
+
+/// Check that ARP discovery sends a full report first, then only what changed or expired.
+/// We inject our ARP packets through an offline capture interface.
+FSTATIC void
+test_arpdiscovery_delta(void)
+{
+	ConfigContext*	config = configcontext_new(0);
+	ConfigContext*	arpconfig = configcontext_new(0);
+	NetAddr*	cma = netaddr_string_new("10.10.10.200:1984");
+	ArpDiscovery*	arp;
+	ConfigContext*	report;
+	ConfigContext*	data;
+	NetAddr*	mac;
+	ConfigValue*	expired;
+	char*		macstr;
+
+	nano_random = g_rand_new();
+	config->setaddr(config, CONFIGNAME_CMADISCOVER, cma);
+	UNREF(cma);
+	g_assert(pcap_mux_offline(ARPTEST_DEV));
+	arpconfig->setstring(arpconfig, CONFIGNAME_DEVNAME, ARPTEST_DEV);
+	arpconfig->setstring(arpconfig, CONFIGNAME_INSTANCE, "test_arp");
+	arpconfig->setint(arpconfig, CONFIGNAME_ARPEXPIRE, 1);
+	arp = arpdiscovery_new(arpconfig, G_PRIORITY_LOW, NULL, NULL, config, 0);
+	g_assert(NULL != arp);
+	arp->baseclass.sendjson = arptest_sendjson;
+
+	// Our first report is always a full one
+	arptest_inject(1, 1);
+	arptest_inject(2, 2);
+	arptest_inject(1, 1);
+	report = arptest_report(arp, "ARP", 2, 0);
+	UNREF(report);
+	// Nothing new - nothing to say
+	arptest_inject(2, 2);
+	arptest_report(arp, NULL, 0, 0);
+
+	// 10.10.10.2 moved to a new MAC address, and 10.10.10.3 showed up
+	arptest_inject(2, 3);
+	arptest_inject(3, 4);
+	report = arptest_report(arp, "ARPDELTA", 2, 0);
+	data = report->getconfig(report, "data");
+	g_assert(NULL == data->getaddr(data, "::ffff:10.10.10.1"));
+	mac = data->getaddr(data, "::ffff:10.10.10.2");
+	g_assert(NULL != mac);
+	macstr = mac->baseclass.toString(&mac->baseclass);
+	g_assert_cmpstr(macstr, ==, "00-11-22-33-44-03");
+	g_free(macstr);
+	g_assert(NULL != data->getaddr(data, "::ffff:10.10.10.3"));
+	UNREF(report);
+
+	// Only 10.10.10.1 keeps talking - the other two expire
+	g_usleep(1200000);
+	arptest_inject(1, 1);
+	report = arptest_report(arp, "ARPDELTA", 0, 2);
+	expired = (ConfigValue*)report->getarray(report, "expired")->data;
+	g_assert_cmpint(expired->valtype, ==, CFG_STRING);
+	g_assert(strcmp(expired->u.strvalue, "::ffff:10.10.10.2") == 0
+	||	 strcmp(expired->u.strvalue, "::ffff:10.10.10.3") == 0);
+	UNREF(report);
+	g_assert_cmpint(arp->arpcount, ==, 1);
+	g_assert_cmpint(arp->expirecount, ==, 2);
+
+	// The CMA can ask for everything again
+	arp->baseclass.flushcache(&arp->baseclass);
+	report = arptest_report(arp, "ARP", 1, 0);
+	UNREF(report);
+	g_assert_cmpint(arp->baseclass.reportcount, ==, 4);
+
+	UNREF2(arp);
+	discovery_unregister_all();
+	UNREF(arpconfig);
+	UNREF(config);
+	g_rand_free(nano_random);
+	nano_random = NULL;
+	test_all_freed();
+}
+
+#define	MUXTEST_DEV	"muxtest0"
+/// What one of our pcap_mux test consumers has seen
+typedef struct {
+	guint	count;		///< How many packets we've been given
+	guint	maxcount;	///< Return FALSE once we've had this many (0 for never)
+}MuxTestConsumer;
+
+/// Count the packets a pcap_mux test consumer gets - and stop when it's had enough
+FSTATIC gboolean
+muxtest_dispatch(GSource_pcap_t* gsource, pcap_t* capstruct, gconstpointer pkt
+,		gconstpointer pend, const struct pcap_pkthdr* pkthdr, const char * dev
+,		gpointer userdata)
+{
+	MuxTestConsumer*	us = (MuxTestConsumer*)userdata;
+
+	(void)gsource; (void)capstruct; (void)pkt; (void)pend; (void)pkthdr;
+	g_assert_cmpstr(dev, ==, MUXTEST_DEV);
+	++us->count;
+	return (0 == us->maxcount || us->count < us->maxcount);
+}
+
+/// Inject an ARP or LLDP frame into our pcap_mux test interface
+FSTATIC gboolean
+muxtest_inject(guint16 ethertype, gboolean lldp)
+{
+	guint8			pkt[60];
+	static const guint8	lldpaddr[6] = {0x01, 0x80, 0xc2, 0x00, 0x00, 0x0e};
+	struct pcap_pkthdr	hdr;
+
+	memset(pkt, 0, sizeof(pkt));
+	memset(pkt, 0xff, 6);
+	if (lldp) {
+		memcpy(pkt, lldpaddr, sizeof(lldpaddr));
+	}
+	pkt[12] = (guint8)(ethertype >> 8);
+	pkt[13] = (guint8)(ethertype & 0xff);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.caplen = hdr.len = sizeof(pkt);
+	return pcap_mux_inject(MUXTEST_DEV, pkt, pkt + sizeof(pkt), &hdr);
+}
+
+/// Attach and detach pcap_mux consumers - checking who gets what, and what we capture
+FSTATIC void
+test_pcap_mux(void)
+{
+	MuxTestConsumer	arpuser = {0, 0};
+	MuxTestConsumer	swuser = {0, 2};
+	PcapConsumer*	arpc;
+	PcapConsumer*	swc;
+	unsigned	mask;
+	guint		snaplen;
+
+	g_assert(!pcap_mux_filter(MUXTEST_DEV, &mask, &snaplen));
+	g_assert(pcap_mux_offline(MUXTEST_DEV));
+	g_assert(!pcap_mux_offline(MUXTEST_DEV));
+
+	// An ARP-only capture only needs the start of each frame
+	arpc = pcap_mux_attach(MUXTEST_DEV, ENABLE_ARP, 0, 0, muxtest_dispatch, &arpuser
+	,	G_PRIORITY_LOW, NULL);
+	g_assert(NULL != arpc);
+	g_assert(pcap_mux_filter(MUXTEST_DEV, &mask, &snaplen));
+	g_assert_cmpuint(mask, ==, ENABLE_ARP);
+	g_assert_cmpuint(snaplen, ==, PCAP_SNAPLEN_ARP);
+
+	// Switch discovery needs whole frames - so everyone gets them
+	swc = pcap_mux_attach(MUXTEST_DEV, ENABLE_LLDP|ENABLE_CDP, 0, 0, muxtest_dispatch, &swuser
+	,	G_PRIORITY_LOW, NULL);
+	g_assert(NULL != swc);
+	g_assert(pcap_mux_filter(MUXTEST_DEV, &mask, &snaplen));
+	g_assert_cmpuint(mask, ==, ENABLE_ARP|ENABLE_LLDP|ENABLE_CDP);
+	g_assert_cmpuint(snaplen, ==, PCAP_SNAPLEN_FULL);
+
+	// Each consumer only gets the protocols it asked for
+	g_assert(muxtest_inject(0x0806, FALSE));
+	g_assert(muxtest_inject(0x88cc, TRUE));
+	g_assert(muxtest_inject(0x0800, FALSE));
+	g_assert_cmpuint(arpuser.count, ==, 1);
+	g_assert_cmpuint(swuser.count, ==, 1);
+
+	// Once a consumer returns FALSE, it's dropped from our filter and hears nothing more
+	g_assert(muxtest_inject(0x88cc, TRUE));
+	g_assert_cmpuint(swuser.count, ==, 2);
+	g_assert(pcap_mux_filter(MUXTEST_DEV, &mask, NULL));
+	g_assert_cmpuint(mask, ==, ENABLE_ARP);
+	g_assert(muxtest_inject(0x88cc, TRUE));
+	g_assert(muxtest_inject(0x0806, FALSE));
+	g_assert_cmpuint(swuser.count, ==, 2);
+	g_assert_cmpuint(arpuser.count, ==, 2);
+	g_assert(NULL == pcap_mux_source(swc));
+	pcap_mux_detach(swc);
+
+	// The capture goes away with its last consumer
+	pcap_mux_detach(arpc);
+	g_assert(!pcap_mux_filter(MUXTEST_DEV, NULL, NULL));
+
+	// ... even when that consumer leaves by returning FALSE
+	g_assert(pcap_mux_offline(MUXTEST_DEV));
+	arpuser.count = 0;
+	arpuser.maxcount = 1;
+	arpc = pcap_mux_attach(MUXTEST_DEV, ENABLE_ARP, 0, 0, muxtest_dispatch, &arpuser
+	,	G_PRIORITY_LOW, NULL);
+	g_assert(NULL != arpc);
+	g_assert(!muxtest_inject(0x0806, FALSE));
+	g_assert_cmpuint(arpuser.count, ==, 1);
+	g_assert(!pcap_mux_filter(MUXTEST_DEV, NULL, NULL));
+	pcap_mux_detach(arpc);
+	test_all_freed();
+}
+
+#define	SWTEST_DEV	"swtest0"
+static guint	swtest_sent = 0;
+
+/// Count the LLDP reports our SwitchDiscovery would have sent to the CMA
+FSTATIC void
+swtest_sendjson(Discovery* self, char* jsonout, gsize jsonlen)
+{
+	(void)jsonlen;
+	++self->reportcount;
+	++swtest_sent;
+	g_free(jsonout);
+}
+
+/// Inject an LLDP packet from switch port Gi0/'port' with the given TTL and system name
+FSTATIC void
+swtest_inject(char port, guint8 ttl, char sysname)
+{
+	guint8	pkt[] = {
+		0x01, 0x80, 0xc2, 0x00, 0x00, 0x0e,		// LLDP multicast address
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55,		// Switch MAC address
+		0x88, 0xcc,					// Ethertype: LLDP
+		0x02, 0x07, 4, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55,	// Chassis id: MAC address
+		0x04, 0x06, 7, 'G', 'i', '0', '/', '1',		// Port id: local name
+		0x06, 0x02, 0x00, 120,				// TTL
+		0x0a, 0x03, 's', 'w', 'a',			// System name
+		0x00, 0x00					// End
+	};
+	struct pcap_pkthdr	hdr;
+
+	pkt[30] = (guint8)port;
+	pkt[34] = ttl;
+	pkt[39] = (guint8)sysname;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.caplen = hdr.len = sizeof(pkt);
+	g_assert(pcap_mux_inject(SWTEST_DEV, pkt, pkt + sizeof(pkt), &hdr));
+}
+
+/// Check that switch discovery only reports LLDP changes which matter - and not too often.
+FSTATIC void
+test_switchdiscovery_changes(void)
+{
+	ConfigContext*		config = configcontext_new(0);
+	ConfigContext*		swconfig = configcontext_new(0);
+	NetAddr*		cma = netaddr_string_new("10.10.10.200:1984");
+	SwitchDiscovery*	sw;
+
+	config->setaddr(config, CONFIGNAME_CMADISCOVER, cma);
+	UNREF(cma);
+	g_assert(pcap_mux_offline(SWTEST_DEV));
+	swconfig->setstring(swconfig, CONFIGNAME_DEVNAME, SWTEST_DEV);
+	swconfig->setstring(swconfig, CONFIGNAME_INSTANCE, "test_switch");
+	swconfig->setint(swconfig, CONFIGNAME_SWMINREPORT, 0);
+	sw = switchdiscovery_new(swconfig, G_PRIORITY_LOW, NULL, NULL, config, 0);
+	g_assert(NULL != sw);
+	g_assert(sw->localdecode);
+	sw->baseclass.sendjson = swtest_sendjson;
+
+	// The first one always goes to the CMA
+	swtest_inject('1', 120, 'a');
+	g_assert_cmpuint(swtest_sent, ==, 1);
+	// A new TTL or system name isn't worth mentioning
+	swtest_inject('1', 60, 'b');
+	swtest_inject('1', 120, 'a');
+	g_assert_cmpuint(swtest_sent, ==, 1);
+	g_assert_cmpint(sw->suppresscount, ==, 2);
+	// But being plugged into a different port is
+	swtest_inject('2', 120, 'a');
+	g_assert_cmpuint(swtest_sent, ==, 2);
+
+	// Changes too soon after the last one are held back until a later advertisement
+	sw->minreportusecs = 3600 * G_USEC_PER_SEC;
+	swtest_inject('3', 120, 'a');
+	g_assert_cmpuint(swtest_sent, ==, 2);
+	g_assert_cmpint(sw->suppresscount, ==, 3);
+	sw->minreportusecs = 0;
+	swtest_inject('3', 120, 'a');
+	g_assert_cmpuint(swtest_sent, ==, 3);
+	g_assert_cmpint(sw->baseclass.reportcount, ==, 3);
+	g_assert_cmpint(sw->baseclass.discovercount, ==, 6);
+	g_assert_cmpint(sw->keepalivecount, ==, 0);
+
+	UNREF2(sw);
+	discovery_unregister_all();
+	UNREF(swconfig);
+	UNREF(config);
+	test_all_freed();
+}
+
+/// Check the JSON patches configcontext_diff() makes for discovery-style data
+FSTATIC void
+test_configcontext_diff(void)
+{
+	const char *	oldjson = "{\"discovertype\":\"tcpdiscovery\",\"data\":{\"/usr/sbin/sshd\":"
+			"{\"pid\":42,\"ports\":[22,2222]},\"ntpd\":{\"pid\":7,\"ports\":[123]}}}";
+	const char *	newjson = "{\"discovertype\":\"tcpdiscovery\",\"data\":{\"/usr/sbin/sshd\":"
+			"{\"pid\":43,\"ports\":[22]},\"named\":{\"pid\":9,\"ports\":[53]}}}";
+	const char *	expected = "["
+		"{\"op\":\"replace\",\"path\":\"/data/~1usr~1sbin~1sshd/pid\",\"value\":43},"
+		"{\"op\":\"remove\",\"path\":\"/data/~1usr~1sbin~1sshd/ports/1\"},"
+		"{\"op\":\"remove\",\"path\":\"/data/ntpd\"},"
+		"{\"op\":\"add\",\"path\":\"/data/named\",\"value\":{\"pid\":9,\"ports\":[53]}}"
+		"]";
+	ConfigContext*	oldcfg = configcontext_new_JSON_string(oldjson);
+	ConfigContext*	newcfg = configcontext_new_JSON_string(newjson);
+	char *		patch;
+
+	g_assert(oldcfg != NULL && newcfg != NULL);
+	patch = configcontext_diff(oldcfg, newcfg);
+	g_assert_cmpstr(patch, ==, expected);
+	g_free(patch);
+	patch = configcontext_diff(newcfg, newcfg);
+	g_assert_cmpstr(patch, ==, "[]");
+	g_free(patch);
+	UNREF(oldcfg);
+	UNREF(newcfg);
+
+	// Addresses have to come out exactly the way they went in - not as NetAddrs
+	oldcfg = configcontext_new_JSON_string_raw("{\"addr\":\"::ffff:10.10.10.1\",\"mac\":\"00:1b:fc:a6:9d:5e\"}");
+	newcfg = configcontext_new_JSON_string_raw("{\"addr\":\"::ffff:10.10.10.2\",\"mac\":\"00:1b:fc:a6:9d:5e\"}");
+	g_assert(oldcfg != NULL && newcfg != NULL);
+	g_assert_cmpint(newcfg->gettype(newcfg, "addr"), ==, CFG_STRING);
+	patch = configcontext_diff(oldcfg, newcfg);
+	g_assert_cmpstr(patch, ==, "[{\"op\":\"replace\",\"path\":\"/addr\",\"value\":\"::ffff:10.10.10.2\"}]");
+	g_free(patch);
+	UNREF(oldcfg);
+	UNREF(newcfg);
+	test_all_freed();
+}
+
+static guint	disctest_sent = 0;
+
+/// Count the discovery FrameSets which would have gone to the CMA
+FSTATIC gboolean
+disctest_sendareliablefs(NetIO* self, NetAddr* dest, guint16 queueid, FrameSet* frameset)
+{
+	(void)self; (void)dest; (void)queueid; (void)frameset;
+	++disctest_sent;
+	return TRUE;
+}
+
+#define	DISCTEST_JSON1	"{\"discovertype\":\"disctest\",\"data\":{\"a\":1}}"
+#define	DISCTEST_JSON2	"{\"discovertype\":\"disctest\",\"data\":{\"a\":2}}"
+
+/// Check that we don't send the same discovery data twice - and only keep its text when we need it
+FSTATIC void
+test_discovery_digest(void)
+{
+	PacketDecoder*	decoder = packetdecoder_new(0, NULL, 0);
+	SignFrame*	signframe = signframe_glib_new(G_CHECKSUM_SHA256, 0);
+	ConfigContext*	config = configcontext_new(0);
+	NetAddr*	cma = netaddr_string_new("10.10.10.200:1984");
+	NetIOudp*	sendio;
+	NetGSource*	netsource;
+	Discovery*	disc;
+
+	config->setframe(config, CONFIGNAME_OUTSIG, &signframe->baseclass);
+	config->setaddr(config, CONFIGNAME_CMADISCOVER, cma);
+	UNREF(cma);
+	sendio = netioudp_new(0, config, decoder);
+	sendio->baseclass.sendareliablefs = disctest_sendareliablefs;
+	netsource = netgsource_new(&sendio->baseclass, NULL, G_PRIORITY_HIGH, FALSE, NULL, 0, NULL);
+	disc = discovery_new("disctest", netsource, config, 0);
+
+	disc->sendjson(disc, g_strdup(DISCTEST_JSON1), strlen(DISCTEST_JSON1));
+	g_assert_cmpuint(disctest_sent, ==, 1);
+	// Identical reports are suppressed by their digest
+	disc->sendjson(disc, g_strdup(DISCTEST_JSON1), strlen(DISCTEST_JSON1));
+	g_assert_cmpuint(disctest_sent, ==, 1);
+	g_assert_cmpint(disc->reportcount, ==, 1);
+	// ... and we don't need the text to know that
+	g_assert(config->getstring(config, "disctest") == NULL);
+	disc->sendjson(disc, g_strdup(DISCTEST_JSON2), strlen(DISCTEST_JSON2));
+	g_assert_cmpuint(disctest_sent, ==, 2);
+
+	// A one-shot discovery doesn't need a base for patches - until it reports again
+	config->setbool(config, CONFIGNAME_JSONDELTA, TRUE);
+	UNREF(disc);
+	disc = discovery_new("disctest", netsource, config, 0);
+	disc->sendjson(disc, g_strdup(DISCTEST_JSON1), strlen(DISCTEST_JSON1));
+	g_assert(config->getstring(config, "disctest") == NULL);
+	disc->sendjson(disc, g_strdup(DISCTEST_JSON2), strlen(DISCTEST_JSON2));
+	g_assert_cmpstr(config->getstring(config, "disctest"), ==, DISCTEST_JSON2);
+	disc->sendjson(disc, g_strdup(DISCTEST_JSON2), strlen(DISCTEST_JSON2));
+	g_assert_cmpuint(disctest_sent, ==, 4);
+
+	UNREF(disc);
+	g_source_destroy(&netsource->baseclass);
+	g_source_unref(&netsource->baseclass);
+	UNREF2(sendio);
+	UNREF(config);
+	UNREF2(signframe);
+	UNREF(decoder);
+	test_all_freed();
+}
+
+#define	SCHEDTEST_COUNT	5
+static Discovery*	schedtest_disc[SCHEDTEST_COUNT];
+static guint		schedtest_order[SCHEDTEST_COUNT];
+static guint		schedtest_started = 0;
+static guint		schedtest_running = 0;
+static guint		schedtest_maxrunning = 0;
+static guint		schedtest_qlen = 0;
+
+/// Discover function for our scheduler tests - it keeps running until we say it's done
+FSTATIC gboolean
+schedtest_discover(Discovery* self)
+{
+	guint	j;
+	for (j=0; j < SCHEDTEST_COUNT; ++j) {
+		if (schedtest_disc[j] == self) {
+			break;
+		}
+	}
+	g_assert_cmpuint(schedtest_started, <, SCHEDTEST_COUNT);
+	schedtest_order[schedtest_started] = j;
+	++schedtest_started;
+	if (!self->keepjson) {
+		self->_inprogress = TRUE;
+		++schedtest_running;
+		schedtest_maxrunning = MAX(schedtest_maxrunning, schedtest_running);
+	}
+	return FALSE;
+}
+
+/// How many FrameSets our scheduler tests pretend are queued up for the CMA
+FSTATIC guint
+schedtest_outputqlen(NetIO* self)
+{
+	(void)self;
+	return schedtest_qlen;
+}
+
+/// Dispatch everything which is ready to go - without waiting for anything
+FSTATIC void
+schedtest_spin(void)
+{
+	int	j;
+	for (j=0; j < 100 && g_main_context_iteration(NULL, FALSE); ++j) {
+		;
+	}
+}
+
+/// Make sure discoveries run in the order they came due - and never more at once than allowed
+FSTATIC void
+test_discovery_scheduler(void)
+{
+	ConfigContext*	config = configcontext_new(0);
+	guint		j;
+
+	config->setint(config, CONFIGNAME_DISCMAXRUN, 2);
+	config->setint(config, CONFIGNAME_DISCMAXLOAD, 0);
+	config->setint(config, CONFIGNAME_DISCMAXOUTQ, 0);
+	schedtest_started = schedtest_running = schedtest_maxrunning = 0;
+	for (j=0; j < SCHEDTEST_COUNT; ++j) {
+		char *	name = g_strdup_printf("schedtest%u", j);
+		schedtest_disc[j] = discovery_new(name, NULL, config, 0);
+		schedtest_disc[j]->discover = schedtest_discover;
+		g_free(name);
+		discovery_register(schedtest_disc[j]);
+		g_usleep(1000);	// So they come due in the order we registered them
+	}
+	schedtest_spin();
+	g_assert_cmpuint(schedtest_started, ==, 2);
+	// Each one which finishes lets the next one start
+	for (j=0; j < SCHEDTEST_COUNT; ++j) {
+		g_assert_cmpuint(schedtest_order[j], ==, j);
+		discovery_complete(schedtest_disc[j]);
+		--schedtest_running;
+		schedtest_spin();
+		g_assert_cmpuint(schedtest_started, ==, MIN(j+3, SCHEDTEST_COUNT));
+	}
+	g_assert_cmpuint(schedtest_maxrunning, ==, 2);
+	discovery_unregister_all();
+	for (j=0; j < SCHEDTEST_COUNT; ++j) {
+		UNREF(schedtest_disc[j]);
+	}
+	UNREF(config);
+	test_all_freed();
+}
+
+/// Make sure a busy machine postpones discovery - longer each time - except for keepjson discovery
+FSTATIC void
+test_discovery_backoff(void)
+{
+	PacketDecoder*	decoder = packetdecoder_new(0, NULL, 0);
+	SignFrame*	signframe = signframe_glib_new(G_CHECKSUM_SHA256, 0);
+	ConfigContext*	config = configcontext_new(0);
+	NetIOudp*	io;
+	NetGSource*	netsource;
+	gint64		now;
+	guint		j;
+
+	config->setframe(config, CONFIGNAME_OUTSIG, &signframe->baseclass);
+	config->setint(config, CONFIGNAME_DISCMAXOUTQ, 1);
+	config->setint(config, CONFIGNAME_DISCMAXLOAD, 0);
+	config->setint(config, CONFIGNAME_DISCJITTER, 0);
+	io = netioudp_new(0, config, decoder);
+	io->baseclass.outputqlen = schedtest_outputqlen;
+	netsource = netgsource_new(&io->baseclass, NULL, G_PRIORITY_HIGH, FALSE, NULL, 0, NULL);
+	schedtest_started = schedtest_running = schedtest_maxrunning = 0;
+	schedtest_qlen = 5;
+	for (j=0; j < SCHEDTEST_COUNT; ++j) {
+		char *	name = g_strdup_printf("backofftest%u", j);
+		schedtest_disc[j] = discovery_new(name, netsource, config, 0);
+		schedtest_disc[j]->discover = schedtest_discover;
+		g_free(name);
+	}
+	// Whoever is waiting for our startup discovery (keepjson) doesn't get held up
+	schedtest_disc[1]->keepjson = TRUE;
+	now = g_get_monotonic_time();
+	discovery_register(schedtest_disc[0]);
+	g_usleep(1000);
+	discovery_register(schedtest_disc[1]);
+	schedtest_spin();
+	g_assert_cmpuint(schedtest_started, ==, 1);
+	g_assert_cmpuint(schedtest_order[0], ==, 1);
+	g_assert_cmpint(schedtest_disc[0]->_nextdue - now, >=, DISCOVERY_BACKOFF_MIN*G_USEC_PER_SEC);
+	g_assert_cmpint(schedtest_disc[0]->_nextdue - now, <, 2*DISCOVERY_BACKOFF_MIN*G_USEC_PER_SEC);
+
+	// Still busy - so the next one waits twice as long
+	now = g_get_monotonic_time();
+	discovery_register(schedtest_disc[2]);
+	schedtest_spin();
+	g_assert_cmpuint(schedtest_started, ==, 1);
+	g_assert_cmpint(schedtest_disc[2]->_nextdue - now, >=, 2*DISCOVERY_BACKOFF_MIN*G_USEC_PER_SEC);
+
+	// Not busy any more - so it runs right away, and we start over with our backoff
+	schedtest_qlen = 0;
+	discovery_register(schedtest_disc[3]);
+	schedtest_spin();
+	g_assert_cmpuint(schedtest_started, ==, 2);
+	g_assert_cmpuint(schedtest_order[1], ==, 3);
+	discovery_complete(schedtest_disc[3]);
+	schedtest_qlen = 5;
+	now = g_get_monotonic_time();
+	discovery_register(schedtest_disc[4]);
+	schedtest_spin();
+	g_assert_cmpuint(schedtest_started, ==, 2);
+	g_assert_cmpint(schedtest_disc[4]->_nextdue - now, <, 2*DISCOVERY_BACKOFF_MIN*G_USEC_PER_SEC);
+
+	discovery_unregister_all();
+	for (j=0; j < SCHEDTEST_COUNT; ++j) {
+		UNREF(schedtest_disc[j]);
+	}
+	g_source_destroy(&netsource->baseclass);
+	g_source_unref(&netsource->baseclass);
+	UNREF2(io);
+	UNREF(config);
+	UNREF2(signframe);
+	UNREF(decoder);
+	test_all_freed();
+}
+
+/// Make sure our native "cpu" discovery produces valid JSON - and exactly what the (installed)
+/// cpu agent does, unless our /proc/cpuinfo has fields before its first processor (like ARM's).
+/// The agent's JSON is invalid then - and ours isn't.
+FSTATIC void
+test_nativediscovery_cpu(void)
+{
+	char *		agent = g_build_filename(JSONAGENTROOT, "cpu", NULL);
+	char *		argv[] = {agent, NULL};
+	char *		agentout = NULL;
+	gchar*		cpuinfo = NULL;
+	NativeDiscoveryFunc native = nativediscovery_find("cpu");
+	GString*	nativeout;
+	ConfigContext*	cfg;
+
+	if (NULL == native || !g_file_test(agent, G_FILE_TEST_IS_EXECUTABLE)) {
+		g_message("Skipping native cpu discovery test - no cpu agent or no native version");
+		g_free(agent);
+		return;
+	}
+	nativeout = g_string_new("");
+	g_assert(native(nativeout, agent, NULL));
+	cfg = configcontext_new_JSON_string(nativeout->str);
+	g_assert(cfg != NULL);
+	UNREF(cfg);
+	if (g_file_get_contents("/proc/cpuinfo", &cpuinfo, NULL, NULL)
+	&&	g_str_has_prefix(cpuinfo, "processor")) {
+		g_assert(g_spawn_sync(NULL, argv, NULL, 0, NULL, NULL, &agentout, NULL, NULL, NULL));
+		g_assert_cmpstr(nativeout->str, ==, agentout);
+		g_free(agentout);
+	}
+	g_free(cpuinfo);
+	g_string_free(nativeout, TRUE);
+	g_free(agent);
+	nativediscovery_unregister_all();
+}
+
+/// Make sure our native "cpu" discovery produces valid JSON from odd-looking (ARM-like) cpuinfo -
+/// where the cpu agent's JSON would be invalid
+FSTATIC void
+test_nativediscovery_cpu_malformed(void)
+{
+	NativeDiscoveryFunc native = nativediscovery_find("cpu");
+	const char	cpuinfo[] =
+		"Processor\t: ARMv7 Processor rev 10 (v7l)\n"
+		"processor\t: 0\n"
+		"BogoMIPS\t: 1.5*\n"
+		"model name\t: Say \"hi\"\tthere\n"
+		"flags\t\t: fp \"neon\"\n"
+		"serial\t: 007\n"
+		"\n"
+		"processor\t: 1\n"
+		"cores\t: 4\n";
+	const char	meminfo[] = "MemTotal:        1024 kB\nMemFree:          512 kB\n";
+	char *		tmpdir;
+	char *		cpufile;
+	char *		memfile;
+	gchar**		env;
+	GString*	out;
+	ConfigContext*	cfg;
+	ConfigContext*	data;
+	ConfigContext*	proc;
+	ConfigContext*	flags;
+
+	if (NULL == native) {
+		g_message("Skipping malformed cpuinfo test - no native cpu discovery");
+		return;
+	}
+	tmpdir = g_dir_make_tmp("gtest01-XXXXXX", NULL);
+	g_assert(tmpdir != NULL);
+	cpufile = g_build_filename(tmpdir, "cpuinfo", NULL);
+	memfile = g_build_filename(tmpdir, "meminfo", NULL);
+	g_assert(g_file_set_contents(cpufile, cpuinfo, -1, NULL));
+	g_assert(g_file_set_contents(memfile, meminfo, -1, NULL));
+	env = g_environ_setenv(NULL, "ASSIM_cpuinfo", cpufile, TRUE);
+	env = g_environ_setenv(env, "ASSIM_meminfo", memfile, TRUE);
+	out = g_string_new("");
+	g_assert(native(out, "cpu", (const gchar* const*)env));
+	cfg = configcontext_new_JSON_string(out->str);
+	g_assert(cfg != NULL);
+	data = cfg->getconfig(cfg, "data");
+	g_assert(data != NULL);
+	g_assert_cmpstr(data->getstring(data, "Processor"), ==, "ARMv7 Processor rev 10 (v7l)");
+	proc = data->getconfig(data, "0");
+	g_assert(proc != NULL);
+	g_assert_cmpstr(proc->getstring(proc, "BogoMIPS"), ==, "1.5*");
+	g_assert_cmpstr(proc->getstring(proc, "model name"), ==, "Say \"hi\"\tthere");
+	g_assert_cmpstr(proc->getstring(proc, "serial"), ==, "007");
+	flags = proc->getconfig(proc, "flags");
+	g_assert(flags != NULL);
+	g_assert(flags->getbool(flags, "\"neon\""));
+	proc = data->getconfig(data, "1");
+	g_assert(proc != NULL);
+	g_assert_cmpint(proc->getint(proc, "cores"), ==, 4);
+	g_assert_cmpint(proc->getint(proc, "MemTotal"), ==, 1024);
+	UNREF(cfg);
+	g_string_free(out, TRUE);
+	g_strfreev(env);
+	g_unlink(cpufile);
+	g_unlink(memfile);
+	g_rmdir(tmpdir);
+	g_free(cpufile);
+	g_free(memfile);
+	g_free(tmpdir);
+	nativediscovery_unregister_all();
+}
+
+/// Make sure our native "checksums" discovery gets everything from its cache the second time around -
+/// and that it asks ldd again once the dynamic linker's cache changes
+FSTATIC void
+test_nativediscovery_checksums(void)
+{
+	NativeDiscoveryFunc native = nativediscovery_find("checksums");
+	char *		tmpdir;
+	char *		cachefile;
+	char *		ldsocache;
+	gchar*		contents = NULL;
+	gchar**		lines;
+	gchar**		env;
+	GString*	first;
+	GString*	second;
+	gboolean	hasdeps = FALSE;
+	guint		j;
+
+	if (NULL == native || !g_file_test("/usr/bin/sha256sum", G_FILE_TEST_IS_EXECUTABLE)) {
+		g_message("Skipping native checksums discovery test - no sha256sum or no native version");
+		return;
+	}
+	tmpdir = g_dir_make_tmp("gtest01-XXXXXX", NULL);
+	g_assert(tmpdir != NULL);
+	cachefile = g_build_filename(tmpdir, "checksums.cache", NULL);
+	ldsocache = g_build_filename(tmpdir, "ld.so.cache", NULL);
+	g_assert(g_file_set_contents(ldsocache, "1", -1, NULL));
+	env = g_environ_setenv(NULL, "ASSIM_sumcmds", "/usr/bin/sha256sum", TRUE);
+	env = g_environ_setenv(env, "ASSIM_filelist", "/bin/sh", TRUE);
+	env = g_environ_setenv(env, "ASSIM_cachefile", cachefile, TRUE);
+	env = g_environ_setenv(env, "ASSIM_iobudget", "0", TRUE);
+	env = g_environ_setenv(env, "ASSIM_ldsocache", ldsocache, TRUE);
+	first = g_string_new("");
+	second = g_string_new("");
+	g_assert(native(first, "checksums", (const gchar* const*)env));
+	g_assert(g_file_test(cachefile, G_FILE_TEST_IS_REGULAR));
+	g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "checksums: 0 files rehashed, *");
+	g_assert(native(second, "checksums", (const gchar* const*)env));
+	g_test_assert_expected_messages();
+	g_assert(strstr(second->str, "cachestats") == NULL);
+	g_assert(strstr(second->str, "\"/bin/sh\": \"") != NULL);
+	g_assert_cmpstr(strstr(first->str, "\"data\""), ==, strstr(second->str, "\"data\""));
+
+	// Make our cache say /bin/sh depends on nothing - it should believe that until ld.so.cache changes
+	g_assert(g_file_get_contents(cachefile, &contents, NULL, NULL));
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+	for (j=0; lines[j]; ++j) {
+		if (g_str_has_prefix(lines[j], "D\t/bin/sh\t")) {
+			g_free(lines[j]);
+			lines[j] = g_strdup("D\t/bin/sh");
+			hasdeps = TRUE;
+		}
+	}
+	contents = g_strjoinv("\n", lines);
+	g_strfreev(lines);
+	g_assert(g_file_set_contents(cachefile, contents, -1, NULL));
+	g_free(contents);
+	if (hasdeps) {
+		g_string_truncate(second, 0);
+		g_assert(native(second, "checksums", (const gchar* const*)env));
+		g_assert_cmpstr(strstr(first->str, "\"data\""), !=, strstr(second->str, "\"data\""));
+		g_assert(g_file_set_contents(ldsocache, "22", -1, NULL));
+		g_string_truncate(second, 0);
+		g_assert(native(second, "checksums", (const gchar* const*)env));
+		g_assert_cmpstr(strstr(first->str, "\"data\""), ==, strstr(second->str, "\"data\""));
+	}else{
+		g_message("Skipping ld.so.cache part of checksums test - /bin/sh has no libraries");
+	}
+	g_string_free(first, TRUE);
+	g_string_free(second, TRUE);
+	g_strfreev(env);
+	g_unlink(cachefile);
+	g_unlink(ldsocache);
+	g_rmdir(tmpdir);
+	g_free(cachefile);
+	g_free(ldsocache);
+	g_free(tmpdir);
+	nativediscovery_unregister_all();
+}
+
+#ifdef __linux__
+/// Return the entry in this tcpdiscovery report for whoever listens on 'listenaddr'
+FSTATIC ConfigContext*
+tcptest_entry(ConfigContext* report, const char * listenaddr, const char ** name)
+{
+	ConfigContext*	data = report->getconfig(report, "data");
+	GSList*		keys;
+	GSList*		this;
+	ConfigContext*	ret = NULL;
+
+	g_assert(data != NULL);
+	keys = data->keys(data);
+	for (this = keys; this; this = this->next) {
+		ConfigContext*	entry = data->getconfig(data, (const char *)this->data);
+		ConfigContext*	addrs;
+		g_assert(entry != NULL);
+		// Every entry has the same schema
+		g_assert_cmpint(entry->gettype(entry, "exe"), ==, CFG_STRING);
+		g_assert_cmpint(entry->gettype(entry, "cmdline"), ==, CFG_ARRAY);
+		g_assert_cmpint(entry->gettype(entry, "uid"), ==, CFG_STRING);
+		g_assert_cmpint(entry->gettype(entry, "gid"), ==, CFG_STRING);
+		g_assert_cmpint(entry->gettype(entry, "cwd"), ==, CFG_STRING);
+		addrs = entry->getconfig(entry, "listenaddrs");
+		if (addrs && g_strcmp0(addrs->getstring(addrs, listenaddr), "tcp") == 0) {
+			*name = (const char *)this->data;
+			ret = entry;
+		}
+	}
+	g_slist_free(keys);
+	return ret;
+}
+
+/// Make sure our native tcpdiscovery says what the agent does - about our own listener, anyway.
+/// Everyone else's connections come and go while we're looking.
+FSTATIC void
+tcptest_compare(const char * native, const char * agentout, const char * listenaddr)
+{
+	ConfigContext*	nativecfg = configcontext_new_JSON_string_raw(native);
+	ConfigContext*	agentcfg = configcontext_new_JSON_string_raw(agentout);
+	static const char * fields[] = {"discovertype", "description", "source", "host"};
+	const char *	nativename = NULL;
+	const char *	agentname = NULL;
+	ConfigContext*	nativeentry;
+	ConfigContext*	agententry;
+	char *		nativestr;
+	char *		agentstr;
+	guint		j;
+
+	g_assert(nativecfg != NULL);
+	g_assert(agentcfg != NULL);
+	g_assert_cmpint(nativecfg->keycount(nativecfg), ==, agentcfg->keycount(agentcfg));
+	for (j=0; j < DIMOF(fields); ++j) {
+		g_assert_cmpstr(nativecfg->getstring(nativecfg, fields[j])
+		,	==, agentcfg->getstring(agentcfg, fields[j]));
+	}
+	nativeentry = tcptest_entry(nativecfg, listenaddr, &nativename);
+	agententry = tcptest_entry(agentcfg, listenaddr, &agentname);
+	g_assert(nativeentry != NULL);
+	g_assert(agententry != NULL);
+	g_assert_cmpstr(nativename, ==, agentname);
+	nativestr = nativeentry->baseclass.toString(&nativeentry->baseclass);
+	agentstr = agententry->baseclass.toString(&agententry->baseclass);
+	g_assert_cmpstr(nativestr, ==, agentstr);
+	g_free(nativestr);
+	g_free(agentstr);
+	UNREF(nativecfg);
+	UNREF(agentcfg);
+}
+
+/// Make sure our native "tcpdiscovery" discovery finds our own listener - just like the agent does
+FSTATIC void
+test_nativediscovery_tcp(void)
+{
+	NativeDiscoveryFunc native = nativediscovery_find("tcpdiscovery");
+	char *			agent = g_build_filename(JSONAGENTROOT, "tcpdiscovery", NULL);
+	char *			netstat = g_find_program_in_path("netstat");
+	struct sockaddr_in	addr;
+	socklen_t		addrlen = sizeof(addr);
+	int			fd;
+	GString*		out;
+
+	if (NULL == native) {
+		g_message("Skipping native tcpdiscovery test - no native version");
+		g_free(netstat);
+		g_free(agent);
+		return;
+	}
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	g_assert(fd >= 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	g_assert(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+	g_assert(listen(fd, 1) == 0);
+	g_assert(getsockname(fd, (struct sockaddr*)&addr, &addrlen) == 0);
+	out = g_string_new("");
+	if (native(out, agent, NULL)) {
+		char *		listenaddr = g_strdup_printf("0.0.0.0:%u", ntohs(addr.sin_port));
+		char *		quoted = g_strdup_printf("\"%s\":\"tcp\"", listenaddr);
+		ConfigContext*	cfg = configcontext_new_JSON_string(out->str);
+		g_assert(cfg != NULL);
+		g_assert(strstr(out->str, quoted) != NULL);
+		UNREF(cfg);
+		if (netstat && g_file_test(agent, G_FILE_TEST_IS_EXECUTABLE)) {
+			char *	argv[] = {agent, NULL};
+			char *	agentout = NULL;
+			g_assert(g_spawn_sync(NULL, argv, NULL, 0, NULL, NULL, &agentout, NULL, NULL, NULL));
+			tcptest_compare(out->str, agentout, listenaddr);
+			g_free(agentout);
+		}else{
+			g_message("Skipping tcpdiscovery agent comparison - no agent or no netstat");
+		}
+		g_free(quoted);
+		g_free(listenaddr);
+	}else{
+		g_message("Skipping native tcpdiscovery test - no NETLINK_SOCK_DIAG");
+	}
+	g_string_free(out, TRUE);
+	close(fd);
+	g_free(netstat);
+	g_free(agent);
+	nativediscovery_unregister_all();
+}
+#endif
+
+static int		trigger_test_runs = 0;
+static char *		trigger_test_dir = NULL;
+static char *		trigger_test_file = NULL;
+
+/// Discover function for our trigger test.
+/// The first run changes the file we're triggered by.  The second replaces its whole directory
+/// (like package managers do to /etc/pam.d), and the third changes the file in the new one.
+FSTATIC gboolean
+trigger_test_discover(Discovery* self)
+{
+	char *	olddir = g_strdup_printf("%s.old", trigger_test_dir);
+
+	(void)self;
+	++trigger_test_runs;
+	switch (trigger_test_runs) {
+		case 1:
+			g_assert(g_file_set_contents(trigger_test_file, "changed\n", -1, NULL));
+			break;
+		case 2:
+			g_assert(g_rename(trigger_test_dir, olddir) == 0);
+			g_assert(g_mkdir(trigger_test_dir, 0700) == 0);
+			g_assert(g_file_set_contents(trigger_test_file, "replaced\n", -1, NULL));
+			break;
+		case 3:
+			g_assert(g_file_set_contents(trigger_test_file, "changed again\n", -1, NULL));
+			break;
+		default:
+			g_main_loop_quit(mainloop);
+			break;
+	}
+	g_free(olddir);
+	return TRUE;
+}
+
+/// Give up on our trigger test
+FSTATIC gboolean
+trigger_test_timeout(gpointer unused)
+{
+	(void)unused;
+	g_main_loop_quit(mainloop);
+	return FALSE;
+}
+
+/// Make sure that changing a file we're subscribed to reruns our (one-shot) discovery -
+/// even after its directory has been replaced
+FSTATIC void
+test_discoverytrigger_inotify(void)
+{
+	ConfigContext*	config = configcontext_new(0);
+	char *		tmpdir = g_dir_make_tmp("gtest01-XXXXXX", NULL);
+	char *		olddir;
+	char *		oldfile;
+	Discovery*	discovery;
+	guint		timeout;
+
+	g_assert(tmpdir != NULL);
+	trigger_test_runs = 0;
+	trigger_test_dir = tmpdir;
+	trigger_test_file = g_build_filename(tmpdir, "watched", NULL);
+	g_assert(g_file_set_contents(trigger_test_file, "original\n", -1, NULL));
+	config->setint(config, CONFIGNAME_DISCDEBOUNCE, 0);
+	config->setint(config, CONFIGNAME_DISCMAXLOAD, 0);
+	discovery = discovery_new("trigger_test", NULL, config, 0);
+	discovery->discover = trigger_test_discover;
+	if (!discoverytrigger_subscribe(discovery, trigger_test_file)) {
+		g_message("Skipping discovery trigger test - no inotify");
+	}else{
+		discovery_register(discovery);
+		mainloop = g_main_loop_new(g_main_context_default(), TRUE);
+		timeout = g_timeout_add_seconds(10, trigger_test_timeout, NULL);
+		g_main_loop_run(mainloop);
+		g_source_remove(timeout);
+		g_main_loop_unref(mainloop);
+		mainloop = NULL;
+		g_assert_cmpint(trigger_test_runs, ==, 4);
+		discovery_unregister_all();
+	}
+	discoverytrigger_shutdown();
+	UNREF(discovery);
+	UNREF(config);
+	olddir = g_strdup_printf("%s.old", tmpdir);
+	oldfile = g_build_filename(olddir, "watched", NULL);
+	g_unlink(oldfile);
+	g_rmdir(olddir);
+	g_unlink(trigger_test_file);
+	g_rmdir(tmpdir);
+	g_free(oldfile);
+	g_free(olddir);
+	g_free(trigger_test_file);
+	trigger_test_file = NULL;
+	trigger_test_dir = NULL;
+	g_free(tmpdir);
+	test_all_freed();
+}
+
+#ifdef __linux__
+/// Pretend to be the kernel telling every rtnetlink socket we have that an address was added.
+/// Unprivileged processes can't add addresses - but they can send each other netlink messages.
+/// @return how many sockets we sent our forgery to
+FSTATIC guint
+nltrigger_test_send(void)
+{
+	guint		count = 0;
+	GDir*		fds = g_dir_open("/proc/self/fd", 0, NULL);
+	const char *	fdname;
+	int		sendfd = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+	struct {
+		struct nlmsghdr		hdr;
+		struct ifaddrmsg	ifa;
+	}		msg;
+
+	g_assert(fds != NULL);
+	g_assert(sendfd >= 0);
+	memset(&msg, 0, sizeof(msg));
+	msg.hdr.nlmsg_len = sizeof(msg);
+	msg.hdr.nlmsg_type = RTM_NEWADDR;
+	msg.ifa.ifa_family = AF_INET;
+	while (NULL != (fdname = g_dir_read_name(fds))) {
+		int			fd = atoi(fdname);
+		struct sockaddr_nl	addr;
+		socklen_t		addrlen = sizeof(addr);
+		int			protocol = -1;
+		socklen_t		protolen = sizeof(protocol);
+
+		if (fd == sendfd
+		||	getsockname(fd, (struct sockaddr*)&addr, &addrlen) < 0
+		||	addr.nl_family != AF_NETLINK
+		||	getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &protolen) < 0
+		||	protocol != NETLINK_ROUTE) {
+			continue;
+		}
+		addr.nl_groups = 0;
+		g_assert(sendto(sendfd, &msg, sizeof(msg), 0, (struct sockaddr*)&addr, sizeof(addr))
+		==	(ssize_t)sizeof(msg));
+		++count;
+	}
+	g_dir_close(fds);
+	close(sendfd);
+	return count;
+}
+
+/// Discover function for our rtnetlink trigger test - the first run forges an address event
+FSTATIC gboolean
+nltrigger_test_discover(Discovery* self)
+{
+	(void)self;
+	++trigger_test_runs;
+	if (trigger_test_runs == 1) {
+		g_assert_cmpint(nltrigger_test_send(), >, 0);
+	}
+	return TRUE;
+}
+
+/// Make sure rtnetlink events which didn't come from the kernel don't rerun discovery.
+/// Otherwise any local user could make us rerun it as often as our debounce time allows.
+FSTATIC void
+test_discoverytrigger_netlink(void)
+{
+	ConfigContext*	config = configcontext_new(0);
+	Discovery*	discovery;
+
+	trigger_test_runs = 0;
+	config->setint(config, CONFIGNAME_DISCDEBOUNCE, 1);
+	config->setint(config, CONFIGNAME_DISCMAXLOAD, 0);
+	discovery = discovery_new("nltrigger_test", NULL, config, 0);
+	discovery->discover = nltrigger_test_discover;
+	g_assert(discoverytrigger_subscribe(discovery, "netlink:addr"));
+	discovery_register(discovery);
+	mainloop = g_main_loop_new(g_main_context_default(), TRUE);
+	// Well past our debounce time - a real event would have rerun it by then
+	g_timeout_add_seconds(4, trigger_test_timeout, NULL);
+	g_main_loop_run(mainloop);
+	g_main_loop_unref(mainloop);
+	mainloop = NULL;
+	g_assert_cmpint(trigger_test_runs, ==, 1);
+	discovery_unregister_all();
+	discoverytrigger_shutdown();
+	UNREF(discovery);
+	UNREF(config);
+	test_all_freed();
+}
+#endif
+
 /// Test main program ('/gtest01') using the glib test fixtures
 int
 main(int argc, char ** argv)
@@ -768,5 +2928,34 @@ main(int argc, char ** argv)
 	g_test_add_func("/gtest01/gmain/safe_ocfops", test_safe_ocfops);
 	g_test_add_func("/gtest01/gmain/safe_queue_ocfops", test_safe_queue_ocfops);
 	g_test_add_func("/gtest01/gmain/safe_queue_lsbops", test_safe_queue_lsbops);
+	g_test_add_func("/gtest01/gmain/marshalpool", test_marshalpool);
+	g_test_add_func("/gtest01/gmain/signframe_aead", test_signframe_aead);
+	g_test_add_func("/gtest01/gmain/cryptcurve25519_keyindex", test_cryptcurve25519_keyindex);
+	g_test_add_func("/gtest01/gmain/cryptframe_cache", test_cryptframe_cache);
+	g_test_add_func("/gtest01/gmain/fsprotocol_fragments", test_fsprotocol_fragments);
+	g_test_add_func("/gtest01/gmain/fsprotocol_fragments_incompressible"
+	,	test_fsprotocol_fragments_incompressible);
+	g_test_add_func("/gtest01/gmain/hblistener_phi", test_hblistener_phi);
+	g_test_add_func("/gtest01/gmain/hblistener_histograms", test_hblistener_histograms);
+	g_test_add_func("/gtest01/gmain/hblistener_deadlines", test_hblistener_deadlines);
+	g_test_add_func("/gtest01/gmain/hbsender_scheduler", test_hbsender_scheduler);
+	g_test_add_func("/gtest01/gmain/hbsender_packets", test_hbsender_packets);
+	g_test_add_func("/gtest01/gmain/arpdiscovery_delta", test_arpdiscovery_delta);
+	g_test_add_func("/gtest01/gmain/pcap_mux", test_pcap_mux);
+	g_test_add_func("/gtest01/gmain/switchdiscovery_changes", test_switchdiscovery_changes);
+	g_test_add_func("/gtest01/gmain/configcontext_diff", test_configcontext_diff);
+	g_test_add_func("/gtest01/gmain/discovery_digest", test_discovery_digest);
+	g_test_add_func("/gtest01/gmain/discovery_scheduler", test_discovery_scheduler);
+	g_test_add_func("/gtest01/gmain/discovery_backoff", test_discovery_backoff);
+	g_test_add_func("/gtest01/gmain/nativediscovery_cpu", test_nativediscovery_cpu);
+	g_test_add_func("/gtest01/gmain/nativediscovery_cpu_malformed", test_nativediscovery_cpu_malformed);
+	g_test_add_func("/gtest01/gmain/nativediscovery_checksums", test_nativediscovery_checksums);
+#ifdef __linux__
+	g_test_add_func("/gtest01/gmain/nativediscovery_tcp", test_nativediscovery_tcp);
+#endif
+	g_test_add_func("/gtest01/gmain/discoverytrigger_inotify", test_discoverytrigger_inotify);
+#ifdef __linux__
+	g_test_add_func("/gtest01/gmain/discoverytrigger_netlink", test_discoverytrigger_netlink);
+#endif
 	return g_test_run();
 }
@@ -0,0 +1,341 @@
+/**
+ * @file
+ * @brief Offline replay benchmark for ARP and switch (LLDP/CDP) discovery.
+ * @details Feeds packets from pcap capture files through the same code that
+ * @ref ArpDiscovery and @ref SwitchDiscovery use for live captures - via an offline
+ * @ref pcap_mux_offline "pcap multiplexor" interface - and reports packets per second,
+ * heap allocations and C-class objects per packet, and how much JSON we generated.
+ * Heap allocations include everything GLib allocates for us (g_malloc, g_strdup, JSON text...).
+ * We can only count those with glibc - where we can put our own malloc() in front of its own.
+ * It needs no privileges and no network, so it can run anywhere - including CI.
+ *
+ * Each pass through the packets can be given different (synthesized) addresses, so that we
+ * see the cost of discovering something new - not just of noticing that nothing has changed.
+ *
+ * This file is part of the Assimilation Project.
+ *
+ * @author Copyright &copy; 2015 - Alan Robertson <alanr@unix.sh>
+ * @n
+ *  The Assimilation software is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Assimilation software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the Assimilation Project software.  If not, see http://www.gnu.org/licenses/
+ *
+ */
+#include <projectcommon.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <proj_classes.h>
+#include <cdp.h>
+#include <lldp.h>
+#include <netaddr.h>
+#include <configcontext.h>
+#include <pcap_min.h>
+#include <pcap_mux.h>
+#include <discovery.h>
+#include <arpdiscovery.h>
+#include <switchdiscovery.h>
+#include <nanoprobe.h>
+
+#define	BENCHDEV	"bench0"		///< Our (fake) offline interface
+#define	BENCHCMA	"127.0.0.1:1984"	///< Where we pretend to send things
+#define	ARP_SHA_OFFSET	22			///< Offset of the sender MAC address in an ARP packet
+#define	ARP_SPA_OFFSET	28			///< Offset of the sender IP address in an ARP packet
+
+/// One packet from a capture file - copied so we can change its addresses
+typedef struct _BenchPacket {
+	struct pcap_pkthdr	hdr;		///< libpcap packet header
+	guint8*			pkt;		///< Our copy of the packet
+	unsigned		protocol;	///< Which of @ref pcap_protocols it is (or zero)
+	gssize			varyoffset;	///< Chassis id byte to vary (LLDP/CDP) or -1
+} BenchPacket;
+
+static guint64	jsoncount = 0;		///< How many JSON reports we generated
+static guint64	jsonbytes = 0;		///< How many bytes of JSON we generated
+
+#ifdef __GLIBC__
+#	define	BENCH_COUNT_MALLOC	1
+static guint64	malloccount = 0;	///< How many times malloc(), calloc() or realloc() were called
+extern void*	__libc_malloc(size_t size);
+extern void*	__libc_calloc(size_t nmemb, size_t size);
+extern void*	__libc_realloc(void* ptr, size_t size);
+
+/// Count every malloc() - including GLib's
+void*
+malloc(size_t size)
+{
+	__atomic_add_fetch(&malloccount, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+/// Count every calloc() - including GLib's
+void*
+calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&malloccount, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+/// Count every realloc() - including GLib's
+void*
+realloc(void* ptr, size_t size)
+{
+	__atomic_add_fetch(&malloccount, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+FSTATIC void bench_sendjson(Discovery* self, char* jsonout, gsize jsonlen);
+FSTATIC void load_packets(GArray* packets, const char * filename);
+FSTATIC void vary_packet(BenchPacket* bp, guint variant);
+FSTATIC void usage(const char * cmdname);
+
+/// Our replacement for _discovery_sendjson() - count the JSON instead of sending it
+FSTATIC void
+bench_sendjson(Discovery* self,	///<[in/out] Discovery object which generated the JSON
+	       char* jsonout,	///<[in] malloced JSON text - which we free (!)
+	       gsize jsonlen)	///<[in] length of 'jsonout'
+{
+	++ self->reportcount;
+	++ jsoncount;
+	jsonbytes += jsonlen;
+	g_free(jsonout);
+}
+
+/// Read all the packets from a capture file into memory
+FSTATIC void
+load_packets(GArray* packets,		///<[in/out] Where to put them
+	     const char * filename)	///<[in] capture file to read
+{
+	pcap_t*			handle;
+	char			errbuf[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr	hdr;
+	const guchar*		packet;
+
+	if (NULL == (handle = pcap_open_offline(filename, errbuf))) {
+		g_error("open_offline failed.../: %s", errbuf);
+	}
+	while (NULL != (packet = pcap_next(handle, &hdr))) {
+		BenchPacket	bp;
+		gconstpointer	chassis = NULL;
+		gssize		chassislen = 0;
+
+		bp.hdr = hdr;
+		bp.pkt = g_memdup(packet, hdr.caplen);
+		bp.protocol = pcap_packet_protocol(bp.pkt, bp.pkt + hdr.caplen);
+		bp.varyoffset = -1;
+		if (bp.protocol == ENABLE_LLDP) {
+			chassis = get_lldp_chassis_id(bp.pkt, &chassislen, bp.pkt + hdr.caplen);
+		}else if (bp.protocol == ENABLE_CDP) {
+			chassis = get_cdp_chassis_id(bp.pkt, &chassislen, bp.pkt + hdr.caplen);
+		}
+		if (chassis && chassislen > 0) {
+			bp.varyoffset = ((const guint8*)chassis - bp.pkt) + chassislen - 1;
+		}
+		g_array_append_val(packets, bp);
+	}
+	pcap_close(handle);
+}
+
+/// Give a packet the addresses for this variant - variant zero is the original packet.
+/// Varying twice with the same variant puts things back the way they were.
+FSTATIC void
+vary_packet(BenchPacket* bp,	///<[in/out] Packet to change
+	    guint variant)	///<[in] Which variant we want
+{
+	guint8	lo = (guint8)(variant & 0xff);
+	guint8	hi = (guint8)((variant >> 8) & 0xff);
+
+	if (0 == variant) {
+		return;
+	}
+	if (bp->protocol == ENABLE_ARP && bp->hdr.caplen >= ARP_SPA_OFFSET + 4) {
+		bp->pkt[ARP_SHA_OFFSET+4] ^= hi;
+		bp->pkt[ARP_SHA_OFFSET+5] ^= lo;
+		bp->pkt[ARP_SPA_OFFSET+2] ^= hi;
+		bp->pkt[ARP_SPA_OFFSET+3] ^= lo;
+	}else if (bp->varyoffset >= 0) {
+		bp->pkt[bp->varyoffset] ^= lo;
+	}
+}
+
+FSTATIC void
+usage(const char * cmdname)
+{
+	fprintf(stderr, "usage: %s [-l loops] [-v variations] [-a max-allocations-per-packet]"
+		" [-o max-objects-per-packet] pcap-file [pcap-file ...]\n", cmdname);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	static int		loops = 100;
+	static int		variations = 16;
+	static gdouble		maxallocs = 0.0;
+	static gdouble		maxobjects = 0.0;
+	static gchar **		optremaining = NULL;
+	static GOptionEntry	long_options [] = {
+		{"loops",      'l', 0, G_OPTION_ARG_INT,	&loops,		"passes through the packets", NULL},
+		{"variations", 'v', 0, G_OPTION_ARG_INT,	&variations,	"address variations to cycle through", NULL},
+		{"maxallocs",  'a', 0, G_OPTION_ARG_DOUBLE,	&maxallocs,	"fail if more heap allocations per packet", NULL},
+		{"maxobjects", 'o', 0, G_OPTION_ARG_DOUBLE,	&maxobjects,	"fail if more C-class objects created per packet", NULL},
+		{G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &optremaining,	"pcap-file [pcap-file ...]", NULL},
+		{NULL, 0, 0, 0, NULL, NULL, NULL}
+	};
+	GError*			optionerror = NULL;
+	GOptionContext*		myOptionContext;
+	GArray*			packets = g_array_new(FALSE, FALSE, sizeof(BenchPacket));
+	ConfigContext*		config;
+	ConfigContext*		arpconfig;
+	ConfigContext*		swconfig;
+	ArpDiscovery*		arp;
+	SwitchDiscovery*	sw;
+	NetAddr*		cma;
+	guint64			npackets = 0;
+	guint64			startobjs;
+	guint64			nobjs;
+	guint64			startallocs = 0;
+	guint64			nallocs = 0;
+	gint64			starttime;
+	gint64			elapsed;
+	gdouble			objsperpacket;
+	gdouble			allocsperpacket;
+	int			loop;
+	guint			j;
+	int			exitcode = 0;
+
+	myOptionContext = g_option_context_new(" pcap-file [pcap-file...]");
+	g_option_context_add_main_entries(myOptionContext, long_options, NULL);
+	g_log_set_fatal_mask(NULL, (int) G_LOG_LEVEL_ERROR|G_LOG_LEVEL_CRITICAL);
+	if (!g_option_context_parse(myOptionContext, &argc, &argv, &optionerror)) {
+		g_print("option parsing failed %s\n", optionerror->message);
+		usage(argv[0]);
+	}
+	g_option_context_free(myOptionContext);
+	if (NULL == optremaining || NULL == optremaining[0] || loops <= 0 || variations < 0) {
+		usage(argv[0]);
+	}
+	for (j=0; optremaining[j]; ++j) {
+		load_packets(packets, optremaining[j]);
+	}
+	g_strfreev(optremaining); optremaining = NULL;
+
+	config = configcontext_new(0);
+	cma = netaddr_string_new(BENCHCMA);
+	config->setaddr(config, CONFIGNAME_CMADISCOVER, cma);
+	UNREF(cma);
+
+	if (!pcap_mux_offline(BENCHDEV)) {
+		g_error("Cannot set up offline interface %s", BENCHDEV);
+	}
+	arpconfig = configcontext_new(0);
+	arpconfig->setstring(arpconfig, CONFIGNAME_DEVNAME, BENCHDEV);
+	arpconfig->setstring(arpconfig, CONFIGNAME_INSTANCE, "bench_arp");
+	swconfig = configcontext_new(0);
+	swconfig->setstring(swconfig, CONFIGNAME_DEVNAME, BENCHDEV);
+	swconfig->setstring(swconfig, CONFIGNAME_INSTANCE, "bench_switch");
+	// Report every change - we want to measure the reporting too
+	swconfig->setint(swconfig, CONFIGNAME_SWMINREPORT, 0);
+
+	// With no transport (NULL) we'd crash if anything tried to send a packet.
+	// We replace sendjson, and always decode locally - so nothing ever will.
+	// ARP discovery picks its first report time with nano_random.
+	nano_random = g_rand_new();
+	arp = arpdiscovery_new(arpconfig, G_PRIORITY_LOW, NULL, NULL, config, 0);
+	sw = switchdiscovery_new(swconfig, G_PRIORITY_LOW, NULL, NULL, config, 0);
+	g_return_val_if_fail(arp != NULL && sw != NULL, 1);
+	arp->baseclass.sendjson = bench_sendjson;
+	sw->baseclass.sendjson = bench_sendjson;
+	sw->localdecode = TRUE;
+
+	startobjs = proj_class_total_object_count();
+#ifdef BENCH_COUNT_MALLOC
+	startallocs = __atomic_load_n(&malloccount, __ATOMIC_RELAXED);
+#endif
+	starttime = g_get_monotonic_time();
+	for (loop=0; loop < loops; ++loop) {
+		guint	variant = (variations > 0 ? (guint)(loop % variations) : 0);
+
+		for (j=0; j < packets->len; ++j) {
+			BenchPacket*	bp = &g_array_index(packets, BenchPacket, j);
+
+			vary_packet(bp, variant);
+			pcap_mux_inject(BENCHDEV, bp->pkt, bp->pkt + bp->hdr.caplen, &bp->hdr);
+			vary_packet(bp, variant);
+			++ npackets;
+		}
+		// Don't wait for the ARP timer - report what we've got now
+		arp->baseclass.discover(&arp->baseclass);
+	}
+	elapsed = g_get_monotonic_time() - starttime;
+	nobjs = proj_class_total_object_count() - startobjs;
+#ifdef BENCH_COUNT_MALLOC
+	nallocs = __atomic_load_n(&malloccount, __ATOMIC_RELAXED) - startallocs;
+#endif
+	objsperpacket = (npackets ? (gdouble)nobjs / (gdouble)npackets : 0.0);
+	allocsperpacket = (npackets ? (gdouble)nallocs / (gdouble)npackets : 0.0);
+
+	g_message("%"G_GUINT64_FORMAT" packets in %.3f seconds: %.0f packets/second"
+	,	npackets, (gdouble)elapsed / G_USEC_PER_SEC
+	,	(elapsed > 0 ? (gdouble)npackets * G_USEC_PER_SEC / (gdouble)elapsed : 0.0));
+#ifdef BENCH_COUNT_MALLOC
+	g_message("%.2f heap allocations per packet", allocsperpacket);
+#else
+	g_message("Heap allocations can't be counted here");
+#endif
+	g_message("%.2f objects created per packet", objsperpacket);
+	g_message("%"G_GUINT64_FORMAT" JSON reports: %"G_GUINT64_FORMAT" bytes (%.1f bytes/packet)"
+	,	jsoncount, jsonbytes, (npackets ? (gdouble)jsonbytes / (gdouble)npackets : 0.0));
+	g_message("ARP: %"G_GUINT64_FORMAT" packets, %"G_GUINT64_FORMAT" reports"
+	,	arp->baseclass.discovercount, arp->baseclass.reportcount);
+	g_message("Switch: %"G_GUINT64_FORMAT" packets, %"G_GUINT64_FORMAT" reports"
+	", %"G_GUINT64_FORMAT" suppressed"
+	,	sw->baseclass.discovercount, sw->baseclass.reportcount, sw->suppresscount);
+	if (maxallocs > 0.0) {
+#ifdef BENCH_COUNT_MALLOC
+		if (allocsperpacket > maxallocs) {
+			g_warning("%.2f heap allocations per packet - more than our limit of %.2f"
+			,	allocsperpacket, maxallocs);
+			exitcode = 1;
+		}
+#else
+		g_warning("Cannot check heap allocations against our limit of %.2f", maxallocs);
+		exitcode = 1;
+#endif
+	}
+	if (maxobjects > 0.0 && objsperpacket > maxobjects) {
+		g_warning("%.2f objects created per packet - more than our limit of %.2f"
+		,	objsperpacket, maxobjects);
+		exitcode = 1;
+	}
+
+	UNREF2(arp);
+	UNREF2(sw);
+	discovery_unregister_all();
+	UNREF(arpconfig);
+	UNREF(swconfig);
+	UNREF(config);
+	g_rand_free(nano_random);
+	nano_random = NULL;
+	for (j=0; j < packets->len; ++j) {
+		g_free(g_array_index(packets, BenchPacket, j).pkt);
+	}
+	g_array_free(packets, TRUE);
+	if (proj_class_live_object_count() > 0) {
+		g_warning("%u objects still alive at end of benchmark.", proj_class_live_object_count());
+		proj_class_dump_live_objects();
+		exitcode = 1;
+	}
+	proj_class_finalize_sys();
+	return exitcode;
+}
@@ -32,6 +32,8 @@
 #include <address_family_numbers.h>
 #include <server_dump.h>
 #include <pcap_min.h>
+#include <pcap_GSource.h>
+#include <switchdiscovery.h>
 #include <frameset.h>
 #include <frame.h>
 #include <addrframe.h>
@@ -46,6 +48,14 @@
 FSTATIC void frameset_tests(void);
 FSTATIC void cast_frameset_tests(void);
 FSTATIC void address_tests(void);
+FSTATIC gboolean replay_dispatch(GSource_pcap_t*, pcap_t*, gconstpointer, gconstpointer
+,		const struct pcap_pkthdr*, const char *, gpointer);
+FSTATIC gboolean replay_done(gpointer);
+FSTATIC void replay_tests(const char * filename);
+FSTATIC void quiet_log(const gchar*, GLogLevelFlags, const gchar*, gpointer);
+FSTATIC void fuzz_decode(GRand* rand, const guint8* pkt, gsize pktlen);
+FSTATIC void decode_tests(const char * filename, GRand* rand);
+FSTATIC void malformed_decode_tests(GRand* rand);
 
 
 /// Basic tests of our Class system, and for good measure testing of some Frame and FrameSet objects.
@@ -187,6 +197,214 @@ address_tests(void)
 
 
 
+static GMainLoop*	replay_loop = NULL;
+static guint		replay_count = 0;
+
+/// Dispatch function for replay_tests() - just count the packets we get
+FSTATIC gboolean
+replay_dispatch(GSource_pcap_t* gsource, pcap_t* capstruct, gconstpointer pkt, gconstpointer pend
+,		const struct pcap_pkthdr* pkthdr, const char * capturedev, gpointer userdata)
+{
+	(void)gsource; (void)capstruct; (void)userdata; (void)capturedev;
+	if ((gsize)((const guint8*)pend - (const guint8*)pkt) != pkthdr->caplen) {
+		g_critical("Replayed packet has the wrong length");
+	}
+	++replay_count;
+	return TRUE;
+}
+
+/// Idle function for replay_tests() - quit once our replay source has read its whole file
+FSTATIC gboolean
+replay_done(gpointer gsource)
+{
+	if (g_source_is_destroyed((GSource*)gsource)) {
+		g_main_loop_quit(replay_loop);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/// Replay a pcap file through our pcap GSource and main loop - just as we would capture it.
+/// All our test files are LLDP or CDP, so our filter should let every packet through.
+FSTATIC void
+replay_tests(const char * filename)	///<[in] pcap file to replay
+{
+	GSource*		src;
+	pcap_t*			handle;
+	char			errbuf[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr 	hdr;
+	guint			expected = 0;
+
+	if (NULL == (handle = pcap_open_offline(filename, errbuf))) {
+		g_error("open_offline failed.../: %s", errbuf);
+	}
+	while (NULL != pcap_next(handle, &hdr)) {
+		++expected;
+	}
+	pcap_close(handle);
+
+	replay_count = 0;
+	replay_loop = g_main_loop_new(g_main_context_default(), TRUE);
+	src = g_source_pcap_replay_new(filename, ENABLE_LLDP|ENABLE_CDP, replay_dispatch, NULL
+	,	G_PRIORITY_DEFAULT, NULL, 0, NULL);
+	if (NULL == src) {
+		g_error("Cannot replay [%s]", filename);
+	}
+	g_idle_add(replay_done, src);
+	g_main_loop_run(replay_loop);
+	g_source_unref(src);
+	g_main_loop_unref(replay_loop);
+	replay_loop = NULL;
+	if (replay_count != expected) {
+		g_critical("Replaying [%s] produced %d packets instead of %d"
+		,	filename, replay_count, expected);
+	}
+	g_message("Replayed %d packets from [%s]", replay_count, filename);
+}
+
+#define	FUZZ_ROUNDS	500	///< How many corrupted copies of each packet we decode
+#define	FUZZ_SEED	20151019///< So our corruption is the same every time
+
+/// Log handler that throws away the complaints corrupted packets provoke
+FSTATIC void
+quiet_log(const gchar* domain, GLogLevelFlags level, const gchar* message, gpointer unused)
+{
+	(void)domain; (void)level; (void)message; (void)unused;
+}
+
+/// Decode lots of corrupted (and truncated) copies of a packet.
+/// They don't have to decode - but they mustn't crash or make bad memory references.
+/// Each copy is exactly as long as its (truncated) packet, so valgrind can catch overruns.
+FSTATIC void
+fuzz_decode(GRand* rand, const guint8* pkt, gsize pktlen)
+{
+	guint		handler;
+	unsigned	j;
+
+	if (pktlen <= 14) {
+		return;
+	}
+	handler = g_log_set_handler(NULL, G_LOG_LEVEL_WARNING|G_LOG_LEVEL_CRITICAL, quiet_log, NULL);
+	g_log_set_fatal_mask(NULL, G_LOG_LEVEL_ERROR);
+	for (j=0; j < FUZZ_ROUNDS; ++j) {
+		gsize		len = (gsize)g_rand_int_range(rand, 15, (gint32)pktlen+1);
+		guint8*		copy = g_memdup(pkt, len);
+		gint32		nchanges = g_rand_int_range(rand, 0, 8);
+		ConfigContext*	json;
+
+		while (nchanges-- > 0) {
+			copy[g_rand_int_range(rand, 14, (gint32)len)] = (guint8)g_rand_int_range(rand, 0, 256);
+		}
+		json = switchdiscovery_decode_packet("fuzzhost", "eth0", 0, copy, copy+len);
+		if (json) {
+			gchar*	jsonstr = json->baseclass.toString(&json->baseclass);
+			g_free(jsonstr);
+			UNREF(json);
+		}
+		g_free(copy);
+	}
+	g_log_set_fatal_mask(NULL, G_LOG_LEVEL_ERROR|G_LOG_LEVEL_CRITICAL);
+	g_log_remove_handler(NULL, handler);
+}
+
+/// Decode each LLDP/CDP packet in a pcap file into JSON - then lots of corrupted copies of it
+FSTATIC void
+decode_tests(const char * filename, GRand* rand)
+{
+	pcap_t*			handle;
+	char			errbuf[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr 	hdr;
+	const guchar*		packet;
+
+	if (NULL == (handle = pcap_open_offline(filename, errbuf))) {
+		g_error("open_offline failed.../: %s", errbuf);
+	}
+	while (NULL != (packet = pcap_next(handle, &hdr))) {
+		const guchar *	pend = packet + hdr.caplen;
+		ConfigContext*	json;
+		gboolean	valid;
+
+		valid = is_valid_lldp_packet(packet, pend) || is_valid_cdp_packet(packet, pend);
+		json = switchdiscovery_decode_packet("testhost", "eth0", 0, packet, pend);
+		if (valid) {
+			ConfigContext*	data;
+			gchar*		jsonstr;
+			if (NULL == json) {
+				g_critical("Could not decode valid packet from [%s]", filename);
+			}
+			data = json->getconfig(json, "data");
+			if (NULL == data || NULL == data->getconfig(data, "ports")) {
+				g_critical("Decoded packet from [%s] has no switch data", filename);
+			}
+			jsonstr = json->baseclass.toString(&json->baseclass);
+			g_message("Decoded packet from [%s]: %s", filename, jsonstr);
+			g_free(jsonstr);
+		}
+		if (json) {
+			UNREF(json);
+		}
+		fuzz_decode(rand, packet, hdr.caplen);
+	}
+	pcap_close(handle);
+}
+
+/// Decode some hand-made packets with malformed TLVs - and corrupted copies of them
+FSTATIC void
+malformed_decode_tests(GRand* rand)
+{
+	// TLV longer than the packet
+	static const guint8	lldp_overrun[] = {
+		0x01, 0x80, 0xc2, 0x00, 0x00, 0x0e,	0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+		0x88, 0xcc,
+		0x03, 0xff, 0x04, 0x00,
+	};
+	// Empty port id, management address longer than its TLV, short capabilities
+	static const guint8	lldp_badvalues[] = {
+		0x01, 0x80, 0xc2, 0x00, 0x00, 0x0e,	0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+		0x88, 0xcc,
+		0x02, 0x07, 0x04, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55,	// Chassis ID (MAC)
+		0x04, 0x01, 0x07,					// Port ID (local, empty)
+		0x06, 0x02, 0x00, 0x78,					// TTL
+		0x10, 0x06, 0xc8, 0x01, 0x0a, 0x00, 0x00, 0x01,		// Management address
+		0x0e, 0x02, 0x00, 0x14,					// Capabilities
+		0x00, 0x00,						// End
+	};
+	// Absurd address count and protocol length, empty port id
+	static const guint8	cdp_badaddrs[] = {
+		0x01, 0x00, 0x0c, 0xcc, 0xcc, 0xcc,	0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+		0x00, 0x24, 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x0c, 0x20, 0x00,
+		0x02, 0xb4, 0x00, 0x00,
+		0x00, 0x01, 0x00, 0x06, 's', 'w',			// Device ID
+		0x00, 0x02, 0x00, 0x0d, 0xff, 0xff, 0xff, 0xff,		// Addresses
+		0x01, 0xff, 0xcc, 0x00, 0x04,
+		0x00, 0x03, 0x00, 0x04,					// Port ID (empty)
+	};
+	// Zero length TLV
+	static const guint8	cdp_zerolen[] = {
+		0x01, 0x00, 0x0c, 0xcc, 0xcc, 0xcc,	0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+		0x00, 0x12, 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x0c, 0x20, 0x00,
+		0x02, 0xb4, 0x00, 0x00,
+		0x00, 0x01, 0x00, 0x00,
+	};
+	static const struct {
+		const guint8*	pkt;
+		gsize		pktlen;
+	} malformed[] = {
+		{lldp_overrun,	sizeof(lldp_overrun)},
+		{lldp_badvalues,sizeof(lldp_badvalues)},
+		{cdp_badaddrs,	sizeof(cdp_badaddrs)},
+		{cdp_zerolen,	sizeof(cdp_zerolen)},
+	};
+	unsigned	j;
+
+	for (j=0; j < DIMOF(malformed); ++j) {
+		// g_memdup() so that valgrind can see us overrun them
+		guint8*		copy = g_memdup(malformed[j].pkt, malformed[j].pktlen);
+		fuzz_decode(rand, copy, malformed[j].pktlen);
+		g_free(copy);
+	}
+	g_message("Malformed LLDP/CDP decode tests complete.");
+}
 
 #define PCAP	"../pcap/"
 
@@ -198,6 +416,7 @@ main(int argc, char **argv)
 	struct pcap_pkthdr 	hdr;
 	const	guchar*		packet;
 	unsigned		j;
+	GRand*			rand;
 	const char * lldpfilenames []	= {PCAP "lldp.detailed.pcap", PCAP "procurve.lldp.pcap", PCAP "lldpmed_civicloc.pcap"};
 	const char * cdpfilenames  []	= {PCAP "cdp.pcap", PCAP "n0.eth2.cdp.pcap"};
 	
@@ -248,5 +467,24 @@ main(int argc, char **argv)
 		}
 		pcap_close(handle);
 	}
+
+	// Replay them through the main loop
+	for (j=0; j < DIMOF(cdpfilenames); ++j) {
+		replay_tests(cdpfilenames[j]);
+	}
+	for (j=0; j < DIMOF(lldpfilenames); ++j) {
+		replay_tests(lldpfilenames[j]);
+	}
+
+	// Decode them into JSON - along with lots of corrupted and malformed packets
+	rand = g_rand_new_with_seed(FUZZ_SEED);
+	for (j=0; j < DIMOF(cdpfilenames); ++j) {
+		decode_tests(cdpfilenames[j], rand);
+	}
+	for (j=0; j < DIMOF(lldpfilenames); ++j) {
+		decode_tests(lldpfilenames[j], rand);
+	}
+	malformed_decode_tests(rand);
+	g_rand_free(rand);
 	return(0);
 }